@@ -0,0 +1,195 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : enable
+#endif
+
+struct light_t
+{
+    vec4 position;
+    vec4 color;
+    vec4 direction;
+    vec4 properties;
+};
+
+//
+// SCENE/VIEW
+//
+layout( set = 0, binding = 0, std140 ) uniform subo
+{
+    mat4 view;
+    mat4 proj;
+
+    vec4 sky_color;
+
+    light_t lights[8];
+} scene;
+
+layout( set = 0, binding = 1 ) uniform sampler tex_sampler;
+
+//
+// MATERIALS, BINDLESS: the instance carries its index in the material table,
+// which gives the texture indices.
+// Otherwise (no descriptor indexing), one material set per draw: all the
+// instances of a draw share the material of their instance set.
+//
+#ifdef BINDLESS
+#define MAX_BINDLESS_TEXTURES 256 // same as scene.h
+
+struct material_t
+{
+    uint base_tex; // xyz = albedo or specular. a = alpha
+    uint spec_tex; // x = roughness, y = metallic
+};
+
+layout( std430, set = 1, binding = 0 ) readonly buffer Materials
+{
+    material_t materials[];
+};
+
+layout( set = 1, binding = 1 ) uniform texture2D textures[MAX_BINDLESS_TEXTURES];
+#else
+layout( set = 1, binding = 0 ) uniform texture2D base_tex; // xyz = albedo or specular. a = alpha
+layout( set = 1, binding = 1 ) uniform texture2D spec_tex; // x = roughness, y = metallic
+#endif
+
+//
+// IN
+//
+layout( location = 0 ) in struct fragment_in
+{
+    vec3 view_pos;
+    vec3 view_center;
+    float radius;
+    vec4 base;
+    vec4 spec;
+} IN;
+layout( location = 5 ) flat in uint material_index; // unused without BINDLESS, same interface
+
+//
+// OUT
+//
+layout (location = 0) out vec4 uFragColor;
+
+#define PI 3.1415926
+
+vec3 sRGB_to_Linear(vec3 v)
+{
+    return vec3(pow(v.x, 2.2), pow(v.y, 2.2), pow(v.z, 2.2));
+}
+
+vec3 Linear_to_sRGB(vec3 v)
+{
+    const float i = 1.0/2.2;
+    return vec3(pow(v.x, i), pow(v.y, i), pow(v.z, i));
+}
+
+//
+// Reduced version of the BSDF in instancing.frag: these particles cover a
+// few pixels, no anisotropy nor clear coat.
+//
+float D_GGX(in float NdotH, in float a)
+{
+    float a2 = a * a;
+    float f = (NdotH * a2 - NdotH) * NdotH + 1.0;
+    return a2 / (PI * f * f);
+}
+
+vec3 F_Schlick(in float product, in vec3 f0)
+{
+    return f0 + (vec3(1) - f0) * pow(1.0 - product, 5.0);
+}
+
+float V_SmithGGXCorrelatedFast(float NdotV, float NdotL, float a)
+{
+    float GGXV = NdotL * (NdotV * (1.0 - a) + a);
+    float GGXL = NdotV * (NdotL * (1.0 - a) + a);
+    return 0.5 / (GGXV + GGXL);
+}
+
+float Fd_Lambert()
+{
+    return 1.0 / PI;
+}
+
+void main()
+{
+    // Ray from the eye through the quad, against the sphere (view space).
+    vec3 dir = normalize(IN.view_pos);
+    float b = dot(dir, IN.view_center);
+    float c = dot(IN.view_center, IN.view_center) - IN.radius * IN.radius;
+    float h = b * b - c;
+    if (h < 0.0)
+        discard;
+
+    vec3 hit = dir * (b - sqrt(h));
+
+    // Write the depth of the sphere, not the one of the quad.
+    vec4 clip = scene.proj * vec4(hit, 1.0);
+    gl_FragDepth = clip.z / clip.w;
+
+    // Back to world space, the view matrix is a rigid transform.
+    mat3 inv_view_rotation = transpose(mat3(scene.view));
+    vec3 n = normalize(inv_view_rotation * ((hit - IN.view_center) / IN.radius));
+    vec3 v = normalize(inv_view_rotation * -dir);
+
+    vec2 uv = vec2(0.5 + atan(n.z, n.x) / (2.0 * PI), 0.5 - asin(n.y) / PI);
+#ifdef BINDLESS
+    material_t material = materials[material_index];
+    vec4 sampled_base = texture(sampler2D(textures[nonuniformEXT(material.base_tex)], tex_sampler), uv);
+    vec4 sampled_spec = texture(sampler2D(textures[nonuniformEXT(material.spec_tex)], tex_sampler), uv);
+#else
+    vec4 sampled_base = texture(sampler2D(base_tex, tex_sampler), uv);
+    vec4 sampled_spec = texture(sampler2D(spec_tex, tex_sampler), uv);
+#endif
+
+    vec3 base         = sRGB_to_Linear(IN.base.rgb) * sRGB_to_Linear(sampled_base.rgb);
+    float roughness   = sampled_spec.r * IN.spec.x;
+    float metallic    = sampled_spec.g < 1e-5 ? IN.spec.y : sampled_spec.g * IN.spec.y;
+    float reflectance = sampled_spec.b * IN.spec.z;
+
+    vec3 diffuse_color = mix(base, vec3(0), metallic);
+    reflectance = 0.16 * reflectance * reflectance;
+    vec3 f0 = mix(vec3(reflectance), base, metallic);
+    float linear_roughness = roughness * roughness;
+
+    float NdotV = max(dot(n, v), 0.0) + 1e-5;
+
+    // same directional lights as instancing.frag
+    const vec3 dir_light_dir[6] = {
+        vec3(0,1,0),
+        vec3(0,-1,0),
+        vec3(1,0,0),
+        vec3(-1,0,0),
+        vec3(0,0,1),
+        vec3(0,0,-1),
+    };
+
+    const vec4 dir_light_col[6] = {
+        vec4(255.0/255.0, 12.0/255.0, 174.0/255.0,0.5), // pink
+        vec4(233.0/255.0, 41.0/255.0, 0.0/255.0,0.5),
+        vec4(1,0,1,0.5),
+        vec4(0,1,0,0.5),
+        vec4(0,1,1,0.5),
+        vec4(40.0/255.0, 137.0/255.0, 255.0/255.0,0.5),
+    };
+
+    vec3 luminance = vec3(0);
+    for(int i=0; i<6; ++i)
+    {
+        vec3 l = dir_light_dir[i];
+        vec3 hv = normalize(v + l);
+        float NdotL = max(dot(n, l), 0.0);
+        float NdotH = max(dot(n, hv), 0.0);
+        float LdotH = max(dot(l, hv), 0.0);
+
+        float D = D_GGX(NdotH, linear_roughness);
+        float V = V_SmithGGXCorrelatedFast(NdotV, NdotL, linear_roughness);
+        vec3  F = F_Schlick(LdotH, f0);
+
+        vec3 BSDF = diffuse_color * Fd_Lambert() + (D * V) * F;
+        luminance += BSDF * dir_light_col[i].a * NdotL * sRGB_to_Linear(dir_light_col[i].rgb);
+    }
+
+    uFragColor = vec4(Linear_to_sRGB(luminance), 1);
+}
@@ -0,0 +1,88 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+struct light_t
+{
+    vec4 position;
+    vec4 color;
+    vec4 direction;
+    vec4 properties;
+};
+
+layout( set = 0, binding = 0 ) uniform subo
+{
+    mat4 view;
+    mat4 proj;
+
+    vec4 sky_color;
+
+    light_t lights[8];
+} scene;
+
+struct particle
+{
+    vec4 position;
+    vec4 rotation;
+    vec4 scale;
+    vec4 speed;
+    vec4 jitter;
+    vec4 base;
+    vec4 spec;
+};
+
+// Instance data, indexed through the far list filled by particles_classify.comp
+layout( std140, set = 2, binding = 0 ) readonly buffer Pos
+{
+    particle particles[];
+};
+
+layout( std430, set = 2, binding = 1 ) readonly buffer Indices
+{
+    uint indices[];
+};
+
+layout( push_constant ) uniform impostor_constants
+{
+    float bounding_radius; // of the reference mesh, unscaled
+} pc;
+
+// OUT
+layout( location = 0 ) out struct vertex_out
+{
+    vec3 view_pos;    // position on the quad, view space
+    vec3 view_center; // sphere center, view space
+    float radius;
+    vec4 base;
+    vec4 spec;
+} OUT;
+layout( location = 5 ) flat out uint material_index; // in the bindless material table
+
+// 2 triangles, no vertex buffer.
+const vec2 corners[6] = vec2[](
+    vec2(-1,-1), vec2( 1,-1), vec2( 1, 1),
+    vec2(-1,-1), vec2( 1, 1), vec2(-1, 1)
+);
+
+void main()
+{
+    particle p = particles[indices[gl_InstanceIndex]];
+
+    float radius = pc.bounding_radius * max(p.scale.x, max(p.scale.y, p.scale.z));
+    vec3 center = (scene.view * vec4(p.position.xyz, 1.0)).xyz;
+
+    // The silhouette of a sphere seen in perspective is a bit larger than
+    // its radius: scale the quad by d / sqrt(d^2 - r^2).
+    float d2 = dot(center, center);
+    float grow = inversesqrt(max(1.0 - radius * radius / d2, 1e-4));
+
+    vec3 view_pos = center + vec3(corners[gl_VertexIndex] * radius * grow, 0.0);
+
+    gl_Position = scene.proj * vec4(view_pos, 1.0);
+
+    OUT.view_pos = view_pos;
+    OUT.view_center = center;
+    OUT.radius = radius;
+    OUT.base = vec4(1.0, 0.85, 0.57, 1.0); // same as instancing.vert
+    OUT.spec = vec4(0.045, 1, 1, 0);
+    material_index = uint(p.spec.w);
+}
@@ -1,5 +1,8 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : enable
+#endif
 //#extension GL_KHR_vulkan_glsl : enable
 
 //#define ANISOTROPY
@@ -36,10 +39,30 @@ layout( set = 0, binding = 0, std140 ) uniform subo
 layout( set = 0, binding = 1 ) uniform sampler tex_sampler;
 
 //
-// MATERIAL INSTANCE - TODO: use 2 texture arrays and texture indices per instance.
+// MATERIALS, BINDLESS: the instance carries its index in the material table,
+// which gives the texture indices. Same for all instances of a draw or not.
+// Otherwise (no descriptor indexing), one material set per draw: all the
+// instances of a draw share the material of their instance set.
 //
+#ifdef BINDLESS
+#define MAX_BINDLESS_TEXTURES 256 // same as scene.h
+
+struct material_t
+{
+    uint base_tex; // xyz = albedo or specular. a = alpha
+    uint spec_tex; // x = roughness, y = metallic
+};
+
+layout( std430, set = 1, binding = 0 ) readonly buffer Materials
+{
+    material_t materials[];
+};
+
+layout( set = 1, binding = 1 ) uniform texture2D textures[MAX_BINDLESS_TEXTURES];
+#else
 layout( set = 1, binding = 0 ) uniform texture2D base_tex; // xyz = albedo or specular. a = alpha
 layout( set = 1, binding = 1 ) uniform texture2D spec_tex; // x = roughness, y = metallic
+#endif
 
 //
 // IN
@@ -53,6 +76,7 @@ layout( location = 0 ) in struct fragment_in
     vec4 base; // instance data
     vec4 spec; // instance data
 } IN;
+layout( location = 6 ) flat in uint material_index; // unused without BINDLESS, same interface
 
 //
 // OUT
@@ -290,8 +314,14 @@ void main()
     float clearCoatRoughness = 0.0; // remapped later
     float clearCoat = 1.0; // fresnel multiplier
 
+#ifdef BINDLESS
+    material_t material = materials[material_index];
+    vec4 sampled_base = texture(sampler2D(textures[nonuniformEXT(material.base_tex)], tex_sampler), IN.uv);
+    vec4 sampled_spec = texture(sampler2D(textures[nonuniformEXT(material.spec_tex)], tex_sampler), IN.uv);
+#else
     vec4 sampled_base = texture(sampler2D(base_tex, tex_sampler), IN.uv);
     vec4 sampled_spec = texture(sampler2D(spec_tex, tex_sampler), IN.uv);
+#endif
 
     vec3 base         = sRGB_to_Linear(IN.base.rgb) * sRGB_to_Linear(sampled_base.rgb);
     float roughness   = sampled_spec.r * IN.spec.x;
@@ -435,7 +465,7 @@ void main()
 //    float Es = Is;// * NdotLs;
 //    luminance += BSDF_Sky * Es * sky_color;
 
-    uFragColor = vec4(Linear_to_sRGB(luminance), 1);
+    uFragColor = vec4(Linear_to_sRGB(luminance), IN.base.a); // only blended by the sorted particles
 
     // DEBUG
     //uFragColor = vec4(0.5*(n+1),1);
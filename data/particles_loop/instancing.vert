@@ -43,6 +43,7 @@ layout( location = 0 ) out struct vertex_out
     vec4 base; // pass through instance data
     vec4 spec; // pass through instance data
 } OUT;
+layout( location = 6 ) flat out uint material_index; // in the bindless material table
 
 mat4 rebuild_matrix(vec4 p, vec3 r, vec3 s)
 {
@@ -111,4 +112,5 @@ void main()
 //    OUT.spec = i_spec;
     OUT.base = vec4(1.0, 0.85, 0.57, 1.0);
     OUT.spec = vec4(0.045, 1, 1, 0);
+    material_index = uint(i_spec.w);
 }
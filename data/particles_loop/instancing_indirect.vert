@@ -0,0 +1,129 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+struct light_t
+{
+    vec4 position;
+    vec4 color;
+    vec4 direction;
+    vec4 properties;
+};
+
+layout( set = 0, binding = 0 ) uniform subo
+{
+    mat4 view;
+    mat4 proj;
+
+    vec4 sky_color;
+
+    light_t lights[8];
+} scene;
+
+struct particle
+{
+    vec4 position;
+    vec4 rotation;
+    vec4 scale;
+    vec4 speed;
+    vec4 jitter;
+    vec4 base;
+    vec4 spec;
+};
+
+// Instance data, indexed through the near list filled by particles_classify.comp
+layout( std140, set = 2, binding = 0 ) readonly buffer Pos
+{
+    particle particles[];
+};
+
+layout( std430, set = 2, binding = 1 ) readonly buffer Indices
+{
+    uint indices[];
+};
+
+// Per-Vertex
+layout( location = 0 ) in vec4 v_pos;
+layout( location = 1 ) in vec3 normal;
+layout( location = 2 ) in vec2 uv;
+
+// OUT
+layout( location = 0 ) out struct vertex_out
+{
+    vec3 normal;
+    vec2 uv;
+    vec3 to_camera;
+    vec3 world_pos;
+    vec4 base; // pass through instance data
+    vec4 spec; // pass through instance data
+} OUT;
+layout( location = 6 ) flat out uint material_index; // in the bindless material table
+
+mat4 rebuild_matrix(vec4 p, vec3 r, vec3 s)
+{
+    mat4 m = mat4(1.0);
+
+    // position
+    m[3] = p;
+
+    float cx = cos(r.x);
+    float sx = sin(r.x);
+    float cy = cos(r.y);
+    float sy = sin(r.y);
+    float cz = cos(r.z);
+    float sz = sin(r.z);
+
+    mat3 rot_matrix_x = mat3(
+        vec3(1,0,0),
+        vec3(0,cx,sx),
+        vec3(0,-sx,cx)
+    );
+
+    mat3 rot_matrix_y = mat3(
+        vec3(cy,0,-sy),
+        vec3(0,1,0),
+        vec3(sy,0,cy)
+    );
+
+    mat3 rot_matrix_z = mat3(
+        vec3(cz,sz,0),
+        vec3(-sz,cz,0),
+        vec3(0,0,1)
+    );
+
+    mat4 rot_mat = mat4(rot_matrix_x * rot_matrix_y * rot_matrix_z);
+    rot_mat[3][3] = 1;
+
+    // rotation
+    m *= rot_mat;
+
+    // scale
+    mat4 scale_mat = mat4(
+    s.x, 0,   0,   0,
+    0,   s.y, 0,   0,
+    0,   0,   s.z, 0,
+    0,   0,   0,   1);
+
+    m *= scale_mat;
+
+    return m;
+}
+
+void main()
+{
+    particle p = particles[indices[gl_InstanceIndex]];
+
+    mat4 model_matrix = rebuild_matrix(p.position, p.rotation.xyz, p.scale.xyz);
+    vec4 world_pos = model_matrix * v_pos;
+    mat4 model_view = scene.view * model_matrix;
+    vec4 camera_pos = inverse(scene.view) * vec4(0,0,0,1);
+
+    gl_Position = scene.proj * model_view * v_pos;
+
+    OUT.uv = uv;
+    OUT.normal = (transpose(inverse(model_matrix)) * vec4(normal, 0.0)).xyz; // world space normals
+    OUT.to_camera = camera_pos.xyz - world_pos.xyz;
+    OUT.world_pos = world_pos.xyz;
+    OUT.base = vec4(1.0, 0.85, 0.57, 1.0);
+    OUT.spec = vec4(0.045, 1, 1, 0);
+    material_index = uint(p.spec.w);
+}
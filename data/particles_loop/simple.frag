@@ -44,11 +44,16 @@ layout( set = 1, binding = 1 ) uniform texture2D spec_tex; // x = roughness, y =
 //
 // OBJECT
 //
-layout( set = 2, binding = 1 ) uniform object_ubo
+struct material_override_t
 {
     vec4 base; // xyz = albedo or specular. a = alpha
     vec4 spec; // x = roughness, y = metallic, z = reflectance
-} Object_UBO;
+};
+
+layout( set = 2, binding = 1, std430 ) readonly buffer object_ssbo
+{
+    material_override_t overrides[];
+} Object_SSBO;
 
 //
 // IN
@@ -60,6 +65,7 @@ layout ( location = 0 ) in struct fragment_in {
     //vec3 to_light;
     vec3 world_pos;
 } IN;
+layout( location = 4 ) flat in uint object_index;
 
 //
 // OUT
@@ -300,10 +306,12 @@ void main()
     vec4 sampled_base = texture(sampler2D(base_tex, tex_sampler), IN.uv);
     vec4 sampled_spec = texture(sampler2D(spec_tex, tex_sampler), IN.uv);
 
-    vec3 base         = sRGB_to_Linear(Object_UBO.base.rgb) * sRGB_to_Linear(sampled_base.rgb);
-    float roughness   = sampled_spec.r * Object_UBO.spec.x;
-    float metallic    = sampled_spec.g < 1e-5 ? Object_UBO.spec.y : sampled_spec.g * Object_UBO.spec.y;
-    float reflectance = sampled_spec.b * Object_UBO.spec.z;
+    material_override_t object = Object_SSBO.overrides[object_index];
+
+    vec3 base         = sRGB_to_Linear(object.base.rgb) * sRGB_to_Linear(sampled_base.rgb);
+    float roughness   = sampled_spec.r * object.spec.x;
+    float metallic    = sampled_spec.g < 1e-5 ? object.spec.y : sampled_spec.g * object.spec.y;
+    float reflectance = sampled_spec.b * object.spec.z;
 
     // remappings
     vec3 diffuse_color = mix(base, vec3(0), metallic); // (1-metallic)*base
@@ -19,10 +19,17 @@ layout( set = 0, binding = 0, std140 ) uniform scene_ubo
     light_t lights[8];
 } Scene_UBO;
 
-layout( set = 2, binding = 0 ) uniform object_ubo
+// all the global objects, firstInstance of the indirect draw = object index
+struct object_matrices_t
 {
     mat4 model_matrix;
-} Object_UBO;
+    mat3 normal_matrix; // inverse transpose of the model 3x3
+};
+
+layout( set = 2, binding = 0, std430 ) readonly buffer object_ssbo
+{
+    object_matrices_t objects[];
+} Object_SSBO;
 
 layout( location = 0 ) in vec4 pos;
 layout( location = 1 ) in vec3 normal;
@@ -35,11 +42,14 @@ layout( location = 0 ) out struct vertex_out
     vec3 to_camera;
     vec3 world_pos;
 } OUT;
+layout( location = 4 ) flat out uint object_index;
 
 void main() 
 {
-    vec4 world_pos = Object_UBO.model_matrix * pos;
-    mat4 modelView = Scene_UBO.view_matrix * Object_UBO.model_matrix;
+    mat4 model_matrix = Object_SSBO.objects[gl_InstanceIndex].model_matrix;
+    mat3 normal_matrix = Object_SSBO.objects[gl_InstanceIndex].normal_matrix;
+    vec4 world_pos = model_matrix * pos;
+    mat4 modelView = Scene_UBO.view_matrix * model_matrix;
     vec4 camera_pos = inverse(Scene_UBO.view_matrix) * vec4(0,0,0,1);
     // use inv view matrix last column/row. 
     //vec3 camera_pos = vec3( -Scene_UBO.view_matrix[3][0], -Scene_UBO.view_matrix[3][1], -Scene_UBO.view_matrix[3][2] );
@@ -47,7 +57,8 @@ void main()
     gl_Position = Scene_UBO.proj_matrix * modelView * pos;
 
     OUT.uv = uv;
-    OUT.normal = normal;//( inverse( transpose( modelView ) ) * vec4( normal, 0.0 )).xyz;
+    OUT.normal = normal_matrix * normal;
     OUT.to_camera = camera_pos.xyz - world_pos.xyz;
     OUT.world_pos = world_pos.xyz;
+    object_index = gl_InstanceIndex;
 }
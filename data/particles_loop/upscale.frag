@@ -0,0 +1,22 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Scene target, rendered in its top-left corner only.
+layout( set = 0, binding = 0 ) uniform sampler2D scene;
+
+layout( push_constant ) uniform upscale_constants
+{
+    vec2 uv_scale; // render size / target size
+    vec2 uv_max;   // last rendered texel center
+} pc;
+
+// IN
+layout( location = 0 ) in vec2 uv;
+
+// OUT
+layout( location = 0 ) out vec4 uFragColor;
+
+void main()
+{
+    uFragColor = texture(scene, min(uv * pc.uv_scale, pc.uv_max));
+}
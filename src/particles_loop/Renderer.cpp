@@ -5,6 +5,8 @@
 #include "Shared.h"
 #include "window.h"
 #include "scene.h"
+#include "utils.h"
+#include "initializers.h"
 
 #include "imgui.h"
 #include "imgui_impl_vulkan.h"
@@ -12,6 +14,8 @@
 #include "glm_usage.h"
 
 #include <cstdlib>
+#include <cmath>
+#include <algorithm>
 #include <assert.h>
 #include <vector>
 #include <array>
@@ -19,8 +23,9 @@
 #include <fstream>
 #include <sstream>
 #include <set>
+#include <cstring>
 
-Renderer::Renderer(Window *w) : _w(w)
+Renderer::Renderer(Window *w) : _w(w), _frame_graph(&_ctx)
 {
     
 }
@@ -157,11 +162,28 @@ bool Renderer::InitSceneVulkan()
     if (!InitDescriptorPool())
         return false;
 
+    Log("#    Init Timestamp Queries\n");
+    if (!InitTimestampQueries())
+        return false;
+
+    Log("#    Init Upscale Pipeline\n");
+    if (!InitCompositePipeline())
+        return false;
+
     return true;
 }
 
 void Renderer::DeInitSceneVulkan()
 {
+    Log("#    Destroy Frame Graph\n");
+    DeInitFrameGraph();
+
+    Log("#    Destroy Upscale Pipeline\n");
+    DeInitCompositePipeline();
+
+    Log("#    Destroy Timestamp Queries\n");
+    DeInitTimestampQueries();
+
     Log("#    Destroy DescriptorPool\n");
     DeInitDescriptorPool();
 
@@ -185,9 +207,19 @@ bool Renderer::InitInstance()
 {
     VkResult result;
 
+    // 1.1 when the loader has it: subgroup operations in compute shaders.
+    _ctx.api_version = VK_API_VERSION_1_0;
+    uint32_t loader_version = VK_API_VERSION_1_0;
+    if (vkEnumerateInstanceVersion != nullptr
+        && vkEnumerateInstanceVersion(&loader_version) == VK_SUCCESS
+        && loader_version >= VK_API_VERSION_1_1)
+    {
+        _ctx.api_version = VK_API_VERSION_1_1;
+    }
+
     VkApplicationInfo application_info = {};
     application_info.sType              = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-    application_info.apiVersion         = VK_API_VERSION_1_0;//VK_MAKE_VERSION( 1, 1, 73 );
+    application_info.apiVersion         = _ctx.api_version;
     application_info.applicationVersion = VK_MAKE_VERSION( 0, 0, 4 );
     application_info.pApplicationName   = "Vulkan Renderer";
 
@@ -301,6 +333,16 @@ bool Renderer::ChoosePhysicalDevice()
 
             Log("#      Get Physical Device Memory Properties\n");
             vkGetPhysicalDeviceMemoryProperties(_ctx.physical_device, &_ctx.physical_device_memory_properties);
+
+            if (_ctx.api_version >= VK_API_VERSION_1_1 && _ctx.physical_device_properties.apiVersion >= VK_API_VERSION_1_1)
+            {
+                Log("#      Get Physical Device Subgroup Properties\n");
+                _ctx.subgroup_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+                VkPhysicalDeviceProperties2KHR physical_device_properties2 = {};
+                physical_device_properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+                physical_device_properties2.pNext = &_ctx.subgroup_properties;
+                vkGetPhysicalDeviceProperties2KHR(_ctx.physical_device, &physical_device_properties2);
+            }
             break;
         }
     }
@@ -393,11 +435,13 @@ bool Renderer::IsDeviceSuitable(VkPhysicalDevice dev)
     Log(std::string("   variableMultisampleRate ") + std::to_string(physical_device_features.variableMultisampleRate) + "\n");
     Log(std::string("   inheritedQueries ") + std::to_string(physical_device_features.inheritedQueries) + "\n");
 #endif
+
     return physical_device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU
         && physical_device_features.geometryShader
         && physical_device_features.tessellationShader
         && physical_device_features.samplerAnisotropy
-        && physical_device_features.fillModeNonSolid;
+        && physical_device_features.fillModeNonSolid
+        && physical_device_features.drawIndirectFirstInstance;
 }
 
 bool Renderer::SelectQueueFamilyIndices()
@@ -430,6 +474,7 @@ bool Renderer::SelectQueueFamilyIndices()
                 Log(std::string("#     FOUND Graphics queue: ") + std::to_string(i) + std::string("\n"));
                 found_graphics = true;
                 _ctx.graphics.family_index = i;
+                _ctx.graphics.timestamp_valid_bits = family_property_list[i].timestampValidBits;
             }
         }
 
@@ -440,6 +485,7 @@ bool Renderer::SelectQueueFamilyIndices()
                 Log(std::string("#     FOUND Compute queue: ") + std::to_string(i) + std::string("\n"));
                 found_compute = true;
                 _ctx.compute.family_index = i;
+                _ctx.compute.timestamp_valid_bits = family_property_list[i].timestampValidBits;
             }
         }
 
@@ -550,6 +596,50 @@ bool Renderer::EnumerateDeviceExtensions()
     return true;
 }
 
+//
+// Bindless material textures: one array of sampled images, indexed per
+// instance, written while previous frames are still in flight.
+//
+void Renderer::SelectDescriptorIndexingFeatures()
+{
+    uint32_t extension_count = 0;
+    vkEnumerateDeviceExtensionProperties(_ctx.physical_device, nullptr, &extension_count, nullptr);
+    std::vector<VkExtensionProperties> extensions(extension_count);
+    vkEnumerateDeviceExtensionProperties(_ctx.physical_device, nullptr, &extension_count, extensions.data());
+    auto has_extension = [&](const char *name) {
+        return std::any_of(extensions.begin(), extensions.end(), [&](const VkExtensionProperties &e) {
+            return std::strcmp(e.extensionName, name) == 0; });
+    };
+
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT supported = {};
+    supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    const bool has_extensions = has_extension(VK_KHR_MAINTENANCE3_EXTENSION_NAME) && has_extension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+    if (has_extensions)
+    {
+        VkPhysicalDeviceFeatures2KHR physical_device_features2 = {};
+        physical_device_features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+        physical_device_features2.pNext = &supported;
+        vkGetPhysicalDeviceFeatures2KHR(_ctx.physical_device, &physical_device_features2);
+    }
+
+    _ctx.bindless = has_extensions
+        && supported.shaderSampledImageArrayNonUniformIndexing
+        && supported.descriptorBindingPartiallyBound
+        && supported.descriptorBindingSampledImageUpdateAfterBind;
+    Log(std::string("#     Bindless materials: ") + (_ctx.bindless ? "yes" : "no, one material set per draw") + "\n");
+    if (!_ctx.bindless)
+        return;
+
+    _ctx.device_extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME); // required by descriptor indexing
+    _ctx.device_extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+
+    auto &indexing = _ctx.descriptor_indexing_features;
+    indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    indexing.shaderSampledImageArrayNonUniformIndexing = VK_TRUE; // material index varies within a draw
+    indexing.descriptorBindingPartiallyBound = VK_TRUE;           // unused texture slots
+    indexing.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE; // new textures while frames are in flight
+}
+
 bool Renderer::CreateLogicalDevice()
 {
     VkResult result;
@@ -578,9 +668,20 @@ bool Renderer::CreateLogicalDevice()
     device_create_info.pQueueCreateInfos = device_queue_create_infos.data();
     //device_create_info.enabledLayerCount = _ctx.device_layers.size(); // deprecated
     //device_create_info.ppEnabledLayerNames = _ctx.device_layers.data(); // deprecated
+    // optional, the cooked textures fall back to RGBA8 without it.
+    VkPhysicalDeviceFeatures supported_features = {};
+    vkGetPhysicalDeviceFeatures(_ctx.physical_device, &supported_features);
+    _ctx.features.textureCompressionBC = supported_features.textureCompressionBC;
+    // optional, the global objects get one indirect draw per object without it.
+    _ctx.features.multiDrawIndirect = supported_features.multiDrawIndirect;
+
+    // optional, the instance pipelines bind one material set per draw without them.
+    SelectDescriptorIndexingFeatures();
+
     device_create_info.enabledExtensionCount = (uint32_t)_ctx.device_extensions.size();
     device_create_info.ppEnabledExtensionNames = _ctx.device_extensions.data();
     device_create_info.pEnabledFeatures = &_ctx.features;
+    device_create_info.pNext = _ctx.bindless ? &_ctx.descriptor_indexing_features : nullptr;
 
     Log("#     Create Device\n");
     result = vkCreateDevice(_ctx.physical_device, &device_create_info, nullptr, &_ctx.device);
@@ -692,6 +793,7 @@ void Renderer::SetupExtensions()
     _ctx.instance_extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
     _ctx.instance_extensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
     _ctx.instance_extensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+    _ctx.instance_extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME); // descriptor indexing features
 
     _ctx.device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 }
@@ -734,6 +836,7 @@ void Renderer::SetupExtensions()
 {
     _ctx.instance_extensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
     _ctx.instance_extensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+    _ctx.instance_extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME); // descriptor indexing features
 
     _ctx.device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 }
@@ -747,6 +850,7 @@ void Renderer::SetupFeatures()
 {
     _ctx.features.fillModeNonSolid = VK_TRUE;
     _ctx.features.samplerAnisotropy = VK_TRUE;
+    _ctx.features.drawIndirectFirstInstance = VK_TRUE; // firstInstance = object index
 }
 
 bool Renderer::InitVma()
@@ -793,7 +897,7 @@ bool Renderer::InitSynchronizations()
 {
     VkResult result;
 
-    Log("#     Create two semaphores and a fence per parallel frame\n");
+    Log("#     Create four semaphores and two fences per parallel frame\n");
     for (uint32_t i = 0; i < MAX_PARALLEL_FRAMES; ++i)
     {
         VkSemaphoreCreateInfo semaphore_create_info = {};
@@ -809,6 +913,16 @@ bool Renderer::InitSynchronizations()
         if (result != VK_SUCCESS)
             return false;
 
+        result = vkCreateSemaphore(_ctx.device, &semaphore_create_info, nullptr, &_compute_complete_semaphores[i]);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+
+        result = vkCreateSemaphore(_ctx.device, &semaphore_create_info, nullptr, &_graphics_complete_semaphores[i]);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+
         VkFenceCreateInfo fence_create_info = {};
         fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
         fence_create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT; // we are starting the rendering by a wait on a fence.
@@ -837,7 +951,286 @@ void Renderer::DeInitSynchronizations()
         vkDestroyFence(_ctx.device, _compute_fences[i], nullptr);
         vkDestroySemaphore(_ctx.device, _render_complete_semaphores[i], nullptr);
         vkDestroySemaphore(_ctx.device, _present_complete_semaphores[i], nullptr);
+        vkDestroySemaphore(_ctx.device, _compute_complete_semaphores[i], nullptr);
+        vkDestroySemaphore(_ctx.device, _graphics_complete_semaphores[i], nullptr);
+    }
+}
+
+bool Renderer::InitTimestampQueries()
+{
+    VkResult result;
+
+    if (_ctx.graphics.timestamp_valid_bits == 0 || _ctx.compute.timestamp_valid_bits == 0)
+    {
+        Log("#     -> no timestamp support, GPU timings disabled.\n");
+        return true;
+    }
+
+    VkQueryPoolCreateInfo query_pool_create_info = {};
+    query_pool_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_pool_create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    query_pool_create_info.queryCount = MAX_PARALLEL_FRAMES * TIMESTAMP_COUNT;
+
+    result = vkCreateQueryPool(_ctx.device, &query_pool_create_info, nullptr, &_timestamp_query_pool);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    return true;
+}
+
+void Renderer::DeInitTimestampQueries()
+{
+    vkDestroyQueryPool(_ctx.device, _timestamp_query_pool, nullptr);
+    _timestamp_query_pool = VK_NULL_HANDLE;
+}
+
+// Called once both fences of current_frame have been waited on,
+// the queries of that frame are available.
+void Renderer::ReadTimestampQueries()
+{
+    if (_timestamp_query_pool == VK_NULL_HANDLE || !_timestamps_written[current_frame])
+        return;
+
+    std::array<uint64_t, TIMESTAMP_COUNT> timestamps = {};
+    VkResult result = vkGetQueryPoolResults(_ctx.device, _timestamp_query_pool,
+        current_frame * TIMESTAMP_COUNT, TIMESTAMP_COUNT,
+        sizeof(timestamps), timestamps.data(), sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS)
+        return;
+
+    const double ns_to_ms = _ctx.physical_device_properties.limits.timestampPeriod / 1000000.0;
+    float compute_ms = (float)((timestamps[TIMESTAMP_COMPUTE_END] - timestamps[TIMESTAMP_COMPUTE_BEGIN]) * ns_to_ms);
+    float graphics_ms = (float)((timestamps[TIMESTAMP_GRAPHICS_END] - timestamps[TIMESTAMP_GRAPHICS_BEGIN]) * ns_to_ms);
+    float frame_ms = (float)((timestamps[TIMESTAMP_FRAME_END] - timestamps[TIMESTAMP_FRAME_BEGIN]) * ns_to_ms);
+    _scene->set_gpu_timings(compute_ms, graphics_ms);
+
+    UpdateDynamicResolution(compute_ms + frame_ms);
+}
+
+bool Renderer::CreateShaderModule(const std::string &file_path, VkShaderModule *shader_module)
+{
+    auto content = utils::read_file_content(file_path);
+
+    VkShaderModuleCreateInfo shader_creation_info = {};
+    shader_creation_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shader_creation_info.codeSize = content.size();
+    shader_creation_info.pCode = (uint32_t *)content.data();
+
+    VkResult result = vkCreateShaderModule(_ctx.device, &shader_creation_info, nullptr, shader_module);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    return true;
+}
+
+bool Renderer::InitCompositePipeline()
+{
+    VkResult result;
+
+    VkSamplerCreateInfo sampler_create_info = {};
+    sampler_create_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_create_info.magFilter = VK_FILTER_LINEAR;
+    sampler_create_info.minFilter = VK_FILTER_LINEAR;
+    sampler_create_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    sampler_create_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_create_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_create_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_create_info.anisotropyEnable = VK_FALSE;
+    sampler_create_info.minLod = 0;
+    sampler_create_info.maxLod = 0;
+    sampler_create_info.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+    sampler_create_info.unnormalizedCoordinates = VK_FALSE;
+
+    Log("#     Create Upscale Sampler\n");
+    result = vkCreateSampler(_ctx.device, &sampler_create_info, nullptr, &_composite_sampler);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    VkDescriptorSetLayoutBinding binding = {};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    binding.pImmutableSamplers = nullptr;
+
+    VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
+    desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    desc_set_layout_create_info.bindingCount = 1;
+    desc_set_layout_create_info.pBindings = &binding;
+
+    Log("#     Create Upscale Descriptor Set Layout\n");
+    result = vkCreateDescriptorSetLayout(_ctx.device, &desc_set_layout_create_info, nullptr, &_composite_descriptor_set_layout);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    VkDescriptorSetAllocateInfo descriptor_allocate_info = {};
+    descriptor_allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptor_allocate_info.descriptorPool = _ctx.descriptor_pool;
+    descriptor_allocate_info.descriptorSetCount = 1;
+    descriptor_allocate_info.pSetLayouts = &_composite_descriptor_set_layout;
+
+    Log("#     Allocate Upscale Descriptor Set\n");
+    result = vkAllocateDescriptorSets(_ctx.device, &descriptor_allocate_info, &_composite_descriptor_set);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    // written once the frame graph has allocated the scene target.
+
+    VkPushConstantRange push_constant_range = {};
+    push_constant_range.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    push_constant_range.offset = 0;
+    push_constant_range.size = sizeof(glm::vec4); // xy = uv scale, zw = max uv
+
+    VkPipelineLayoutCreateInfo layout_create_info = {};
+    layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_create_info.setLayoutCount = 1;
+    layout_create_info.pSetLayouts = &_composite_descriptor_set_layout;
+    layout_create_info.pushConstantRangeCount = 1;
+    layout_create_info.pPushConstantRanges = &push_constant_range;
+
+    Log("#     Create Upscale Pipeline Layout\n");
+    result = vkCreatePipelineLayout(_ctx.device, &layout_create_info, nullptr, &_composite_pipeline_layout);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    Log("#     Create Upscale Shaders\n");
+    if (!CreateShaderModule("./data/upscale.vert.spv", &_composite_vs))
+        return false;
+    if (!CreateShaderModule("./data/upscale.frag.spv", &_composite_fs))
+        return false;
+
+    std::array<VkPipelineShaderStageCreateInfo, 2> shader_stage_create_infos = {
+        vk::init::pipeline::shader_stage_create_info(_composite_vs, VK_SHADER_STAGE_VERTEX_BIT),
+        vk::init::pipeline::shader_stage_create_info(_composite_fs, VK_SHADER_STAGE_FRAGMENT_BIT)
+    };
+
+    // full screen triangle, generated in the vertex shader.
+    VkPipelineVertexInputStateCreateInfo vertex_input_state_create_info = {};
+    vertex_input_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+    VkPipelineInputAssemblyStateCreateInfo input_assembly_state_create_info = {};
+    input_assembly_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    input_assembly_state_create_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    input_assembly_state_create_info.primitiveRestartEnable = VK_FALSE;
+
+    VkViewport viewport = vk::init::pipeline::viewport(); // dynamic
+    VkRect2D scissors = { { 0, 0 }, _w->surface_size() };
+
+    VkPipelineViewportStateCreateInfo viewport_state_create_info = {};
+    viewport_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport_state_create_info.viewportCount = 1;
+    viewport_state_create_info.pViewports = &viewport;
+    viewport_state_create_info.scissorCount = 1;
+    viewport_state_create_info.pScissors = &scissors;
+
+    VkPipelineRasterizationStateCreateInfo raster_state_create_info = vk::init::pipeline::raster_state_create_info();
+    raster_state_create_info.polygonMode = VK_POLYGON_MODE_FILL;
+    raster_state_create_info.cullMode = VK_CULL_MODE_NONE;
+    raster_state_create_info.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+    VkPipelineMultisampleStateCreateInfo multisample_state_create_info = vk::init::pipeline::multisample_state_create_info_NO_MSAA();
+
+    VkPipelineDepthStencilStateCreateInfo depth_stencil_state_create_info = vk::init::pipeline::depth_stencil_state_create_info();
+    depth_stencil_state_create_info.depthTestEnable = VK_FALSE;
+    depth_stencil_state_create_info.depthWriteEnable = VK_FALSE;
+
+    VkPipelineColorBlendAttachmentState color_blend_attachment_state = vk::init::pipeline::color_blend_attachment_state_NO_BLEND();
+
+    VkPipelineColorBlendStateCreateInfo color_blend_state_create_info = vk::init::pipeline::color_blend_state_create_info();
+    color_blend_state_create_info.attachmentCount = 1;
+    color_blend_state_create_info.pAttachments = &color_blend_attachment_state;
+
+    std::array<VkDynamicState, 2> dynamic_state = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamic_state_create_info = {};
+    dynamic_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamic_state_create_info.dynamicStateCount = (uint32_t)dynamic_state.size();
+    dynamic_state_create_info.pDynamicStates = dynamic_state.data();
+
+    VkGraphicsPipelineCreateInfo pipeline_create_info = {};
+    pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_create_info.stageCount = (uint32_t)shader_stage_create_infos.size();
+    pipeline_create_info.pStages = shader_stage_create_infos.data();
+    pipeline_create_info.pVertexInputState = &vertex_input_state_create_info;
+    pipeline_create_info.pInputAssemblyState = &input_assembly_state_create_info;
+    pipeline_create_info.pTessellationState = nullptr;
+    pipeline_create_info.pViewportState = &viewport_state_create_info;
+    pipeline_create_info.pRasterizationState = &raster_state_create_info;
+    pipeline_create_info.pMultisampleState = &multisample_state_create_info;
+    pipeline_create_info.pDepthStencilState = &depth_stencil_state_create_info;
+    pipeline_create_info.pColorBlendState = &color_blend_state_create_info;
+    pipeline_create_info.pDynamicState = &dynamic_state_create_info;
+    pipeline_create_info.layout = _composite_pipeline_layout;
+    pipeline_create_info.renderPass = _render_pass;
+    pipeline_create_info.subpass = 0;
+    pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+    pipeline_create_info.basePipelineIndex = 0;
+
+    Log("#     Create Upscale Pipeline\n");
+    result = vkCreateGraphicsPipelines(_ctx.device, VK_NULL_HANDLE, 1, &pipeline_create_info, nullptr, &_composite_pipeline);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    return true;
+}
+
+void Renderer::DeInitCompositePipeline()
+{
+    vkDestroyPipeline(_ctx.device, _composite_pipeline, nullptr);
+    vkDestroyPipelineLayout(_ctx.device, _composite_pipeline_layout, nullptr);
+    vkDestroyShaderModule(_ctx.device, _composite_vs, nullptr);
+    vkDestroyShaderModule(_ctx.device, _composite_fs, nullptr);
+    vkDestroyDescriptorSetLayout(_ctx.device, _composite_descriptor_set_layout, nullptr);
+    vkDestroySampler(_ctx.device, _composite_sampler, nullptr);
+}
+
+// Pixel cost is roughly proportional to scale^2: aim for the scale that would
+// land on the budget, drop fast when over it, climb back slowly to avoid oscillations.
+void Renderer::UpdateDynamicResolution(float gpu_frame_ms)
+{
+    _gpu_frame_ms = gpu_frame_ms;
+
+    if (!_dynamic_resolution || gpu_frame_ms <= 0.0f)
+        return;
+
+    float target = _resolution_scale * std::sqrt(_gpu_budget_ms / gpu_frame_ms);
+    target = glm::clamp(target, _min_resolution_scale, 1.0f);
+
+    float rate = (target < _resolution_scale) ? 0.3f : 0.05f;
+    _resolution_scale += (target - _resolution_scale) * rate;
+}
+
+VkExtent2D Renderer::SceneRenderExtent()
+{
+    VkExtent2D extent = {};
+    extent.width = std::max(1u, (uint32_t)(_depth_extent.width * _resolution_scale));
+    extent.height = std::max(1u, (uint32_t)(_depth_extent.height * _resolution_scale));
+    return extent;
+}
+
+void Renderer::ShowDynamicResolutionProperties()
+{
+    ImGui::Begin("Properties");
+    {
+        if (ImGui::CollapsingHeader("Dynamic Resolution"))
+        {
+            VkExtent2D extent = SceneRenderExtent();
+            ImGui::Checkbox("Automatic", &_dynamic_resolution);
+            ImGui::SliderFloat("GPU budget (ms)", &_gpu_budget_ms, 1.0f, 33.0f);
+            ImGui::SliderFloat("Min scale", &_min_resolution_scale, 0.25f, 1.0f);
+            ImGui::SliderFloat("Scale", &_resolution_scale, _min_resolution_scale, 1.0f);
+            ImGui::Text("Render size  : %u x %u", extent.width, extent.height);
+            ImGui::Text("GPU frame    : %.3f ms", _gpu_frame_ms);
+        }
     }
+    ImGui::End();
 }
 
 
@@ -854,6 +1247,9 @@ void Renderer::DeInitSynchronizations()
 void Renderer::Update(float dt)
 {
     _scene->update(dt);
+
+    ShowDynamicResolutionProperties();
+    _frame_graph.show_property_sheet();
 }
 
 void Renderer::Draw(float dt)
@@ -866,9 +1262,6 @@ void Renderer::Draw(float dt)
         vkResetFences(_ctx.device, 1, fences_to_wait_on.data());
     }
 
-    auto &compute_cmd = _ctx.compute.command_buffers[current_frame];
-    _scene->record_compute_commands(compute_cmd);
-
     // CPU wait for the end of the previous same parallel frame.
     // If we want to render frame 1 of 2 parallel frames, wait for
     // the end of the previous frame 1.
@@ -878,112 +1271,114 @@ void Renderer::Draw(float dt)
         vkResetFences(_ctx.device, 1, fences_to_wait_on.data());
     }
 
-    _scene->upload(); // upload uniforms for graphics and compute
+    // both halves of the previous same parallel frame are done.
+    ReadTimestampQueries();
+
+    const uint32_t first_query = current_frame * TIMESTAMP_COUNT;
+
+    // Uniforms are written by the host before the submits,
+    // vkQueueSubmit makes them visible: no barrier needed.
+    _scene->upload(current_frame);
 
     // Begin render = acquire image and set semaphore to be signaled when presenting
     // engine is done reading that frame.
     _w->BeginRender(_present_complete_semaphores[current_frame]);
 
+    // The scene target has the window size, only its top-left
+    // render extent is drawn, then stretched to the swapchain.
+    _render_extent = SceneRenderExtent();
+
+    // the graph transitions the swapchain image once the acquire semaphore is waited on.
+    _frame_graph.bind_image(_fg.swapchain, _w->active_swapchain_image(), 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    _scene->update_frame_graph(&_frame_graph, _render_extent);
+
+    auto &compute_cmd = _ctx.compute.command_buffers[current_frame];
+    auto &cmd = _ctx.graphics.command_buffers[current_frame];
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    result = vkBeginCommandBuffer(compute_cmd, &begin_info);
+    ErrorCheck(result);
+    result = vkBeginCommandBuffer(cmd, &begin_info);
+    ErrorCheck(result);
+
+    if (_timestamp_query_pool != VK_NULL_HANDLE)
+    {
+        vkCmdResetQueryPool(compute_cmd, _timestamp_query_pool, first_query + TIMESTAMP_COMPUTE_BEGIN, 2);
+        vkCmdWriteTimestamp(compute_cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _timestamp_query_pool, first_query + TIMESTAMP_COMPUTE_BEGIN);
+
+        vkCmdResetQueryPool(cmd, _timestamp_query_pool, first_query + TIMESTAMP_GRAPHICS_BEGIN, 4);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _timestamp_query_pool, first_query + TIMESTAMP_FRAME_BEGIN);
+    }
+
+    // all the passes, with their barriers.
+    _frame_graph.execute({ cmd, compute_cmd });
+
+    if (_timestamp_query_pool != VK_NULL_HANDLE)
+    {
+        vkCmdWriteTimestamp(compute_cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _timestamp_query_pool, first_query + TIMESTAMP_COMPUTE_END);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _timestamp_query_pool, first_query + TIMESTAMP_FRAME_END);
+    }
 
+    result = vkEndCommandBuffer(compute_cmd);
+    ErrorCheck(result);
+    result = vkEndCommandBuffer(cmd); // compiles the command buffer
+    ErrorCheck(result);
 
     //
     // COMPUTE
     //
     {
+        // waits for the previous graphics frame to be done with what the compute passes overwrite.
+        const uint32_t previous_frame = (current_frame + MAX_PARALLEL_FRAMES - 1) % MAX_PARALLEL_FRAMES;
+        VkPipelineStageFlags compute_wait_stage_mask[] = { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT };
+
         VkSubmitInfo submit_info = {};
         submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.waitSemaphoreCount = _graphics_semaphore_signaled ? 1 : 0;
+        submit_info.pWaitSemaphores = &_graphics_complete_semaphores[previous_frame];
+        submit_info.pWaitDstStageMask = compute_wait_stage_mask;
         submit_info.commandBufferCount = 1;
         submit_info.pCommandBuffers = &compute_cmd;
+        submit_info.signalSemaphoreCount = 1;
+        submit_info.pSignalSemaphores = &_compute_complete_semaphores[current_frame];
 
-        //result = vkQueueSubmit(_ctx.compute.queue, 1, &submit_info, VK_NULL_HANDLE);// _compute_fences[current_frame]);
         result = vkQueueSubmit(_ctx.compute.queue, 1, &submit_info, _compute_fences[current_frame]);
         ErrorCheck(result);
     }
 
+    //
+    // GRAPHICS
+    //
 
+    // the pipeline stage COLOR_ATTACH_OUTPUT has to wait for the semaphore saying
+    //  that the FBO is available to write to = finished reading by the present engine.
+    // The first reads of the compute results wait for the compute submit.
+    std::array<VkSemaphore, 2> wait_semaphores = { _present_complete_semaphores[current_frame], _compute_complete_semaphores[current_frame] };
+    std::array<VkPipelineStageFlags, 2> wait_stage_mask = {
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT };
 
+    // signals render complete so that the presentation can begin presenting,
+    // and graphics complete for the next compute submit.
+    std::array<VkSemaphore, 2> signal_semaphores = { _render_complete_semaphores[current_frame], _graphics_complete_semaphores[current_frame] };
 
-    auto &cmd = _ctx.graphics.command_buffers[current_frame];
-
-    // Record command buffer
-    VkCommandBufferBeginInfo begin_info = {};
-    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    result = vkBeginCommandBuffer(cmd, &begin_info);
-    ErrorCheck(result);
-    {
-#if 1
-        // barrier for reading from uniform buffer after all writing is done:
-        VkMemoryBarrier uniform_memory_barrier = {};
-        uniform_memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
-        uniform_memory_barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT; // the vkFlushMappedMemoryRanges is a "host" command.
-        uniform_memory_barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT;
-
-        vkCmdPipelineBarrier(cmd,
-            VK_PIPELINE_STAGE_HOST_BIT,
-            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
-            0,
-            1, &uniform_memory_barrier,
-            0, nullptr,
-            0, nullptr);
-#endif
-
-        VkRect2D render_area = {};
-        render_area.offset = { 0, 0 };
-        render_area.extent = _w->surface_size();
-
-        // NOTE: these values are used only if the attachment has the loadOp LOAD_OP_CLEAR
-        std::array<VkClearValue, 2> clear_values = {};
-        clear_values[0].depthStencil.depth = 1.0f;
-        clear_values[0].depthStencil.stencil = 0;
-        // cornflower blue #6495ED - 100 149 237
-        // partly clouded sky 214 224 255
-        glm::vec4 bg_color = _scene->bg_color();
-        clear_values[1].color.float32[0] = bg_color.r; // R // backbuffer is of type B8G8R8A8_UNORM
-        clear_values[1].color.float32[1] = bg_color.g; // G
-        clear_values[1].color.float32[2] = bg_color.b; // B
-        clear_values[1].color.float32[3] = bg_color.a; // A
-
-        VkRenderPassBeginInfo render_pass_begin_info = {};
-        render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        render_pass_begin_info.renderPass = _render_pass;
-        render_pass_begin_info.framebuffer = _swapchain_framebuffers[_w->active_swapchain_image_id()];
-        render_pass_begin_info.renderArea = render_area;
-        render_pass_begin_info.clearValueCount = (uint32_t)clear_values.size();
-        render_pass_begin_info.pClearValues = clear_values.data();
-
-        vkCmdBeginRenderPass(cmd, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-        {
-            VkViewport viewport = { 0, 0, (float)_global_viewport.width, (float)_global_viewport.height, 0, 1 };
-            VkRect2D scissor = { 0, 0, _global_viewport.width, _global_viewport.height };
-            _scene->draw(cmd, viewport, scissor);
-            ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
-        }
-        vkCmdEndRenderPass(cmd);
-
-    // NO NEED to transition from OPTIMAL to PRESENT at the end, if already specified in the render pass.
-    }
-    result = vkEndCommandBuffer(cmd); // compiles the command buffer
-    ErrorCheck(result);
-
-    // Submit command buffer
-    VkPipelineStageFlags wait_stage_mask[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
     VkSubmitInfo submit_info = {};
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.waitSemaphoreCount = 1;
-    // the pipeline stage COLOR_ATTACH_OUTPUT has to wait for the semaphore saying
-    //  that the FBO is available to write to = finished reading by the present engine.
-    submit_info.pWaitSemaphores = &_present_complete_semaphores[current_frame];
-    submit_info.pWaitDstStageMask = wait_stage_mask;
+    submit_info.waitSemaphoreCount = (uint32_t)wait_semaphores.size();
+    submit_info.pWaitSemaphores = wait_semaphores.data();
+    submit_info.pWaitDstStageMask = wait_stage_mask.data();
     submit_info.commandBufferCount = 1;
     submit_info.pCommandBuffers = &cmd;
-    // signals this semaphore when the render is complete GPU side
-    // so that the presentation can begin presenting.
-    submit_info.signalSemaphoreCount = 1;
-    submit_info.pSignalSemaphores = &_render_complete_semaphores[current_frame];
+    submit_info.signalSemaphoreCount = (uint32_t)signal_semaphores.size();
+    submit_info.pSignalSemaphores = signal_semaphores.data();
 
     result = vkQueueSubmit(_ctx.graphics.queue, 1, &submit_info, _render_fences[current_frame]);
     ErrorCheck(result);
+    _timestamps_written[current_frame] = (_timestamp_query_pool != VK_NULL_HANDLE);
+    _graphics_semaphore_signaled = true;
 
     // Present the frame after having waited on the rendering to be finished.
     _w->EndRender({ _render_complete_semaphores[current_frame] });
@@ -992,6 +1387,87 @@ void Renderer::Draw(float dt)
     current_frame = (current_frame + 1) % MAX_PARALLEL_FRAMES;
 }
 
+void Renderer::RecordScenePass(VkCommandBuffer cmd)
+{
+    const uint32_t first_query = current_frame * TIMESTAMP_COUNT;
+
+    VkRect2D render_area = {};
+    render_area.offset = { 0, 0 };
+    render_area.extent = _render_extent;
+
+    // NOTE: these values are used only if the attachment has the loadOp LOAD_OP_CLEAR
+    std::array<VkClearValue, 2> clear_values = {};
+    clear_values[0].depthStencil.depth = 1.0f;
+    clear_values[0].depthStencil.stencil = 0;
+    // cornflower blue #6495ED - 100 149 237
+    // partly clouded sky 214 224 255
+    glm::vec4 bg_color = _scene->bg_color();
+    clear_values[1].color.float32[0] = bg_color.r; // R // backbuffer is of type B8G8R8A8_UNORM
+    clear_values[1].color.float32[1] = bg_color.g; // G
+    clear_values[1].color.float32[2] = bg_color.b; // B
+    clear_values[1].color.float32[3] = bg_color.a; // A
+
+    VkRenderPassBeginInfo render_pass_begin_info = {};
+    render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    render_pass_begin_info.renderPass = _scene_render_pass;
+    render_pass_begin_info.framebuffer = _scene_framebuffer;
+    render_pass_begin_info.renderArea = render_area;
+    render_pass_begin_info.clearValueCount = (uint32_t)clear_values.size();
+    render_pass_begin_info.pClearValues = clear_values.data();
+
+    vkCmdBeginRenderPass(cmd, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    {
+        VkViewport viewport = { 0, 0, (float)_render_extent.width, (float)_render_extent.height, 0, 1 };
+        VkRect2D scissor = { { 0, 0 }, _render_extent };
+        if (_timestamp_query_pool != VK_NULL_HANDLE)
+            vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _timestamp_query_pool, first_query + TIMESTAMP_GRAPHICS_BEGIN);
+
+        _scene->draw(cmd, viewport, scissor);
+
+        if (_timestamp_query_pool != VK_NULL_HANDLE)
+            vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _timestamp_query_pool, first_query + TIMESTAMP_GRAPHICS_END);
+    }
+    vkCmdEndRenderPass(cmd);
+}
+
+void Renderer::RecordCompositePass(VkCommandBuffer cmd)
+{
+    VkExtent2D surface_extent = _w->surface_size();
+
+    VkRenderPassBeginInfo render_pass_begin_info = {};
+    render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    render_pass_begin_info.renderPass = _render_pass;
+    render_pass_begin_info.framebuffer = _swapchain_framebuffers[_w->active_swapchain_image_id()];
+    render_pass_begin_info.renderArea = { { 0, 0 }, surface_extent };
+    render_pass_begin_info.clearValueCount = 0; // every pixel is overwritten
+    render_pass_begin_info.pClearValues = nullptr;
+
+    vkCmdBeginRenderPass(cmd, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    {
+        VkViewport viewport = { 0, 0, (float)surface_extent.width, (float)surface_extent.height, 0, 1 };
+        VkRect2D scissor = { { 0, 0 }, surface_extent };
+        vkCmdSetViewport(cmd, 0, 1, &viewport);
+        vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+        // uv in [0,1] over the swapchain -> [0, render/full] in the scene target,
+        // clamped half a texel inside so bilinear never reads outside the render extent.
+        glm::vec4 uv_scale_max(
+            (float)_render_extent.width / (float)_depth_extent.width,
+            (float)_render_extent.height / (float)_depth_extent.height,
+            ((float)_render_extent.width - 0.5f) / (float)_depth_extent.width,
+            ((float)_render_extent.height - 0.5f) / (float)_depth_extent.height);
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _composite_pipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _composite_pipeline_layout, 0, 1, &_composite_descriptor_set, 0, nullptr);
+        vkCmdPushConstants(cmd, _composite_pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(glm::vec4), &uv_scale_max);
+        vkCmdDraw(cmd, 3, 1, 0, 0);
+
+        // UI stays at native resolution.
+        ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
+    }
+    vkCmdEndRenderPass(cmd);
+}
+
 
 
 
@@ -1083,7 +1559,9 @@ bool Renderer::InitDepthStencilImage()
             VkFormatProperties format_properties = {};
             // vkGetPhysicalDeviceFormatProperties2 ???
             vkGetPhysicalDeviceFormatProperties(_ctx.physical_device, f, &format_properties);
-            if (format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+            // also sampled by the depth pyramid build (Hi-Z occlusion culling).
+            const VkFormatFeatureFlags needed_features = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+            if ((format_properties.optimalTilingFeatures & needed_features) == needed_features)
             {
                 _depth_stencil_format = f;
                 break;
@@ -1109,14 +1587,15 @@ bool Renderer::InitDepthStencilImage()
     image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     image_create_info.imageType = VK_IMAGE_TYPE_2D;
     image_create_info.format = _depth_stencil_format;
-    image_create_info.extent.width = _w->surface_size().width;
-    image_create_info.extent.height = _w->surface_size().height;
+    _depth_extent = _w->surface_size();
+    image_create_info.extent.width = _depth_extent.width;
+    image_create_info.extent.height = _depth_extent.height;
     image_create_info.extent.depth = 1;
     image_create_info.mipLevels = 1;
     image_create_info.arrayLayers = 1;
     image_create_info.samples = VK_SAMPLE_COUNT_1_BIT; // of doing multi sampling, put the same here as in the swapchain.
     image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL; // use gpu tiling
-    image_create_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    image_create_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
     image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     image_create_info.queueFamilyIndexCount = VK_QUEUE_FAMILY_IGNORED;
     image_create_info.pQueueFamilyIndices = nullptr;
@@ -1179,12 +1658,20 @@ bool Renderer::InitDepthStencilImage()
     if (result != VK_SUCCESS)
         return false;
 
+    Log("#     Create Depth Only Image View (sampled)\n");
+    image_view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT; // cannot sample both aspects at once
+    result = vkCreateImageView(_ctx.device, &image_view_create_info, nullptr, &_depth_sample_image_view);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
     return true;
 }
 
 void Renderer::DeInitDepthStencilImage()
 {
-    Log("#   Destroy Image View\n");
+    Log("#   Destroy Image Views\n");
+    vkDestroyImageView(_ctx.device, _depth_sample_image_view, nullptr);
     vkDestroyImageView(_ctx.device, _depth_stencil_image_view, nullptr);
 
     Log("#   Free Memory\n");
@@ -1194,6 +1681,104 @@ void Renderer::DeInitDepthStencilImage()
     vkDestroyImage(_ctx.device, _depth_stencil_image, nullptr);
 }
 
+bool Renderer::SetScene(Scene *scene)
+{
+    _scene = scene;
+
+    Log("#   Init Frame Graph\n");
+    return InitFrameGraph();
+}
+
+//
+// The whole frame, in order:
+//  [compute]  simulate, reset draw commands, classify (scene)
+//  [graphics] scene, depth pyramid (scene), upscale + UI
+//
+bool Renderer::InitFrameGraph()
+{
+    VkResult result;
+    auto &fg = _frame_graph;
+
+    _fg.depth = fg.import_image("depth", _stencil_available ? VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT : VK_IMAGE_ASPECT_DEPTH_BIT);
+    fg.bind_image(_fg.depth, _depth_stencil_image, 1, VK_IMAGE_LAYOUT_UNDEFINED);
+
+    // Allocated at window size, the scene only renders into the top-left render extent.
+    FrameGraph::image_description_t scene_color_desc = {};
+    scene_color_desc.format = _scene_color_format;
+    scene_color_desc.extent = _depth_extent;
+    scene_color_desc.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    scene_color_desc.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+    _fg.scene_color = fg.create_image("scene_color", scene_color_desc);
+
+    // bound each frame, once acquired.
+    _fg.swapchain = fg.import_image("swapchain", VK_IMAGE_ASPECT_COLOR_BIT);
+    fg.set_output(_fg.swapchain, FrameGraph::ACCESS_PRESENT);
+
+    _scene->declare_compute_passes(&fg);
+
+    _fg.scene_pass = fg.add_pass("scene", FrameGraph::QUEUE_GRAPHICS, [this](VkCommandBuffer cmd) { RecordScenePass(cmd); });
+    fg.write(_fg.scene_pass, _fg.scene_color, FrameGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+    fg.write(_fg.scene_pass, _fg.depth, FrameGraph::ACCESS_DEPTH_ATTACHMENT_WRITE);
+
+    _scene->declare_graphics_passes(&fg, _fg.scene_pass, _fg.depth);
+
+    _fg.composite_pass = fg.add_pass("upscale", FrameGraph::QUEUE_GRAPHICS, [this](VkCommandBuffer cmd) { RecordCompositePass(cmd); });
+    fg.read(_fg.composite_pass, _fg.scene_color, FrameGraph::ACCESS_FRAGMENT_SAMPLED);
+    fg.write(_fg.composite_pass, _fg.swapchain, FrameGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+
+    if (!fg.compile())
+        return false;
+
+    //
+    // Now that the transient images exist.
+    //
+
+    std::array<VkImageView, 2> attachments = {};
+    attachments[ATTACH_INDEX_DEPTH] = _depth_stencil_image_view;
+    attachments[ATTACH_INDEX_COLOR] = fg.image_view(_fg.scene_color);
+
+    VkFramebufferCreateInfo frame_buffer_create_info = {};
+    frame_buffer_create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    frame_buffer_create_info.renderPass = _scene_render_pass;
+    frame_buffer_create_info.attachmentCount = (uint32_t)attachments.size(); // need to be compatible with the render pass attachments
+    frame_buffer_create_info.pAttachments = attachments.data();
+    frame_buffer_create_info.width = _depth_extent.width;
+    frame_buffer_create_info.height = _depth_extent.height;
+    frame_buffer_create_info.layers = 1;
+
+    Log("#    Create Scene FrameBuffer\n");
+    result = vkCreateFramebuffer(_ctx.device, &frame_buffer_create_info, nullptr, &_scene_framebuffer);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    VkDescriptorImageInfo image_info = {};
+    image_info.sampler = _composite_sampler;
+    image_info.imageView = fg.image_view(_fg.scene_color);
+    image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkWriteDescriptorSet write_descriptor_set = {};
+    write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set.dstSet = _composite_descriptor_set;
+    write_descriptor_set.dstBinding = 0;
+    write_descriptor_set.dstArrayElement = 0;
+    write_descriptor_set.descriptorCount = 1;
+    write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write_descriptor_set.pImageInfo = &image_info;
+
+    vkUpdateDescriptorSets(_ctx.device, 1, &write_descriptor_set, 0, nullptr);
+
+    return true;
+}
+
+void Renderer::DeInitFrameGraph()
+{
+    vkDestroyFramebuffer(_ctx.device, _scene_framebuffer, nullptr);
+    _scene_framebuffer = VK_NULL_HANDLE;
+
+    _frame_graph.de_init();
+}
+
 #define ATTACH_INDEX_DEPTH 0
 #define ATTACH_INDEX_COLOR 1
 
@@ -1201,85 +1786,127 @@ bool Renderer::InitRenderPass()
 {
     VkResult result;
 
-    Log("#   Define Attachements\n");
-    std::array<VkAttachmentDescription, 2> attachements = {};
-    {   // depth/stencil
-        attachements[ATTACH_INDEX_DEPTH].flags = 0;
-        attachements[ATTACH_INDEX_DEPTH].format = _depth_stencil_format;
-        attachements[ATTACH_INDEX_DEPTH].samples = VK_SAMPLE_COUNT_1_BIT;
-        attachements[ATTACH_INDEX_DEPTH].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        attachements[ATTACH_INDEX_DEPTH].storeOp = VK_ATTACHMENT_STORE_OP_STORE; // VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        attachements[ATTACH_INDEX_DEPTH].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;// VK_ATTACHMENT_LOAD_OP_LOAD;
-        attachements[ATTACH_INDEX_DEPTH].stencilStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
-        attachements[ATTACH_INDEX_DEPTH].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // format EXPECTED (render pass DOES NOT do it for you)
-        attachements[ATTACH_INDEX_DEPTH].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL; // renderpass DOES transform into it at the end.
-
-        // color
-        attachements[ATTACH_INDEX_COLOR].flags = 0;
-        attachements[ATTACH_INDEX_COLOR].format = _w->surface_format(); // bc we are rendering directly to the screen
-        attachements[ATTACH_INDEX_COLOR].samples = VK_SAMPLE_COUNT_1_BIT; // needs to be the same for all attachements
-        attachements[ATTACH_INDEX_COLOR].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        attachements[ATTACH_INDEX_COLOR].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        //attachements[ATTACH_INDEX_COLOR].stencilLoadOp  = ; // not used for color att
-        //attachements[ATTACH_INDEX_COLOR].stencilStoreOp = ; // not used for color att
-        attachements[ATTACH_INDEX_COLOR].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // UNDEFINED allows vulkan to throw the old content.
-        attachements[ATTACH_INDEX_COLOR].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; // ready to present
-    }
+    // same format as the swapchain, the shaders output display values.
+    _scene_color_format = _w->surface_format();
+
+    //
+    // SCENE PASS: offscreen color + depth
+    //
+    {
+        Log("#   Define Scene Pass Attachements\n");
+        std::array<VkAttachmentDescription, 2> attachements = {};
+        {   // depth/stencil
+            attachements[ATTACH_INDEX_DEPTH].flags = 0;
+            attachements[ATTACH_INDEX_DEPTH].format = _depth_stencil_format;
+            attachements[ATTACH_INDEX_DEPTH].samples = VK_SAMPLE_COUNT_1_BIT;
+            attachements[ATTACH_INDEX_DEPTH].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            attachements[ATTACH_INDEX_DEPTH].storeOp = VK_ATTACHMENT_STORE_OP_STORE; // VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            attachements[ATTACH_INDEX_DEPTH].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;// VK_ATTACHMENT_LOAD_OP_LOAD;
+            attachements[ATTACH_INDEX_DEPTH].stencilStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
+            attachements[ATTACH_INDEX_DEPTH].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL; // transitions done by the frame graph
+            attachements[ATTACH_INDEX_DEPTH].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+            // color
+            attachements[ATTACH_INDEX_COLOR].flags = 0;
+            attachements[ATTACH_INDEX_COLOR].format = _scene_color_format;
+            attachements[ATTACH_INDEX_COLOR].samples = VK_SAMPLE_COUNT_1_BIT; // needs to be the same for all attachements
+            attachements[ATTACH_INDEX_COLOR].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            attachements[ATTACH_INDEX_COLOR].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+            attachements[ATTACH_INDEX_COLOR].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL; // transitions done by the frame graph
+            attachements[ATTACH_INDEX_COLOR].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        }
 
-    Log("#   Define Attachment References\n");
+        Log("#   Define Scene Pass Attachment References\n");
 
-    VkAttachmentReference subpass_0_depth_attachment = {};
-    subpass_0_depth_attachment.attachment = ATTACH_INDEX_DEPTH;
-    subpass_0_depth_attachment.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        VkAttachmentReference subpass_0_depth_attachment = {};
+        subpass_0_depth_attachment.attachment = ATTACH_INDEX_DEPTH;
+        subpass_0_depth_attachment.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
-    std::array<VkAttachmentReference, 1> subpass_0_color_attachments = {};
-    subpass_0_color_attachments[0].attachment = ATTACH_INDEX_COLOR;
-    subpass_0_color_attachments[0].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        std::array<VkAttachmentReference, 1> subpass_0_color_attachments = {};
+        subpass_0_color_attachments[0].attachment = ATTACH_INDEX_COLOR;
+        subpass_0_color_attachments[0].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
-    Log("#   Define SubPasses\n");
+        Log("#   Define Scene Pass SubPasses\n");
 
-    std::array<VkSubpassDescription, 1> subpasses = {};
-    {
-        subpasses[0].flags = 0;
-        subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS; // or compute
-        subpasses[0].inputAttachmentCount = 0; // used for example if we are in the second subpass and it needs something from the first subpass
-        subpasses[0].pInputAttachments = nullptr;
-        subpasses[0].colorAttachmentCount = (uint32_t)subpass_0_color_attachments.size();
-        subpasses[0].pColorAttachments = subpass_0_color_attachments.data();
-        subpasses[0].pResolveAttachments = nullptr;
-        subpasses[0].pDepthStencilAttachment = &subpass_0_depth_attachment;
-        subpasses[0].preserveAttachmentCount = 0;
-        subpasses[0].pPreserveAttachments = nullptr;
+        std::array<VkSubpassDescription, 1> subpasses = {};
+        {
+            subpasses[0].flags = 0;
+            subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS; // or compute
+            subpasses[0].inputAttachmentCount = 0; // used for example if we are in the second subpass and it needs something from the first subpass
+            subpasses[0].pInputAttachments = nullptr;
+            subpasses[0].colorAttachmentCount = (uint32_t)subpass_0_color_attachments.size();
+            subpasses[0].pColorAttachments = subpass_0_color_attachments.data();
+            subpasses[0].pResolveAttachments = nullptr;
+            subpasses[0].pDepthStencilAttachment = &subpass_0_depth_attachment;
+            subpasses[0].preserveAttachmentCount = 0;
+            subpasses[0].pPreserveAttachments = nullptr;
+        }
+
+        // No external dependency: the frame graph puts the barriers and
+        // layout transitions around the pass, the attachments stay in their layout.
+
+        Log("#   Create Scene Render Pass\n");
+
+        VkRenderPassCreateInfo render_pass_create_info = {};
+        render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        render_pass_create_info.attachmentCount = (uint32_t)attachements.size();
+        render_pass_create_info.pAttachments = attachements.data();
+        render_pass_create_info.subpassCount = (uint32_t)subpasses.size();
+        render_pass_create_info.pSubpasses = subpasses.data();
+        render_pass_create_info.dependencyCount = 0;
+        render_pass_create_info.pDependencies = nullptr;
+
+        result = vkCreateRenderPass(_ctx.device, &render_pass_create_info, nullptr, &_scene_render_pass);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
     }
 
-    VkSubpassDependency dependency = {};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL; // between the previous (acquire) command
-    dependency.dstSubpass = 0;                   // and the first subpass
-    // Our first subpass will wait for the COLOR_ATTACH_OUTPUT to begin, so the
-    // auto transition will happen after the swap chain image is ready to write,
-    // because we put a semaphore wait on that same stage in the submit info.
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT; 
-    dependency.srcAccessMask = 0;
-    // the operations waiting are read/write operations on the out color.
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-    //| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-    Log("#   Create Render Pass\n");
-
-    VkRenderPassCreateInfo render_pass_create_info = {};
-    render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    render_pass_create_info.attachmentCount = (uint32_t)attachements.size();
-    render_pass_create_info.pAttachments = attachements.data();
-    render_pass_create_info.subpassCount = (uint32_t)subpasses.size();
-    render_pass_create_info.pSubpasses = subpasses.data();
-    render_pass_create_info.dependencyCount = 1; // dependencies between subpasses, if one reads a buffer from another
-    render_pass_create_info.pDependencies = &dependency;
-
-    result = vkCreateRenderPass(_ctx.device, &render_pass_create_info, nullptr, &_render_pass);
-    ErrorCheck(result);
-    if (result != VK_SUCCESS)
-        return false;
+    //
+    // SWAPCHAIN PASS: upscaled scene + ImGui
+    //
+    {
+        Log("#   Define Swapchain Pass Attachement\n");
+        VkAttachmentDescription attachement = {};
+        attachement.flags = 0;
+        attachement.format = _w->surface_format(); // bc we are rendering directly to the screen
+        attachement.samples = VK_SAMPLE_COUNT_1_BIT;
+        attachement.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE; // fully covered by the upscale
+        attachement.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachement.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachement.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachement.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL; // transitions done by the frame graph
+        attachement.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference subpass_0_color_attachment = {};
+        subpass_0_color_attachment.attachment = 0;
+        subpass_0_color_attachment.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass = {};
+        subpass.flags = 0;
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &subpass_0_color_attachment;
+        subpass.pDepthStencilAttachment = nullptr;
+
+        // Acquire wait and transition to PRESENT are done by the frame graph.
+
+        Log("#   Create Swapchain Render Pass\n");
+
+        VkRenderPassCreateInfo render_pass_create_info = {};
+        render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        render_pass_create_info.attachmentCount = 1;
+        render_pass_create_info.pAttachments = &attachement;
+        render_pass_create_info.subpassCount = 1;
+        render_pass_create_info.pSubpasses = &subpass;
+        render_pass_create_info.dependencyCount = 0;
+        render_pass_create_info.pDependencies = nullptr;
+
+        result = vkCreateRenderPass(_ctx.device, &render_pass_create_info, nullptr, &_render_pass);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
 
     return true;
 }
@@ -1287,6 +1914,7 @@ bool Renderer::InitRenderPass()
 void Renderer::DeInitRenderPass()
 {
     vkDestroyRenderPass(_ctx.device, _render_pass, nullptr);
+    vkDestroyRenderPass(_ctx.device, _scene_render_pass, nullptr);
 }
 
 bool Renderer::InitSwapChainFrameBuffers()
@@ -1297,15 +1925,13 @@ bool Renderer::InitSwapChainFrameBuffers()
 
     for (uint32_t i = 0; i < _w->swapchain_image_count(); ++i)
     {
-        std::array<VkImageView, 2> attachments = {};
-        attachments[ATTACH_INDEX_DEPTH] = _depth_stencil_image_view; // shared between framebuffers
-        attachments[ATTACH_INDEX_COLOR] = _w->swapchain_image_views(i);
+        VkImageView attachment = _w->swapchain_image_views(i);
 
         VkFramebufferCreateInfo frame_buffer_create_info = {};
         frame_buffer_create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
         frame_buffer_create_info.renderPass = _render_pass;
-        frame_buffer_create_info.attachmentCount = (uint32_t)attachments.size(); // need to be compatible with the render pass attachments
-        frame_buffer_create_info.pAttachments = attachments.data();
+        frame_buffer_create_info.attachmentCount = 1; // need to be compatible with the render pass attachments
+        frame_buffer_create_info.pAttachments = &attachment;
         frame_buffer_create_info.width = _w->surface_size().width;
         frame_buffer_create_info.height = _w->surface_size().height;
         frame_buffer_create_info.layers = 1;
@@ -7,6 +7,9 @@
 
 #include <vector>
 #include <array>
+#include <string>
+
+#include "frame_graph.h"
 
 class Window;
 class Scene;
@@ -17,6 +20,7 @@ struct vulkan_queue
 {
     VkQueue         queue = VK_NULL_HANDLE;
     uint32_t        family_index = UINT32_MAX;
+    uint32_t        timestamp_valid_bits = 0; // 0 = no timestamp support on this family
     VkCommandPool   command_pool = VK_NULL_HANDLE;
     std::array<VkCommandBuffer, MAX_PARALLEL_FRAMES> command_buffers = {}; // maybe many
 };
@@ -29,6 +33,9 @@ struct vulkan_context
     
     VkPhysicalDeviceProperties       physical_device_properties = {};
     VkPhysicalDeviceMemoryProperties physical_device_memory_properties = {};
+    VkPhysicalDeviceSubgroupProperties subgroup_properties = {}; // all 0 below Vulkan 1.1
+
+    uint32_t api_version = VK_API_VERSION_1_0; // of the instance
 
     vulkan_queue graphics = {};
     vulkan_queue compute  = {};
@@ -40,6 +47,8 @@ struct vulkan_context
     std::vector< const char * > device_layers; // deprecated
     std::vector< const char * > device_extensions;
     VkPhysicalDeviceFeatures    features = {};
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptor_indexing_features = {}; // bindless material textures
+    bool bindless = false; // the features above are there and enabled
 
     VkDescriptorPool descriptor_pool = VK_NULL_HANDLE; // big descriptor pool for ImGui
 
@@ -59,12 +68,16 @@ public:
     bool InitContext();
     bool InitSceneVulkan();
     void DeInitSceneVulkan();
-    void SetScene(Scene *scene) { _scene = scene; }
+    bool SetScene(Scene *scene); // builds the frame graph
+
     void Update(float dt); 
     void Draw(float dt);
 
     vulkan_context *context() { return &_ctx; };
-    VkRenderPass render_pass() { return _render_pass; }
+    VkRenderPass render_pass() { return _render_pass; } // swapchain pass: upscale + ImGui
+    VkRenderPass scene_render_pass() { return _scene_render_pass; } // offscreen scene pass
+    VkImageView depth_sample_view() { return _depth_sample_image_view; }
+    VkExtent2D depth_extent() { return _depth_extent; }
 
 private:
     bool InitInstance();
@@ -77,6 +90,7 @@ private:
         bool EnumerateInstanceLayers();
         bool EnumerateDeviceLayers();
         bool EnumerateDeviceExtensions();
+        void SelectDescriptorIndexingFeatures();
         bool CreateLogicalDevice();
     void DeInitDevice();
 
@@ -117,9 +131,36 @@ private:
     bool InitDescriptorPool();
     void DeInitDescriptorPool();
 
+    bool InitTimestampQueries();
+    void DeInitTimestampQueries();
+    void ReadTimestampQueries();
+
+    bool InitFrameGraph();
+    void DeInitFrameGraph();
+    void RecordScenePass(VkCommandBuffer cmd);
+    void RecordCompositePass(VkCommandBuffer cmd);
+
+    bool CreateShaderModule(const std::string &file_path, VkShaderModule *shader_module);
+    bool InitCompositePipeline();
+    void DeInitCompositePipeline();
+
+    void UpdateDynamicResolution(float gpu_frame_ms);
+    void ShowDynamicResolutionProperties();
+    VkExtent2D SceneRenderExtent();
+
 private:
 
     vulkan_context _ctx;
+    FrameGraph _frame_graph; // after _ctx
+
+    struct _frame_graph_ids_t
+    {
+        FrameGraph::resource_id_t depth = FrameGraph::INVALID_ID;
+        FrameGraph::resource_id_t scene_color = FrameGraph::INVALID_ID;
+        FrameGraph::resource_id_t swapchain = FrameGraph::INVALID_ID;
+        FrameGraph::pass_id_t scene_pass = FrameGraph::INVALID_ID;
+        FrameGraph::pass_id_t composite_pass = FrameGraph::INVALID_ID;
+    } _fg;
 
 #if USE_VMA == 1
     VmaAllocator _allocator = VK_NULL_HANDLE;
@@ -135,14 +176,54 @@ private:
     VkImage _depth_stencil_image = {};
     VkDeviceMemory _depth_stencil_image_memory = VK_NULL_HANDLE;
     VkImageView _depth_stencil_image_view = VK_NULL_HANDLE;
+    VkImageView _depth_sample_image_view = VK_NULL_HANDLE; // depth aspect only
+    VkExtent2D _depth_extent = {};
     VkFormat _depth_stencil_format = VK_FORMAT_UNDEFINED;
     bool _stencil_available = false;
 
-    VkRenderPass _render_pass = VK_NULL_HANDLE;
+    VkRenderPass _render_pass = VK_NULL_HANDLE;       // swapchain color only
+    VkRenderPass _scene_render_pass = VK_NULL_HANDLE; // offscreen color + depth
+
+    // Offscreen scene target, a transient image of the frame graph, at window size.
+    // The scene only renders into the top-left render extent, scaled by _resolution_scale.
+    VkFormat _scene_color_format = VK_FORMAT_UNDEFINED;
+    VkExtent2D _render_extent = {};
+    VkFramebuffer _scene_framebuffer = VK_NULL_HANDLE;
+
+    // Upscale of the scene target into the swapchain image.
+    VkShaderModule _composite_vs = VK_NULL_HANDLE;
+    VkShaderModule _composite_fs = VK_NULL_HANDLE;
+    VkSampler _composite_sampler = VK_NULL_HANDLE;
+    VkDescriptorSetLayout _composite_descriptor_set_layout = VK_NULL_HANDLE;
+    VkDescriptorSet _composite_descriptor_set = VK_NULL_HANDLE;
+    VkPipelineLayout _composite_pipeline_layout = VK_NULL_HANDLE;
+    VkPipeline _composite_pipeline = VK_NULL_HANDLE;
+
+    // Dynamic resolution
+    bool  _dynamic_resolution = true;
+    float _gpu_budget_ms = 8.0f;
+    float _resolution_scale = 1.0f; // of the window size, per axis
+    float _min_resolution_scale = 0.5f;
+    float _gpu_frame_ms = 0.0f;
 
     uint32_t current_frame = 0;
     std::array<VkSemaphore, MAX_PARALLEL_FRAMES> _render_complete_semaphores = {};
     std::array<VkSemaphore, MAX_PARALLEL_FRAMES> _present_complete_semaphores = {};
     std::array<VkFence, MAX_PARALLEL_FRAMES>     _render_fences = {};
     std::array<VkFence, MAX_PARALLEL_FRAMES>     _compute_fences = {};
+    std::array<VkSemaphore, MAX_PARALLEL_FRAMES> _compute_complete_semaphores = {};  // compute -> graphics, same frame
+    std::array<VkSemaphore, MAX_PARALLEL_FRAMES> _graphics_complete_semaphores = {}; // graphics -> next frame compute
+    bool _graphics_semaphore_signaled = false;
+
+    // GPU timings, per parallel frame.
+    // GRAPHICS_BEGIN..FRAME_END must stay contiguous, they are reset together.
+    enum
+    {
+        TIMESTAMP_COMPUTE_BEGIN = 0, TIMESTAMP_COMPUTE_END,
+        TIMESTAMP_GRAPHICS_BEGIN, TIMESTAMP_GRAPHICS_END, // scene draw only
+        TIMESTAMP_FRAME_BEGIN, TIMESTAMP_FRAME_END,       // whole graphics command buffer
+        TIMESTAMP_COUNT
+    };
+    VkQueryPool _timestamp_query_pool = VK_NULL_HANDLE;
+    std::array<bool, MAX_PARALLEL_FRAMES> _timestamps_written = {};
 };
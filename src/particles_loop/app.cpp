@@ -7,6 +7,11 @@
 
 #include "Renderer.h"
 #include "utils.h"
+#include "obj_loader.h"
+#include "gltf_loader.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "meshlets.h"
 #include "Scene.h"
 
 #include "imgui.h"
@@ -23,15 +28,21 @@
 
 #define WINDOW_WIDTH 1600
 #define WINDOW_HEIGHT 900
+#define OBJ_MODEL_PATH "./data/models/model.obj"
+#define OBJ_MODEL_BASE_TEX_PATH "./data/models/model_base.png" // loaded in the background
+#define GLTF_SCENE_PATH "./data/models/scene.glb"
+#define BRICKS_BASE_TEX_PATH "./data/textures/bricks_base.png" // loaded in the background
+#define MESH_CACHE_DIR "./cache/"
 
-void BaseApplication::run()
+int BaseApplication::run()
 {
-    if (!init()) return;
+    if (!init()) return 1;
     loop();
     clean();
+    return _exit_code;
 }
 
-VulkanApplication::VulkanApplication() : BaseApplication()
+VulkanApplication::VulkanApplication(const app_options_t &options) : BaseApplication(), _options(options)
 {
 }
 
@@ -63,7 +74,8 @@ bool VulkanApplication::init()
     Log("#  Init Scene\n");
     BuildScene();
 
-    _r->SetScene(_scene);
+    if (!_r->SetScene(_scene))
+        return false;
 
     return true;
 }
@@ -115,6 +127,22 @@ bool VulkanApplication::loop()
         ImGui::Render();
 
         _r->Draw(dt);
+
+        // the particles are in place after the first frame.
+        if (_options.check_simulation || _options.check_primitives)
+        {
+            if (_options.check_simulation && !_scene->run_simulation_check())
+            {
+                Log("# CPU/GPU simulation check FAILED\n");
+                _exit_code = 1;
+            }
+            if (_options.check_primitives && !_scene->run_primitives_check())
+            {
+                Log("# GPU primitives check FAILED\n");
+                _exit_code = 1;
+            }
+            break;
+        }
     }
 
     Log("#----------------------------------------\n");
@@ -149,7 +177,7 @@ void VulkanApplication::BuildScene()
     auto real_rand = std::bind(std::uniform_real_distribution<float>(0, 1), std::mt19937((unsigned int)seed));
 
     _scene = new Scene(_r->context());
-    _scene->init(_r->render_pass());
+    _scene->init(_r->scene_render_pass(), _r->depth_sample_view(), _r->depth_extent());
 
     //
     // Lights
@@ -231,25 +259,64 @@ void VulkanApplication::BuildScene()
         _scene->add_material_instance(mi);
     }
 
+    {
+        // neutral until the image is decoded and uploaded, a few frames in.
+        Scene::material_instance_description_t mi = {};
+        mi.instance_id = "obj_model";
+        mi.pipeline_id = "default";
+        mi.base_tex = _scene->load_texture("obj_model_base", OBJ_MODEL_BASE_TEX_PATH, "neutral_base", true) ? "obj_model_base" : "neutral_base";
+        mi.specular_tex = "neutral_dielectric_spec";
+        _scene->add_material_instance(mi);
+    }
+
+    {
+        // cooked on the first run, read back from the texture cache after.
+        Scene::material_instance_description_t mi = {};
+        mi.instance_id = "bricks_dielectric";
+        mi.pipeline_id = "default";
+        mi.base_tex = _scene->load_texture("bricks_base", BRICKS_BASE_TEX_PATH, "neutral_base", true) ? "bricks_base" : "neutral_base";
+        mi.specular_tex = "neutral_dielectric_spec";
+        _scene->add_material_instance(mi);
+    }
+
     //
     // Objects
     //
 
+    // one cooked icosphere for all the spheres, keyed by its parameters.
+    const uint32_t icosphere_subdivisions = 3; // 3 = 642 vtx, 1280 tri, 3840 idx
+    const float icosphere_radius = 0.5f;
+    uint64_t icosphere_hash = hash_bytes(&icosphere_subdivisions, sizeof(icosphere_subdivisions));
+    icosphere_hash = hash_bytes(&icosphere_radius, sizeof(icosphere_radius), icosphere_hash);
+    cooked_mesh_t icosphere;
+    load_cooked_mesh(MESH_CACHE_DIR "icosphere.mesh", icosphere_hash, [&](IndexedMesh *mesh) {
+        *mesh = make_icosphere(icosphere_subdivisions, icosphere_radius);
+        optimize_mesh(mesh, "icosphere");
+        return true;
+    }, &icosphere);
+
+    // the dielectric row is culled per meshlet, the metal row is drawn whole.
+    std::vector<Scene::meshlet_t> icosphere_meshlets;
+    build_meshlets(icosphere.vertices, icosphere.header->vertex_count, icosphere.indices, icosphere.header->index_count, &icosphere_meshlets);
+
 #   define NB_SPHERES 10
-    // SPHERE - shiny red plastic
+    // SPHERE - bricks
     for (size_t i = 0; i < NB_SPHERES; ++i)
     {
         float ith = (float)i / (NB_SPHERES - 1);
-        IndexedMesh icosphere = make_icosphere(3, 0.5f); // 3 = 642 vtx, 1280 tri, 3840 idx
         Scene::object_description_t obj_desc = {};
         obj_desc.name = std::string("DielectricSphere_") + std::to_string(i);
-        obj_desc.vertexCount = (uint32_t)icosphere.first.size();
-        obj_desc.vertices = icosphere.first.data();
-        obj_desc.indexCount = (uint32_t)icosphere.second.size();
-        obj_desc.indices = icosphere.second.data();
+        obj_desc.vertexCount = icosphere.header->vertex_count;
+        obj_desc.vertices = icosphere.vertices;
+        obj_desc.indexCount = icosphere.header->index_count;
+        obj_desc.indices = icosphere.indices;
+        obj_desc.bounding_radius = icosphere.header->bounding_radius;
+        obj_desc.meshletCount = (uint32_t)icosphere_meshlets.size();
+        obj_desc.meshlets = icosphere_meshlets.data();
         obj_desc.position = glm::vec3(-4.5f + 9.0f*ith, 0.0f, -1.0f);
-        obj_desc.material = "neutral_dielectric";
-        obj_desc.base_color = glm::vec4(0.97, 0.74, 0.62, 1); // copper tint
+        obj_desc.spin = glm::vec3(0.0f, 0.5f, 0.0f);
+        obj_desc.material = "bricks_dielectric";
+        obj_desc.base_color = glm::vec4(1, 1, 1, 1);
         obj_desc.specular = glm::vec4(0.045f + 0.955f*ith, 0, 0.5f, 0);
         _scene->add_object_to_global_instance_set(obj_desc);
     }
@@ -258,19 +325,60 @@ void VulkanApplication::BuildScene()
     for (size_t i = 0; i < NB_SPHERES; ++i)
     {
         float ith = (float)i / (NB_SPHERES - 1);
-        IndexedMesh icosphere = make_icosphere(3, 0.5f); // 3 = 642 vtx, 1280 tri, 3840 idx
         Scene::object_description_t obj_desc = {};
         obj_desc.name = std::string("MetalSphere_") + std::to_string(i);
-        obj_desc.vertexCount = (uint32_t)icosphere.first.size();
-        obj_desc.vertices = icosphere.first.data();
-        obj_desc.indexCount = (uint32_t)icosphere.second.size();
-        obj_desc.indices = icosphere.second.data();
-        obj_desc.position = glm::vec3(-4.5f + 9.0f*ith, 0.0f, 1.0f);
+        obj_desc.vertexCount = icosphere.header->vertex_count;
+        obj_desc.vertices = icosphere.vertices;
+        obj_desc.indexCount = icosphere.header->index_count;
+        obj_desc.indices = icosphere.indices;
+        obj_desc.bounding_radius = icosphere.header->bounding_radius;
+        // orbits its dielectric sphere, 2 units away.
+        obj_desc.parent = std::string("DielectricSphere_") + std::to_string(i);
+        obj_desc.position = glm::vec3(0.0f, 0.0f, 2.0f);
         obj_desc.material = "neutral_metal";
         obj_desc.base_color = glm::vec4(0.97, 0.74, 0.62, 1); // copper
         obj_desc.specular = glm::vec4(0.045f + 0.955f*ith, 1, 1, 0);
         _scene->add_object_to_global_instance_set(obj_desc);
     }
+    close_cooked_mesh(&icosphere);
+
+    // OBJ MODEL - trefoil knot, parsed again only when the .obj changes
+    {
+        uint64_t source_hash = 0;
+        cooked_mesh_t model;
+        if (hash_file(OBJ_MODEL_PATH, &source_hash)
+            && load_cooked_mesh(MESH_CACHE_DIR "model.mesh", source_hash, [](IndexedMesh *mesh) {
+                if (!load_obj(OBJ_MODEL_PATH, mesh))
+                    return false;
+                optimize_mesh(mesh, OBJ_MODEL_PATH);
+                return true;
+            }, &model))
+        {
+            Scene::object_description_t obj_desc = {};
+            obj_desc.name = std::string("ObjModel");
+            obj_desc.vertexCount = model.header->vertex_count;
+            obj_desc.vertices = model.vertices;
+            obj_desc.indexCount = model.header->index_count;
+            obj_desc.indices = model.indices;
+            obj_desc.bounding_radius = model.header->bounding_radius;
+
+            // culled per meshlet when drawn with the global objects.
+            std::vector<Scene::meshlet_t> meshlets;
+            build_meshlets(model.vertices, model.header->vertex_count, model.indices, model.header->index_count, &meshlets);
+            obj_desc.meshletCount = (uint32_t)meshlets.size();
+            obj_desc.meshlets = meshlets.data();
+
+            obj_desc.position = glm::vec3(0.0f, 1.5f, 0.0f);
+            obj_desc.material = "obj_model";
+            obj_desc.base_color = glm::vec4(0.8, 0.8, 0.8, 1);
+            obj_desc.specular = glm::vec4(0.5f, 0, 0.5f, 0);
+            _scene->add_object_to_global_instance_set(obj_desc);
+            close_cooked_mesh(&model);
+        }
+    }
+
+    // GLTF SCENE - marble pedestal, gold rings and a ruby, next to the spheres
+    load_gltf(GLTF_SCENE_PATH, _scene, "gltf", glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 4.0f)));
 
     constexpr float roughness_min = 0.045f;
 
@@ -286,11 +394,13 @@ void VulkanApplication::BuildScene()
     //
     // PARTICLES instance set
     //
+    const uint32_t instance_count = _options.instance_count > 0 ? _options.instance_count : MAX_INSTANCE_COUNT;
     {
         //IndexedMesh obj = make_icosphere(0, 1.0f);
         //IndexedMesh obj = make_icosphere(1, 1.0f);
         IndexedMesh obj = make_flat_cube(0.5f, 0.5f, 0.5f);
         //IndexedMesh obj = make_hexagon(1.0f, 1.0f, glm::vec3(0, 0, 1));
+        optimize_mesh(&obj, "particle"); // shaded once per instance
         Scene::object_description_t obj_desc = {};
         obj_desc.name = std::string("Obj2_Template");
         obj_desc.vertexCount = (uint32_t)obj.first.size();
@@ -307,20 +417,26 @@ void VulkanApplication::BuildScene()
         is_desc.instance_set = "particles";
         is_desc.object_desc = obj_desc;
 
-        _scene->add_instance_set(is_desc, MAX_INSTANCE_COUNT);
+        _scene->add_instance_set(is_desc, instance_count);
     }
 
+    // as many slices as it takes, the last one partly filled.
+    const uint32_t slice_count = (instance_count + ROWS_COUNT * COLS_COUNT - 1) / (ROWS_COUNT * COLS_COUNT);
+    auto particles = _scene->find_instance_set("particles");
     for (uint32_t i = 0; i < ROWS_COUNT; ++i)
     {
         for (uint32_t j = 0; j < COLS_COUNT; ++j)
         {
-            for (uint32_t k = 0; k < SLICE_COUNT; ++k)
+            for (uint32_t k = 0; k < slice_count; ++k)
             {
+                if ((k * ROWS_COUNT + i) * COLS_COUNT + j >= instance_count)
+                    continue;
+
                 Scene::instanced_object_description_t instanced_object_desc;
                 instanced_object_desc.position = glm::vec3(
                     float(i) * ROWS_COUNT - (ROWS_COUNT/2.0),
                     float(j) * COLS_COUNT - (COLS_COUNT/2.0),
-                    float(k) * SLICE_COUNT - (SLICE_COUNT/2.0));
+                    float(k) * slice_count - (slice_count/2.0));
                 instanced_object_desc.rotation = glm::vec3(0, 0, 0);
                 instanced_object_desc.scale = glm::vec3(1, 1, 1);
                 instanced_object_desc.jitters = glm::vec4(real_rand(), real_rand(), real_rand(), real_rand());
@@ -333,8 +449,10 @@ void VulkanApplication::BuildScene()
                 float metallic = 1.0f;
                 instanced_object_desc.base_color = glm::vec4(1.0f, 0.85f, 0.57f, 1.0f); // gold_reflectance;
                 instanced_object_desc.specular = glm::vec4(roughness, metallic, 1, 0);
+                // mixed materials, still one draw per instance set.
+                instanced_object_desc.material = ((i + j + k) % 2) ? "half_metal_checker" : "neutral_metal";
 
-                _scene->add_object_to_instance_set(instanced_object_desc, "particles");
+                _scene->add_object_to_instance_set(instanced_object_desc, particles);
             }
         }
     }
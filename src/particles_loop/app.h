@@ -1,6 +1,8 @@
 #ifndef _VULKAN_APPLICATION_2018_07_20_H_
 #define _VULKAN_APPLICATION_2018_07_20_H_
 
+#include <stdint.h> // uint32_t
+
 //
 // BASE APPLICATION
 //
@@ -8,12 +10,14 @@
 class BaseApplication
 {
 public:
-    void run();
+    int run(); // the exit code of the program
 
 protected:
     virtual bool init()  = 0;
     virtual bool loop()  = 0;
     virtual void clean() = 0;
+
+    int _exit_code = 0;
 };
 
 //
@@ -24,10 +28,18 @@ class Renderer;
 class Window;
 class Scene;
 
+// From the command line, see main.cpp.
+struct app_options_t
+{
+    uint32_t instance_count = 0; // particles, 0 = MAX_INSTANCE_COUNT. --instances 1048576 for the benchmark
+    bool check_simulation = false; // --check-simulation: after the first frame, then quit. Exit code 1 on a mismatch
+    bool check_primitives = false; // --check-primitives: same, scan, compaction, reduction and sort
+};
+
 class VulkanApplication : public BaseApplication
 {
 public:
-    VulkanApplication();
+    VulkanApplication(const app_options_t &options = app_options_t());
     ~VulkanApplication();
 
 protected:
@@ -44,6 +56,7 @@ private:
     void ShowFPSWindow(bool should_refresh_fps, uint64_t fps);
 
 private:
+    app_options_t _options;
     Renderer * _r = nullptr;
     Window   * _w = nullptr;
     Scene    * _scene = nullptr;
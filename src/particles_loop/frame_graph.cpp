@@ -0,0 +1,804 @@
+#include "build_options.h"
+#include "platform.h"
+#include "frame_graph.h"
+#include "Renderer.h"
+#include "Shared.h"
+
+#include "imgui.h"
+
+#include <algorithm>
+
+static const VkAccessFlags WRITE_ACCESS_MASK =
+    VK_ACCESS_SHADER_WRITE_BIT |
+    VK_ACCESS_TRANSFER_WRITE_BIT |
+    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_HOST_WRITE_BIT;
+
+FrameGraph::FrameGraph(vulkan_context *ctx) : _ctx(ctx)
+{
+
+}
+
+FrameGraph::~FrameGraph()
+{
+    de_init();
+}
+
+const FrameGraph::_access_info_t &FrameGraph::access_info(access_t access)
+{
+    static const std::array<_access_info_t, ACCESS_COUNT> infos = { {
+        // ACCESS_INDIRECT_READ
+        { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false },
+        // ACCESS_VERTEX_BUFFER_READ
+        { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false },
+        // ACCESS_INDEX_BUFFER_READ
+        { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false },
+        // ACCESS_VERTEX_SHADER_READ
+        { VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false },
+        // ACCESS_FRAGMENT_SAMPLED
+        { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false },
+        // ACCESS_COMPUTE_READ
+        { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, false },
+        // ACCESS_COMPUTE_SAMPLED_DEPTH
+        { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, false },
+        // ACCESS_COMPUTE_WRITE
+        { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, true },
+        // ACCESS_COMPUTE_READ_WRITE
+        { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, true },
+        // ACCESS_TRANSFER_WRITE
+        { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true },
+        // ACCESS_COLOR_ATTACHMENT_WRITE
+        { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+          VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true },
+        // ACCESS_DEPTH_ATTACHMENT_WRITE
+        { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+          VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+          VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true },
+        // ACCESS_PRESENT
+        { VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, false },
+    } };
+
+    return infos[access];
+}
+
+//
+// DECLARATION
+//
+
+FrameGraph::resource_id_t FrameGraph::create_image(const std::string &name, const image_description_t &desc)
+{
+    _resource_t r = {};
+    r.name = name;
+    r.is_image = true;
+    r.transient = true;
+    r.desc = desc;
+    _resources.push_back(r);
+    return (resource_id_t)(_resources.size() - 1);
+}
+
+FrameGraph::resource_id_t FrameGraph::import_image(const std::string &name, VkImageAspectFlags aspect)
+{
+    _resource_t r = {};
+    r.name = name;
+    r.is_image = true;
+    r.desc.aspect = aspect;
+    _resources.push_back(r);
+    return (resource_id_t)(_resources.size() - 1);
+}
+
+FrameGraph::resource_id_t FrameGraph::import_buffer(const std::string &name)
+{
+    _resource_t r = {};
+    r.name = name;
+    _resources.push_back(r);
+    return (resource_id_t)(_resources.size() - 1);
+}
+
+void FrameGraph::set_output(resource_id_t id, access_t final_access)
+{
+    _resources[id].is_output = true;
+    _resources[id].final_access = final_access;
+}
+
+FrameGraph::pass_id_t FrameGraph::add_pass(const std::string &name, queue_t queue, std::function<void(VkCommandBuffer)> record)
+{
+    _pass_t p = {};
+    p.name = name;
+    p.queue = queue;
+    p.record = record;
+    _passes.push_back(p);
+    return (pass_id_t)(_passes.size() - 1);
+}
+
+void FrameGraph::read(pass_id_t pass, resource_id_t id, access_t access)
+{
+    add_usage(pass, id, access, false);
+}
+
+void FrameGraph::write(pass_id_t pass, resource_id_t id, access_t access)
+{
+    add_usage(pass, id, access, true);
+}
+
+void FrameGraph::add_usage(pass_id_t pass, resource_id_t id, access_t access, bool writes)
+{
+    const auto &info = access_info(access);
+    assert(writes == info.writes || access == ACCESS_COMPUTE_READ_WRITE);
+
+    // the same resource used twice by a pass (ex: vertex input + storage buffer)
+    for (auto &u : _passes[pass].usages)
+    {
+        if (u.resource == id)
+        {
+            assert(!_resources[id].is_image || u.layout == info.layout);
+            u.stages |= info.stages;
+            u.access |= info.access;
+            u.writes |= writes;
+            return;
+        }
+    }
+
+    _usage_t u = {};
+    u.resource = id;
+    u.stages = info.stages;
+    u.access = info.access;
+    u.layout = info.layout;
+    u.writes = writes;
+    _passes[pass].usages.push_back(u);
+}
+
+bool FrameGraph::compile()
+{
+    Log("#     Cull Frame Graph Passes\n");
+    cull_passes();
+
+    // One way only within a frame: compute, then graphics.
+    for (uint32_t p = 0; p < _passes.size(); ++p)
+    {
+        if (!_passes[p].alive || _passes[p].queue != QUEUE_COMPUTE)
+            continue;
+
+        for (const auto &u : _passes[p].usages)
+        {
+            for (uint32_t q = 0; q < p; ++q)
+            {
+                if (!_passes[q].alive || _passes[q].queue != QUEUE_GRAPHICS)
+                    continue;
+                for (const auto &w : _passes[q].usages)
+                {
+                    if (w.resource == u.resource && w.writes)
+                    {
+                        Log(std::string("#     compute pass \"") + _passes[p].name + std::string("\" reads \"")
+                            + _resources[u.resource].name + std::string("\" written by an earlier graphics pass\n"));
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+#if BUILD_ENABLE_VULKAN_DEBUG
+    const bool aliasing_ok = check_transient_aliasing();
+    assert(aliasing_ok && "transient images with disjoint lifetimes must share memory");
+    (void)aliasing_ok;
+#endif
+
+    Log("#     Allocate Transient Images\n");
+    if (!allocate_transients())
+        return false;
+
+    return true;
+}
+
+// Walk back from the resources that outlive the frame (imported or output),
+// keep the passes writing a needed resource, then what they read is needed too.
+void FrameGraph::cull_passes()
+{
+    std::vector<bool> needed(_resources.size());
+    for (size_t i = 0; i < _resources.size(); ++i)
+    {
+        needed[i] = !_resources[i].transient || _resources[i].is_output;
+    }
+
+    _culled_pass_count = 0;
+    for (size_t p = _passes.size(); p-- > 0; )
+    {
+        auto &pass = _passes[p];
+
+        pass.alive = false;
+        for (const auto &u : pass.usages)
+        {
+            if (u.writes && needed[u.resource])
+                pass.alive = true;
+        }
+
+        if (!pass.alive)
+        {
+            Log(std::string("#      cull pass \"") + pass.name + std::string("\"\n"));
+            ++_culled_pass_count;
+            continue;
+        }
+
+        for (const auto &u : pass.usages)
+        {
+            if (!u.writes || (u.access & ~WRITE_ACCESS_MASK) != 0)
+                needed[u.resource] = true;
+        }
+    }
+
+    for (auto &r : _resources)
+    {
+        r.alive = false;
+        r.first_pass = INVALID_ID;
+        r.last_pass = INVALID_ID;
+    }
+
+    for (uint32_t p = 0; p < _passes.size(); ++p)
+    {
+        if (!_passes[p].alive)
+            continue;
+
+        for (const auto &u : _passes[p].usages)
+        {
+            auto &r = _resources[u.resource];
+            r.alive = true;
+            if (r.first_pass == INVALID_ID)
+                r.first_pass = p;
+            r.last_pass = p;
+        }
+    }
+}
+
+bool FrameGraph::allocate_transients()
+{
+    VkResult result;
+
+    std::vector<resource_id_t> transients;
+    std::vector<VkMemoryRequirements> requirements(_resources.size());
+
+    for (resource_id_t id = 0; id < _resources.size(); ++id)
+    {
+        auto &r = _resources[id];
+        if (!r.transient || !r.alive)
+            continue;
+
+        VkImageCreateInfo image_create_info = {};
+        image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_create_info.imageType = VK_IMAGE_TYPE_2D;
+        image_create_info.format = r.desc.format;
+        image_create_info.extent = { r.desc.extent.width, r.desc.extent.height, 1 };
+        image_create_info.mipLevels = 1;
+        image_create_info.arrayLayers = 1;
+        image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        image_create_info.usage = r.desc.usage;
+        image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        result = vkCreateImage(_ctx->device, &image_create_info, nullptr, &r.image);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+
+        vkGetImageMemoryRequirements(_ctx->device, r.image, &requirements[id]);
+        transients.push_back(id);
+    }
+
+    place_transients(transients, requirements);
+
+    _allocated_bytes = 0;
+    for (auto &block : _blocks)
+    {
+        VkMemoryRequirements block_requirements = {};
+        block_requirements.size = block.size;
+        block_requirements.memoryTypeBits = block.memory_type_bits;
+
+        uint32_t memory_index = FindMemoryTypeIndex(&_ctx->physical_device_memory_properties, &block_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        if (memory_index == UINT32_MAX)
+        {
+            assert(!"Memory index not found to allocate transient images");
+            return false;
+        }
+
+        VkMemoryAllocateInfo memory_allocate_info = {};
+        memory_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memory_allocate_info.allocationSize = block.size;
+        memory_allocate_info.memoryTypeIndex = memory_index;
+
+        result = vkAllocateMemory(_ctx->device, &memory_allocate_info, nullptr, &block.memory);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+
+        _allocated_bytes += block.size;
+
+        for (auto id : block.images)
+        {
+            auto &r = _resources[id];
+
+            // alignment is met, every image starts at offset 0.
+            result = vkBindImageMemory(_ctx->device, r.image, block.memory, 0);
+            ErrorCheck(result);
+            if (result != VK_SUCCESS)
+                return false;
+
+            VkImageViewCreateInfo image_view_create_info = {};
+            image_view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            image_view_create_info.image = r.image;
+            image_view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            image_view_create_info.format = r.desc.format;
+            image_view_create_info.components = { VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY };
+            image_view_create_info.subresourceRange = { r.desc.aspect, 0, 1, 0, 1 };
+
+            result = vkCreateImageView(_ctx->device, &image_view_create_info, nullptr, &r.view);
+            ErrorCheck(result);
+            if (result != VK_SUCCESS)
+                return false;
+        }
+    }
+
+    Log(std::string("#      ") + std::to_string(transients.size()) + std::string(" transient images, ")
+        + std::to_string(_transient_bytes / 1024) + std::string(" KB in ")
+        + std::to_string(_blocks.size()) + std::string(" blocks of ")
+        + std::to_string(_allocated_bytes / 1024) + std::string(" KB\n"));
+
+    return true;
+}
+
+// Gives each transient a block. Only uses the lifetimes from cull_passes()
+// and the memory requirements, no Vulkan call.
+void FrameGraph::place_transients(std::vector<resource_id_t> transients, const std::vector<VkMemoryRequirements> &requirements)
+{
+    // biggest first, each one goes in the first block it fits in: compatible
+    // memory types and no lifetime overlap with the images already there.
+    std::sort(transients.begin(), transients.end(), [&](resource_id_t a, resource_id_t b) {
+        return requirements[a].size > requirements[b].size;
+    });
+
+    _transient_bytes = 0;
+    for (auto id : transients)
+    {
+        auto &r = _resources[id];
+        const auto &req = requirements[id];
+        _transient_bytes += req.size;
+
+        for (uint32_t b = 0; b < _blocks.size() && r.block == INVALID_ID; ++b)
+        {
+            auto &block = _blocks[b];
+            if ((block.memory_type_bits & req.memoryTypeBits) == 0)
+                continue;
+
+            bool overlaps = false;
+            for (auto other : block.images)
+            {
+                const auto &o = _resources[other];
+                if (r.first_pass <= o.last_pass && o.first_pass <= r.last_pass)
+                    overlaps = true;
+            }
+            if (overlaps)
+                continue;
+
+            block.memory_type_bits &= req.memoryTypeBits;
+            block.size = std::max(block.size, req.size);
+            block.images.push_back(id);
+            r.block = b;
+        }
+
+        if (r.block == INVALID_ID)
+        {
+            _block_t block = {};
+            block.memory_type_bits = req.memoryTypeBits;
+            block.size = req.size;
+            block.images.push_back(id);
+            _blocks.push_back(block);
+            r.block = (uint32_t)(_blocks.size() - 1);
+        }
+    }
+}
+
+// The scene graph has a single transient, this declares a graph where aliasing
+// must happen: "a" and "b" have disjoint lifetimes and share a block, "c"
+// overlaps both and gets its own.
+bool FrameGraph::check_transient_aliasing()
+{
+    FrameGraph fg(nullptr);
+
+    image_description_t desc = {};
+    resource_id_t a = fg.create_image("a", desc);
+    resource_id_t b = fg.create_image("b", desc);
+    resource_id_t c = fg.create_image("c", desc);
+    resource_id_t out = fg.import_image("out", VK_IMAGE_ASPECT_COLOR_BIT);
+
+    pass_id_t p0 = fg.add_pass("write a", QUEUE_GRAPHICS, nullptr);
+    fg.write(p0, a, ACCESS_COLOR_ATTACHMENT_WRITE);
+    pass_id_t p1 = fg.add_pass("a to out, write c", QUEUE_GRAPHICS, nullptr);
+    fg.read(p1, a, ACCESS_FRAGMENT_SAMPLED);
+    fg.write(p1, c, ACCESS_COLOR_ATTACHMENT_WRITE);
+    fg.write(p1, out, ACCESS_COLOR_ATTACHMENT_WRITE);
+    pass_id_t p2 = fg.add_pass("c to b", QUEUE_GRAPHICS, nullptr);
+    fg.read(p2, c, ACCESS_FRAGMENT_SAMPLED);
+    fg.write(p2, b, ACCESS_COLOR_ATTACHMENT_WRITE);
+    pass_id_t p3 = fg.add_pass("b to out", QUEUE_GRAPHICS, nullptr);
+    fg.read(p3, b, ACCESS_FRAGMENT_SAMPLED);
+    fg.write(p3, out, ACCESS_COLOR_ATTACHMENT_WRITE);
+
+    fg.cull_passes();
+
+    std::vector<VkMemoryRequirements> requirements(fg._resources.size());
+    requirements[a] = { 1024, 256, 1 };
+    requirements[b] = { 512, 256, 1 };
+    requirements[c] = { 256, 256, 1 };
+    fg.place_transients({ a, b, c }, requirements);
+
+    return fg._culled_pass_count == 0
+        && fg._blocks.size() == 2
+        && fg._resources[a].block == fg._resources[b].block
+        && fg._resources[c].block != fg._resources[a].block
+        && fg._blocks[fg._resources[a].block].size == 1024
+        && fg._transient_bytes == 1024 + 512 + 256;
+}
+
+void FrameGraph::de_init()
+{
+    if (_ctx == nullptr || _ctx->device == VK_NULL_HANDLE)
+        return;
+
+    for (auto &r : _resources)
+    {
+        if (!r.transient)
+            continue;
+        vkDestroyImageView(_ctx->device, r.view, nullptr);
+        vkDestroyImage(_ctx->device, r.image, nullptr);
+        r.view = VK_NULL_HANDLE;
+        r.image = VK_NULL_HANDLE;
+    }
+
+    for (auto &block : _blocks)
+    {
+        vkFreeMemory(_ctx->device, block.memory, nullptr);
+    }
+
+    _blocks.clear();
+    _resources.clear();
+    _passes.clear();
+}
+
+//
+// PER FRAME
+//
+
+void FrameGraph::bind_image(resource_id_t id, VkImage image, uint32_t level_count, VkImageLayout current_layout, VkPipelineStageFlags ready_stage)
+{
+    auto &r = _resources[id];
+    assert(!r.transient);
+
+    r.image = image;
+    r.level_count = level_count;
+    r.state = {};
+    r.state.layout = current_layout;
+    r.state.write_stages = (ready_stage == VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT) ? 0 : ready_stage;
+    r.state.family = _ctx->graphics.family_index; // uploads go through the graphics queue
+}
+
+void FrameGraph::bind_buffer(resource_id_t id, VkBuffer buffer, VkDeviceSize size)
+{
+    auto &r = _resources[id];
+    assert(!r.is_image && !r.transient);
+
+    r.buffer = buffer;
+    r.offset = 0;
+    r.size = size;
+    r.state = {};
+    r.state.family = _ctx->graphics.family_index; // uploads go through the graphics queue
+}
+
+void FrameGraph::set_buffer_range(resource_id_t id, VkDeviceSize offset, VkDeviceSize size)
+{
+    _resources[id].offset = offset;
+    _resources[id].size = size;
+}
+
+void FrameGraph::set_enabled(pass_id_t pass, bool enabled)
+{
+    _passes[pass].enabled = enabled;
+}
+
+uint32_t FrameGraph::family_index(queue_t queue) const
+{
+    return (queue == QUEUE_COMPUTE) ? _ctx->compute.family_index : _ctx->graphics.family_index;
+}
+
+void FrameGraph::_barriers_t::flush(VkCommandBuffer cmd)
+{
+    if (empty())
+        return;
+
+    vkCmdPipelineBarrier(cmd,
+        src_stages ? src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        dst_stages ? dst_stages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0,
+        0, nullptr,
+        (uint32_t)buffers.size(), buffers.data(),
+        (uint32_t)images.size(), images.data());
+}
+
+void FrameGraph::fill_barrier(const _resource_t &r, VkAccessFlags src_access, VkAccessFlags dst_access,
+    VkImageLayout old_layout, VkImageLayout new_layout, uint32_t src_family, uint32_t dst_family,
+    _barriers_t *barriers)
+{
+    // No memory barrier for a write after read, the stages are enough.
+    // Same family: no ownership transfer.
+    if (src_family == dst_family)
+    {
+        src_family = VK_QUEUE_FAMILY_IGNORED;
+        dst_family = VK_QUEUE_FAMILY_IGNORED;
+    }
+
+    if (r.is_image && (old_layout != new_layout || src_access != 0 || src_family != dst_family))
+    {
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = src_access;
+        barrier.dstAccessMask = dst_access;
+        barrier.oldLayout = old_layout;
+        barrier.newLayout = new_layout;
+        barrier.srcQueueFamilyIndex = src_family;
+        barrier.dstQueueFamilyIndex = dst_family;
+        barrier.image = r.image;
+        barrier.subresourceRange = { r.desc.aspect, 0, r.level_count, 0, 1 };
+        barriers->images.push_back(barrier);
+    }
+    else if (!r.is_image && (src_access != 0 || src_family != dst_family))
+    {
+        VkBufferMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = src_access;
+        barrier.dstAccessMask = dst_access;
+        barrier.srcQueueFamilyIndex = src_family;
+        barrier.dstQueueFamilyIndex = dst_family;
+        barrier.buffer = r.buffer;
+        barrier.offset = r.offset;
+        barrier.size = r.size;
+        barriers->buffers.push_back(barrier);
+    }
+}
+
+// Release on the queue that used the resource last, now. The caller adds the acquire.
+void FrameGraph::transfer_ownership(resource_id_t id, uint32_t src_family, uint32_t dst_family,
+    VkCommandBuffer release_cmd, VkPipelineStageFlags src_stages, VkAccessFlags src_access)
+{
+    auto &r = _resources[id];
+
+    _barriers_t release;
+    release.src_stages = src_stages;
+    release.dst_stages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    fill_barrier(r, src_access, 0, r.state.layout, r.state.layout, src_family, dst_family, &release);
+    release.flush(release_cmd);
+
+    r.state.released_to = dst_family;
+    ++_ownership_transfer_count;
+}
+
+void FrameGraph::transition(resource_id_t id, const _usage_t &usage, queue_t queue, uint32_t family, _barriers_t *barriers)
+{
+    auto &r = _resources[id];
+    auto &s = r.state;
+
+    if (!r.touched)
+    {
+        r.first_queue = queue;
+
+        // New frame for a transient image: its content is discarded, but the
+        // memory is still used by the last image of its block.
+        if (r.transient)
+        {
+            auto &block = _blocks[r.block];
+
+            _state_t previous = {};
+            if (block.last_user != INVALID_ID)
+                previous = _resources[block.last_user].state;
+
+            s = {};
+            if (previous.queue == (int)queue)
+            {
+                s.write_stages = previous.write_stages | previous.read_stages;
+                s.write_access = previous.write_access;
+            }
+            s.family = family;
+            block.last_user = id;
+        }
+    }
+    r.touched = true;
+
+    // Queue family ownership. Nothing to keep for an undefined content.
+    if (s.family != family && s.layout != VK_IMAGE_LAYOUT_UNDEFINED && !r.transient)
+    {
+        if (s.released_to != family)
+        {
+            if (s.released_to != VK_QUEUE_FAMILY_IGNORED)
+            {
+                // released to a queue that did not use it this frame: take it back there first.
+                queue_t other = (s.released_to == family_index(QUEUE_COMPUTE)) ? QUEUE_COMPUTE : QUEUE_GRAPHICS;
+                _barriers_t acquire;
+                acquire.src_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+                acquire.dst_stages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+                fill_barrier(r, 0, 0, s.layout, s.layout, s.family, s.released_to, &acquire);
+                acquire.flush(_cmds[other]);
+                s.family = s.released_to;
+                s.queue = other;
+            }
+
+            transfer_ownership(id, s.family, family, _cmds[s.queue], s.write_stages | s.read_stages, s.write_access);
+        }
+
+        barriers->src_stages |= VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        barriers->dst_stages |= usage.stages;
+        fill_barrier(r, 0, usage.access, s.layout, s.layout, s.family, family, barriers);
+
+        s.family = family;
+        s.released_to = VK_QUEUE_FAMILY_IGNORED;
+        // visible on this queue now, a layout transition still has to wait for the acquire.
+        s.write_stages = (r.is_image && usage.layout != s.layout) ? usage.stages : 0;
+        s.write_access = 0;
+        s.read_stages = 0;
+        s.visible_stages = usage.stages;
+        s.visible_access = usage.access;
+    }
+    s.family = family;
+    s.queue = queue;
+
+    bool layout_change = r.is_image && usage.layout != s.layout;
+
+    if (usage.writes || layout_change)
+    {
+        // write after write/read, or a layout transition: wait for every previous use.
+        VkPipelineStageFlags src_stages = s.write_stages | s.read_stages;
+        if (layout_change || src_stages != 0)
+        {
+            barriers->src_stages |= src_stages;
+            barriers->dst_stages |= usage.stages;
+            fill_barrier(r, s.write_access, usage.access, s.layout, r.is_image ? usage.layout : s.layout, family, family, barriers);
+        }
+
+        s.write_stages = usage.stages;
+        s.write_access = usage.writes ? (usage.access & WRITE_ACCESS_MASK) : 0;
+        s.read_stages = usage.writes ? 0 : usage.stages;
+        // a new write is visible to nobody, a transition is visible to its reader.
+        s.visible_stages = usage.writes ? 0 : usage.stages;
+        s.visible_access = usage.writes ? 0 : usage.access;
+        if (r.is_image)
+            s.layout = usage.layout;
+    }
+    else
+    {
+        // read after write: once per stage/access, read after read is free.
+        bool visible = (s.write_stages == 0)
+            || (((s.visible_stages & usage.stages) == usage.stages) && ((s.visible_access & usage.access) == usage.access));
+        if (!visible)
+        {
+            barriers->src_stages |= s.write_stages;
+            barriers->dst_stages |= usage.stages;
+            fill_barrier(r, s.write_access, usage.access, s.layout, s.layout, family, family, barriers);
+
+            s.visible_stages |= usage.stages;
+            s.visible_access |= usage.access;
+        }
+        s.read_stages |= usage.stages;
+    }
+}
+
+void FrameGraph::execute(const std::array<VkCommandBuffer, QUEUE_COUNT> &cmds)
+{
+    _cmds = cmds;
+    _barrier_count = 0;
+    _ownership_transfer_count = 0;
+
+    for (auto &r : _resources)
+    {
+        r.touched = false;
+        r.first_queue = -1;
+    }
+
+    _barriers_t barriers;
+    for (uint32_t p = 0; p < _passes.size(); ++p)
+    {
+        auto &pass = _passes[p];
+        if (!pass.alive || !pass.enabled)
+            continue;
+
+        barriers.clear();
+        uint32_t family = family_index(pass.queue);
+        for (const auto &u : pass.usages)
+        {
+            transition(u.resource, u, pass.queue, family, &barriers);
+        }
+
+        if (!barriers.empty())
+        {
+            barriers.flush(cmds[pass.queue]);
+            ++_barrier_count;
+        }
+
+        pass.record(cmds[pass.queue]);
+    }
+
+    for (resource_id_t id = 0; id < _resources.size(); ++id)
+    {
+        auto &r = _resources[id];
+        if (!r.touched)
+            continue;
+
+        // handed to the presentation engine (or anything after the frame).
+        if (r.is_output)
+        {
+            const auto &info = access_info(r.final_access);
+            _usage_t u = {};
+            u.resource = id;
+            u.stages = info.stages;
+            u.access = info.access;
+            u.layout = info.layout;
+            u.writes = false;
+
+            barriers.clear();
+            transition(id, u, (queue_t)r.state.queue, r.state.family, &barriers);
+            barriers.flush(cmds[r.state.queue]);
+            ++_barrier_count;
+            continue;
+        }
+
+        // next frame starts on another queue family: release it now, its last user is still recording.
+        uint32_t next_family = family_index((queue_t)r.first_queue);
+        if (!r.transient && next_family != r.state.family)
+        {
+            transfer_ownership(id, r.state.family, next_family, cmds[r.state.queue],
+                r.state.write_stages | r.state.read_stages, r.state.write_access);
+        }
+    }
+}
+
+//
+// ACCESSORS
+//
+
+FrameGraph::resource_id_t FrameGraph::find(const std::string &name) const
+{
+    for (resource_id_t id = 0; id < _resources.size(); ++id)
+    {
+        if (_resources[id].name == name)
+            return id;
+    }
+    return INVALID_ID;
+}
+
+VkImage FrameGraph::image(resource_id_t id) const
+{
+    return _resources[id].image;
+}
+
+VkImageView FrameGraph::image_view(resource_id_t id) const
+{
+    return _resources[id].view;
+}
+
+void FrameGraph::show_property_sheet()
+{
+    ImGui::Begin("Properties");
+    {
+        if (ImGui::CollapsingHeader("Frame Graph"))
+        {
+            for (const auto &pass : _passes)
+            {
+                const char *status = !pass.alive ? "culled" : (pass.enabled ? "" : "disabled");
+                ImGui::Text("%-20s %-8s %s", pass.name.c_str(), pass.queue == QUEUE_COMPUTE ? "compute" : "graphics", status);
+            }
+            ImGui::Separator();
+            ImGui::Text("Barrier batches       : %u", _barrier_count);
+            ImGui::Text("Ownership transfers   : %u", _ownership_transfer_count);
+            ImGui::Text("Transient images      : %.2f MB", _transient_bytes / (1024.0f * 1024.0f));
+            ImGui::Text("  allocated (aliased) : %.2f MB", _allocated_bytes / (1024.0f * 1024.0f));
+        }
+    }
+    ImGui::End();
+}
@@ -0,0 +1,245 @@
+#ifndef _VULKAN_FRAME_GRAPH_H_
+#define _VULKAN_FRAME_GRAPH_H_
+
+#include <stdint.h> // uint32_t
+
+#include <array>
+#include <vector>
+#include <string>
+#include <functional>
+
+struct vulkan_context;
+
+//
+// Passes declare which buffers and images they read and write, and how.
+// The graph records the passes in declaration order and puts the barriers,
+// layout transitions and queue family ownership transfers between them.
+//
+// - compile() culls the passes whose results are never used, and gives the
+//   transient images (owned by the graph) a memory block, shared between
+//   images whose lifetimes do not overlap.
+// - execute() records one frame. Resource states are kept from one frame
+//   to the next, so the first barrier of a frame waits on the last use of
+//   the previous one.
+//
+// Compute passes must be declared before the graphics passes they feed:
+// the compute command buffer is submitted first.
+//
+class FrameGraph
+{
+public:
+    FrameGraph(vulkan_context *);
+    ~FrameGraph();
+
+    using resource_id_t = uint32_t;
+    using pass_id_t = uint32_t;
+    static constexpr uint32_t INVALID_ID = UINT32_MAX;
+
+    enum queue_t
+    {
+        QUEUE_GRAPHICS = 0,
+        QUEUE_COMPUTE,
+
+        QUEUE_COUNT
+    };
+
+    // Each access is a set of pipeline stages, access flags and, for images, a layout.
+    enum access_t
+    {
+        ACCESS_INDIRECT_READ = 0,      // draw/dispatch indirect commands
+        ACCESS_VERTEX_BUFFER_READ,     // per-vertex or per-instance attributes
+        ACCESS_INDEX_BUFFER_READ,      // bound index buffer
+        ACCESS_VERTEX_SHADER_READ,     // storage buffer
+        ACCESS_FRAGMENT_SAMPLED,       // SHADER_READ_ONLY_OPTIMAL
+        ACCESS_COMPUTE_READ,           // storage buffer, or image in GENERAL
+        ACCESS_COMPUTE_SAMPLED_DEPTH,  // DEPTH_STENCIL_READ_ONLY_OPTIMAL
+        ACCESS_COMPUTE_WRITE,
+        ACCESS_COMPUTE_READ_WRITE,
+        ACCESS_TRANSFER_WRITE,
+        ACCESS_COLOR_ATTACHMENT_WRITE,
+        ACCESS_DEPTH_ATTACHMENT_WRITE,
+        ACCESS_PRESENT,
+
+        ACCESS_COUNT
+    };
+
+    struct image_description_t
+    {
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        VkExtent2D extent = { 0, 0 };
+        VkImageUsageFlags usage = 0;
+        VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+    };
+
+    //
+    // Declaration, before compile()
+    //
+
+    // Transient image, allocated by compile(). Its content does not survive the frame.
+    resource_id_t create_image(const std::string &name, const image_description_t &desc);
+    // Resources owned elsewhere, given with bind_*() before the first execute().
+    resource_id_t import_image(const std::string &name, VkImageAspectFlags aspect);
+    resource_id_t import_buffer(const std::string &name);
+
+    // The resource is consumed after the frame (presentation).
+    void set_output(resource_id_t id, access_t final_access);
+
+    pass_id_t add_pass(const std::string &name, queue_t queue, std::function<void(VkCommandBuffer)> record);
+    void read(pass_id_t pass, resource_id_t id, access_t access);
+    void write(pass_id_t pass, resource_id_t id, access_t access);
+
+    bool compile();
+    void de_init();
+
+    //
+    // Per frame
+    //
+
+    // ready_stage: first stage allowed to touch the image, e.g. the wait stage
+    // of the acquire semaphore for a swapchain image. Resets the tracked state.
+    void bind_image(resource_id_t id, VkImage image, uint32_t level_count, VkImageLayout current_layout,
+        VkPipelineStageFlags ready_stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    void bind_buffer(resource_id_t id, VkBuffer buffer, VkDeviceSize size = VK_WHOLE_SIZE);
+    // Part of the buffer touched this frame, the barriers only cover it.
+    void set_buffer_range(resource_id_t id, VkDeviceSize offset, VkDeviceSize size);
+
+    // A disabled pass is skipped, as if it was not declared.
+    void set_enabled(pass_id_t pass, bool enabled);
+
+    // Both command buffers are open. The compute one must be submitted first.
+    void execute(const std::array<VkCommandBuffer, QUEUE_COUNT> &cmds);
+
+    resource_id_t find(const std::string &name) const;
+    VkImage image(resource_id_t id) const;
+    VkImageView image_view(resource_id_t id) const; // transient images only
+
+    void show_property_sheet();
+
+private:
+
+    struct _access_info_t
+    {
+        VkPipelineStageFlags stages;
+        VkAccessFlags access;
+        VkImageLayout layout;
+        bool writes;
+    };
+    static const _access_info_t &access_info(access_t access);
+
+    // What happened to a resource since its last write.
+    struct _state_t
+    {
+        VkPipelineStageFlags write_stages = 0;
+        VkAccessFlags        write_access = 0;
+        VkPipelineStageFlags read_stages = 0;
+        VkPipelineStageFlags visible_stages = 0; // the last write is visible to these
+        VkAccessFlags        visible_access = 0;
+        VkImageLayout        layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        uint32_t             family = VK_QUEUE_FAMILY_IGNORED; // owner, for exclusive sharing
+        uint32_t             released_to = VK_QUEUE_FAMILY_IGNORED; // release done, acquire pending
+        int                  queue = -1; // queue_t of the last use
+    };
+
+    struct _resource_t
+    {
+        std::string name;
+        bool is_image = false;
+        bool transient = false;
+        bool alive = false;
+
+        // images
+        image_description_t desc;
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE; // transient only
+        uint32_t level_count = 1;
+        uint32_t block = INVALID_ID;       // transient only, index in _blocks
+        uint32_t first_pass = INVALID_ID;  // lifetime, transient only
+        uint32_t last_pass = INVALID_ID;
+
+        // buffers
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = VK_WHOLE_SIZE;
+
+        bool is_output = false;
+        access_t final_access = ACCESS_PRESENT;
+
+        _state_t state;
+        bool touched = false; // used in the current frame
+        int first_queue = -1; // queue_t of the first use in the current frame
+    };
+
+    struct _usage_t
+    {
+        resource_id_t resource;
+        VkPipelineStageFlags stages;
+        VkAccessFlags access;
+        VkImageLayout layout;
+        bool writes;
+    };
+
+    struct _pass_t
+    {
+        std::string name;
+        queue_t queue = QUEUE_GRAPHICS;
+        std::function<void(VkCommandBuffer)> record;
+        std::vector<_usage_t> usages;
+        bool alive = false;   // not culled
+        bool enabled = true;  // set each frame
+    };
+
+    // Memory shared by transient images with disjoint lifetimes, all bound at offset 0.
+    struct _block_t
+    {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        uint32_t memory_type_bits = UINT32_MAX;
+        std::vector<resource_id_t> images;
+        resource_id_t last_user = INVALID_ID; // during execute()
+    };
+
+    void add_usage(pass_id_t pass, resource_id_t id, access_t access, bool writes);
+    void cull_passes();
+    bool allocate_transients();
+    void place_transients(std::vector<resource_id_t> transients, const std::vector<VkMemoryRequirements> &requirements);
+    static bool check_transient_aliasing(); // self-check of the placement, debug builds
+
+    struct _barriers_t
+    {
+        VkPipelineStageFlags src_stages = 0;
+        VkPipelineStageFlags dst_stages = 0;
+        std::vector<VkBufferMemoryBarrier> buffers;
+        std::vector<VkImageMemoryBarrier> images;
+
+        bool empty() const { return src_stages == 0 && dst_stages == 0; }
+        void clear() { src_stages = 0; dst_stages = 0; buffers.clear(); images.clear(); }
+        void flush(VkCommandBuffer cmd);
+    };
+
+    void transition(resource_id_t id, const _usage_t &usage, queue_t queue, uint32_t family, _barriers_t *barriers);
+    void transfer_ownership(resource_id_t id, uint32_t src_family, uint32_t dst_family,
+        VkCommandBuffer release_cmd, VkPipelineStageFlags src_stages, VkAccessFlags src_access);
+    void fill_barrier(const _resource_t &r, VkAccessFlags src_access, VkAccessFlags dst_access,
+        VkImageLayout old_layout, VkImageLayout new_layout, uint32_t src_family, uint32_t dst_family,
+        _barriers_t *barriers);
+    uint32_t family_index(queue_t queue) const;
+
+private:
+
+    vulkan_context * _ctx = nullptr;
+
+    std::vector<_resource_t> _resources;
+    std::vector<_pass_t> _passes;
+    std::vector<_block_t> _blocks;
+
+    std::array<VkCommandBuffer, QUEUE_COUNT> _cmds = {}; // during execute()
+
+    // stats
+    VkDeviceSize _transient_bytes = 0; // without aliasing
+    VkDeviceSize _allocated_bytes = 0;
+    uint32_t _culled_pass_count = 0;
+    uint32_t _barrier_count = 0; // last frame
+    uint32_t _ownership_transfer_count = 0;
+};
+
+#endif // _VULKAN_FRAME_GRAPH_H_
@@ -6,5 +6,6 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp> // glm::perspective
 #include <glm/gtc/type_ptr.hpp> // glm::value_ptr
+#include <glm/gtc/quaternion.hpp> // glm::quat
 
 #endif // _GLM_USAGE_2018_26_07_H_
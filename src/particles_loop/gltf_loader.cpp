@@ -0,0 +1,907 @@
+#include "build_options.h"
+#include "platform.h"
+#include "gltf_loader.h"
+#include "mesh_optimizer.h" // optimize_mesh
+#include "scene.h"
+#include "utils.h" // mapped_file, IndexList
+#include "Shared.h" // Log
+
+#include <math.h>
+#include <stdlib.h> // strtod
+#include <string.h> // memcpy
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <vector>
+
+#define GLB_MAGIC       0x46546C67 // "glTF"
+#define GLB_CHUNK_JSON  0x4E4F534A
+#define GLB_CHUNK_BIN   0x004E4942
+
+#define GLTF_BYTE           5120
+#define GLTF_UNSIGNED_BYTE  5121
+#define GLTF_SHORT          5122
+#define GLTF_UNSIGNED_SHORT 5123
+#define GLTF_UNSIGNED_INT   5125
+#define GLTF_FLOAT          5126
+
+#define GLTF_TRIANGLES 4
+
+#define MAX_NODE_DEPTH 256
+
+namespace
+{
+    //
+    // JSON, just enough for glTF
+    //
+
+    struct json_value
+    {
+        enum type_t { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+        type_t type = JSON_NULL;
+        bool boolean = false;
+        double number = 0.0;
+        std::string string;
+        std::vector<json_value> elements;                        // array
+        std::vector<std::pair<std::string, json_value>> members; // object
+
+        // a null value when missing
+        const json_value &operator[](const std::string &key) const
+        {
+            for (const auto &m : members)
+                if (m.first == key)
+                    return m.second;
+            return null_value();
+        }
+        const json_value &operator[](size_t i) const { return i < elements.size() ? elements[i] : null_value(); }
+
+        bool is_null() const { return type == JSON_NULL; }
+        size_t size() const { return elements.size(); }
+        double as_number(double fallback = 0.0) const { return type == JSON_NUMBER ? number : fallback; }
+        int64_t as_index() const { return type == JSON_NUMBER && number >= 0.0 ? (int64_t)number : -1; } // -1 = none
+        bool as_bool(bool fallback = false) const { return type == JSON_BOOL ? boolean : fallback; }
+        const std::string &as_string() const { return string; }
+
+        static const json_value &null_value()
+        {
+            static const json_value null;
+            return null;
+        }
+    };
+
+    class json_parser
+    {
+    public:
+        json_parser(const char *begin, const char *end) : _p(begin), _end(end) {}
+
+        bool parse(json_value *value)
+        {
+            if (!parse_value(value, 0))
+                return false;
+            skip_spaces();
+            return _p == _end || *_p == '\0'; // GLB pads the chunk with spaces
+        }
+
+    private:
+        void skip_spaces()
+        {
+            while (_p < _end && (*_p == ' ' || *_p == '\t' || *_p == '\n' || *_p == '\r'))
+                ++_p;
+        }
+
+        bool expect(char c)
+        {
+            skip_spaces();
+            if (_p == _end || *_p != c)
+                return false;
+            ++_p;
+            return true;
+        }
+
+        bool literal(const char *word)
+        {
+            size_t n = strlen(word);
+            if ((size_t)(_end - _p) < n || strncmp(_p, word, n) != 0)
+                return false;
+            _p += n;
+            return true;
+        }
+
+        bool parse_value(json_value *value, int depth)
+        {
+            skip_spaces();
+            if (_p == _end || depth > MAX_NODE_DEPTH)
+                return false;
+
+            switch (*_p)
+            {
+            case '{':
+            {
+                value->type = json_value::JSON_OBJECT;
+                ++_p;
+                if (expect('}'))
+                    return true;
+                do
+                {
+                    std::pair<std::string, json_value> member;
+                    skip_spaces();
+                    if (!parse_string(&member.first) || !expect(':') || !parse_value(&member.second, depth + 1))
+                        return false;
+                    value->members.push_back(std::move(member));
+                } while (expect(','));
+                return expect('}');
+            }
+            case '[':
+            {
+                value->type = json_value::JSON_ARRAY;
+                ++_p;
+                if (expect(']'))
+                    return true;
+                do
+                {
+                    value->elements.emplace_back();
+                    if (!parse_value(&value->elements.back(), depth + 1))
+                        return false;
+                } while (expect(','));
+                return expect(']');
+            }
+            case '"':
+                value->type = json_value::JSON_STRING;
+                return parse_string(&value->string);
+            case 't':
+                value->type = json_value::JSON_BOOL;
+                value->boolean = true;
+                return literal("true");
+            case 'f':
+                value->type = json_value::JSON_BOOL;
+                return literal("false");
+            case 'n':
+                return literal("null");
+            default:
+                value->type = json_value::JSON_NUMBER;
+                return parse_number(&value->number);
+            }
+        }
+
+        bool parse_number(double *number)
+        {
+            // the chunk is not 0 terminated, strtod gets a copy.
+            char token[64];
+            size_t n = 0;
+            while (_p < _end && n + 1 < sizeof(token) && *_p != '\0' && strchr("+-0123456789.eE", *_p))
+                token[n++] = *_p++;
+            token[n] = '\0';
+
+            char *token_end = nullptr;
+            *number = strtod(token, &token_end);
+            return n > 0 && token_end == token + n;
+        }
+
+        static void append_utf8(std::string *s, uint32_t c)
+        {
+            if (c < 0x80)
+                s->push_back((char)c);
+            else if (c < 0x800)
+            {
+                s->push_back((char)(0xC0 | (c >> 6)));
+                s->push_back((char)(0x80 | (c & 0x3F)));
+            }
+            else if (c < 0x10000)
+            {
+                s->push_back((char)(0xE0 | (c >> 12)));
+                s->push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+                s->push_back((char)(0x80 | (c & 0x3F)));
+            }
+            else
+            {
+                s->push_back((char)(0xF0 | (c >> 18)));
+                s->push_back((char)(0x80 | ((c >> 12) & 0x3F)));
+                s->push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+                s->push_back((char)(0x80 | (c & 0x3F)));
+            }
+        }
+
+        bool parse_hex4(uint32_t *c)
+        {
+            if (_end - _p < 4)
+                return false;
+            *c = 0;
+            for (int i = 0; i < 4; ++i, ++_p)
+            {
+                char h = *_p;
+                uint32_t digit = (h >= '0' && h <= '9') ? h - '0'
+                    : (h >= 'a' && h <= 'f') ? h - 'a' + 10
+                    : (h >= 'A' && h <= 'F') ? h - 'A' + 10 : 16;
+                if (digit == 16)
+                    return false;
+                *c = (*c << 4) | digit;
+            }
+            return true;
+        }
+
+        bool parse_string(std::string *s)
+        {
+            if (_p == _end || *_p != '"')
+                return false;
+
+            for (++_p; _p < _end; ++_p)
+            {
+                char c = *_p;
+                if (c == '"')
+                {
+                    ++_p;
+                    return true;
+                }
+                if (c != '\\')
+                {
+                    s->push_back(c);
+                    continue;
+                }
+
+                if (++_p == _end)
+                    return false;
+                switch (*_p)
+                {
+                case '"': s->push_back('"'); break;
+                case '\\': s->push_back('\\'); break;
+                case '/': s->push_back('/'); break;
+                case 'b': s->push_back('\b'); break;
+                case 'f': s->push_back('\f'); break;
+                case 'n': s->push_back('\n'); break;
+                case 'r': s->push_back('\r'); break;
+                case 't': s->push_back('\t'); break;
+                case 'u':
+                {
+                    uint32_t code = 0;
+                    ++_p;
+                    if (!parse_hex4(&code))
+                        return false;
+                    // surrogate pair
+                    if (code >= 0xD800 && code < 0xDC00 && _end - _p >= 6 && _p[0] == '\\' && _p[1] == 'u')
+                    {
+                        uint32_t low = 0;
+                        _p += 2;
+                        if (!parse_hex4(&low))
+                            return false;
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    append_utf8(s, code);
+                    --_p; // the loop steps over the last digit
+                    break;
+                }
+                default:
+                    return false;
+                }
+            }
+            return false;
+        }
+
+        const char *_p;
+        const char *_end;
+    };
+
+    //
+    // Buffers, mapped or decoded
+    //
+
+    struct gltf_buffer_t
+    {
+        const uint8_t *data = nullptr;
+        size_t size = 0;
+        utils::mapped_file file;      // .glb or .bin
+        std::vector<uint8_t> decoded; // data URI
+
+        gltf_buffer_t() = default;
+        gltf_buffer_t(const gltf_buffer_t &) = delete;
+        ~gltf_buffer_t() { utils::unmap_file(&file); }
+    };
+
+    bool decode_base64(const char *p, const char *end, std::vector<uint8_t> *out)
+    {
+        uint32_t bits = 0;
+        int bit_count = 0;
+        out->reserve((end - p) * 3 / 4);
+        for (; p < end && *p != '='; ++p)
+        {
+            char c = *p;
+            uint32_t v = (c >= 'A' && c <= 'Z') ? c - 'A'
+                : (c >= 'a' && c <= 'z') ? c - 'a' + 26
+                : (c >= '0' && c <= '9') ? c - '0' + 52
+                : c == '+' ? 62 : c == '/' ? 63 : 64;
+            if (v == 64)
+                return false;
+            bits = (bits << 6) | v;
+            bit_count += 6;
+            if (bit_count >= 8)
+            {
+                bit_count -= 8;
+                out->push_back((uint8_t)(bits >> bit_count));
+            }
+        }
+        return true;
+    }
+
+    // %XX escapes of relative URIs.
+    std::string decode_uri(const std::string &uri)
+    {
+        std::string path;
+        for (size_t i = 0; i < uri.size(); ++i)
+        {
+            if (uri[i] == '%' && i + 2 < uri.size())
+            {
+                path.push_back((char)strtol(uri.substr(i + 1, 2).c_str(), nullptr, 16));
+                i += 2;
+            }
+            else
+                path.push_back(uri[i]);
+        }
+        return path;
+    }
+
+    bool load_buffer(const json_value &buffer, const std::string &directory, gltf_buffer_t *out)
+    {
+        const std::string &uri = buffer["uri"].as_string();
+        size_t declared_size = (size_t)buffer["byteLength"].as_number();
+
+        if (uri.compare(0, 5, "data:") == 0)
+        {
+            size_t comma = uri.find(";base64,");
+            if (comma == std::string::npos
+                || !decode_base64(uri.data() + comma + 8, uri.data() + uri.size(), &out->decoded))
+            {
+                Log("#      Unsupported data URI\n");
+                return false;
+            }
+            out->data = out->decoded.data();
+            out->size = out->decoded.size();
+        }
+        else
+        {
+            if (!utils::map_file(directory + decode_uri(uri), &out->file))
+                return false;
+            out->data = (const uint8_t*)out->file.data;
+            out->size = out->file.size;
+        }
+
+        if (out->size < declared_size)
+        {
+            Log("#      Buffer smaller than its byteLength\n");
+            return false;
+        }
+        return true;
+    }
+
+    //
+    // Accessors, read in place
+    //
+
+    struct accessor_t
+    {
+        const uint8_t *data = nullptr; // first element
+        uint32_t count = 0;
+        uint32_t stride = 0;
+        uint32_t component_type = 0;
+        uint32_t component_count = 0;
+        bool normalized = false;
+    };
+
+    uint32_t component_size(uint32_t type)
+    {
+        switch (type)
+        {
+        case GLTF_BYTE: case GLTF_UNSIGNED_BYTE: return 1;
+        case GLTF_SHORT: case GLTF_UNSIGNED_SHORT: return 2;
+        case GLTF_UNSIGNED_INT: case GLTF_FLOAT: return 4;
+        default: return 0;
+        }
+    }
+
+    uint32_t component_count(const std::string &type)
+    {
+        if (type == "SCALAR") return 1;
+        if (type == "VEC2") return 2;
+        if (type == "VEC3") return 3;
+        if (type == "VEC4") return 4;
+        return 0; // matrices are not vertex data
+    }
+
+    bool get_accessor(const json_value &gltf, const std::vector<std::unique_ptr<gltf_buffer_t>> &buffers, int64_t index, accessor_t *a)
+    {
+        const json_value &accessor = gltf["accessors"][(size_t)index];
+        const json_value &view = gltf["bufferViews"][(size_t)accessor["bufferView"].as_index()];
+        int64_t buffer_index = view["buffer"].as_index();
+        if (index < 0 || accessor.is_null() || view.is_null() || !accessor["sparse"].is_null()
+            || buffer_index < 0 || buffer_index >= (int64_t)buffers.size())
+            return false;
+
+        a->count = (uint32_t)accessor["count"].as_number();
+        a->component_type = (uint32_t)accessor["componentType"].as_number();
+        a->component_count = component_count(accessor["type"].as_string());
+        a->normalized = accessor["normalized"].as_bool();
+
+        uint32_t element_size = component_size(a->component_type) * a->component_count;
+        a->stride = (uint32_t)view["byteStride"].as_number(element_size);
+        if (element_size == 0 || a->stride < element_size)
+            return false;
+
+        // all the elements within the view, the view within the buffer.
+        const gltf_buffer_t &buffer = *buffers[(size_t)buffer_index];
+        uint64_t view_offset = (uint64_t)view["byteOffset"].as_number();
+        uint64_t view_length = (uint64_t)view["byteLength"].as_number();
+        uint64_t offset = (uint64_t)accessor["byteOffset"].as_number();
+        uint64_t last = a->count > 0 ? offset + (uint64_t)a->stride * (a->count - 1) + element_size : 0;
+        if (view_offset + view_length > buffer.size || last > view_length)
+            return false;
+
+        a->data = buffer.data + view_offset + offset;
+        return true;
+    }
+
+    inline float read_component(const uint8_t *p, uint32_t type, bool normalized)
+    {
+        switch (type)
+        {
+        case GLTF_FLOAT: { float f; memcpy(&f, p, 4); return f; }
+        case GLTF_UNSIGNED_BYTE: return normalized ? *p / 255.0f : (float)*p;
+        case GLTF_BYTE: { int8_t v = (int8_t)*p; return normalized ? std::max(v / 127.0f, -1.0f) : (float)v; }
+        case GLTF_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, p, 2); return normalized ? v / 65535.0f : (float)v; }
+        case GLTF_SHORT: { int16_t v; memcpy(&v, p, 2); return normalized ? std::max(v / 32767.0f, -1.0f) : (float)v; }
+        case GLTF_UNSIGNED_INT: { uint32_t v; memcpy(&v, p, 4); return (float)v; }
+        default: return 0.0f;
+        }
+    }
+
+    // the first n components of element i, 0 past the accessor ones.
+    inline void read_floats(const accessor_t &a, uint32_t i, float *out, uint32_t n)
+    {
+        const uint8_t *p = a.data + (size_t)a.stride * i;
+        if (a.component_type == GLTF_FLOAT && a.component_count >= n)
+        {
+            memcpy(out, p, n * sizeof(float));
+            return;
+        }
+        uint32_t size = component_size(a.component_type);
+        for (uint32_t c = 0; c < n; ++c)
+            out[c] = c < a.component_count ? read_component(p + c * size, a.component_type, a.normalized) : 0.0f;
+    }
+
+    inline uint32_t read_index(const accessor_t &a, uint32_t i)
+    {
+        const uint8_t *p = a.data + (size_t)a.stride * i;
+        switch (a.component_type)
+        {
+        case GLTF_UNSIGNED_BYTE: return *p;
+        case GLTF_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, p, 2); return v; }
+        default: { uint32_t v; memcpy(&v, p, 4); return v; }
+        }
+    }
+
+    glm::vec4 read_vec4(const json_value &v, glm::vec4 fallback)
+    {
+        return v.size() == 4
+            ? glm::vec4(v[0].as_number(), v[1].as_number(), v[2].as_number(), v[3].as_number())
+            : fallback;
+    }
+
+    glm::mat4 local_matrix(const json_value &node)
+    {
+        const json_value &m = node["matrix"];
+        if (m.size() == 16)
+        {
+            glm::mat4 matrix;
+            for (int c = 0; c < 4; ++c)
+                for (int r = 0; r < 4; ++r)
+                    matrix[c][r] = (float)m[c * 4 + r].as_number();
+            return matrix;
+        }
+
+        const json_value &t = node["translation"];
+        const json_value &r = node["rotation"];
+        const json_value &s = node["scale"];
+        glm::vec3 translation = t.size() == 3 ? glm::vec3(t[0].as_number(), t[1].as_number(), t[2].as_number()) : glm::vec3(0.0f);
+        glm::quat rotation = r.size() == 4 ? glm::quat((float)r[3].as_number(), (float)r[0].as_number(), (float)r[1].as_number(), (float)r[2].as_number()) : glm::quat(1, 0, 0, 0);
+        glm::vec3 scale = s.size() == 3 ? glm::vec3(s[0].as_number(), s[1].as_number(), s[2].as_number()) : glm::vec3(1.0f);
+
+        return glm::translate(glm::mat4(1.0f), translation) * glm::mat4_cast(rotation) * glm::scale(glm::mat4(1.0f), scale);
+    }
+
+    // To the position/rotation/scale of an object, without shear.
+    void decompose(const glm::mat4 &m, Scene::object_description_t *desc)
+    {
+        glm::vec3 axes[3] = { glm::vec3(m[0]), glm::vec3(m[1]), glm::vec3(m[2]) };
+        glm::vec3 scale(glm::length(axes[0]), glm::length(axes[1]), glm::length(axes[2]));
+        if (glm::dot(glm::cross(axes[0], axes[1]), axes[2]) < 0.0f)
+            scale.x = -scale.x; // mirrored
+
+        glm::mat3 rotation(1.0f);
+        for (int c = 0; c < 3; ++c)
+        {
+            if (scale[c] != 0.0f)
+                rotation[c] = axes[c] / scale[c];
+        }
+
+        desc->position = glm::vec3(m[3]);
+        desc->rotation = glm::normalize(glm::quat_cast(rotation));
+        desc->scale = scale;
+    }
+
+    float ms_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    //
+    // The file
+    //
+
+    class gltf_importer
+    {
+    public:
+        gltf_importer(Scene *scene, const std::string &prefix, gltf_load_stats_t *stats)
+            : _scene(scene), _prefix(prefix), _stats(stats) {}
+
+        bool load(const std::string &file_path, const glm::mat4 &root)
+        {
+            if (!utils::map_file(file_path, &_file))
+                return false;
+
+            size_t slash = file_path.find_last_of("/\\");
+            std::string directory = slash == std::string::npos ? "" : file_path.substr(0, slash + 1);
+            _directory = directory;
+
+            const char *json_begin = _file.data;
+            const char *json_end = _file.data + _file.size;
+            const uint8_t *bin = nullptr;
+            size_t bin_size = 0;
+            if (!split_glb(&json_begin, &json_end, &bin, &bin_size))
+                return false;
+
+            if (!json_parser(json_begin, json_end).parse(&_gltf))
+            {
+                Log("#      Invalid JSON\n");
+                return false;
+            }
+            if (_gltf["asset"]["version"].as_string().compare(0, 2, "2.") != 0)
+            {
+                Log("#      Not glTF 2.x\n");
+                return false;
+            }
+
+            const json_value &buffers = _gltf["buffers"];
+            for (size_t b = 0; b < buffers.size(); ++b)
+            {
+                _buffers.emplace_back(new gltf_buffer_t());
+                gltf_buffer_t &buffer = *_buffers.back();
+                if (b == 0 && bin && buffers[b]["uri"].is_null())
+                {
+                    // the GLB binary chunk, in the mapping of the file.
+                    buffer.data = bin;
+                    buffer.size = bin_size;
+                }
+                else if (!load_buffer(buffers[b], directory, &buffer))
+                    return false;
+            }
+
+            add_materials();
+
+            int64_t scene_index = std::max<int64_t>(_gltf["scene"].as_index(), 0);
+            const json_value &roots = _gltf["scenes"][(size_t)scene_index]["nodes"];
+            for (size_t n = 0; n < roots.size(); ++n)
+            {
+                if (!add_node(roots[n].as_index(), root, 0))
+                    return false;
+            }
+
+            return true;
+        }
+
+        ~gltf_importer()
+        {
+            _buffers.clear(); // before the mapping of the GLB
+            utils::unmap_file(&_file);
+        }
+
+    private:
+        bool split_glb(const char **json_begin, const char **json_end, const uint8_t **bin, size_t *bin_size)
+        {
+            uint32_t header[5];
+            if (_file.size < sizeof(header))
+                return true;
+            memcpy(header, _file.data, sizeof(header));
+            if (header[0] != GLB_MAGIC)
+                return true; // .gltf
+
+            // magic, version, length, then the chunks: length, type, data.
+            if (header[1] != 2 || header[2] > _file.size || header[4] != GLB_CHUNK_JSON || 20 + (uint64_t)header[3] > header[2])
+            {
+                Log("#      Invalid GLB header\n");
+                return false;
+            }
+            *json_begin = _file.data + 20;
+            *json_end = *json_begin + header[3];
+
+            size_t bin_offset = 20 + ((header[3] + 3) & ~3u);
+            if (bin_offset + 8 <= header[2])
+            {
+                uint32_t chunk[2];
+                memcpy(chunk, _file.data + bin_offset, sizeof(chunk));
+                if (chunk[1] == GLB_CHUNK_BIN && bin_offset + 8 + (uint64_t)chunk[0] <= header[2])
+                {
+                    *bin = (const uint8_t*)_file.data + bin_offset + 8;
+                    *bin_size = chunk[0];
+                }
+            }
+            return true;
+        }
+
+        void add_materials()
+        {
+            const json_value &materials = _gltf["materials"];
+            for (size_t m = 0; m < materials.size(); ++m)
+            {
+                Scene::material_instance_description_t mi = {};
+                mi.instance_id = _prefix + "/" + std::to_string(m) + ":" + materials[m]["name"].as_string();
+                mi.pipeline_id = "default";
+                // white and 1: the object overrides are the factors.
+                mi.base_tex = "neutral_base";
+                mi.specular_tex = "neutral_metal_spec";
+
+                std::string base_tex;
+                if (load_image(materials[m]["pbrMetallicRoughness"]["baseColorTexture"]["index"].as_index(), &base_tex))
+                    mi.base_tex = base_tex;
+
+                _material_ids.push_back(_scene->add_material_instance(mi) ? mi.instance_id : std::string());
+                _stats->material_count += _material_ids.back().empty() ? 0 : 1;
+            }
+        }
+
+        // Decoded by the texture loader of the scene, from the file or from a
+        // copy of the buffer view: the buffers are unmapped before it is done.
+        bool load_image(int64_t texture, std::string *texture_id)
+        {
+            int64_t source = _gltf["textures"][(size_t)texture]["source"].as_index();
+            const json_value &image = _gltf["images"][(size_t)source];
+            if (texture < 0 || source < 0 || image.is_null())
+                return false;
+
+            *texture_id = _prefix + "/image/" + std::to_string(source);
+
+            const std::string &uri = image["uri"].as_string();
+            if (uri.compare(0, 5, "data:") == 0)
+            {
+                std::vector<uint8_t> data;
+                size_t comma = uri.find(";base64,");
+                if (comma == std::string::npos
+                    || !decode_base64(uri.data() + comma + 8, uri.data() + uri.size(), &data))
+                    return false;
+                return _scene->load_texture(*texture_id, std::move(data), "neutral_base", true);
+            }
+            if (!uri.empty())
+                return _scene->load_texture(*texture_id, _directory + decode_uri(uri), "neutral_base", true);
+
+            const json_value &view = _gltf["bufferViews"][(size_t)image["bufferView"].as_index()];
+            int64_t buffer_index = view["buffer"].as_index();
+            if (view.is_null() || buffer_index < 0 || buffer_index >= (int64_t)_buffers.size())
+                return false;
+
+            size_t offset = (size_t)view["byteOffset"].as_number(0);
+            size_t length = (size_t)view["byteLength"].as_number();
+            const gltf_buffer_t &buffer = *_buffers[(size_t)buffer_index];
+            if (offset + length > buffer.size)
+                return false;
+            return _scene->load_texture(*texture_id, std::vector<uint8_t>(buffer.data + offset, buffer.data + offset + length), "neutral_base", true);
+        }
+
+        void set_material(int64_t material, Scene::object_description_t *desc)
+        {
+            // the default material of glTF: white, fully metallic and rough.
+            const json_value &pbr = _gltf["materials"][(size_t)std::max<int64_t>(material, 0)]["pbrMetallicRoughness"];
+            glm::vec4 base = material >= 0 ? read_vec4(pbr["baseColorFactor"], glm::vec4(1.0f)) : glm::vec4(1.0f);
+            float metallic = material >= 0 ? (float)pbr["metallicFactor"].as_number(1.0) : 1.0f;
+            float roughness = material >= 0 ? (float)pbr["roughnessFactor"].as_number(1.0) : 1.0f;
+
+            if (material >= 0 && material < (int64_t)_material_ids.size() && !_material_ids[(size_t)material].empty())
+                desc->material = _material_ids[(size_t)material];
+
+            // glTF factors are linear, the shader takes the override as sRGB.
+            desc->base_color = glm::vec4(powf(base.x, 1.0f / 2.2f), powf(base.y, 1.0f / 2.2f), powf(base.z, 1.0f / 2.2f), base.w);
+            desc->specular = glm::vec4(roughness, metallic, 0.5f, 0.0f);
+        }
+
+        bool add_node(int64_t node_index, const glm::mat4 &parent, int depth)
+        {
+            const json_value &node = _gltf["nodes"][(size_t)std::max<int64_t>(node_index, 0)];
+            if (node_index < 0 || node.is_null() || depth > MAX_NODE_DEPTH)
+            {
+                Log("#      Invalid node hierarchy\n");
+                return false;
+            }
+
+            glm::mat4 world = parent * local_matrix(node);
+
+            int64_t mesh_index = node["mesh"].as_index();
+            const json_value &primitives = _gltf["meshes"][(size_t)std::max<int64_t>(mesh_index, 0)]["primitives"];
+            for (size_t p = 0; mesh_index >= 0 && p < primitives.size(); ++p)
+            {
+                std::string name = _prefix + "/" + std::to_string(node_index) + ":" + node["name"].as_string() + "/" + std::to_string(p);
+                if (!add_primitive(primitives[p], std::make_pair(mesh_index, (int64_t)p), name, world))
+                    ++_stats->skipped_primitive_count;
+            }
+
+            const json_value &children = node["children"];
+            for (size_t c = 0; c < children.size(); ++c)
+            {
+                if (!add_node(children[c].as_index(), world, depth + 1))
+                    return false;
+            }
+            return true;
+        }
+
+        bool add_primitive(const json_value &primitive, std::pair<int64_t, int64_t> key, const std::string &name, const glm::mat4 &world)
+        {
+            if (primitive["mode"].as_number(GLTF_TRIANGLES) != GLTF_TRIANGLES)
+                return false;
+
+            Scene::object_description_t desc = {};
+            desc.name = name;
+            decompose(world, &desc);
+            set_material(primitive["material"].as_index(), &desc);
+
+            auto shared = _geometries.find(key);
+            if (shared != _geometries.end())
+            {
+                desc.geometry = shared->second;
+                if (!_scene->add_object_to_global_instance_set(desc))
+                    return false;
+                ++_stats->object_count;
+                return true;
+            }
+
+            const json_value &attributes = primitive["attributes"];
+            accessor_t positions, normals, uvs, indices;
+            if (!get_accessor(_gltf, _buffers, attributes["POSITION"].as_index(), &positions) || positions.component_count != 3)
+                return false;
+            bool has_normals = get_accessor(_gltf, _buffers, attributes["NORMAL"].as_index(), &normals) && normals.count == positions.count;
+            bool has_uvs = get_accessor(_gltf, _buffers, attributes["TEXCOORD_0"].as_index(), &uvs) && uvs.count == positions.count;
+            bool has_indices = !primitive["indices"].is_null();
+            if (has_indices && (!get_accessor(_gltf, _buffers, primitive["indices"].as_index(), &indices)
+                || indices.component_count != 1 || (indices.component_type != GLTF_UNSIGNED_BYTE
+                    && indices.component_type != GLTF_UNSIGNED_SHORT && indices.component_type != GLTF_UNSIGNED_INT)))
+                return false;
+
+            uint32_t vertex_count = positions.count;
+            uint32_t index_count = has_indices ? indices.count : vertex_count;
+            if (index_count % 3 != 0)
+                return false;
+
+            // the only copy: the indices are reordered, the vertices are read in fetch order.
+            IndexList order(index_count);
+            for (uint32_t i = 0; i < index_count; ++i)
+            {
+                order[i] = has_indices ? read_index(indices, i) : i;
+                if (order[i] >= vertex_count)
+                    return false;
+            }
+
+            // glTF asks for flat normals when there are none, smooth ones
+            // are close enough and keep the vertices shared.
+            std::vector<glm::vec3> computed_normals;
+            if (!has_normals)
+            {
+                computed_normals.assign(vertex_count, glm::vec3(0.0f));
+                for (uint32_t t = 0; t < index_count; t += 3)
+                {
+                    uint32_t v[3];
+                    glm::vec3 p[3];
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        v[k] = order[t + k];
+                        read_floats(positions, v[k], &p[k].x, 3);
+                    }
+                    glm::vec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+                    for (int k = 0; k < 3; ++k)
+                        computed_normals[v[k]] += n;
+                }
+            }
+
+            // POSITION min/max are mandatory, the radius around the origin of the mesh.
+            const json_value &accessor = _gltf["accessors"][(size_t)attributes["POSITION"].as_index()];
+            const json_value &min = accessor["min"];
+            const json_value &max = accessor["max"];
+            if (min.size() == 3 && max.size() == 3)
+            {
+                glm::vec3 extent(0.0f);
+                for (int c = 0; c < 3; ++c)
+                    extent[c] = (float)std::max(fabs(min[c].as_number()), fabs(max[c].as_number()));
+                desc.bounding_radius = glm::length(extent);
+            }
+            else
+            {
+                for (uint32_t v = 0; v < vertex_count; ++v)
+                {
+                    glm::vec3 p;
+                    read_floats(positions, v, &p.x, 3);
+                    desc.bounding_radius = std::max(desc.bounding_radius, glm::length(p));
+                }
+            }
+
+            IndexList fetch_order;
+            mesh_optimize_stats_t optimize_stats;
+            optimize_mesh(&order, vertex_count, [&](Scene::index_t v) {
+                glm::vec3 p;
+                read_floats(positions, v, &p.x, 3);
+                return p;
+            }, &fetch_order, name, &optimize_stats);
+            _stats->optimize_ms += optimize_stats.total_ms;
+
+            desc.vertexCount = (uint32_t)fetch_order.size();
+            desc.write_vertices = [&](Scene::vertex_t *dst, uint32_t first, uint32_t count) {
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    uint32_t v = fetch_order[first + i];
+                    glm::vec3 p, n(0.0f, 0.0f, 1.0f);
+                    glm::vec2 uv(0.0f);
+                    read_floats(positions, v, &p.x, 3);
+                    if (has_normals)
+                        read_floats(normals, v, &n.x, 3);
+                    else if (glm::length(computed_normals[v]) > 0.0f)
+                        n = glm::normalize(computed_normals[v]);
+                    if (has_uvs)
+                        read_floats(uvs, v, &uv.x, 2);
+
+                    dst[i].p = glm::vec4(p, 1.0f);
+                    dst[i].n = n;
+                    dst[i].uv = uv;
+                }
+            };
+
+            desc.indexCount = index_count;
+            desc.write_indices = [&](Scene::index_t *dst, uint32_t first, uint32_t count) {
+                memcpy(dst, order.data() + first, count * sizeof(Scene::index_t));
+            };
+
+            if (!_scene->add_object_to_global_instance_set(desc))
+                return false;
+
+            _geometries[key] = name;
+            ++_stats->object_count;
+            _stats->geometry_bytes += (uint64_t)desc.vertexCount * sizeof(Scene::vertex_t) + (uint64_t)index_count * sizeof(Scene::index_t);
+            return true;
+        }
+
+        Scene *_scene;
+        std::string _prefix;
+        std::string _directory; // of the file, for the relative URIs
+        gltf_load_stats_t *_stats;
+
+        utils::mapped_file _file;
+        json_value _gltf;
+        std::vector<std::unique_ptr<gltf_buffer_t>> _buffers;
+        std::vector<std::string> _material_ids; // empty: the scene was full
+        std::map<std::pair<int64_t, int64_t>, std::string> _geometries; // (mesh, primitive) -> first object
+    };
+}
+
+bool load_gltf(const std::string &file_path, Scene *scene, const std::string &prefix, const glm::mat4 &root, gltf_load_stats_t *stats)
+{
+    Log("#     Load glTF " + file_path + "\n");
+
+    auto start = std::chrono::steady_clock::now();
+
+    gltf_load_stats_t s;
+    bool loaded = gltf_importer(scene, prefix, &s).load(file_path, root);
+    s.total_ms = ms_since(start);
+    if (stats)
+        *stats = s;
+
+    Log("#      " + std::to_string(s.object_count) + " objects, " + std::to_string(s.material_count) + " materials, "
+        + std::to_string(s.skipped_primitive_count) + " primitives skipped\n");
+    Log("#      " + std::to_string(s.geometry_bytes / (1024 * 1024)) + " MB of geometry in " + std::to_string(s.total_ms) + " ms, "
+        + std::to_string(s.total_ms > 0.0f ? s.geometry_bytes / (s.total_ms * 1000.0f) : 0.0f) + " MB/s, "
+        + std::to_string(s.optimize_ms) + " ms of it optimizing\n");
+
+    return loaded;
+}
@@ -0,0 +1,44 @@
+#ifndef _VULKAN_GLTF_LOADER_H_
+#define _VULKAN_GLTF_LOADER_H_
+
+#include <stdint.h> // uint32_t
+
+#include "glm_usage.h"
+
+#include <string>
+
+class Scene;
+
+//
+// glTF 2.0 scenes, .gltf (JSON) or .glb (JSON and binary in one file).
+//
+// The .glb and the external .bin buffers are mapped. The vertices are
+// read in place and written straight into the staging memory of the
+// scene, without a std::vector in between. The indices are copied once,
+// to be reordered by optimize_mesh(); the vertices are then read in its
+// fetch order. Data URIs (base64) are decoded once.
+//
+// Each triangle primitive of each node of the default scene becomes an
+// object of the global instance set, with the world transform of its node:
+// the hierarchy is flattened. Nodes using the same mesh share its geometry.
+//
+// Each material becomes a material instance "<prefix>/<index>:<name>". Its
+// base color image goes to the texture loader of the scene and replaces the
+// neutral base when decoded. The metallic-roughness images are not used, the
+// base color, roughness and metallic factors go in the object overrides.
+//
+struct gltf_load_stats_t
+{
+    uint32_t object_count = 0;
+    uint32_t material_count = 0;
+    uint32_t skipped_primitive_count = 0; // not triangles, or unsupported accessors
+    uint64_t geometry_bytes = 0;          // uploaded vertices and indices
+    float optimize_ms = 0.0f;             // part of total_ms
+    float total_ms = 0.0f;
+};
+
+// prefix: of the object and material instance names, unique per file.
+bool load_gltf(const std::string &file_path, Scene *scene, const std::string &prefix,
+    const glm::mat4 &root = glm::mat4(1.0f), gltf_load_stats_t *stats = nullptr);
+
+#endif // _VULKAN_GLTF_LOADER_H_
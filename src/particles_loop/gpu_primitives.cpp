@@ -0,0 +1,939 @@
+#include "build_options.h"
+#include "platform.h"
+#include "gpu_primitives.h"
+#include "Renderer.h"
+#include "Shared.h"
+#include "utils.h"
+#include "initializers.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef> // offsetof
+#include <cstring>
+#include <numeric>
+
+// xorshift32: the same elements from one test run to the next.
+static uint32_t next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static uint32_t float_bits(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static float bits_float(uint32_t u)
+{
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+//
+// CPU references of the scans and reductions, in double: exact for the
+// uint sums of the tests, and closer than the GPU for the float ones.
+//
+static double element_value(uint32_t bits, GpuPrimitives::type_t type)
+{
+    return type == GpuPrimitives::TYPE_FLOAT ? (double)bits_float(bits) : (double)bits;
+}
+
+static double reference_identity(GpuPrimitives::type_t type, GpuPrimitives::op_t op)
+{
+    if (op == GpuPrimitives::OP_SUM)
+        return 0.0;
+    if (type == GpuPrimitives::TYPE_FLOAT)
+        return op == GpuPrimitives::OP_MIN ? INFINITY : -INFINITY;
+    return op == GpuPrimitives::OP_MIN ? (double)UINT32_MAX : 0.0;
+}
+
+static double reference_combine(double a, double b, GpuPrimitives::op_t op)
+{
+    return op == GpuPrimitives::OP_SUM ? a + b : (op == GpuPrimitives::OP_MIN ? std::min(a, b) : std::max(a, b));
+}
+
+// Float sums depend on the order: relative tolerance.
+static bool element_matches(uint32_t gpu_bits, double reference, GpuPrimitives::type_t type, GpuPrimitives::op_t op)
+{
+    if (type == GpuPrimitives::TYPE_UINT)
+        return gpu_bits == (uint32_t)reference;
+
+    double g = bits_float(gpu_bits);
+    if (op != GpuPrimitives::OP_SUM)
+        return g == (double)(float)reference;
+    return std::abs(g - reference) <= 1e-4 * (std::abs(reference) + 1.0);
+}
+
+// Small values for the sums, they do not overflow; any value for min/max.
+static std::vector<uint32_t> random_elements(uint32_t count, GpuPrimitives::type_t type, GpuPrimitives::op_t op, uint32_t *seed)
+{
+    std::vector<uint32_t> elements(count);
+    for (auto &e : elements)
+    {
+        uint32_t r = next_random(seed);
+        if (type == GpuPrimitives::TYPE_FLOAT)
+        {
+            float unit = (r >> 8) / 16777216.0f; // [0, 1[
+            e = float_bits(op == GpuPrimitives::OP_SUM ? unit : 2000.0f * unit - 1000.0f);
+        }
+        else
+        {
+            e = op == GpuPrimitives::OP_SUM ? (r & 0xFF) : r;
+        }
+    }
+    return elements;
+}
+
+GpuPrimitives::GpuPrimitives(vulkan_context *ctx) : _ctx(ctx)
+{
+
+}
+
+GpuPrimitives::~GpuPrimitives()
+{
+    de_init();
+}
+
+bool GpuPrimitives::init()
+{
+    VkResult result;
+
+    const auto &subgroups = _ctx->subgroup_properties;
+    const VkSubgroupFeatureFlags needed_operations = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+    _has_subgroups = (subgroups.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) != 0
+        && (subgroups.supportedOperations & needed_operations) == needed_operations;
+    _use_subgroups = _has_subgroups;
+
+    Log(std::string("#     GPU Primitives: ") + (_has_subgroups
+        ? "subgroups of " + std::to_string(subgroups.subgroupSize) + "\n"
+        : std::string("no subgroup operations, shared memory scans\n")));
+
+    // the same storage buffers for all the kernels, see scan.comp and radix_scatter.comp.
+    std::array<VkDescriptorSetLayoutBinding, BINDING_COUNT> bindings = {};
+    for (uint32_t b = 0; b < BINDING_COUNT; ++b)
+    {
+        bindings[b].binding = b;
+        bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[b].descriptorCount = 1;
+        bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo set_layout_create_info = {};
+    set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    set_layout_create_info.bindingCount = BINDING_COUNT;
+    set_layout_create_info.pBindings = bindings.data();
+
+    Log("#      Create Descriptor Set Layout\n");
+    result = vkCreateDescriptorSetLayout(_ctx->device, &set_layout_create_info, nullptr, &_set_layout);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    VkPushConstantRange push_constant_range = {};
+    push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_constant_range.offset = 0;
+    push_constant_range.size = 4 * sizeof(uint32_t);
+
+    VkPipelineLayoutCreateInfo layout_create_info = {};
+    layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_create_info.setLayoutCount = 1;
+    layout_create_info.pSetLayouts = &_set_layout;
+    layout_create_info.pushConstantRangeCount = 1;
+    layout_create_info.pPushConstantRanges = &push_constant_range;
+
+    Log("#      Create Pipeline Layout\n");
+    result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &_pipeline_layout);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    // a scan job and two sort sets per job, at most.
+    VkDescriptorPoolSize pool_size = {};
+    pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    pool_size.descriptorCount = 3 * MAX_JOBS * BINDING_COUNT;
+
+    VkDescriptorPoolCreateInfo pool_create_info = {};
+    pool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_create_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT; // destroy_job()
+    pool_create_info.maxSets = 3 * MAX_JOBS;
+    pool_create_info.poolSizeCount = 1;
+    pool_create_info.pPoolSizes = &pool_size;
+
+    Log("#      Create Descriptor Pool\n");
+    result = vkCreateDescriptorPool(_ctx->device, &pool_create_info, nullptr, &_descriptor_pool);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    Log("#      Create Scan Pipelines\n");
+    for (uint32_t subgroup = 0; subgroup < (_has_subgroups ? 2u : 1u); ++subgroup)
+    {
+        const char *path = subgroup ? "./data/scan_subgroup.comp.spv" : "./data/scan.comp.spv";
+        for (uint32_t kernel = 0; kernel < KERNEL_COUNT; ++kernel)
+        {
+            for (uint32_t type = 0; type < TYPE_COUNT; ++type)
+            {
+                for (uint32_t op = 0; op < OP_COUNT; ++op)
+                {
+                    uint32_t index = ((subgroup * KERNEL_COUNT + kernel) * TYPE_COUNT + type) * OP_COUNT + op;
+                    if (!create_pipeline(path, kernel, op, type, &_scan_pipes[index]))
+                        return false;
+                }
+            }
+        }
+    }
+
+    Log("#      Create Setup and Radix Sort Pipelines\n");
+    if (!create_pipeline("./data/scan_setup.comp.spv", 0, 0, 0, &_setup_pipe))
+        return false;
+    if (!create_pipeline("./data/radix_count.comp.spv", 0, 0, 0, &_radix_count_pipe))
+        return false;
+    if (!create_pipeline("./data/radix_scatter.comp.spv", 0, 0, 0, &_radix_scatter_pipe))
+        return false;
+
+    return true;
+}
+
+void GpuPrimitives::de_init()
+{
+    if (_ctx->device == VK_NULL_HANDLE)
+        return;
+
+    for (auto &pipe : _scan_pipes)
+    {
+        if (pipe != VK_NULL_HANDLE)
+            vkDestroyPipeline(_ctx->device, pipe, nullptr);
+        pipe = VK_NULL_HANDLE;
+    }
+
+    for (auto *pipe : { &_setup_pipe, &_radix_count_pipe, &_radix_scatter_pipe })
+    {
+        if (*pipe != VK_NULL_HANDLE)
+            vkDestroyPipeline(_ctx->device, *pipe, nullptr);
+        *pipe = VK_NULL_HANDLE;
+    }
+
+    if (_descriptor_pool != VK_NULL_HANDLE)
+        vkDestroyDescriptorPool(_ctx->device, _descriptor_pool, nullptr);
+    _descriptor_pool = VK_NULL_HANDLE;
+
+    if (_pipeline_layout != VK_NULL_HANDLE)
+        vkDestroyPipelineLayout(_ctx->device, _pipeline_layout, nullptr);
+    _pipeline_layout = VK_NULL_HANDLE;
+
+    if (_set_layout != VK_NULL_HANDLE)
+        vkDestroyDescriptorSetLayout(_ctx->device, _set_layout, nullptr);
+    _set_layout = VK_NULL_HANDLE;
+}
+
+bool GpuPrimitives::create_buffer(buffer_t *buffer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memory_flags)
+{
+    VkResult result;
+
+    VkBufferCreateInfo buffer_create_info = {};
+    buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_create_info.size = size;
+    buffer_create_info.usage = usage;
+    buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    result = vkCreateBuffer(_ctx->device, &buffer_create_info, nullptr, &buffer->buffer);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    VkMemoryRequirements memory_requirements = {};
+    vkGetBufferMemoryRequirements(_ctx->device, buffer->buffer, &memory_requirements);
+
+    VkMemoryAllocateInfo memory_allocate_info = {};
+    memory_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memory_allocate_info.allocationSize = memory_requirements.size;
+    memory_allocate_info.memoryTypeIndex = FindMemoryTypeIndex(&_ctx->physical_device_memory_properties, &memory_requirements, memory_flags);
+
+    result = vkAllocateMemory(_ctx->device, &memory_allocate_info, nullptr, &buffer->memory);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    result = vkBindBufferMemory(_ctx->device, buffer->buffer, buffer->memory, 0);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    return true;
+}
+
+void GpuPrimitives::destroy_buffer(buffer_t *buffer)
+{
+    vkFreeMemory(_ctx->device, buffer->memory, nullptr);
+    vkDestroyBuffer(_ctx->device, buffer->buffer, nullptr);
+    *buffer = {};
+}
+
+//
+// The kernel, the operation and the element type are specialization
+// constants: one pipeline per combination, the branches fold away.
+//
+bool GpuPrimitives::create_pipeline(const char *path, uint32_t kernel, uint32_t op, uint32_t type, VkPipeline *pipeline)
+{
+    VkResult result;
+
+    auto content = utils::read_file_content(path);
+
+    VkShaderModuleCreateInfo shader_creation_info = {};
+    shader_creation_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shader_creation_info.codeSize = content.size();
+    shader_creation_info.pCode = (uint32_t *)content.data();
+
+    VkShaderModule cs = VK_NULL_HANDLE;
+    result = vkCreateShaderModule(_ctx->device, &shader_creation_info, nullptr, &cs);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    const std::array<uint32_t, 3> constants = { kernel, op, type == TYPE_FLOAT ? VK_TRUE : VK_FALSE };
+    std::array<VkSpecializationMapEntry, 3> map_entries = {};
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+        map_entries[i].constantID = i;
+        map_entries[i].offset = i * sizeof(uint32_t);
+        map_entries[i].size = sizeof(uint32_t);
+    }
+
+    VkSpecializationInfo specialization_info = {};
+    specialization_info.mapEntryCount = (uint32_t)map_entries.size();
+    specialization_info.pMapEntries = map_entries.data();
+    specialization_info.dataSize = sizeof(constants);
+    specialization_info.pData = constants.data();
+
+    VkComputePipelineCreateInfo compute_pipeline_create_info = {};
+    compute_pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    compute_pipeline_create_info.stage = vk::init::pipeline::shader_stage_create_info(cs, VK_SHADER_STAGE_COMPUTE_BIT);
+    compute_pipeline_create_info.stage.pSpecializationInfo = &specialization_info;
+    compute_pipeline_create_info.layout = _pipeline_layout;
+    compute_pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+    compute_pipeline_create_info.basePipelineIndex = 0;
+
+    result = vkCreateComputePipelines(_ctx->device, VK_NULL_HANDLE, 1, &compute_pipeline_create_info, nullptr, pipeline);
+    ErrorCheck(result);
+
+    // not needed once the pipeline exists.
+    vkDestroyShaderModule(_ctx->device, cs, nullptr);
+
+    return result == VK_SUCCESS;
+}
+
+VkPipeline GpuPrimitives::scan_pipeline(kernel_t kernel, type_t type, op_t op) const
+{
+    uint32_t subgroup = _use_subgroups ? 1 : 0;
+    return _scan_pipes[((subgroup * KERNEL_COUNT + kernel) * TYPE_COUNT + type) * OP_COUNT + op];
+}
+
+//
+// Jobs
+//
+
+bool GpuPrimitives::allocate_set(VkDescriptorSet *set, const std::array<VkBuffer, BINDING_COUNT> &bindings)
+{
+    VkResult result;
+
+    VkDescriptorSetAllocateInfo descriptor_allocate_info = {};
+    descriptor_allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptor_allocate_info.descriptorPool = _descriptor_pool;
+    descriptor_allocate_info.descriptorSetCount = 1;
+    descriptor_allocate_info.pSetLayouts = &_set_layout;
+
+    result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, set);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    std::array<VkDescriptorBufferInfo, BINDING_COUNT> buffer_infos = {};
+    std::array<VkWriteDescriptorSet, BINDING_COUNT> writes = {};
+    for (uint32_t b = 0; b < BINDING_COUNT; ++b)
+    {
+        buffer_infos[b].buffer = bindings[b];
+        buffer_infos[b].offset = 0;
+        buffer_infos[b].range = VK_WHOLE_SIZE;
+
+        writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[b].dstSet = *set;
+        writes[b].dstBinding = b;
+        writes[b].descriptorCount = 1;
+        writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[b].pBufferInfo = &buffer_infos[b];
+    }
+    vkUpdateDescriptorSets(_ctx->device, BINDING_COUNT, writes.data(), 0, nullptr);
+
+    return true;
+}
+
+//
+// Headers and block totals for a scan of scan_count elements. The bindings
+// the kernels do not use point at the headers: all of them must be valid.
+//
+bool GpuPrimitives::create_job(job_t *job, uint32_t max_count, uint32_t scan_count, const std::array<VkBuffer, BINDING_COUNT> &scan_bindings)
+{
+    job->max_count = max_count;
+
+    if (!create_buffer(&job->headers, 2 * sizeof(_header_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT))
+        return false;
+
+    const VkDeviceSize block_count = (scan_count + ITEMS_PER_BLOCK - 1) / ITEMS_PER_BLOCK;
+    if (!create_buffer(&job->block_totals, (block_count + 1) * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT))
+        return false;
+
+    std::array<VkBuffer, BINDING_COUNT> bindings = scan_bindings;
+    bindings[0] = job->headers.buffer;
+    bindings[3] = job->block_totals.buffer;
+    for (auto &b : bindings)
+    {
+        if (b == VK_NULL_HANDLE)
+            b = job->headers.buffer;
+    }
+
+    return allocate_set(&job->scan_set, bindings);
+}
+
+bool GpuPrimitives::create_scan_job(job_t *job, uint32_t max_count, VkBuffer input, VkBuffer output, VkBuffer count_buffer)
+{
+    return create_job(job, max_count, max_count, { VK_NULL_HANDLE, input, output, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, count_buffer });
+}
+
+bool GpuPrimitives::create_reduce_job(job_t *job, uint32_t max_count, VkBuffer input, VkBuffer result, VkBuffer count_buffer)
+{
+    return create_job(job, max_count, max_count, { VK_NULL_HANDLE, input, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, result, count_buffer });
+}
+
+bool GpuPrimitives::create_compact_job(job_t *job, uint32_t max_count, VkBuffer flags, VkBuffer values, VkBuffer output, VkBuffer result, VkBuffer count_buffer)
+{
+    return create_job(job, max_count, max_count, { VK_NULL_HANDLE, flags, output, VK_NULL_HANDLE, values, result, count_buffer });
+}
+
+//
+// The scan of the job is the one of the digit counts, digit major: the
+// first destination of (digit, block) counts the smaller digits, then the
+// same digit in the blocks before.
+//
+bool GpuPrimitives::create_sort_job(job_t *job, uint32_t max_count, const std::array<VkBuffer, 2> &keys, const std::array<VkBuffer, 2> &values, VkBuffer count_buffer)
+{
+    const uint32_t digit_count = RADIX * ((max_count + ITEMS_PER_BLOCK - 1) / ITEMS_PER_BLOCK);
+
+    for (auto *b : { &job->histograms, &job->digit_offsets })
+    {
+        if (!create_buffer(b, std::max(digit_count, 1u) * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT))
+            return false;
+    }
+
+    if (!create_job(job, max_count, digit_count,
+        { VK_NULL_HANDLE, job->histograms.buffer, job->digit_offsets.buffer, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, count_buffer }))
+        return false;
+
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        if (!allocate_set(&job->sort_sets[i], { job->headers.buffer, keys[i], values[i], keys[1 - i], values[1 - i],
+            job->histograms.buffer, job->digit_offsets.buffer }))
+            return false;
+    }
+
+    return true;
+}
+
+void GpuPrimitives::destroy_job(job_t *job)
+{
+    std::vector<VkDescriptorSet> sets;
+    for (auto set : { job->scan_set, job->sort_sets[0], job->sort_sets[1] })
+    {
+        if (set != VK_NULL_HANDLE)
+            sets.push_back(set);
+    }
+    if (!sets.empty())
+        vkFreeDescriptorSets(_ctx->device, _descriptor_pool, (uint32_t)sets.size(), sets.data());
+
+    for (auto *b : { &job->headers, &job->block_totals, &job->histograms, &job->digit_offsets })
+        destroy_buffer(b);
+
+    *job = {};
+}
+
+//
+// Recording
+//
+
+// Each dispatch reads what the one before wrote, maybe as indirect arguments.
+// It also orders the scratch of a job with its previous use.
+void GpuPrimitives::record_barrier(VkCommandBuffer cmd)
+{
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+    vkCmdPipelineBarrier(cmd,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        0,
+        1, &barrier,
+        0, nullptr,
+        0, nullptr);
+}
+
+void GpuPrimitives::record_setup(VkCommandBuffer cmd, const job_t &job, count_t count, uint32_t digits)
+{
+    record_barrier(cmd);
+
+    const std::array<uint32_t, 4> constants = { count.value, count.word, job.max_count, digits };
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _setup_pipe);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline_layout, 0, 1, &job.scan_set, 0, nullptr);
+    vkCmdPushConstants(cmd, _pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), constants.data());
+    vkCmdDispatch(cmd, 1, 1, 1);
+
+    record_barrier(cmd);
+}
+
+//
+// Totals of the blocks, their scan (and the total of all), then the
+// blocks again. A reduction stops after the scan of the totals.
+//
+void GpuPrimitives::record_scan_passes(VkCommandBuffer cmd, const job_t &job, uint32_t header_index,
+    type_t type, op_t op, uint32_t mode, uint32_t result_word, bool downsweep)
+{
+    const std::array<uint32_t, 4> constants = { header_index, mode, result_word, 0 };
+    const VkDeviceSize dispatch_offset = header_index * sizeof(_header_t) + offsetof(_header_t, dispatch);
+
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline_layout, 0, 1, &job.scan_set, 0, nullptr);
+    vkCmdPushConstants(cmd, _pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), constants.data());
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, scan_pipeline(KERNEL_BLOCKS, type, op));
+    vkCmdDispatchIndirect(cmd, job.headers.buffer, dispatch_offset);
+    record_barrier(cmd);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, scan_pipeline(KERNEL_TOP, type, op));
+    vkCmdDispatch(cmd, 1, 1, 1);
+
+    if (!downsweep)
+        return;
+    record_barrier(cmd);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, scan_pipeline(KERNEL_DOWNSWEEP, type, op));
+    vkCmdDispatchIndirect(cmd, job.headers.buffer, dispatch_offset);
+}
+
+void GpuPrimitives::record_scan(VkCommandBuffer cmd, const job_t &job, count_t count, type_t type, op_t op, scan_mode_t mode)
+{
+    record_setup(cmd, job, count, 0);
+    record_scan_passes(cmd, job, 0, type, op, mode, NO_WORD, true);
+}
+
+void GpuPrimitives::record_reduce(VkCommandBuffer cmd, const job_t &job, count_t count, type_t type, op_t op, uint32_t result_word)
+{
+    record_setup(cmd, job, count, 0);
+    record_scan_passes(cmd, job, 0, type, op, SCAN_EXCLUSIVE, result_word, false);
+}
+
+// An exclusive sum of the flags, as 0/1, is the destination of the kept values.
+void GpuPrimitives::record_compact(VkCommandBuffer cmd, const job_t &job, count_t count, uint32_t result_word)
+{
+    record_setup(cmd, job, count, 0);
+    record_scan_passes(cmd, job, 0, TYPE_UINT, OP_SUM, MODE_COMPACT, result_word, true);
+}
+
+//
+// LSD radix sort, 4 bits per pass: count the digits of each block, scan
+// the counts, scatter. An even pass count: the result is back in keys[0].
+//
+void GpuPrimitives::record_sort(VkCommandBuffer cmd, const job_t &job, count_t count, uint32_t key_bits)
+{
+    const uint32_t pass_count = 2 * ((std::min(key_bits, 32u) + 7) / 8);
+
+    // the second header is for the scan of the digit counts.
+    record_setup(cmd, job, count, RADIX);
+
+    for (uint32_t pass = 0; pass < pass_count; ++pass)
+    {
+        const std::array<uint32_t, 4> shift = { 4 * pass, 0, 0, 0 };
+        const VkDescriptorSet set = job.sort_sets[pass % 2];
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _radix_count_pipe);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline_layout, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(cmd, _pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(shift), shift.data());
+        vkCmdDispatchIndirect(cmd, job.headers.buffer, offsetof(_header_t, dispatch));
+        record_barrier(cmd);
+
+        record_scan_passes(cmd, job, 1, TYPE_UINT, OP_SUM, SCAN_EXCLUSIVE, NO_WORD, true);
+        record_barrier(cmd);
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _radix_scatter_pipe);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline_layout, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(cmd, _pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(shift), shift.data());
+        vkCmdDispatchIndirect(cmd, job.headers.buffer, offsetof(_header_t, dispatch));
+
+        if (pass + 1 < pass_count)
+            record_barrier(cmd);
+    }
+}
+
+//
+// Tests
+//
+
+bool GpuPrimitives::run_test_commands(const std::vector<transfer_t> &uploads, const std::function<void(VkCommandBuffer)> &record,
+    const std::vector<transfer_t> &readbacks, float *gpu_ms)
+{
+    VkResult result;
+    *gpu_ms = -1.0f;
+
+    // the uploads, then the readbacks over them, from the start of the staging buffer.
+    VkDeviceSize offset = 0;
+    for (const auto &u : uploads)
+    {
+        VkDeviceSize size = u.second->size() * sizeof(uint32_t);
+        if (offset + size > _staging_size)
+            return false;
+        memcpy((char*)_staging_mapped + offset, u.second->data(), size);
+        offset += size;
+    }
+
+    VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+    command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_allocate_info.commandPool = _ctx->compute.command_pool;
+    command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    command_buffer_allocate_info.commandBufferCount = 1;
+
+    VkCommandBuffer cmd = VK_NULL_HANDLE;
+    result = vkAllocateCommandBuffers(_ctx->device, &command_buffer_allocate_info, &cmd);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(cmd, &begin_info);
+    {
+        offset = 0;
+        for (const auto &u : uploads)
+        {
+            VkBufferCopy region = {};
+            region.srcOffset = offset;
+            region.size = u.second->size() * sizeof(uint32_t);
+            vkCmdCopyBuffer(cmd, _staging.buffer, u.first, 1, &region);
+            offset += region.size;
+        }
+
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+            1, &barrier, 0, nullptr, 0, nullptr);
+
+        if (_query_pool != VK_NULL_HANDLE)
+        {
+            vkCmdResetQueryPool(cmd, _query_pool, 0, 2);
+            vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _query_pool, 0);
+        }
+
+        record(cmd);
+
+        if (_query_pool != VK_NULL_HANDLE)
+            vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, _query_pool, 1);
+
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            1, &barrier, 0, nullptr, 0, nullptr);
+
+        offset = 0;
+        for (const auto &r : readbacks)
+        {
+            VkBufferCopy region = {};
+            region.dstOffset = offset;
+            region.size = r.second->size() * sizeof(uint32_t);
+            vkCmdCopyBuffer(cmd, r.first, _staging.buffer, 1, &region);
+            offset += region.size;
+        }
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+            1, &barrier, 0, nullptr, 0, nullptr);
+    }
+    vkEndCommandBuffer(cmd);
+
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &cmd;
+    result = vkQueueSubmit(_ctx->compute.queue, 1, &submit_info, VK_NULL_HANDLE);
+    ErrorCheck(result);
+    if (result == VK_SUCCESS)
+    {
+        result = vkQueueWaitIdle(_ctx->compute.queue);
+        ErrorCheck(result);
+    }
+
+    vkFreeCommandBuffers(_ctx->device, _ctx->compute.command_pool, 1, &cmd);
+    if (result != VK_SUCCESS)
+        return false;
+
+    offset = 0;
+    for (const auto &r : readbacks)
+    {
+        VkDeviceSize size = r.second->size() * sizeof(uint32_t);
+        memcpy(r.second->data(), (char*)_staging_mapped + offset, size);
+        offset += size;
+    }
+
+    if (_query_pool != VK_NULL_HANDLE)
+    {
+        std::array<uint64_t, 2> timestamps = {};
+        result = vkGetQueryPoolResults(_ctx->device, _query_pool, 0, 2,
+            sizeof(timestamps), timestamps.data(), sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        if (result == VK_SUCCESS)
+            *gpu_ms = (float)((timestamps[1] - timestamps[0]) * _ctx->physical_device_properties.limits.timestampPeriod / 1000000.0);
+    }
+
+    return true;
+}
+
+//
+// One submit per primitive, the GPU time is the one of the primitive alone,
+// setup included. The throughput is in input elements per second.
+//
+bool GpuPrimitives::run_tests(uint32_t count, std::vector<test_result_t> *results)
+{
+    VkResult result;
+    results->clear();
+    count = std::max(count, 1u);
+
+    Log("#  Test GPU Primitives, " + std::to_string(count) + " elements\n");
+
+    result = vkDeviceWaitIdle(_ctx->device);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    const uint32_t result_words = 4;
+
+    // a, b: inputs, sorted keys and values. c, d: outputs, ping-pong of the sort.
+    std::array<buffer_t, 4> buffers;
+    buffer_t result_buffer;
+    job_t scan_job, reduce_job, compact_job, sort_job;
+
+    bool ok = true;
+    for (auto &b : buffers)
+        ok = ok && create_buffer(&b, count * sizeof(uint32_t), usage);
+    ok = ok && create_buffer(&result_buffer, result_words * sizeof(uint32_t), usage);
+
+    _staging_size = (2 * (VkDeviceSize)count + result_words) * sizeof(uint32_t);
+    ok = ok && create_buffer(&_staging, _staging_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    if (ok)
+    {
+        result = vkMapMemory(_ctx->device, _staging.memory, 0, VK_WHOLE_SIZE, 0, &_staging_mapped);
+        ErrorCheck(result);
+        ok = result == VK_SUCCESS;
+    }
+
+    if (ok && _ctx->compute.timestamp_valid_bits != 0)
+    {
+        VkQueryPoolCreateInfo query_pool_info = {};
+        query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        query_pool_info.queryCount = 2;
+        result = vkCreateQueryPool(_ctx->device, &query_pool_info, nullptr, &_query_pool);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            _query_pool = VK_NULL_HANDLE;
+    }
+
+    VkBuffer a = buffers[0].buffer, b = buffers[1].buffer, c = buffers[2].buffer, d = buffers[3].buffer;
+    ok = ok && create_scan_job(&scan_job, count, a, c);
+    ok = ok && create_reduce_job(&reduce_job, count, a, result_buffer.buffer);
+    ok = ok && create_compact_job(&compact_job, count, a, b, c, result_buffer.buffer);
+    ok = ok && create_sort_job(&sort_job, count, { a, c }, { b, d });
+
+    const count_t n = count_of(count);
+    const bool saved_use_subgroups = _use_subgroups;
+    uint32_t seed = 0x9E3779B9u;
+
+    for (uint32_t subgroup = 0; ok && subgroup < (_has_subgroups ? 2u : 1u); ++subgroup)
+    {
+        _use_subgroups = subgroup == 1;
+
+        auto add_result = [&](const std::string &name, uint32_t mismatch_count, float gpu_ms)
+        {
+            test_result_t r;
+            r.name = name;
+            r.subgroups = _use_subgroups;
+            r.count = count;
+            r.mismatch_count = mismatch_count;
+            r.gpu_ms = gpu_ms;
+            results->push_back(r);
+
+            Log("#   " + name + (r.subgroups ? " (subgroups)" : std::string())
+                + ": " + (mismatch_count ? std::to_string(mismatch_count) + " mismatches" : std::string("ok"))
+                + ", GPU " + std::to_string(gpu_ms) + " ms, "
+                + std::to_string(r.elements_per_second() / 1000000.0) + " M elements/s\n");
+        };
+
+        static const char *type_names[TYPE_COUNT] = { "uint", "float" };
+        static const char *op_names[OP_COUNT] = { "sum", "min", "max" };
+
+        // scans
+        struct scan_case_t { type_t type; op_t op; scan_mode_t mode; };
+        const std::array<scan_case_t, 4> scan_cases = { {
+            { TYPE_UINT, OP_SUM, SCAN_EXCLUSIVE },
+            { TYPE_UINT, OP_MAX, SCAN_INCLUSIVE },
+            { TYPE_FLOAT, OP_SUM, SCAN_EXCLUSIVE },
+            { TYPE_FLOAT, OP_MIN, SCAN_INCLUSIVE },
+        } };
+        for (const auto &sc : scan_cases)
+        {
+            std::vector<uint32_t> input = random_elements(count, sc.type, sc.op, &seed);
+            std::vector<uint32_t> output(count);
+            float gpu_ms = -1.0f;
+            ok = run_test_commands({ { a, &input } },
+                [&](VkCommandBuffer cmd) { record_scan(cmd, scan_job, n, sc.type, sc.op, sc.mode); },
+                { { c, &output } }, &gpu_ms);
+            if (!ok)
+                break;
+
+            uint32_t mismatch_count = 0;
+            double prefix = reference_identity(sc.type, sc.op);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                double next = reference_combine(prefix, element_value(input[i], sc.type), sc.op);
+                if (!element_matches(output[i], sc.mode == SCAN_INCLUSIVE ? next : prefix, sc.type, sc.op))
+                    ++mismatch_count;
+                prefix = next;
+            }
+
+            add_result(std::string("scan ") + (sc.mode == SCAN_INCLUSIVE ? "inclusive " : "exclusive ")
+                + type_names[sc.type] + " " + op_names[sc.op], mismatch_count, gpu_ms);
+        }
+
+        // reductions
+        for (uint32_t type = 0; ok && type < TYPE_COUNT; ++type)
+        {
+            for (uint32_t op = 0; ok && op < OP_COUNT; ++op)
+            {
+                std::vector<uint32_t> input = random_elements(count, (type_t)type, (op_t)op, &seed);
+                std::vector<uint32_t> output(1);
+                float gpu_ms = -1.0f;
+                ok = run_test_commands({ { a, &input } },
+                    [&](VkCommandBuffer cmd) { record_reduce(cmd, reduce_job, n, (type_t)type, (op_t)op, 0); },
+                    { { result_buffer.buffer, &output } }, &gpu_ms);
+                if (!ok)
+                    break;
+
+                double total = reference_identity((type_t)type, (op_t)op);
+                for (uint32_t e : input)
+                    total = reference_combine(total, element_value(e, (type_t)type), (op_t)op);
+
+                add_result(std::string("reduce ") + type_names[type] + " " + op_names[op],
+                    element_matches(output[0], total, (type_t)type, (op_t)op) ? 0 : 1, gpu_ms);
+            }
+        }
+
+        // compaction, about a third of the values kept; any flag but 0 keeps.
+        if (ok)
+        {
+            std::vector<uint32_t> flags(count), values(count);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                uint32_t r = next_random(&seed);
+                flags[i] = (r % 3 == 0) ? (r | 1) : 0;
+                values[i] = next_random(&seed);
+            }
+            std::vector<uint32_t> output(count), kept(1);
+            float gpu_ms = -1.0f;
+            ok = run_test_commands({ { a, &flags }, { b, &values } },
+                [&](VkCommandBuffer cmd) { record_compact(cmd, compact_job, n, 0); },
+                { { c, &output }, { result_buffer.buffer, &kept } }, &gpu_ms);
+
+            if (ok)
+            {
+                uint32_t mismatch_count = 0;
+                uint32_t j = 0;
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    if (flags[i] == 0)
+                        continue;
+                    if (output[j] != values[i])
+                        ++mismatch_count;
+                    ++j;
+                }
+                if (kept[0] != j)
+                    ++mismatch_count;
+
+                add_result("compact", mismatch_count, gpu_ms);
+            }
+        }
+
+        // stable sorts: the values are the indices, equal keys keep their order.
+        for (uint32_t key_bits : { 16u, 32u })
+        {
+            if (!ok)
+                break;
+
+            const uint32_t mask = key_bits >= 32 ? UINT32_MAX : (1u << key_bits) - 1;
+            std::vector<uint32_t> keys(count), values(count);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                keys[i] = next_random(&seed) & mask;
+                values[i] = i;
+            }
+            std::vector<uint32_t> sorted_keys(count), sorted_values(count);
+            float gpu_ms = -1.0f;
+            ok = run_test_commands({ { a, &keys }, { b, &values } },
+                [&](VkCommandBuffer cmd) { record_sort(cmd, sort_job, n, key_bits); },
+                { { a, &sorted_keys }, { b, &sorted_values } }, &gpu_ms);
+            if (!ok)
+                break;
+
+            std::vector<uint32_t> order(count);
+            std::iota(order.begin(), order.end(), 0u);
+            std::stable_sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) { return keys[x] < keys[y]; });
+
+            uint32_t mismatch_count = 0;
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                if (sorted_keys[i] != keys[order[i]] || sorted_values[i] != order[i])
+                    ++mismatch_count;
+            }
+
+            add_result("sort " + std::to_string(key_bits) + " bit keys", mismatch_count, gpu_ms);
+        }
+    }
+    _use_subgroups = saved_use_subgroups;
+
+    for (auto *job : { &scan_job, &reduce_job, &compact_job, &sort_job })
+        destroy_job(job);
+    for (auto &buffer : buffers)
+        destroy_buffer(&buffer);
+    destroy_buffer(&result_buffer);
+
+    if (_staging_mapped)
+        vkUnmapMemory(_ctx->device, _staging.memory);
+    _staging_mapped = nullptr;
+    destroy_buffer(&_staging);
+    _staging_size = 0;
+
+    if (_query_pool != VK_NULL_HANDLE)
+        vkDestroyQueryPool(_ctx->device, _query_pool, nullptr);
+    _query_pool = VK_NULL_HANDLE;
+
+    return ok;
+}
@@ -0,0 +1,203 @@
+#ifndef _VULKAN_GPU_PRIMITIVES_H_
+#define _VULKAN_GPU_PRIMITIVES_H_
+
+#include <stdint.h> // uint32_t
+
+#include <array>
+#include <vector>
+#include <string>
+#include <functional>
+
+struct vulkan_context;
+
+//
+// Data parallel building blocks over storage buffers of 32 bit elements:
+// prefix scan, stream compaction, reduction and key-value radix sort.
+//
+// All of them are scans of blocks of 2048 elements: a total per block, an
+// exclusive scan of the totals in one group, then each block again from
+// the total of the blocks before it. The scan of a workgroup uses subgroup
+// operations on Vulkan 1.1 devices that have them, shared memory otherwise.
+//
+// A job is made once for fixed buffers, it owns its scratch memory and its
+// descriptor sets. record_*() only puts barriers between its own dispatches:
+// the caller orders the buffers with what comes before and after. The count
+// can be written earlier on the GPU, all the dispatches are indirect.
+//
+class GpuPrimitives
+{
+public:
+    GpuPrimitives(vulkan_context *);
+    ~GpuPrimitives();
+
+    bool init();
+    void de_init(); // after destroy_job() of every job
+
+    enum op_t
+    {
+        OP_SUM = 0,
+        OP_MIN,
+        OP_MAX,
+
+        OP_COUNT
+    };
+
+    enum type_t
+    {
+        TYPE_UINT = 0,
+        TYPE_FLOAT,
+
+        TYPE_COUNT
+    };
+
+    enum scan_mode_t
+    {
+        SCAN_EXCLUSIVE = 0,
+        SCAN_INCLUSIVE
+    };
+
+    static constexpr uint32_t ITEMS_PER_BLOCK = 2048;
+    static constexpr uint32_t NO_WORD = UINT32_MAX;
+    static constexpr uint32_t MAX_JOBS = 16;
+
+    // Element count of a record_*(): a value, or the uint at word of the
+    // count buffer of the job. Clamped to the max count of the job.
+    struct count_t
+    {
+        uint32_t value = 0;
+        uint32_t word = NO_WORD;
+    };
+    static count_t count_of(uint32_t value) { return { value, NO_WORD }; }
+    static count_t count_at(uint32_t word) { return { 0, word }; }
+
+    struct buffer_t
+    {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+    };
+
+    struct job_t
+    {
+        uint32_t max_count = 0;
+        buffer_t headers;      // 2 _header_t: the elements, and the digit counts of a sort
+        buffer_t block_totals; // one per block, then the total
+        VkDescriptorSet scan_set = VK_NULL_HANDLE;
+
+        // sort only: the scan job is over the digit counts.
+        buffer_t histograms;    // 16 digit counts per block of keys
+        buffer_t digit_offsets; // their exclusive scan
+        std::array<VkDescriptorSet, 2> sort_sets = {}; // [i] reads keys[i], writes keys[1-i]
+    };
+
+    //
+    // Jobs. The buffers are bound whole, with STORAGE_BUFFER usage. The count
+    // buffer is only needed by count_at().
+    //
+
+    bool create_scan_job(job_t *job, uint32_t max_count, VkBuffer input, VkBuffer output, VkBuffer count_buffer = VK_NULL_HANDLE);
+    // result: one word per reduction, chosen when recording.
+    bool create_reduce_job(job_t *job, uint32_t max_count, VkBuffer input, VkBuffer result, VkBuffer count_buffer = VK_NULL_HANDLE);
+    // The values whose flag is not 0, in order. result: their count.
+    bool create_compact_job(job_t *job, uint32_t max_count, VkBuffer flags, VkBuffer values, VkBuffer output, VkBuffer result, VkBuffer count_buffer = VK_NULL_HANDLE);
+    // Sorted in keys[0] and values[0], the others are the ping-pong.
+    bool create_sort_job(job_t *job, uint32_t max_count, const std::array<VkBuffer, 2> &keys, const std::array<VkBuffer, 2> &values, VkBuffer count_buffer = VK_NULL_HANDLE);
+    void destroy_job(job_t *job);
+
+    //
+    // Recording, in a compute command buffer
+    //
+
+    void record_scan(VkCommandBuffer cmd, const job_t &job, count_t count, type_t type, op_t op, scan_mode_t mode);
+    void record_reduce(VkCommandBuffer cmd, const job_t &job, count_t count, type_t type, op_t op, uint32_t result_word);
+    void record_compact(VkCommandBuffer cmd, const job_t &job, count_t count, uint32_t result_word);
+    // Stable, on the key_bits low bits of the keys, rounded up to 8.
+    void record_sort(VkCommandBuffer cmd, const job_t &job, count_t count, uint32_t key_bits);
+
+    bool has_subgroups() const { return _has_subgroups; }
+    bool use_subgroups() const { return _use_subgroups; }
+    void set_use_subgroups(bool use) { _use_subgroups = use && _has_subgroups; }
+
+    //
+    // Every primitive on random elements, with each variant, against a CPU
+    // reference. Idles the device.
+    //
+
+    struct test_result_t
+    {
+        std::string name;
+        bool subgroups = false;
+        uint32_t count = 0;
+        uint32_t mismatch_count = 0;
+        float gpu_ms = -1.0f; // the primitive only, -1 without timestamps
+        double elements_per_second() const { return gpu_ms > 0.0f ? count / (gpu_ms * 0.001) : 0.0; }
+    };
+
+    bool run_tests(uint32_t count, std::vector<test_result_t> *results);
+
+private:
+
+    enum kernel_t
+    {
+        KERNEL_BLOCKS = 0,
+        KERNEL_TOP,
+        KERNEL_DOWNSWEEP,
+
+        KERNEL_COUNT
+    };
+
+    // scan.comp: the scan modes, then compaction.
+    static constexpr uint32_t MODE_COMPACT = 2;
+    static constexpr uint32_t RADIX = 16; // 4 bits per sort pass
+    static constexpr uint32_t BINDING_COUNT = 7;
+
+    // std430, scan_setup.comp and scan.comp.
+    struct _header_t
+    {
+        VkDispatchIndirectCommand dispatch; // one group per block
+        uint32_t count;
+        uint32_t block_count;
+        uint32_t pad[3];
+    };
+
+    bool create_buffer(buffer_t *buffer, VkDeviceSize size, VkBufferUsageFlags usage,
+        VkMemoryPropertyFlags memory_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    void destroy_buffer(buffer_t *buffer);
+    bool create_pipeline(const char *path, uint32_t kernel, uint32_t op, uint32_t type, VkPipeline *pipeline);
+    VkPipeline scan_pipeline(kernel_t kernel, type_t type, op_t op) const;
+
+    bool create_job(job_t *job, uint32_t max_count, uint32_t scan_count, const std::array<VkBuffer, BINDING_COUNT> &scan_bindings);
+    bool allocate_set(VkDescriptorSet *set, const std::array<VkBuffer, BINDING_COUNT> &bindings);
+
+    void record_setup(VkCommandBuffer cmd, const job_t &job, count_t count, uint32_t digits);
+    void record_scan_passes(VkCommandBuffer cmd, const job_t &job, uint32_t header_index,
+        type_t type, op_t op, uint32_t mode, uint32_t result_word, bool downsweep);
+    static void record_barrier(VkCommandBuffer cmd);
+
+    // One submit: uploads, the primitive between two timestamps, readbacks.
+    using transfer_t = std::pair<VkBuffer, std::vector<uint32_t>*>;
+    bool run_test_commands(const std::vector<transfer_t> &uploads, const std::function<void(VkCommandBuffer)> &record,
+        const std::vector<transfer_t> &readbacks, float *gpu_ms);
+
+    vulkan_context *_ctx = nullptr;
+
+    bool _has_subgroups = false;
+    bool _use_subgroups = false;
+
+    VkDescriptorSetLayout _set_layout = VK_NULL_HANDLE; // BINDING_COUNT storage buffers
+    VkPipelineLayout _pipeline_layout = VK_NULL_HANDLE; // and 16 bytes of push constants
+    VkDescriptorPool _descriptor_pool = VK_NULL_HANDLE; // MAX_JOBS jobs
+
+    // [subgroups][kernel][type][op]
+    std::array<VkPipeline, 2 * KERNEL_COUNT * TYPE_COUNT * OP_COUNT> _scan_pipes = {};
+    VkPipeline _setup_pipe = VK_NULL_HANDLE;
+    VkPipeline _radix_count_pipe = VK_NULL_HANDLE;
+    VkPipeline _radix_scatter_pipe = VK_NULL_HANDLE;
+
+    // run_tests() only
+    buffer_t _staging;
+    VkDeviceSize _staging_size = 0;
+    void *_staging_mapped = nullptr;
+    VkQueryPool _query_pool = VK_NULL_HANDLE;
+};
+
+#endif // _VULKAN_GPU_PRIMITIVES_H_
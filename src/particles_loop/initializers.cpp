@@ -118,6 +118,21 @@ VkPipelineColorBlendAttachmentState color_blend_attachment_state_NO_BLEND()
     return color_blend_attachment_state;
 }
 
+VkPipelineColorBlendAttachmentState color_blend_attachment_state_ALPHA_BLEND()
+{
+    VkPipelineColorBlendAttachmentState color_blend_attachment_state = {};
+    color_blend_attachment_state.blendEnable = VK_TRUE;
+    color_blend_attachment_state.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    color_blend_attachment_state.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    color_blend_attachment_state.colorBlendOp = VK_BLEND_OP_ADD;
+    color_blend_attachment_state.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    color_blend_attachment_state.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    color_blend_attachment_state.alphaBlendOp = VK_BLEND_OP_ADD;
+    color_blend_attachment_state.colorWriteMask = 0xf; // all components.
+
+    return color_blend_attachment_state;
+}
+
 VkPipelineColorBlendStateCreateInfo color_blend_state_create_info()
 {
     VkPipelineColorBlendStateCreateInfo color_blend_state_create_info = {};
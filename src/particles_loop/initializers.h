@@ -24,6 +24,7 @@ namespace pipeline
     VkStencilOpState stencil_op_state_NOP();
     VkPipelineDepthStencilStateCreateInfo depth_stencil_state_create_info();
     VkPipelineColorBlendAttachmentState color_blend_attachment_state_NO_BLEND();
+    VkPipelineColorBlendAttachmentState color_blend_attachment_state_ALPHA_BLEND(); // src over dst
     VkPipelineColorBlendStateCreateInfo color_blend_state_create_info();
     VkPipelineMultisampleStateCreateInfo multisample_state_create_info_NO_MSAA();
 } // pipeline
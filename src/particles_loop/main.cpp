@@ -4,16 +4,31 @@
 #include "app.h"
 #include "Shared.h" // Log
 
-#include <cstdio> // getchar
+#include <cstdio>  // getchar
+#include <cstdlib> // strtoul
+#include <cstring> // strcmp
 
 int main(int argc, char **argv)
 {
     Log("### Main program starting.\n");
-    
-    VulkanApplication app;
-    app.run();
+
+    app_options_t options;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--instances") && i + 1 < argc)
+            options.instance_count = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--check-simulation"))
+            options.check_simulation = true;
+        else if (!strcmp(argv[i], "--check-primitives"))
+            options.check_primitives = true;
+        else
+            Log(std::string("### Unknown argument: ") + argv[i] + "\n");
+    }
+
+    VulkanApplication app(options);
+    int exit_code = app.run();
 
     Log("### DONE - Press any key...\n");
     //getchar();
-    return 0;
+    return exit_code;
 }
@@ -0,0 +1,223 @@
+#include "build_options.h"
+#include "platform.h"
+#include "mesh_cache.h"
+#include "Shared.h" // Log
+
+#include <float.h> // FLT_MAX
+#include <stdio.h> // rename, remove
+#include <string.h> // memcpy
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+#define MESH_CACHE_MAGIC 0x4348534D // "MSHC"
+#define BLOB_ALIGNMENT 256
+
+static uint64_t align_up(uint64_t offset)
+{
+    return (offset + BLOB_ALIGNMENT - 1) & ~(uint64_t)(BLOB_ALIGNMENT - 1);
+}
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t final_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    return h ^ (h >> 33);
+}
+
+// 8 bytes at a time, a few GB/s: the file is read once anyway.
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    uint64_t h = seed ^ (size * 0x9E3779B97F4A7C15ull);
+
+    size_t word_count = size / 8;
+    for (size_t i = 0; i < word_count; ++i, p += 8)
+    {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h ^= rotl64(w * 0x87C37B91114253D5ull, 31) * 0x4CF5AD432745937Full;
+        h = rotl64(h, 27) * 5 + 0x52DCE729;
+    }
+
+    if (size & 7)
+    {
+        uint64_t tail = 0;
+        memcpy(&tail, p, size & 7);
+        h ^= rotl64(tail * 0x87C37B91114253D5ull, 31) * 0x4CF5AD432745937Full;
+    }
+
+    return final_mix(h);
+}
+
+bool hash_file(const std::string &file_path, uint64_t *hash)
+{
+    utils::mapped_file file;
+    if (!utils::map_file(file_path, &file))
+        return false;
+
+    *hash = hash_bytes(file.data, file.size);
+    utils::unmap_file(&file);
+    return true;
+}
+
+static void fill_header(const IndexedMesh &mesh, uint64_t source_hash, mesh_cache_header_t *header)
+{
+    *header = mesh_cache_header_t();
+    header->magic = MESH_CACHE_MAGIC;
+    header->version = MESH_CACHE_VERSION;
+    header->source_hash = source_hash;
+    header->vertex_stride = sizeof(Scene::vertex_t);
+    header->index_size = sizeof(Scene::index_t);
+    header->vertex_count = (uint32_t)mesh.first.size();
+    header->index_count = (uint32_t)mesh.second.size();
+    header->vertex_offset = align_up(sizeof(mesh_cache_header_t));
+    header->index_offset = align_up(header->vertex_offset + (uint64_t)header->vertex_count * header->vertex_stride);
+
+    glm::vec3 bounds_min(mesh.first.empty() ? 0.0f : FLT_MAX);
+    glm::vec3 bounds_max(mesh.first.empty() ? 0.0f : -FLT_MAX);
+    for (const auto &v : mesh.first)
+    {
+        bounds_min = glm::min(bounds_min, glm::vec3(v.p));
+        bounds_max = glm::max(bounds_max, glm::vec3(v.p));
+        header->bounding_radius = std::max(header->bounding_radius, glm::length(glm::vec3(v.p)));
+    }
+    memcpy(header->bounds_min, &bounds_min.x, sizeof(header->bounds_min));
+    memcpy(header->bounds_max, &bounds_max.x, sizeof(header->bounds_max));
+
+    for (int c = 0; c < 3; ++c)
+        header->position_scale[c] = 1.0f;
+    for (int c = 0; c < 2; ++c)
+        header->uv_scale[c] = 1.0f;
+}
+
+void create_parent_directory(const std::string &file_path)
+{
+    size_t slash = file_path.find_last_of("/\\");
+    if (slash != std::string::npos)
+        CreateDirectoryA(file_path.substr(0, slash).c_str(), nullptr); // fails if it exists
+}
+
+bool cook_mesh(const std::string &cache_path, uint64_t source_hash, const IndexedMesh &mesh)
+{
+    mesh_cache_header_t header;
+    fill_header(mesh, source_hash, &header);
+
+    create_parent_directory(cache_path);
+
+    // a crash while writing leaves a .tmp, never a truncated cache.
+    std::string temp_path = cache_path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            Log("#     Cannot write " + temp_path + "\n");
+            return false;
+        }
+
+        static const char padding[BLOB_ALIGNMENT] = {};
+        file.write((const char*)&header, sizeof(header));
+        file.write(padding, header.vertex_offset - sizeof(header));
+        file.write((const char*)mesh.first.data(), (std::streamsize)header.vertex_count * header.vertex_stride);
+        file.write(padding, header.index_offset - header.vertex_offset - (uint64_t)header.vertex_count * header.vertex_stride);
+        file.write((const char*)mesh.second.data(), (std::streamsize)header.index_count * header.index_size);
+        if (!file.good())
+        {
+            Log("#     Cannot write " + temp_path + "\n");
+            file.close();
+            remove(temp_path.c_str());
+            return false;
+        }
+    }
+
+    remove(cache_path.c_str());
+    if (rename(temp_path.c_str(), cache_path.c_str()) != 0)
+    {
+        remove(temp_path.c_str());
+        return false;
+    }
+
+    Log("#     Cooked " + cache_path + "\n");
+    return true;
+}
+
+bool open_cooked_mesh(const std::string &cache_path, uint64_t source_hash, cooked_mesh_t *mesh)
+{
+    close_cooked_mesh(mesh);
+
+    if (GetFileAttributesA(cache_path.c_str()) == INVALID_FILE_ATTRIBUTES)
+        return false; // not cooked yet, quietly.
+
+    if (!utils::map_file(cache_path, &mesh->file))
+        return false;
+
+    const mesh_cache_header_t *header = (const mesh_cache_header_t*)mesh->file.data;
+    bool valid = mesh->file.size >= sizeof(mesh_cache_header_t)
+        && header->magic == MESH_CACHE_MAGIC
+        && header->version == MESH_CACHE_VERSION
+        && header->source_hash == source_hash
+        && header->vertex_stride == sizeof(Scene::vertex_t)
+        && header->index_size == sizeof(Scene::index_t)
+        && header->vertex_offset % BLOB_ALIGNMENT == 0
+        && header->index_offset % BLOB_ALIGNMENT == 0
+        && header->vertex_offset + (uint64_t)header->vertex_count * header->vertex_stride <= mesh->file.size
+        && header->index_offset + (uint64_t)header->index_count * header->index_size <= mesh->file.size;
+    if (!valid)
+    {
+        Log("#     Stale or invalid " + cache_path + "\n");
+        close_cooked_mesh(mesh);
+        return false;
+    }
+
+    mesh->header = header;
+    mesh->vertices = (const Scene::vertex_t*)(mesh->file.data + header->vertex_offset);
+    mesh->indices = (const Scene::index_t*)(mesh->file.data + header->index_offset);
+    return true;
+}
+
+void close_cooked_mesh(cooked_mesh_t *mesh)
+{
+    utils::unmap_file(&mesh->file);
+    mesh->header = nullptr;
+    mesh->vertices = nullptr;
+    mesh->indices = nullptr;
+    mesh->produced = IndexedMesh();
+}
+
+bool load_cooked_mesh(const std::string &cache_path, uint64_t source_hash,
+    const std::function<bool(IndexedMesh *)> &produce, cooked_mesh_t *mesh)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    if (open_cooked_mesh(cache_path, source_hash, mesh))
+    {
+        float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        Log("#     " + cache_path + ": " + std::to_string(mesh->header->vertex_count) + " vertices, "
+            + std::to_string(mesh->header->index_count) + " indices, mapped in " + std::to_string(ms) + " ms\n");
+        return true;
+    }
+
+    IndexedMesh produced;
+    if (!produce(&produced))
+        return false;
+
+    if (cook_mesh(cache_path, source_hash, produced) && open_cooked_mesh(cache_path, source_hash, mesh))
+        return true;
+
+    // not cooked, served from memory this time.
+    close_cooked_mesh(mesh);
+    mesh->produced = std::move(produced);
+    fill_header(mesh->produced, source_hash, &mesh->produced_header);
+    mesh->header = &mesh->produced_header;
+    mesh->vertices = mesh->produced.first.data();
+    mesh->indices = mesh->produced.second.data();
+    return true;
+}
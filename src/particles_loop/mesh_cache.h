@@ -0,0 +1,73 @@
+#ifndef _VULKAN_MESH_CACHE_H_
+#define _VULKAN_MESH_CACHE_H_
+
+#include <stdint.h> // uint32_t
+
+#include "utils.h" // IndexedMesh, mapped_file
+
+#include <functional>
+#include <string>
+
+//
+// Cooked meshes: the vertices and indices already in the layout of the
+// global VBO/IBO, after a header. The blobs are aligned, a loaded mesh is
+// the mapping of the file, its pointers go straight to the staging copy.
+//
+// A cooked file is valid for one source hash (of the source file, or of
+// the parameters of a generated mesh) and one MESH_CACHE_VERSION. Anything
+// else is cooked again from the source.
+//
+
+// Bump with any change of the layout, of vertex_t or of what an importer outputs.
+#define MESH_CACHE_VERSION 2
+
+struct mesh_cache_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_hash;
+
+    uint32_t vertex_stride; // sizeof(Scene::vertex_t)
+    uint32_t index_size;    // sizeof(Scene::index_t)
+    uint32_t vertex_count;
+    uint32_t index_count;
+    uint64_t vertex_offset; // from the start of the file
+    uint64_t index_offset;
+
+    float bounds_min[3];
+    float bounds_max[3];
+    float bounding_radius;  // around the mesh origin
+
+    // stored * scale + offset, for quantized layouts. 1 and 0 for floats.
+    float position_scale[3];
+    float position_offset[3];
+    float uv_scale[2];
+    float uv_offset[2];
+};
+
+struct cooked_mesh_t
+{
+    utils::mapped_file file;
+    const mesh_cache_header_t *header = nullptr;
+    const Scene::vertex_t *vertices = nullptr; // header->vertex_count
+    const Scene::index_t *indices = nullptr;   // header->index_count
+
+    // not cooked: the cache could not be written.
+    mesh_cache_header_t produced_header = {};
+    IndexedMesh produced;
+};
+
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = 0);
+bool hash_file(const std::string &file_path, uint64_t *hash);
+void create_parent_directory(const std::string &file_path); // one level
+
+bool cook_mesh(const std::string &cache_path, uint64_t source_hash, const IndexedMesh &mesh);
+// false if missing, of another version or of another source.
+bool open_cooked_mesh(const std::string &cache_path, uint64_t source_hash, cooked_mesh_t *mesh);
+void close_cooked_mesh(cooked_mesh_t *mesh);
+
+// The cooked mesh, after running produce() and cooking its result when there is none valid.
+bool load_cooked_mesh(const std::string &cache_path, uint64_t source_hash,
+    const std::function<bool(IndexedMesh *)> &produce, cooked_mesh_t *mesh);
+
+#endif // _VULKAN_MESH_CACHE_H_
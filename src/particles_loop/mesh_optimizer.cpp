@@ -0,0 +1,334 @@
+#include "build_options.h"
+#include "platform.h"
+#include "mesh_optimizer.h"
+#include "Shared.h" // Log
+
+#include <algorithm>
+#include <chrono>
+
+static const uint32_t NO_VERTEX = UINT32_MAX;
+
+vertex_cache_stats_t analyze_vertex_cache(const Scene::index_t *indices, size_t index_count, size_t vertex_count, uint32_t cache_size)
+{
+    vertex_cache_stats_t stats;
+    if (index_count < 3 || vertex_count == 0)
+        return stats;
+
+    // a vertex is in the cache while less than cache_size misses came after its own.
+    std::vector<uint32_t> miss_time(vertex_count, 0);
+    std::vector<bool> used(vertex_count, false);
+    uint32_t time = cache_size + 1;
+    uint32_t miss_count = 0;
+    uint32_t used_count = 0;
+
+    for (size_t i = 0; i < index_count; ++i)
+    {
+        Scene::index_t v = indices[i];
+        if (time - miss_time[v] > cache_size)
+        {
+            miss_time[v] = time++;
+            ++miss_count;
+        }
+        if (!used[v])
+        {
+            used[v] = true;
+            ++used_count;
+        }
+    }
+
+    stats.acmr = (float)miss_count / (float)(index_count / 3);
+    stats.atvr = (float)miss_count / (float)used_count;
+    return stats;
+}
+
+void optimize_vertex_cache(IndexList *indices, size_t vertex_count, uint32_t cache_size)
+{
+    const size_t triangle_count = indices->size() / 3;
+    if (triangle_count == 0)
+        return;
+
+    const IndexList &in = *indices;
+
+    // triangles around each vertex, and how many are still to emit.
+    std::vector<uint32_t> live(vertex_count, 0);
+    for (Scene::index_t v : in)
+        ++live[v];
+
+    std::vector<uint32_t> first_triangle(vertex_count + 1, 0);
+    for (size_t v = 0; v < vertex_count; ++v)
+        first_triangle[v + 1] = first_triangle[v] + live[v];
+
+    std::vector<uint32_t> adjacency(in.size());
+    {
+        std::vector<uint32_t> fill(first_triangle.begin(), first_triangle.end() - 1);
+        for (size_t i = 0; i < in.size(); ++i)
+            adjacency[fill[in[i]]++] = (uint32_t)(i / 3);
+    }
+
+    std::vector<uint32_t> cache_time(vertex_count, 0);
+    std::vector<bool> emitted(triangle_count, false);
+    std::vector<uint32_t> dead_end; // recently used vertices, to restart from
+    std::vector<uint32_t> candidates;
+    IndexList out;
+    out.reserve(in.size());
+
+    uint32_t time = cache_size + 1;
+    size_t cursor = 0;
+    uint32_t fan = in[0];
+
+    while (fan != NO_VERTEX)
+    {
+        candidates.clear();
+        for (uint32_t a = first_triangle[fan]; a < first_triangle[fan + 1]; ++a)
+        {
+            uint32_t t = adjacency[a];
+            if (emitted[t])
+                continue;
+            emitted[t] = true;
+
+            for (uint32_t c = 0; c < 3; ++c)
+            {
+                Scene::index_t v = in[t * 3 + c];
+                out.push_back(v);
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                if (time - cache_time[v] > cache_size)
+                    cache_time[v] = time++;
+            }
+        }
+
+        // the candidate longest in the cache which will still be there
+        // after its remaining triangles are emitted.
+        fan = NO_VERTEX;
+        int32_t best_priority = -1;
+        for (uint32_t v : candidates)
+        {
+            if (live[v] == 0)
+                continue;
+            int32_t priority = 0;
+            if (time - cache_time[v] + 2 * live[v] <= cache_size)
+                priority = (int32_t)(time - cache_time[v]);
+            if (priority > best_priority)
+            {
+                best_priority = priority;
+                fan = v;
+            }
+        }
+
+        // dead end: a vertex used recently, else the next one in the input.
+        while (fan == NO_VERTEX && !dead_end.empty())
+        {
+            uint32_t v = dead_end.back();
+            dead_end.pop_back();
+            if (live[v] > 0)
+                fan = v;
+        }
+        while (fan == NO_VERTEX && cursor < vertex_count)
+        {
+            if (live[cursor] > 0)
+                fan = (uint32_t)cursor;
+            ++cursor;
+        }
+    }
+
+    *indices = std::move(out);
+}
+
+uint32_t optimize_overdraw(IndexList *indices, const VertexList &vertices, uint32_t cache_size, float overdraw_threshold)
+{
+    return optimize_overdraw(indices, vertices.size(), [&](Scene::index_t v) { return glm::vec3(vertices[v].p); },
+        cache_size, overdraw_threshold);
+}
+
+uint32_t optimize_overdraw(IndexList *indices, size_t vertex_count, const vertex_position_t &position,
+    uint32_t cache_size, float overdraw_threshold)
+{
+    const size_t triangle_count = indices->size() / 3;
+    if (triangle_count < 2)
+        return (uint32_t)triangle_count;
+
+    const IndexList &in = *indices;
+
+    // simulated cache, restarted at each cluster.
+    std::vector<uint32_t> miss_time(vertex_count, 0);
+    uint32_t time = cache_size + 1;
+    auto misses = [&](size_t t) {
+        uint32_t count = 0;
+        for (uint32_t c = 0; c < 3; ++c)
+        {
+            Scene::index_t v = in[t * 3 + c];
+            if (time - miss_time[v] > cache_size)
+            {
+                miss_time[v] = time++;
+                ++count;
+            }
+        }
+        return count;
+    };
+    auto flush = [&]() { time += cache_size + 1; };
+
+    // hard boundaries: the triangles missing all their vertices, the cache restarts there anyway.
+    std::vector<uint32_t> hard;
+    for (size_t t = 0; t < triangle_count; ++t)
+        if (misses(t) == 3)
+            hard.push_back((uint32_t)t);
+    hard.push_back((uint32_t)triangle_count);
+
+    // soft boundaries: inside a hard cluster, wherever the ACMR so far stays
+    // within the threshold of the ACMR of the whole cluster.
+    std::vector<uint32_t> clusters;
+    for (size_t h = 0; h + 1 < hard.size(); ++h)
+    {
+        uint32_t begin = hard[h];
+        uint32_t end = hard[h + 1];
+
+        flush();
+        uint32_t cluster_misses = 0;
+        for (uint32_t t = begin; t < end; ++t)
+            cluster_misses += misses(t);
+        float cluster_acmr = (float)cluster_misses / (float)(end - begin);
+
+        flush();
+        clusters.push_back(begin);
+        uint32_t start = begin;
+        uint32_t running_misses = 0;
+        for (uint32_t t = begin; t < end; ++t)
+        {
+            running_misses += misses(t);
+            float running_acmr = (float)running_misses / (float)(t - start + 1);
+            if (t + 1 < end && running_acmr <= cluster_acmr * overdraw_threshold)
+            {
+                clusters.push_back(t + 1);
+                start = t + 1;
+                running_misses = 0;
+                flush();
+            }
+        }
+    }
+    clusters.push_back((uint32_t)triangle_count);
+
+    // outward facing first: the sort key is how far the cluster is from the
+    // center of the mesh, along its average normal.
+    glm::vec3 mesh_centroid(0.0f);
+    float mesh_area = 0.0f;
+    struct cluster_t
+    {
+        uint32_t begin;
+        uint32_t end;
+        glm::vec3 centroid;
+        glm::vec3 normal;
+        float sort_key;
+    };
+    std::vector<cluster_t> sorted(clusters.size() - 1);
+    for (size_t c = 0; c + 1 < clusters.size(); ++c)
+    {
+        cluster_t &cluster = sorted[c];
+        cluster.begin = clusters[c];
+        cluster.end = clusters[c + 1];
+        cluster.centroid = glm::vec3(0.0f);
+        cluster.normal = glm::vec3(0.0f);
+
+        float area = 0.0f;
+        for (uint32_t t = cluster.begin; t < cluster.end; ++t)
+        {
+            glm::vec3 p0 = position(in[t * 3 + 0]);
+            glm::vec3 p1 = position(in[t * 3 + 1]);
+            glm::vec3 p2 = position(in[t * 3 + 2]);
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0); // 2 * area
+            float a = glm::length(n);
+            cluster.centroid += (p0 + p1 + p2) * (a / 3.0f);
+            cluster.normal += n;
+            area += a;
+        }
+
+        mesh_centroid += cluster.centroid;
+        mesh_area += area;
+        if (area > 0.0f)
+            cluster.centroid /= area;
+        float normal_length = glm::length(cluster.normal);
+        if (normal_length > 0.0f)
+            cluster.normal /= normal_length;
+    }
+    if (mesh_area > 0.0f)
+        mesh_centroid /= mesh_area;
+
+    for (cluster_t &cluster : sorted)
+        cluster.sort_key = glm::dot(cluster.centroid - mesh_centroid, cluster.normal);
+
+    std::stable_sort(sorted.begin(), sorted.end(), [](const cluster_t &a, const cluster_t &b) {
+        return a.sort_key > b.sort_key;
+    });
+
+    IndexList out;
+    out.reserve(in.size());
+    for (const cluster_t &cluster : sorted)
+        out.insert(out.end(), in.begin() + cluster.begin * 3, in.begin() + cluster.end * 3);
+
+    *indices = std::move(out);
+    return (uint32_t)sorted.size();
+}
+
+static void reorder_vertices(VertexList *vertices, const IndexList &fetch_order)
+{
+    VertexList out(fetch_order.size());
+    for (size_t v = 0; v < fetch_order.size(); ++v)
+        out[v] = (*vertices)[fetch_order[v]];
+    *vertices = std::move(out);
+}
+
+void optimize_vertex_fetch(IndexedMesh *mesh)
+{
+    IndexList fetch_order;
+    optimize_vertex_fetch(&mesh->second, mesh->first.size(), &fetch_order);
+    reorder_vertices(&mesh->first, fetch_order);
+}
+
+void optimize_vertex_fetch(IndexList *indices, size_t vertex_count, IndexList *fetch_order)
+{
+    std::vector<uint32_t> remap(vertex_count, NO_VERTEX);
+    fetch_order->clear();
+    fetch_order->reserve(vertex_count);
+
+    for (Scene::index_t &v : *indices)
+    {
+        if (remap[v] == NO_VERTEX)
+        {
+            remap[v] = (uint32_t)fetch_order->size();
+            fetch_order->push_back(v);
+        }
+        v = remap[v];
+    }
+}
+
+void optimize_mesh(IndexedMesh *mesh, const std::string &name, mesh_optimize_stats_t *stats)
+{
+    const VertexList &vertices = mesh->first;
+    IndexList fetch_order;
+    optimize_mesh(&mesh->second, vertices.size(), [&](Scene::index_t v) { return glm::vec3(vertices[v].p); },
+        &fetch_order, name, stats);
+    reorder_vertices(&mesh->first, fetch_order);
+}
+
+void optimize_mesh(IndexList *indices, size_t vertex_count, const vertex_position_t &position, IndexList *fetch_order,
+    const std::string &name, mesh_optimize_stats_t *stats)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    mesh_optimize_stats_t s;
+    s.before = analyze_vertex_cache(indices->data(), indices->size(), vertex_count);
+
+    optimize_vertex_cache(indices, vertex_count);
+    s.cluster_count = optimize_overdraw(indices, vertex_count, position);
+    optimize_vertex_fetch(indices, vertex_count, fetch_order);
+
+    s.after = analyze_vertex_cache(indices->data(), indices->size(), fetch_order->size());
+    s.total_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    Log("#     Optimized " + name + ": ACMR " + std::to_string(s.before.acmr) + " -> " + std::to_string(s.after.acmr)
+        + ", ATVR " + std::to_string(s.before.atvr) + " -> " + std::to_string(s.after.atvr)
+        + ", " + std::to_string(s.cluster_count) + " clusters, " + std::to_string(s.total_ms) + " ms\n");
+
+    if (stats)
+        *stats = s;
+}
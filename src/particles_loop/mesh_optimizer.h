@@ -0,0 +1,59 @@
+#ifndef _VULKAN_MESH_OPTIMIZER_H_
+#define _VULKAN_MESH_OPTIMIZER_H_
+
+#include "utils.h" // IndexedMesh
+
+#include <functional>
+#include <string>
+
+//
+// Reordering of meshes for the GPU, before they go to the scene.
+// Nothing is added nor removed but the vertices no triangle uses.
+//
+// 1. Vertex cache: the triangles in Tipsify order (Sander et al. 2007), a
+//    fan around one vertex after the other, chosen among the vertices still
+//    in a simulated FIFO cache of cache_size.
+// 2. Overdraw: that order is cut into clusters where the cache restarts
+//    anyway or where it costs less than overdraw_threshold in ACMR, and the
+//    clusters facing outward are moved first so they occlude the others.
+// 3. Vertex fetch: the vertices in the order of their first use.
+//
+// ACMR: vertex shader invocations per triangle, 0.5 at best for a
+// regular grid, 3 at worst. ATVR: invocations per vertex, 1 at best.
+//
+struct vertex_cache_stats_t
+{
+    float acmr = 0.0f;
+    float atvr = 0.0f;
+};
+
+struct mesh_optimize_stats_t
+{
+    vertex_cache_stats_t before;
+    vertex_cache_stats_t after;
+    uint32_t cluster_count = 0;
+    float total_ms = 0.0f;
+};
+
+// For the meshes whose vertices are read in place, not in a VertexList.
+using vertex_position_t = std::function<glm::vec3(Scene::index_t)>;
+
+// FIFO post-transform cache simulation.
+vertex_cache_stats_t analyze_vertex_cache(const Scene::index_t *indices, size_t index_count, size_t vertex_count, uint32_t cache_size = 16);
+
+void optimize_vertex_cache(IndexList *indices, size_t vertex_count, uint32_t cache_size = 16);
+// indices: in vertex cache order. Returns the number of clusters.
+uint32_t optimize_overdraw(IndexList *indices, const VertexList &vertices, uint32_t cache_size = 16, float overdraw_threshold = 1.05f);
+uint32_t optimize_overdraw(IndexList *indices, size_t vertex_count, const vertex_position_t &position,
+    uint32_t cache_size = 16, float overdraw_threshold = 1.05f);
+void optimize_vertex_fetch(IndexedMesh *mesh);
+// fetch_order: the source vertex of each vertex, the unused ones are left out.
+void optimize_vertex_fetch(IndexList *indices, size_t vertex_count, IndexList *fetch_order);
+
+// The three of them, with a Log of the ACMR/ATVR before and after.
+void optimize_mesh(IndexedMesh *mesh, const std::string &name, mesh_optimize_stats_t *stats = nullptr);
+// Same, only the indices change: the vertices are to be written in fetch_order.
+void optimize_mesh(IndexList *indices, size_t vertex_count, const vertex_position_t &position, IndexList *fetch_order,
+    const std::string &name, mesh_optimize_stats_t *stats = nullptr);
+
+#endif // _VULKAN_MESH_OPTIMIZER_H_
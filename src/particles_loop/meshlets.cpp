@@ -0,0 +1,123 @@
+#include "build_options.h"
+#include "platform.h"
+#include "meshlets.h"
+#include "Shared.h" // Log
+
+#include <float.h> // FLT_MAX
+#include <math.h>
+
+#include <algorithm>
+#include <array>
+
+static const float MIN_CONE_DOT = 0.1f; // cos of ~84 degrees
+
+// bounding sphere, cone and range of the triangles [first, first + count[.
+static Scene::meshlet_t make_meshlet(const Scene::vertex_t *vertices, const Scene::index_t *indices, uint32_t first_triangle, uint32_t triangle_count)
+{
+    const Scene::index_t *tri = indices + first_triangle * 3;
+
+    glm::vec3 box_min(FLT_MAX);
+    glm::vec3 box_max(-FLT_MAX);
+    for (uint32_t i = 0; i < triangle_count * 3; ++i)
+    {
+        glm::vec3 p = glm::vec3(vertices[tri[i]].p);
+        box_min = glm::min(box_min, p);
+        box_max = glm::max(box_max, p);
+    }
+
+    glm::vec3 center = (box_min + box_max) * 0.5f;
+    float radius = 0.0f;
+    for (uint32_t i = 0; i < triangle_count * 3; ++i)
+        radius = std::max(radius, glm::length(glm::vec3(vertices[tri[i]].p) - center));
+
+    // the same normals as the overdraw sort: cross(p1 - p0, p2 - p0), outward.
+    std::array<glm::vec3, MESHLET_MAX_TRIANGLES> normals;
+    uint32_t normal_count = 0;
+    glm::vec3 axis(0.0f);
+    for (uint32_t t = 0; t < triangle_count; ++t)
+    {
+        glm::vec3 p0 = glm::vec3(vertices[tri[t * 3 + 0]].p);
+        glm::vec3 p1 = glm::vec3(vertices[tri[t * 3 + 1]].p);
+        glm::vec3 p2 = glm::vec3(vertices[tri[t * 3 + 2]].p);
+        glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+        float length = glm::length(n);
+        if (length <= 0.0f)
+            continue; // degenerate, never drawn
+        normals[normal_count++] = n / length;
+        axis += n / length;
+    }
+
+    float cutoff = 1.0f;
+    float axis_length = glm::length(axis);
+    if (normal_count > 0 && axis_length > 0.0f)
+    {
+        axis /= axis_length;
+        float min_dot = 1.0f;
+        for (uint32_t i = 0; i < normal_count; ++i)
+            min_dot = std::min(min_dot, glm::dot(axis, normals[i]));
+        if (min_dot > MIN_CONE_DOT)
+            cutoff = sqrtf(1.0f - min_dot * min_dot);
+    }
+
+    Scene::meshlet_t meshlet = {};
+    meshlet.sphere = glm::vec4(center, radius);
+    meshlet.cone = glm::vec4(axis, cutoff);
+    meshlet.first_index = first_triangle * 3;
+    meshlet.index_count = triangle_count * 3;
+    return meshlet;
+}
+
+void build_meshlets(const Scene::vertex_t *vertices, uint32_t vertex_count,
+    const Scene::index_t *indices, uint32_t index_count, std::vector<Scene::meshlet_t> *meshlets)
+{
+    meshlets->clear();
+
+    const uint32_t triangle_count = index_count / 3;
+    if (triangle_count == 0)
+        return;
+
+    // the meshlet a vertex was last counted in.
+    std::vector<uint32_t> owner(vertex_count, UINT32_MAX);
+
+    uint32_t first = 0;
+    uint32_t meshlet_vertex_count = 0;
+    for (uint32_t t = 0; t < triangle_count; ++t)
+    {
+        const uint32_t id = (uint32_t)meshlets->size();
+        const Scene::index_t *tri = indices + t * 3;
+
+        uint32_t new_vertex_count = 0;
+        for (uint32_t c = 0; c < 3; ++c)
+        {
+            bool repeated = (c > 0 && tri[c] == tri[0]) || (c > 1 && tri[c] == tri[1]);
+            if (owner[tri[c]] != id && !repeated)
+                ++new_vertex_count;
+        }
+
+        const uint32_t count = t - first;
+        bool full = count == MESHLET_MAX_TRIANGLES
+            || meshlet_vertex_count + new_vertex_count > MESHLET_MAX_VERTICES;
+        bool disconnected = new_vertex_count == 3 && count >= MESHLET_MAX_TRIANGLES / 4;
+        if (count > 0 && (full || disconnected))
+        {
+            meshlets->push_back(make_meshlet(vertices, indices, first, count));
+            first = t;
+            meshlet_vertex_count = 0;
+            --t; // again, in the new meshlet
+            continue;
+        }
+
+        for (uint32_t c = 0; c < 3; ++c)
+        {
+            if (owner[tri[c]] != id)
+            {
+                owner[tri[c]] = id;
+                ++meshlet_vertex_count;
+            }
+        }
+    }
+    meshlets->push_back(make_meshlet(vertices, indices, first, triangle_count - first));
+
+    Log("#     " + std::to_string(meshlets->size()) + " meshlets, "
+        + std::to_string((float)triangle_count / meshlets->size()) + " triangles each\n");
+}
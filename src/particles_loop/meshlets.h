@@ -0,0 +1,30 @@
+#ifndef _VULKAN_MESHLETS_H_
+#define _VULKAN_MESHLETS_H_
+
+#include <stdint.h> // uint32_t
+
+#include "utils.h" // Scene::vertex_t, index_t, meshlet_t
+
+#include <vector>
+
+//
+// Meshlets for the cluster culling pass of the scene: runs of consecutive
+// triangles of an index buffer, up to MESHLET_MAX_VERTICES distinct
+// vertices and MESHLET_MAX_TRIANGLES triangles. A run also ends at a
+// triangle sharing no vertex with it, once it is a quarter full.
+//
+// The triangles are not reordered: build them after optimize_mesh(), whose
+// vertex cache order keeps neighbours together, or on a cooked mesh.
+//
+// Each meshlet has a bounding sphere and a cone around the normals of its
+// triangles, whose cutoff is the sine of the cone half angle: back facing
+// from where dot(center - eye, axis) >= cutoff * |center - eye| + radius.
+// A normal more than ~84 degrees from the axis gives no cone, cutoff 1.
+//
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+void build_meshlets(const Scene::vertex_t *vertices, uint32_t vertex_count,
+    const Scene::index_t *indices, uint32_t index_count, std::vector<Scene::meshlet_t> *meshlets);
+
+#endif // _VULKAN_MESHLETS_H_
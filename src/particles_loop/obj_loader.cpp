@@ -0,0 +1,541 @@
+#include "build_options.h"
+#include "platform.h"
+#include "obj_loader.h"
+#include "thread_pool.h"
+#include "Shared.h" // Log
+
+#include <math.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+// chunks per thread, for the balance, and their least size.
+static const uint32_t CHUNKS_PER_THREAD = 8;
+static const size_t MIN_CHUNK_SIZE = 1024 * 1024;
+
+// Face indices while parsing: 1-based as in the file, or relative ones
+// (negative in the file) from the first element of the chunk, whose count
+// is only known once all the chunks are parsed. 0 = none.
+static const uint32_t NO_INDEX = 0;
+static const uint32_t RELATIVE_BIT = 0x80000000u;
+static const int64_t RELATIVE_BIAS = 0x40000000;
+
+namespace
+{
+    struct obj_corner_t
+    {
+        uint32_t v;
+        uint32_t vt;
+        uint32_t vn;
+
+        bool operator==(const obj_corner_t &o) const { return v == o.v && vt == o.vt && vn == o.vn; }
+    };
+
+    struct obj_chunk_t
+    {
+        const char *begin = nullptr;
+        const char *end = nullptr;
+
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec2> uvs;
+        std::vector<glm::vec3> normals;
+        std::vector<obj_corner_t> corners; // 3 per triangle
+        uint32_t bad_line_count = 0;
+
+        // in the whole file, before this chunk.
+        uint32_t first_position = 0;
+        uint32_t first_uv = 0;
+        uint32_t first_normal = 0;
+    };
+
+    //
+    // Parsing, no locale, no allocation
+    //
+
+    inline bool is_blank(char c) { return c == ' ' || c == '\t'; }
+    inline bool is_digit(char c) { return (unsigned)(c - '0') < 10; }
+    inline bool is_line_end(char c) { return c == '\n' || c == '\r' || c == '#'; }
+
+    inline const char *skip_blanks(const char *p, const char *end)
+    {
+        while (p < end && is_blank(*p))
+            ++p;
+        return p;
+    }
+
+    inline const char *next_line(const char *p, const char *end)
+    {
+        while (p < end && *p != '\n')
+            ++p;
+        return p < end ? p + 1 : end;
+    }
+
+    // [-+]digits[.digits][(e|E)[-+]digits], nullptr if it is not a number.
+    const char *parse_float(const char *p, const char *end, float *value)
+    {
+        static const double powers_of_10[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = (*p++ == '-');
+
+        // 19 significant digits fit in 64 bits.
+        uint64_t mantissa = 0;
+        int significant_digits = 0;
+        int exponent = 0;
+        bool any_digit = false;
+        for (; p < end && is_digit(*p); ++p)
+        {
+            any_digit = true;
+            if (significant_digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                significant_digits += mantissa != 0;
+            }
+            else
+            {
+                ++exponent;
+            }
+        }
+        if (p < end && *p == '.')
+        {
+            for (++p; p < end && is_digit(*p); ++p)
+            {
+                any_digit = true;
+                if (significant_digits < 19)
+                {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    significant_digits += mantissa != 0;
+                    --exponent;
+                }
+            }
+        }
+        if (!any_digit)
+            return nullptr;
+
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            ++p;
+            bool negative_exponent = false;
+            if (p < end && (*p == '-' || *p == '+'))
+                negative_exponent = (*p++ == '-');
+            if (p == end || !is_digit(*p))
+                return nullptr;
+            int e = 0;
+            for (; p < end && is_digit(*p); ++p)
+                e = std::min(e * 10 + (*p - '0'), 10000);
+            exponent += negative_exponent ? -e : e;
+        }
+
+        double x = (double)mantissa;
+        if (exponent < 0)
+            x = exponent >= -22 ? x / powers_of_10[-exponent] : x * pow(10.0, exponent);
+        else if (exponent > 0)
+            x = exponent <= 22 ? x * powers_of_10[exponent] : x * pow(10.0, exponent);
+
+        *value = (float)(negative ? -x : x);
+        return p;
+    }
+
+    // Up to count blank separated floats, the others are 0.
+    const char *parse_floats(const char *p, const char *end, float *values, int count, int min_count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            p = skip_blanks(p, end);
+            const char *next = (p < end && !is_line_end(*p)) ? parse_float(p, end, &values[i]) : nullptr;
+            if (!next)
+            {
+                if (i < min_count)
+                    return nullptr;
+                for (; i < count; ++i)
+                    values[i] = 0.0f;
+                return p;
+            }
+            p = next;
+        }
+        return p;
+    }
+
+    // One face index: see NO_INDEX. local_count: elements of the chunk so far.
+    const char *parse_index(const char *p, const char *end, uint32_t local_count, uint32_t *index)
+    {
+        bool negative = false;
+        if (p < end && *p == '-')
+        {
+            negative = true;
+            ++p;
+        }
+        if (p == end || !is_digit(*p))
+            return nullptr;
+
+        int64_t i = 0;
+        for (; p < end && is_digit(*p); ++p)
+            i = std::min<int64_t>(i * 10 + (*p - '0'), RELATIVE_BIAS);
+
+        if (i == 0 || i >= RELATIVE_BIAS)
+            return nullptr;
+
+        *index = negative ? RELATIVE_BIT | (uint32_t)((int64_t)local_count - i + RELATIVE_BIAS) : (uint32_t)i;
+        return p;
+    }
+
+    // v[/[vt][/vn]]
+    const char *parse_corner(const char *p, const char *end, const obj_chunk_t &chunk, obj_corner_t *corner)
+    {
+        *corner = { NO_INDEX, NO_INDEX, NO_INDEX };
+
+        p = parse_index(p, end, (uint32_t)chunk.positions.size(), &corner->v);
+        if (!p || p == end || *p != '/')
+            return p;
+
+        ++p;
+        if (p < end && *p != '/')
+        {
+            p = parse_index(p, end, (uint32_t)chunk.uvs.size(), &corner->vt);
+            if (!p || p == end || *p != '/')
+                return p;
+        }
+
+        return parse_index(p + 1, end, (uint32_t)chunk.normals.size(), &corner->vn);
+    }
+
+    void parse_chunk(obj_chunk_t *chunk)
+    {
+        std::vector<obj_corner_t> polygon;
+
+        const char *end = chunk->end;
+        for (const char *p = chunk->begin; p < end; p = next_line(p, end))
+        {
+            p = skip_blanks(p, end);
+            ptrdiff_t left = end - p;
+
+            if (left > 2 && p[0] == 'v' && is_blank(p[1]))
+            {
+                glm::vec3 v;
+                if (parse_floats(p + 2, end, &v.x, 3, 3))
+                    chunk->positions.push_back(v);
+                else
+                    ++chunk->bad_line_count;
+            }
+            else if (left > 3 && p[0] == 'v' && p[1] == 't' && is_blank(p[2]))
+            {
+                glm::vec2 vt;
+                if (parse_floats(p + 3, end, &vt.x, 2, 1))
+                    chunk->uvs.push_back(vt);
+                else
+                    ++chunk->bad_line_count;
+            }
+            else if (left > 3 && p[0] == 'v' && p[1] == 'n' && is_blank(p[2]))
+            {
+                glm::vec3 vn;
+                if (parse_floats(p + 3, end, &vn.x, 3, 3))
+                    chunk->normals.push_back(vn);
+                else
+                    ++chunk->bad_line_count;
+            }
+            else if (left > 2 && p[0] == 'f' && is_blank(p[1]))
+            {
+                polygon.clear();
+                const char *q = skip_blanks(p + 2, end);
+                while (q && q < end && !is_line_end(*q))
+                {
+                    obj_corner_t corner;
+                    q = parse_corner(q, end, *chunk, &corner);
+                    if (!q || (q < end && !is_blank(*q) && !is_line_end(*q)))
+                        q = nullptr;
+                    else
+                    {
+                        polygon.push_back(corner);
+                        q = skip_blanks(q, end);
+                    }
+                }
+
+                if (!q || polygon.size() < 3)
+                {
+                    ++chunk->bad_line_count;
+                    continue;
+                }
+
+                // fan
+                for (size_t i = 1; i + 1 < polygon.size(); ++i)
+                {
+                    chunk->corners.push_back(polygon[0]);
+                    chunk->corners.push_back(polygon[i]);
+                    chunk->corners.push_back(polygon[i + 1]);
+                }
+            }
+        }
+    }
+
+    // To a 0-based index in the whole file, UINT32_MAX for none.
+    inline bool resolve_index(uint32_t *index, uint32_t first, uint32_t total)
+    {
+        if (*index == NO_INDEX)
+        {
+            *index = UINT32_MAX;
+            return true;
+        }
+
+        int64_t i = (*index & RELATIVE_BIT)
+            ? (int64_t)first + (int64_t)(*index & ~RELATIVE_BIT) - RELATIVE_BIAS
+            : (int64_t)*index - 1;
+        if (i < 0 || i >= (int64_t)total)
+            return false;
+
+        *index = (uint32_t)i;
+        return true;
+    }
+
+    inline uint32_t hash_corner(const obj_corner_t &c)
+    {
+        uint32_t h = c.v * 0x9E3779B1u;
+        h = (h ^ (h >> 15) ^ c.vt) * 0x85EBCA77u;
+        h = (h ^ (h >> 13) ^ c.vn) * 0xC2B2AE3Du;
+        return h ^ (h >> 16);
+    }
+
+    // Open addressing, the slots are indices into the unique corners.
+    class corner_welder
+    {
+    public:
+        explicit corner_welder(size_t expected_count)
+        {
+            _unique.reserve(expected_count);
+            grow(std::max<size_t>(expected_count * 2, 1024));
+        }
+
+        uint32_t insert(const obj_corner_t &corner)
+        {
+            for (size_t slot = hash_corner(corner) & _mask;; slot = (slot + 1) & _mask)
+            {
+                uint32_t index = _slots[slot];
+                if (index == UINT32_MAX)
+                {
+                    index = (uint32_t)_unique.size();
+                    _slots[slot] = index;
+                    _unique.push_back(corner);
+                    if (_unique.size() * 2 > _slots.size())
+                        grow(_slots.size() * 2);
+                    return index;
+                }
+                if (_unique[index] == corner)
+                    return index;
+            }
+        }
+
+        const std::vector<obj_corner_t> &unique() const { return _unique; }
+
+    private:
+        void grow(size_t min_slot_count)
+        {
+            size_t slot_count = 1;
+            while (slot_count < min_slot_count)
+                slot_count <<= 1;
+
+            _slots.assign(slot_count, UINT32_MAX);
+            _mask = slot_count - 1;
+            for (uint32_t i = 0; i < (uint32_t)_unique.size(); ++i)
+            {
+                size_t slot = hash_corner(_unique[i]) & _mask;
+                while (_slots[slot] != UINT32_MAX)
+                    slot = (slot + 1) & _mask;
+                _slots[slot] = i;
+            }
+        }
+
+        std::vector<uint32_t> _slots;
+        size_t _mask = 0;
+        std::vector<obj_corner_t> _unique;
+    };
+
+    float ms_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+bool load_obj(const std::string &file_path, IndexedMesh *mesh, ThreadPool *pool, obj_load_stats_t *stats)
+{
+    Log("#     Load OBJ " + file_path + "\n");
+
+    auto start = std::chrono::steady_clock::now();
+
+    utils::mapped_file file;
+    if (!utils::map_file(file_path, &file))
+        return false;
+
+    std::unique_ptr<ThreadPool> local_pool;
+    if (!pool)
+    {
+        local_pool.reset(new ThreadPool());
+        pool = local_pool.get();
+    }
+
+    //
+    // Chunks at line starts, parsed in parallel
+    //
+
+    size_t chunk_count = std::min<size_t>(file.size / MIN_CHUNK_SIZE + 1, pool->thread_count() * CHUNKS_PER_THREAD);
+    std::vector<obj_chunk_t> chunks(chunk_count);
+    const char *file_end = file.data + file.size;
+    for (size_t c = 0; c < chunk_count; ++c)
+    {
+        const char *begin = file.data + file.size * c / chunk_count;
+        if (c > 0 && begin[-1] != '\n')
+            begin = next_line(begin, file_end);
+        chunks[c].begin = std::max(begin, c > 0 ? chunks[c - 1].begin : file.data);
+    }
+    for (size_t c = 0; c < chunk_count; ++c)
+        chunks[c].end = c + 1 < chunk_count ? chunks[c + 1].begin : file_end;
+
+    pool->parallel_for((uint32_t)chunk_count, 1, [&chunks](uint32_t begin, uint32_t end, uint32_t) {
+        for (uint32_t c = begin; c < end; ++c)
+            parse_chunk(&chunks[c]);
+    });
+
+    float parse_ms = ms_since(start);
+
+    // first elements of each chunk, for the relative indices and the copies.
+    uint64_t position_count = 0, uv_count = 0, normal_count = 0, corner_count = 0;
+    uint32_t bad_line_count = 0;
+    for (auto &chunk : chunks)
+    {
+        chunk.first_position = (uint32_t)position_count;
+        chunk.first_uv = (uint32_t)uv_count;
+        chunk.first_normal = (uint32_t)normal_count;
+        position_count += chunk.positions.size();
+        uv_count += chunk.uvs.size();
+        normal_count += chunk.normals.size();
+        corner_count += chunk.corners.size();
+        bad_line_count += chunk.bad_line_count;
+    }
+
+    if (bad_line_count > 0)
+        Log("#      " + std::to_string(bad_line_count) + " lines could not be read\n");
+
+    if (std::max(std::max(position_count, uv_count), std::max(normal_count, corner_count)) >= UINT32_MAX)
+    {
+        Log("#      Too big for 32 bit indices\n");
+        utils::unmap_file(&file);
+        return false;
+    }
+
+    //
+    // Attributes of the whole file, and the corners to them
+    //
+
+    std::vector<glm::vec3> positions(position_count);
+    std::vector<glm::vec2> uvs(uv_count);
+    std::vector<glm::vec3> normals(normal_count);
+    std::vector<uint8_t> chunk_valid(chunk_count, 1);
+
+    pool->parallel_for((uint32_t)chunk_count, 1, [&](uint32_t begin, uint32_t end, uint32_t) {
+        for (uint32_t c = begin; c < end; ++c)
+        {
+            obj_chunk_t &chunk = chunks[c];
+            std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.first_position);
+            std::copy(chunk.uvs.begin(), chunk.uvs.end(), uvs.begin() + chunk.first_uv);
+            std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.first_normal);
+
+            for (obj_corner_t &corner : chunk.corners)
+            {
+                if (!resolve_index(&corner.v, chunk.first_position, (uint32_t)position_count)
+                    || !resolve_index(&corner.vt, chunk.first_uv, (uint32_t)uv_count)
+                    || !resolve_index(&corner.vn, chunk.first_normal, (uint32_t)normal_count))
+                {
+                    chunk_valid[c] = 0;
+                    break;
+                }
+            }
+
+            // no longer needed, the file can be bigger than the memory.
+            std::vector<glm::vec3>().swap(chunk.positions);
+            std::vector<glm::vec2>().swap(chunk.uvs);
+            std::vector<glm::vec3>().swap(chunk.normals);
+        }
+    });
+
+    utils::unmap_file(&file);
+
+    if (std::find(chunk_valid.begin(), chunk_valid.end(), 0) != chunk_valid.end())
+    {
+        Log("#      Face index out of range\n");
+        return false;
+    }
+
+    //
+    // Weld the v/vt/vn triples, in the order of the faces
+    //
+
+    auto weld_start = std::chrono::steady_clock::now();
+
+    IndexList &indices = mesh->second;
+    indices.resize(corner_count);
+
+    corner_welder welder(std::max(std::max(position_count, uv_count), normal_count));
+    uint32_t next_corner = 0;
+    for (auto &chunk : chunks)
+    {
+        for (const obj_corner_t &corner : chunk.corners)
+            indices[next_corner++] = welder.insert(corner);
+        std::vector<obj_corner_t>().swap(chunk.corners);
+    }
+
+    const std::vector<obj_corner_t> &unique = welder.unique();
+
+    // area weighted face normals per position, for the corners without vn.
+    std::vector<glm::vec3> smooth_normals;
+    bool missing_normals = std::any_of(unique.begin(), unique.end(), [](const obj_corner_t &c) { return c.vn == UINT32_MAX; });
+    if (missing_normals)
+    {
+        smooth_normals.assign(position_count, glm::vec3(0.0f));
+        for (size_t t = 0; t < indices.size(); t += 3)
+        {
+            uint32_t a = unique[indices[t + 0]].v;
+            uint32_t b = unique[indices[t + 1]].v;
+            uint32_t c = unique[indices[t + 2]].v;
+            glm::vec3 n = glm::cross(positions[b] - positions[a], positions[c] - positions[a]);
+            smooth_normals[a] += n;
+            smooth_normals[b] += n;
+            smooth_normals[c] += n;
+        }
+    }
+
+    VertexList &vertices = mesh->first;
+    vertices.resize(unique.size());
+    pool->parallel_for((uint32_t)unique.size(), 65536, [&](uint32_t begin, uint32_t end, uint32_t) {
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            const obj_corner_t &c = unique[i];
+            Scene::vertex_t &v = vertices[i];
+            v.p = glm::vec4(positions[c.v], 1.0f);
+            if (c.vn != UINT32_MAX)
+                v.n = normals[c.vn];
+            else
+                v.n = glm::length(smooth_normals[c.v]) > 0.0f ? glm::normalize(smooth_normals[c.v]) : glm::vec3(0, 0, 1);
+            // OBJ textures have their origin at the bottom.
+            v.uv = c.vt != UINT32_MAX ? glm::vec2(uvs[c.vt].x, 1.0f - uvs[c.vt].y) : glm::vec2(0.0f);
+        }
+    });
+
+    obj_load_stats_t s;
+    s.position_count = (uint32_t)position_count;
+    s.corner_count = (uint32_t)corner_count;
+    s.parse_ms = parse_ms;
+    s.weld_ms = ms_since(weld_start);
+    s.total_ms = ms_since(start);
+    if (stats)
+        *stats = s;
+
+    Log("#      " + std::to_string(vertices.size()) + " vertices (" + std::to_string(s.position_count) + " positions), "
+        + std::to_string(s.corner_count / 3) + " triangles, " + std::to_string(chunk_count) + " chunks on "
+        + std::to_string(pool->thread_count()) + " threads\n");
+    Log("#      parse " + std::to_string(s.parse_ms) + " ms, weld " + std::to_string(s.weld_ms) + " ms, total "
+        + std::to_string(s.total_ms) + " ms\n");
+
+    return true;
+}
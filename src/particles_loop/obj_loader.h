@@ -0,0 +1,34 @@
+#ifndef _VULKAN_OBJ_LOADER_H_
+#define _VULKAN_OBJ_LOADER_H_
+
+#include "utils.h" // IndexedMesh
+
+#include <string>
+
+class ThreadPool;
+
+//
+// Wavefront OBJ, for big scanned meshes.
+//
+// The file is mapped, cut into chunks at line ends and the chunks are
+// parsed on all the threads of the pool. The v/vt/vn triples of the faces
+// are then welded into unique vertices with a hash map, in the order of
+// their first use. Polygons are triangulated as fans.
+//
+// Only v, vt, vn and f are read: groups, objects and materials are skipped,
+// the file is one mesh. Without vn, the normals are the average of the
+// normals of the faces around each vertex.
+//
+struct obj_load_stats_t
+{
+    uint32_t position_count = 0;
+    uint32_t corner_count = 0; // 3 per triangle
+    float parse_ms = 0.0f;
+    float weld_ms = 0.0f;
+    float total_ms = 0.0f;
+};
+
+// pool: nullptr = a pool just for this file.
+bool load_obj(const std::string &file_path, IndexedMesh *mesh, ThreadPool *pool = nullptr, obj_load_stats_t *stats = nullptr);
+
+#endif // _VULKAN_OBJ_LOADER_H_
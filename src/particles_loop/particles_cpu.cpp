@@ -0,0 +1,232 @@
+#include "particles_cpu.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <chrono>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#   define PARTICLES_SIMD 1
+#   include <emmintrin.h>
+#else
+#   define PARTICLES_SIMD 0
+#endif
+
+#define TWO_PI (2.0f * 3.14159f) // same constant as the shader
+
+// particles per job, a few hundred KB of output.
+static const uint32_t PARTICLES_PER_JOB = 16384;
+
+// jitter * (whole + fraction + delay_turns) turns, the jitter cut to 24
+// fractional bits: jitter * whole mod 1 is exact. As rotation_angle() in particles.comp.
+static inline float rotation_angle(float jitter, uint32_t whole, float fraction, float delay_turns)
+{
+    int32_t m = (int32_t)(jitter * 16777216.0f);
+    float jq = (float)m * (1.0f / 16777216.0f);
+    float whole_part = (float)(((uint32_t)m * whole) & 0xffffff) * (1.0f / 16777216.0f);
+    return TWO_PI * (whole_part + jq * (fraction + delay_turns));
+}
+
+void ParticleSimulator::set_particles(const particle_t *particles, uint32_t count)
+{
+    _jx.resize(count);
+    _jy.resize(count);
+    _jz.resize(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        _jx[i] = particles[i].jitter.x;
+        _jy[i] = particles[i].jitter.y;
+        _jz[i] = particles[i].jitter.z;
+    }
+}
+
+void ParticleSimulator::simulate(const params_t &params, uint32_t count, particle_t *dst)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    count = std::min(count, size());
+    _thread_busy_ms.assign(_pool.thread_count(), 0.0f);
+
+    _pool.parallel_for(count, PARTICLES_PER_JOB, [&](uint32_t begin, uint32_t end, uint32_t thread)
+    {
+        auto job_start = std::chrono::steady_clock::now();
+        simulate_range(params, begin, end, dst);
+        auto job_end = std::chrono::steady_clock::now();
+        _thread_busy_ms[thread] += std::chrono::duration<float, std::milli>(job_end - job_start).count();
+    });
+
+    auto end = std::chrono::steady_clock::now();
+
+    _stats.particle_count = count;
+    _stats.thread_count = _pool.thread_count();
+    _stats.wall_ms = std::chrono::duration<float, std::milli>(end - start).count();
+    _stats.busy_ms = 0.0f;
+    for (float ms : _thread_busy_ms)
+        _stats.busy_ms += ms;
+}
+
+void ParticleSimulator::simulate_one(const params_t &p, uint32_t i, const glm::vec4 &J, particle_t *dst)
+{
+    // delay each successive particle, adds some distance.
+    float delay = i * p.pdt;
+
+    float global_pos_offset_x = p.e0 * (2.0f * J.x - 1.0f);
+    float global_pos_offset_y = p.e0 * (2.0f * J.y - 1.0f);
+    float global_pos_offset_z = p.e0 * (2.0f * J.z - 1.0f);
+
+    float local_pos_offset_x = p.e1 * (2.0f * J.x - 1.0f);
+    float local_pos_offset_y = p.e1 * (2.0f * J.y - 1.0f);
+    float local_pos_offset_z = p.e1 * (2.0f * J.z - 1.0f);
+
+    dst->position.x = p.ax * cosf(p.phase_bx + p.bx*delay) + (p.cx + local_pos_offset_x) * sinf(p.phase_dx + p.dx*delay) + global_pos_offset_x;
+    dst->position.y = p.ay * sinf(p.phase_by + p.by*delay) + (p.cy + local_pos_offset_y) * cosf(p.phase_dy + p.dy*delay) + global_pos_offset_y;
+    dst->position.z = p.az * sinf(p.phase_bz + p.bz*delay) + (p.cz + local_pos_offset_z) * cosf(p.phase_dz + p.dz*delay) + global_pos_offset_z;
+    dst->position.w = 1.0f;
+
+    dst->rotation = glm::vec4(
+        rotation_angle(J.x, p.turns_rx, p.fraction_rx, p.e2 * p.rsx * delay),
+        rotation_angle(J.y, p.turns_ry, p.fraction_ry, p.e2 * p.rsy * delay),
+        rotation_angle(J.z, p.turns_rz, p.fraction_rz, p.e2 * p.rsz * delay),
+        1.0f);
+
+    dst->scale = glm::vec4(p.psx, p.psy, p.psz, 0.0f);
+}
+
+#if PARTICLES_SIMD == 1
+
+//
+// sin and cos of 4 floats, cephes polynomials (~1 ulp on [-8192, 8192]).
+//
+static inline void sincos_ps(__m128 x, __m128 *s, __m128 *c)
+{
+    const __m128 sign_mask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+
+    __m128 sign_sin = _mm_and_ps(x, sign_mask);
+    x = _mm_andnot_ps(sign_mask, x);
+
+    // octant, rounded up to even
+    __m128i j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.27323954473516f))); // 4/pi
+    j = _mm_add_epi32(j, _mm_set1_epi32(1));
+    j = _mm_and_si128(j, _mm_set1_epi32(~1));
+    __m128 y = _mm_cvtepi32_ps(j);
+
+    __m128 swap_sin = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29));
+    __m128 sign_cos = _mm_castsi128_ps(_mm_slli_epi32(_mm_andnot_si128(_mm_sub_epi32(j, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+    __m128 poly_mask = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(2)), _mm_setzero_si128()));
+    sign_sin = _mm_xor_ps(sign_sin, swap_sin);
+
+    // x - y * pi/4, in 3 parts
+    x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(-0.78515625f)));
+    x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(-2.4187564849853515625e-4f)));
+    x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(-3.77489497744594108e-8f)));
+
+    __m128 z = _mm_mul_ps(x, x);
+
+    __m128 yc = _mm_set1_ps(2.443315711809948E-005f);
+    yc = _mm_add_ps(_mm_mul_ps(yc, z), _mm_set1_ps(-1.388731625493765E-003f));
+    yc = _mm_add_ps(_mm_mul_ps(yc, z), _mm_set1_ps(4.166664568298827E-002f));
+    yc = _mm_mul_ps(_mm_mul_ps(yc, z), z);
+    yc = _mm_sub_ps(yc, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+    yc = _mm_add_ps(yc, _mm_set1_ps(1.0f));
+
+    __m128 ys = _mm_set1_ps(-1.9515295891E-4f);
+    ys = _mm_add_ps(_mm_mul_ps(ys, z), _mm_set1_ps(8.3321608736E-3f));
+    ys = _mm_add_ps(_mm_mul_ps(ys, z), _mm_set1_ps(-1.6666654611E-1f));
+    ys = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ys, z), x), x);
+
+    __m128 sin_v = _mm_or_ps(_mm_and_ps(poly_mask, ys), _mm_andnot_ps(poly_mask, yc));
+    __m128 cos_v = _mm_or_ps(_mm_and_ps(poly_mask, yc), _mm_andnot_ps(poly_mask, ys));
+
+    *s = _mm_xor_ps(sin_v, sign_sin);
+    *c = _mm_xor_ps(cos_v, sign_cos);
+}
+
+static inline __m128 sin_ps(__m128 x) { __m128 s, c; sincos_ps(x, &s, &c); return s; }
+static inline __m128 cos_ps(__m128 x) { __m128 s, c; sincos_ps(x, &s, &c); return c; }
+
+// rotation_angle() of 4 jitters. The low 32 bits of the products without
+// SSE4.1: even and odd lanes apart.
+static inline __m128 rotation_angle_ps(__m128 jitter, uint32_t whole, float fraction, __m128 delay_turns)
+{
+    const __m128 one_24 = _mm_set1_ps(16777216.0f);
+    const __m128 inv_24 = _mm_set1_ps(1.0f / 16777216.0f);
+
+    __m128i m = _mm_cvttps_epi32(_mm_mul_ps(jitter, one_24));
+    __m128 jq = _mm_mul_ps(_mm_cvtepi32_ps(m), inv_24);
+
+    __m128i w = _mm_set1_epi32((int)whole);
+    __m128i even = _mm_mul_epu32(m, w);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(m, 32), w);
+    __m128i product = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    __m128 whole_part = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(product, _mm_set1_epi32(0xffffff))), inv_24);
+
+    __m128 turns = _mm_add_ps(whole_part, _mm_mul_ps(jq, _mm_add_ps(_mm_set1_ps(fraction), delay_turns)));
+    return _mm_mul_ps(_mm_set1_ps(TWO_PI), turns);
+}
+
+// 4 particles, one register per component, transposed into one vec4 per particle.
+// Plain stores: only 48 of the 112 bytes of a particle are written, non temporal
+// stores of partial lines are much slower, in cached and write combined memory alike.
+static inline void store_vec4x4(float *p0, float *p1, float *p2, float *p3, __m128 x, __m128 y, __m128 z, __m128 w)
+{
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(p0, x); _mm_storeu_ps(p1, y); _mm_storeu_ps(p2, z); _mm_storeu_ps(p3, w);
+}
+#endif
+
+void ParticleSimulator::simulate_range(const params_t &p, uint32_t begin, uint32_t end, particle_t *dst)
+{
+    uint32_t i = begin;
+
+#if PARTICLES_SIMD == 1
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 e0 = _mm_set1_ps(p.e0), e1 = _mm_set1_ps(p.e1);
+    const __m128 pdt = _mm_set1_ps(p.pdt);
+    const __m128 e2rsx = _mm_set1_ps(p.e2 * p.rsx), e2rsy = _mm_set1_ps(p.e2 * p.rsy), e2rsz = _mm_set1_ps(p.e2 * p.rsz);
+    const __m128 scale = _mm_setr_ps(p.psx, p.psy, p.psz, 0.0f);
+
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 jx = _mm_loadu_ps(&_jx[i]);
+        __m128 jy = _mm_loadu_ps(&_jy[i]);
+        __m128 jz = _mm_loadu_ps(&_jz[i]);
+
+        // float(i) * pdt, per lane
+        __m128 fi = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32((int)i), _mm_setr_epi32(0, 1, 2, 3)));
+        __m128 delay = _mm_mul_ps(fi, pdt);
+
+        __m128 ox = _mm_sub_ps(_mm_mul_ps(two, jx), one);
+        __m128 oy = _mm_sub_ps(_mm_mul_ps(two, jy), one);
+        __m128 oz = _mm_sub_ps(_mm_mul_ps(two, jz), one);
+
+        __m128 px = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(_mm_set1_ps(p.ax), cos_ps(_mm_add_ps(_mm_set1_ps(p.phase_bx), _mm_mul_ps(_mm_set1_ps(p.bx), delay)))),
+            _mm_mul_ps(_mm_add_ps(_mm_set1_ps(p.cx), _mm_mul_ps(e1, ox)), sin_ps(_mm_add_ps(_mm_set1_ps(p.phase_dx), _mm_mul_ps(_mm_set1_ps(p.dx), delay))))),
+            _mm_mul_ps(e0, ox));
+        __m128 py = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(_mm_set1_ps(p.ay), sin_ps(_mm_add_ps(_mm_set1_ps(p.phase_by), _mm_mul_ps(_mm_set1_ps(p.by), delay)))),
+            _mm_mul_ps(_mm_add_ps(_mm_set1_ps(p.cy), _mm_mul_ps(e1, oy)), cos_ps(_mm_add_ps(_mm_set1_ps(p.phase_dy), _mm_mul_ps(_mm_set1_ps(p.dy), delay))))),
+            _mm_mul_ps(e0, oy));
+        __m128 pz = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(_mm_set1_ps(p.az), sin_ps(_mm_add_ps(_mm_set1_ps(p.phase_bz), _mm_mul_ps(_mm_set1_ps(p.bz), delay)))),
+            _mm_mul_ps(_mm_add_ps(_mm_set1_ps(p.cz), _mm_mul_ps(e1, oz)), cos_ps(_mm_add_ps(_mm_set1_ps(p.phase_dz), _mm_mul_ps(_mm_set1_ps(p.dz), delay))))),
+            _mm_mul_ps(e0, oz));
+
+        __m128 rx = rotation_angle_ps(jx, p.turns_rx, p.fraction_rx, _mm_mul_ps(e2rsx, delay));
+        __m128 ry = rotation_angle_ps(jy, p.turns_ry, p.fraction_ry, _mm_mul_ps(e2rsy, delay));
+        __m128 rz = rotation_angle_ps(jz, p.turns_rz, p.fraction_rz, _mm_mul_ps(e2rsz, delay));
+
+        particle_t *d = dst + i;
+        store_vec4x4(&d[0].position.x, &d[1].position.x, &d[2].position.x, &d[3].position.x, px, py, pz, one);
+        store_vec4x4(&d[0].rotation.x, &d[1].rotation.x, &d[2].rotation.x, &d[3].rotation.x, rx, ry, rz, one);
+        for (int k = 0; k < 4; ++k)
+            _mm_storeu_ps(&d[k].scale.x, scale);
+    }
+#endif
+
+    for (; i < end; ++i)
+    {
+        simulate_one(p, i, glm::vec4(_jx[i], _jy[i], _jz[i], 0.0f), dst + i);
+    }
+}
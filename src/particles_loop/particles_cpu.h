@@ -0,0 +1,84 @@
+#ifndef _VULKAN_PARTICLES_CPU_H_
+#define _VULKAN_PARTICLES_CPU_H_
+
+#include <stdint.h> // uint32_t
+
+#include "glm_usage.h"
+#include "thread_pool.h"
+
+#include <vector>
+
+//
+// CPU version of particles.comp, same math, for GPUs short on compute.
+//
+// The jitters are kept as structure of arrays, the particles are
+// simulated 4 at a time (SSE) on all the threads of the pool. Only
+// position, rotation and scale are written: the other members of the
+// destination (jitter, speed, colors) are set once by the caller.
+//
+class ParticleSimulator
+{
+public:
+    // Same layout as Scene::instance_data_t and the std140 particle of the shader.
+    struct particle_t
+    {
+        glm::vec4 position;
+        glm::vec4 rotation;
+        glm::vec4 scale;
+        glm::vec4 speed;
+        glm::vec4 jitter;
+        glm::vec4 base;
+        glm::vec4 spec;
+    };
+
+    // Unpacked UBO of particles.comp. The time parts are wrapped by the caller:
+    // phase_bx = bx * speed * t mod 2pi, e2 * rsx * rotation_speed * t = turns_rx + fraction_rx
+    // (SimulationClock::split_turns).
+    struct params_t
+    {
+        float pdt = 0.0f;
+        uint32_t turns_rx = 0, turns_ry = 0, turns_rz = 0;
+        float fraction_rx = 0.0f, fraction_ry = 0.0f, fraction_rz = 0.0f;
+        float phase_bx = 0.0f, phase_dx = 0.0f, phase_by = 0.0f, phase_dy = 0.0f, phase_bz = 0.0f, phase_dz = 0.0f;
+        float e0 = 0.0f, e1 = 0.0f, e2 = 0.0f;
+        float ax = 0.0f, bx = 0.0f, cx = 0.0f, dx = 0.0f;
+        float ay = 0.0f, by = 0.0f, cy = 0.0f, dy = 0.0f;
+        float az = 0.0f, bz = 0.0f, cz = 0.0f, dz = 0.0f;
+        float psx = 0.0f, psy = 0.0f, psz = 0.0f;
+        float rsx = 0.0f, rsy = 0.0f, rsz = 0.0f;
+    };
+
+    struct stats_t
+    {
+        uint32_t particle_count = 0;
+        uint32_t thread_count = 0;
+        float wall_ms = 0.0f;      // whole simulate()
+        float busy_ms = 0.0f;      // sum over the threads of the time in the kernel
+        double particles_per_second_per_core() const { return busy_ms > 0.0f ? particle_count / (busy_ms * 0.001) : 0.0; }
+    };
+
+    // Keeps the jitters of the particles, SoA.
+    void set_particles(const particle_t *particles, uint32_t count);
+    uint32_t size() const { return (uint32_t)_jx.size(); }
+
+    // Writes position, rotation and scale of particles [0..count[ into dst.
+    void simulate(const params_t &params, uint32_t count, particle_t *dst);
+
+    // One particle, plain floats and std::sin/cos. Reference for the SSE path.
+    static void simulate_one(const params_t &params, uint32_t i, const glm::vec4 &jitter, particle_t *dst);
+
+    const stats_t &stats() const { return _stats; }
+
+private:
+
+    void simulate_range(const params_t &params, uint32_t begin, uint32_t end, particle_t *dst);
+
+    ThreadPool _pool;
+
+    std::vector<float> _jx, _jy, _jz; // jitter.w is not used by the kernel
+    std::vector<float> _thread_busy_ms; // one per thread, for the stats
+
+    stats_t _stats;
+};
+
+#endif // _VULKAN_PARTICLES_CPU_H_
@@ -11,9 +11,19 @@
 
 #include <array>
 #include <string>
+#include <algorithm>
+#include <chrono>
 
 #define MAX_NB_OBJECTS 1024
+#define GLOBAL_VBO_SIZE (256 * 1024 * 1024) // scanned meshes, millions of vertices
+#define GLOBAL_IBO_SIZE (128 * 1024 * 1024)
+#define GLOBAL_STAGING_SIZE (8 * 1024 * 1024) // bigger uploads go in pieces
+#define MAX_NB_MESHLETS (1 << 18) // 2^18 x 124 triangles
+#define CULLED_IBO_SIZE (64 * 1024 * 1024) // the indices of the objects with meshlets
 #define USE_STAGING_FOR_INSTANCING 1
+#define DRAW_GLOBAL_INSTANCES 1
+#define DRAW_INSTANCED_INSTANCES 1
+#define TEXTURE_CACHE_DIR "./cache/" // with the cooked meshes
 
 //
 // VERTEX
@@ -138,12 +148,33 @@ VkVertexInputAttributeDescription *Scene::instance_data_t::attribute_description
 // SCENE
 //
 
-Scene::Scene(vulkan_context *c) : _ctx(c)
+Scene::Scene(vulkan_context *c) : _ctx(c), _primitives(c)
 {
     _view_t v;
     v.camera = "perspective";
     v.descriptor_set = VK_NULL_HANDLE;
-    _views["perspective"] = v;
+    _main_view = _views.insert("perspective", v);
+
+    // a fountain and periodic bursts, the other emitters are off.
+    auto &fountain = _particle_lifecycle.emitters[0];
+    fountain.enabled = true;
+    fountain.position = glm::vec3(0.0f, -10.0f, 0.0f);
+    fountain.radius = 0.5f;
+    fountain.velocity = glm::vec3(0.0f, 18.0f, 0.0f);
+    fountain.spread = 4.0f;
+    fountain.rate = 50000.0f;
+    fountain.lifetime_min = 2.0f;
+    fountain.lifetime_max = 4.0f;
+
+    auto &bursts = _particle_lifecycle.emitters[1];
+    bursts.enabled = true;
+    bursts.position = glm::vec3(10.0f, 10.0f, 0.0f);
+    bursts.radius = 0.2f;
+    bursts.spread = 12.0f;
+    bursts.burst_count = 100000;
+    bursts.burst_interval = 1.5f;
+    bursts.lifetime_min = 0.5f;
+    bursts.lifetime_max = 1.5f;
 }
 
 Scene::~Scene()
@@ -151,8 +182,11 @@ Scene::~Scene()
     de_init();
 }
 
-bool Scene::init(VkRenderPass rp)
+bool Scene::init(VkRenderPass rp, VkImageView depth_view, VkExtent2D depth_extent)
 {
+    _depth_pyramid.depth_view = depth_view;
+    _depth_pyramid.depth_extent = depth_extent;
+
     Log("#    Create Global Objects VBO/IBO/UBO\n");
     if (!create_global_object_buffers())
         return false;
@@ -169,14 +203,18 @@ bool Scene::init(VkRenderPass rp)
         ImGui_ImplVulkan_InvalidateFontUploadObjects();
     }
 
-    Log("#    Create Procedural Textures\n");
-    if (!create_procedural_textures())
-        return false;
-
     Log("#    Create Texture Samplers\n");
     if (!create_texture_samplers())
         return false;
 
+    Log("#    Create Texture Loader\n");
+    if (!create_texture_loader())
+        return false;
+
+    Log("#    Create Depth Pyramid\n");
+    if (!create_depth_pyramid())
+        return false;
+
     Log("#    Create All Descriptor Set Layouts\n");
     if (!create_all_descriptor_set_layouts(_ctx->device, _descriptor_set_layouts.data()))
         return false;
@@ -185,6 +223,15 @@ bool Scene::init(VkRenderPass rp)
     if (!build_pipelines(rp))
         return false;
 
+    // after the pipelines: they are computed.
+    Log("#    Create Procedural Textures\n");
+    if (!create_procedural_textures())
+        return false;
+
+    Log("#    Create GPU Primitives\n");
+    if (!_primitives.init())
+        return false;
+
     return true;
 }
 
@@ -195,9 +242,18 @@ void Scene::de_init()
     Log("#   Destroy Pipelines\n");
     destroy_pipelines();
 
+    Log("#   Destroy Bindless Material Set\n");
+    destroy_bindless_set();
+
+    Log("#   Destroy Texture Loader\n");
+    destroy_texture_loader();
+
     Log("#   Destroy Procedural Textures\n");
     destroy_textures();
 
+    Log("#   Destroy Depth Pyramid\n");
+    destroy_depth_pyramid();
+
     Log("#   Destroy Uniform Buffers\n");
     if (_global_object_vbo_created
         || _global_object_ibo_created
@@ -207,15 +263,15 @@ void Scene::de_init()
         destroy_global_object_buffers();
     }
     if (_scene_ubo_created) destroy_scene_ubo();
+
+    Log("#   Destroy GPU Primitives\n");
+    _primitives.de_init();
 }
 
 uint32_t Scene::_add_object(const object_description_t &desc )
 {
     Log("#   Add Object\n");
 
-    VkResult result;
-    VkDevice device = _ctx->device;
-
     _object_t obj = {};
 
     // with lazy init
@@ -223,75 +279,107 @@ uint32_t Scene::_add_object(const object_description_t &desc )
     auto &global_ibo = get_global_object_ibo();
     auto &global_matrices_ubo = get_global_object_matrices_ubo();
     auto &global_material_ubo = get_global_object_material_ubo();
-    auto &staging_buffer = get_global_staging_vbo();
+
+    if (_objects.size() >= MAX_NB_OBJECTS)
+    {
+        Log("#     Too many objects\n");
+        return NO_OBJECT;
+    }
 
     obj.position = desc.position;
-    obj.vertexCount = desc.vertexCount;
-    obj.vertex_buffer = global_vbo.buffer;
-    obj.vertex_offset = global_vbo.offset;
-    obj.indexCount = desc.indexCount;
-    obj.index_buffer = global_ibo.buffer;
-    obj.index_offset = global_ibo.offset;
-    obj.material_ref = desc.material;
+    obj.spin = desc.spin;
+    obj.material = _material_instances.find(desc.material);
     obj.base_color = desc.base_color;
     obj.specular = desc.specular;
 
-    Log(std::string("#    v: ") + std::to_string(desc.vertexCount) + std::string(" i: ") + std::to_string(desc.indexCount) + "\n");
-
-    void *mapped = nullptr;
-
+    const _object_t *shared = nullptr;
+    if (!desc.geometry.empty())
     {
-        Log("#    Map (Staging) Vertex Buffer\n");
-        size_t vertex_data_size = desc.vertexCount * sizeof(vertex_t);
-
-        Log("#     offset: " + std::to_string(global_vbo.offset) + std::string(" size: ") + std::to_string(vertex_data_size) + "\n");
-        result = vkMapMemory(device, staging_buffer.memory, 0, vertex_data_size, 0, &mapped);
-        ErrorCheck(result);
-        if (result != VK_SUCCESS)
-            return false;
-
-        vertex_t *vertices = (vertex_t*)mapped;
-        memcpy(vertices, desc.vertices, vertex_data_size);
-
-        Log("#    UnMap Vertex Buffer\n");
-        vkUnmapMemory(device, staging_buffer.memory);
-
-        copy_buffer_to_buffer(_global_staging_vbo.buffer, _global_object_vbo.buffer, vertex_data_size, 0, global_vbo.offset);
+        auto found = std::find(_object_names.begin(), _object_names.end(), desc.geometry);
+        if (found == _object_names.end())
+        {
+            Log("#     Geometry \"" + desc.geometry + "\" not found\n");
+            return NO_OBJECT;
+        }
 
-        global_vbo.offset += (uint32_t)vertex_data_size;
+        shared = &_objects[_global_instance_set[found - _object_names.begin()]];
+        obj.vertexCount = shared->vertexCount;
+        obj.vertex_buffer = shared->vertex_buffer;
+        obj.vertex_offset = shared->vertex_offset;
+        obj.indexCount = shared->indexCount;
+        obj.index_buffer = shared->index_buffer;
+        obj.index_offset = shared->index_offset;
+        obj.bounding_radius = shared->bounding_radius;
+        Log("#    Shares the geometry of " + desc.geometry + "\n");
     }
-
+    else
     {
-        Log("#    Map Index Buffer\n");
-        size_t index_data_size = desc.indexCount * sizeof(index_t);
-
-        Log("#     offset: " + std::to_string(global_ibo.offset) + std::string(" size: ") + std::to_string(index_data_size) + "\n");
-        result = vkMapMemory(device, staging_buffer.memory, 0, index_data_size, 0, &mapped);
-        ErrorCheck(result);
-        if (result != VK_SUCCESS)
-            return false;
+        obj.vertexCount = desc.vertexCount;
+        obj.vertex_buffer = global_vbo.buffer;
+        obj.vertex_offset = global_vbo.offset;
+        obj.indexCount = desc.indexCount;
+        obj.index_buffer = global_ibo.buffer;
+        obj.index_offset = global_ibo.offset;
+
+        obj.bounding_radius = desc.bounding_radius;
+        if (desc.vertices && obj.bounding_radius == 0.0f)
+        {
+            for (uint32_t v = 0; v < desc.vertexCount; ++v)
+            {
+                obj.bounding_radius = std::max(obj.bounding_radius, glm::length(glm::vec3(desc.vertices[v].p)));
+            }
+        }
 
-        index_t *indices = (index_t*)mapped;
-        memcpy(indices, desc.indices, index_data_size);
+        Log(std::string("#    v: ") + std::to_string(desc.vertexCount) + std::string(" i: ") + std::to_string(desc.indexCount) + "\n");
 
-        Log("#    UnMap Index Buffer\n");
-        vkUnmapMemory(device, staging_buffer.memory);
+        size_t vertex_data_size = desc.vertexCount * sizeof(vertex_t);
+        size_t index_data_size = desc.indexCount * sizeof(index_t);
+        if (global_vbo.offset + vertex_data_size > global_vbo.size
+            || global_ibo.offset + index_data_size > global_ibo.size)
+        {
+            Log("#     The global VBO/IBO are full\n");
+            return NO_OBJECT;
+        }
 
-        copy_buffer_to_buffer(_global_staging_vbo.buffer, _global_object_ibo.buffer, index_data_size, 0, global_ibo.offset);
+        Log("#    Upload Vertices, offset: " + std::to_string(global_vbo.offset) + std::string(" size: ") + std::to_string(vertex_data_size) + "\n");
+        bool uploaded = desc.vertices
+            ? upload_through_staging(desc.vertices, vertex_data_size, global_vbo.buffer, global_vbo.offset)
+            : upload_through_staging([&desc](void *dst, uint32_t first, uint32_t count) { desc.write_vertices((vertex_t*)dst, first, count); },
+                desc.vertexCount, sizeof(vertex_t), global_vbo.buffer, global_vbo.offset);
+        if (!uploaded)
+            return NO_OBJECT;
+        global_vbo.offset += (uint32_t)vertex_data_size;
 
+        Log("#    Upload Indices, offset: " + std::to_string(global_ibo.offset) + std::string(" size: ") + std::to_string(index_data_size) + "\n");
+        uploaded = desc.indices
+            ? upload_through_staging(desc.indices, index_data_size, global_ibo.buffer, global_ibo.offset)
+            : upload_through_staging([&desc](void *dst, uint32_t first, uint32_t count) { desc.write_indices((index_t*)dst, first, count); },
+                desc.indexCount, sizeof(index_t), global_ibo.buffer, global_ibo.offset);
+        if (!uploaded)
+            return NO_OBJECT;
         global_ibo.offset += (uint32_t)index_data_size;
     }
 
-    Log("#    Compute ModelMatrix and put it in the aligned buffer\n");
-    glm::mat4* model_mat = (glm::mat4*)((uint64_t)global_matrices_ubo.host_data + (_objects.size() * global_matrices_ubo.alignment));
-    *model_mat = glm::translate(glm::mat4(1), desc.position);
+    if (!add_meshlets(desc, shared, (uint32_t)_objects.size(), &obj))
+        return NO_OBJECT;
 
-    // TODO: add normal matrix as a mat3 -> Matrices.uNormalMatrix = glm::inverseTranspose( glm::mat3( Matrices.uModelMatrix ) );
+    Log("#    Add Transform, the matrices are computed by update_transforms()\n");
+    uint32_t parent = TransformSystem::NO_PARENT;
+    if (!desc.parent.empty())
+    {
+        auto found = std::find(_object_names.begin(), _object_names.end(), desc.parent);
+        if (found != _object_names.end())
+            parent = _global_instance_set[found - _object_names.begin()];
+        else
+            Log("#     Parent \"" + desc.parent + "\" not found, added as a root\n");
+    }
+    _transforms.add(parent, desc.position, desc.rotation, desc.scale);
 
     Log("#    Fill Material Overrides into its aligned buffer\n");
     _material_override_t *materials = (_material_override_t*)((uint64_t)global_material_ubo.host_data + (_objects.size() * global_material_ubo.alignment));
     materials->base_color = desc.base_color;
     materials->specular = desc.specular;
+    mark_dirty(&global_material_ubo, (uint32_t)_objects.size());
 
     uint32_t index = (uint32_t)_objects.size();
 
@@ -303,23 +391,164 @@ uint32_t Scene::_add_object(const object_description_t &desc )
 bool Scene::add_object_to_global_instance_set(object_description_t desc)
 {
     uint32_t index = _add_object(desc);
+    if (index == NO_OBJECT)
+        return false;
 
     _object_names.push_back(desc.name);
     _global_instance_set.push_back(index);
 
+    // after compile(), the command buffer is rebuilt.
+    if (_global_draw_commands.buffer != VK_NULL_HANDLE)
+        return build_global_draw_commands();
+
+    return true;
+}
+
+//
+// The meshlets of the object, or those of the object whose geometry it
+// shares, with the object index and a draw command of its own. The draw
+// command gets a range of the culled IBO as big as all the indices.
+//
+bool Scene::add_meshlets(const object_description_t &desc, const _object_t *shared, uint32_t object_index, _object_t *obj)
+{
+    auto &mc = _meshlet_culling;
+
+    uint32_t meshlet_count = shared ? shared->meshlet_count : desc.meshletCount;
+    if (meshlet_count == 0)
+        return true;
+
+    if (mc.meshlets.size() + meshlet_count > MAX_NB_MESHLETS
+        || (VkDeviceSize)(mc.culled_index_count + obj->indexCount) * sizeof(index_t) > CULLED_IBO_SIZE)
+    {
+        Log("#     Too many meshlets, drawn whole\n");
+        return true;
+    }
+
+    obj->first_meshlet = (uint32_t)mc.meshlets.size();
+    obj->meshlet_count = meshlet_count;
+    obj->meshlet_draw = (uint32_t)mc.commands.size();
+
+    for (uint32_t i = 0; i < meshlet_count; ++i)
+    {
+        _meshlet_culling_t::_gpu_meshlet_t m = {};
+        if (shared)
+        {
+            m = mc.meshlets[shared->first_meshlet + i];
+        }
+        else
+        {
+            m.sphere = desc.meshlets[i].sphere;
+            m.cone = desc.meshlets[i].cone;
+            m.first_index = obj->index_offset / sizeof(index_t) + desc.meshlets[i].first_index;
+            m.index_count = desc.meshlets[i].index_count;
+        }
+        m.object = object_index;
+        m.draw = obj->meshlet_draw;
+        mc.meshlets.push_back(m);
+    }
+
+    Log("#    Upload " + std::to_string(meshlet_count) + " Meshlets\n");
+    if (!upload_through_staging(mc.meshlets.data() + obj->first_meshlet, meshlet_count * sizeof(_meshlet_culling_t::_gpu_meshlet_t),
+        mc.gpu_meshlets.buffer, obj->first_meshlet * sizeof(_meshlet_culling_t::_gpu_meshlet_t)))
+        return false;
+
+    VkDrawIndexedIndirectCommand command = {};
+    command.indexCount = 0; // summed by the pass
+    command.instanceCount = 1;
+    command.firstIndex = mc.culled_index_count;
+    command.vertexOffset = (int32_t)(obj->vertex_offset / sizeof(vertex_t));
+    command.firstInstance = object_index;
+    mc.commands.push_back(command);
+    mc.objects.push_back(object_index);
+    mc.culled_index_count += obj->indexCount;
+
+    if (!copy_data_to_staging_buffer(mc.reset_commands, mc.commands.data(), mc.commands.size() * sizeof(VkDrawIndexedIndirectCommand), false))
+        return false;
+
+    return true;
+}
+
+bool Scene::build_global_draw_commands()
+{
+    // Objects sorted by material, one bucket (one indirect draw) per material.
+    std::vector<uint32_t> sorted = _global_instance_set;
+    std::stable_sort(sorted.begin(), sorted.end(), [this](uint32_t a, uint32_t b) {
+        return _objects[a].material < _objects[b].material; });
+
+    std::vector<VkDrawIndexedIndirectCommand> commands;
+    commands.reserve(sorted.size());
+    _global_draw_buckets.clear();
+
+    for (uint32_t i : sorted)
+    {
+        const _object_t &obj = _objects[i];
+
+        // drawn by meshlets, see draw().
+        if (obj.meshlet_count > 0)
+            continue;
+
+        // no descriptor set for material instances added after compile().
+        const _material_instance_t *m = _material_instances.get(obj.material);
+        if (!m || m->descriptor_set == VK_NULL_HANDLE)
+            continue;
+
+        if (_global_draw_buckets.empty() || _global_draw_buckets.back().material != obj.material)
+        {
+            _global_draw_bucket_t bucket = {};
+            bucket.material = obj.material;
+            bucket.descriptor_set = m->descriptor_set;
+            bucket.first_command = (uint32_t)commands.size();
+            _global_draw_buckets.push_back(bucket);
+        }
+
+        // all the objects share the vbo/ibo, their byte offsets become element offsets.
+        VkDrawIndexedIndirectCommand command = {};
+        command.indexCount = obj.indexCount;
+        command.instanceCount = 1;
+        command.firstIndex = obj.index_offset / sizeof(index_t);
+        command.vertexOffset = (int32_t)(obj.vertex_offset / sizeof(vertex_t));
+        command.firstInstance = i; // object index, into the matrices/materials SSBOs
+        commands.push_back(command);
+
+        ++_global_draw_buckets.back().command_count;
+    }
+
+    if (commands.empty())
+        return true;
+
+    if (commands.size() > MAX_NB_OBJECTS)
+    {
+        Log("#     Too many global objects for the draw commands buffer\n");
+        return false;
+    }
+
+    copy_data_to_staging_buffer(_global_draw_commands, commands.data(), commands.size() * sizeof(VkDrawIndexedIndirectCommand), false);
+
+    Log(std::string("#     Global objects: ") + std::to_string(commands.size()) + std::string(" draws in ")
+        + std::to_string(_global_draw_buckets.size()) + " indirect calls\n");
+
     return true;
 }
 
 bool Scene::add_instance_set(instance_set_description_t isd, uint32_t estimated_instance_count)
 {
-    auto &is = _instance_sets[isd.instance_set];
+    instance_set_handle_t handle = _instance_sets.find(isd.instance_set);
+    if (!handle.valid())
+        handle = _instance_sets.insert(isd.instance_set, _instance_set_t());
+    if (isd.instance_set == "particles")
+        _particles = handle;
+
+    auto &is = _instance_sets[handle];
     is.model_index = _add_object(isd.object_desc);
-    is.material_ref = isd.object_desc.material;
+    if (is.model_index == NO_OBJECT)
+        return false;
+    is.material = _material_instances.find(isd.object_desc.material);
 
     if (estimated_instance_count > 0)
     {
         // NOTE(nfauvet): resize et pas reserve parce que je m'en sers comme un tableau tab[i], pas push_back
-        is.instance_data.resize(MAX_INSTANCE_COUNT);
+        is.capacity = estimated_instance_count;
+        is.instance_data.resize(is.capacity);
     }
 
     return true;
@@ -327,8 +556,15 @@ bool Scene::add_instance_set(instance_set_description_t isd, uint32_t estimated_
 
 uint32_t Scene::add_object_to_instance_set(instanced_object_description_t o, instance_set_id_t id)
 {
-    auto &is = _instance_sets[id];
+    return add_object_to_instance_set(o, _instance_sets.find(id));
+}
+
+uint32_t Scene::add_object_to_instance_set(const instanced_object_description_t &o, instance_set_handle_t handle)
+{
+    auto &is = _instance_sets[handle];
     uint32_t idx = is.instance_count;
+    if (idx >= is.capacity)
+        return UINT32_MAX;
     instance_data_t &data = is.instance_data[idx];
     data.position = glm::vec4(o.position,1);
     data.rotation = glm::vec4(o.rotation,0);
@@ -338,6 +574,11 @@ uint32_t Scene::add_object_to_instance_set(instanced_object_description_t o, ins
     data.base = o.base_color;
     data.spec = o.specular;
 
+    const _material_instance_t *material = o.material.empty() ? nullptr : _material_instances.get(_material_instances.find(o.material));
+    if (!material)
+        material = _material_instances.get(is.material);
+    data.spec.w = material ? (float)material->index : 0.0f;
+
     return is.instance_count++;
 }
 
@@ -362,7 +603,9 @@ bool Scene::add_camera(camera_description_t ca)
     camera.p = glm::perspective(ca.fovy, ca.aspect, ca.near_plane, ca.far_plane);
     camera.p[1][1] *= -1.0f;
 
-    _cameras[ca.camera_id] = camera;
+    camera_handle_t handle = _cameras.insert(ca.camera_id, camera);
+    if (ca.camera_id == _views[_main_view].camera)
+        _main_camera = handle;
 
     return true;
 }
@@ -373,208 +616,929 @@ void Scene::update(float dt)
 
     if (_animate_object)
         animate_object(dt);
+    else
+        update_emitters(0.0); // paused, nothing spawns or ages
 
     //if (_animate_camera)
         animate_camera(dt);
 
     if (_animate_light)
         animate_light(dt);
+
+    update_benchmark();
 }
 
-void Scene::upload()
+void Scene::set_gpu_timings(float compute_ms, float graphics_ms)
 {
-    update_scene_ubo();
-    update_all_objects_ubos();
+    _gpu_compute_ms = compute_ms;
+    _gpu_graphics_ms = graphics_ms;
+
+    if (_benchmark.state == _benchmark_t::MEASURE)
+    {
+        _benchmark.accum_compute_ms += compute_ms;
+        _benchmark.accum_graphics_ms += graphics_ms;
+        _benchmark.accum_sort_ms += _sort_particles ? _particle_sort.gpu_ms : 0.0f;
+    }
 }
 
-void Scene::record_compute_commands(VkCommandBuffer cmd)
+void Scene::update_benchmark()
 {
-    VkResult result;
+    static const int benchmark_modes[2] = { INSTANCE_RENDER_MESH, INSTANCE_RENDER_HYBRID };
+    static const char *benchmark_mode_names[2] = { "mesh", "hybrid" };
+    const int warmup_frame_count = 30;
+    const int measure_frame_count = 120;
 
-    VkCommandBufferBeginInfo begin_info = {};
-    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    result = vkBeginCommandBuffer(cmd, &begin_info);
-    ErrorCheck(result);
+    auto &b = _benchmark;
+    switch (b.state)
     {
-        // TODO: for each instance set
-        auto &is = _instance_sets["particles"];
+    case _benchmark_t::IDLE:
+        return;
 
-        VkBufferMemoryBarrier storage_buffer_memory_barrier_before = {};
-        storage_buffer_memory_barrier_before.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-        storage_buffer_memory_barrier_before.srcAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
-        storage_buffer_memory_barrier_before.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-        storage_buffer_memory_barrier_before.buffer = is.instance_buffer.buffer; // <====== hardcoded 0
-        storage_buffer_memory_barrier_before.size = VK_WHOLE_SIZE;
-        storage_buffer_memory_barrier_before.srcQueueFamilyIndex = _ctx->graphics.family_index;
-        storage_buffer_memory_barrier_before.dstQueueFamilyIndex = _ctx->compute.family_index;
+    case _benchmark_t::WARMUP:
+        // let the timestamps of the previous mode go through the frames in flight.
+        _instance_render_mode = benchmark_modes[b.pass];
+        if (++b.frame >= warmup_frame_count)
+        {
+            b.state = _benchmark_t::MEASURE;
+            b.frame = 0;
+            b.accum_compute_ms = 0.0;
+            b.accum_graphics_ms = 0.0;
+            b.accum_sort_ms = 0.0;
+        }
+        break;
 
-        vkCmdPipelineBarrier(cmd,
-            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-            0,
-            0, nullptr,
-            1, &storage_buffer_memory_barrier_before,
-            0, nullptr);
+    case _benchmark_t::MEASURE:
+        if (++b.frame >= measure_frame_count)
+        {
+            b.results[b.pass] = glm::vec3(
+                (float)(b.accum_compute_ms / measure_frame_count),
+                (float)(b.accum_graphics_ms / measure_frame_count),
+                (float)(b.accum_sort_ms / measure_frame_count));
+
+            Log(std::string("#  Benchmark ") + benchmark_mode_names[b.pass]
+                + ", " + std::to_string(_nb_instances) + " instances: compute "
+                + std::to_string(b.results[b.pass].x) + " ms, graphics "
+                + std::to_string(b.results[b.pass].y) + " ms"
+                + (_sort_particles ? ", of which sort " + std::to_string(b.results[b.pass].z) + " ms" : std::string())
+                + "\n");
+
+            b.frame = 0;
+            if (++b.pass < (int)b.results.size())
+            {
+                b.state = _benchmark_t::WARMUP;
+            }
+            else
+            {
+                b.state = _benchmark_t::IDLE;
+                b.has_results = true;
+                _instance_render_mode = b.saved_render_mode;
+                _nb_instances = b.saved_nb_instances;
+            }
+        }
+        break;
+    }
+}
 
-        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, compute_particles.pipe.pipeline);
+void Scene::upload(uint32_t frame)
+{
+    // before the UBOs: it overwrites the simulation one.
+    if (_simulation_check.requested)
+        check_simulation();
 
-        // bind storage buffer and uniform buffer
-        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, compute_particles.pipe.pipeline_layout,
-            0, // bind to set #0
-            1, &compute_particles.descriptor_set, 0, nullptr);
+    if (_primitives_check.requested)
+    {
+        _primitives_check.requested = false;
+        _primitives.run_tests(1u << _primitives_check.log2_count, &_primitives_check.results);
+    }
 
-        vkCmdDispatch(cmd, 1 + _nb_instances / 256, 1, 1);
+    // between two frames too: the lists are rewritten.
+    if (_use_emitters && _particle_lifecycle.reset_requested)
+        reset_particle_lifecycle();
 
-        VkBufferMemoryBarrier storage_buffer_memory_barrier_after = {};
-        storage_buffer_memory_barrier_after.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-        storage_buffer_memory_barrier_after.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-        storage_buffer_memory_barrier_after.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
-        storage_buffer_memory_barrier_after.buffer = is.instance_buffer.buffer;
-        storage_buffer_memory_barrier_after.size = VK_WHOLE_SIZE;
-        storage_buffer_memory_barrier_after.srcQueueFamilyIndex = _ctx->compute.family_index;
-        storage_buffer_memory_barrier_after.dstQueueFamilyIndex = _ctx->graphics.family_index;
+    // the fences of the frame are waited on: its timestamps are there.
+    auto &ps = _particle_sort;
+    if (ps.query_pool != VK_NULL_HANDLE && (ps.written_frames & (1u << frame)))
+    {
+        std::array<uint64_t, 2> timestamps = {};
+        VkResult result = vkGetQueryPoolResults(_ctx->device, ps.query_pool, 2 * frame, 2,
+            sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        if (result == VK_SUCCESS)
+            ps.gpu_ms = (float)((timestamps[1] - timestamps[0]) * _ctx->physical_device_properties.limits.timestampPeriod / 1000000.0);
+        ps.written_frames &= ~(1u << frame);
+    }
+    ps.frame = frame;
 
-        vkCmdPipelineBarrier(cmd,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
-            0,
-            0, nullptr,
-            1, &storage_buffer_memory_barrier_after,
-            0, nullptr);
+    update_texture_loads();
+
+    // the queue is waited on, the textures are the same: no descriptor changes.
+    if (_procedural.regenerate_requested)
+        regenerate_procedural_textures();
+
+    update_scene_ubo();
+    update_transforms();
+    update_all_objects_ubos(frame);
+    update_texture_streaming(); // after the frustum and the transforms
+
+    // the fences of the frame are waited on: its buffer is free.
+    if (_simulate_cpu && !_use_emitters && create_cpu_simulation_buffers())
+    {
+        auto &cpu = _cpu_particles;
+        cpu.frame = frame % (uint32_t)cpu.buffers.size();
+        cpu.count = std::min(_instance_sets[_particles].instance_count, (uint32_t)_nb_instances);
+        cpu.simulator.simulate(cpu.params, cpu.count, cpu.mapped[cpu.frame]);
     }
-    result = vkEndCommandBuffer(cmd); // compiles the command buffer
-    ErrorCheck(result);
 }
 
-void Scene::draw(VkCommandBuffer cmd, VkViewport viewport, VkRect2D scissor_rect)
+//
+// Compute, in order: simulate (or the particle lifecycle), reset the draw commands, classify.
+//
+void Scene::declare_compute_passes(FrameGraph *fg)
 {
-#define DRAW_GLOBAL_INSTANCES 0
-#define DRAW_INSTANCED_INSTANCES 1
+    // only the particles set is simulated, classified and drawn indirectly, see draw().
+    auto &is = _instance_sets[_particles];
+
+    _fg.instances = fg->import_buffer("instances");
+    _fg.near_indices = fg->import_buffer("near_indices");
+    _fg.far_indices = fg->import_buffer("far_indices");
+    _fg.draw_commands = fg->import_buffer("draw_commands");
+    fg->bind_buffer(_fg.instances, is.instance_buffer.buffer);
+    fg->bind_buffer(_fg.near_indices, is.near_indices.buffer);
+    fg->bind_buffer(_fg.far_indices, is.far_indices.buffer);
+    fg->bind_buffer(_fg.draw_commands, is.draw_commands.buffer);
+
+    auto &lc = _particle_lifecycle;
+    _fg.alive_indices = fg->import_buffer("alive_indices");
+    _fg.dead_indices = fg->import_buffer("dead_indices");
+    _fg.particle_counters = fg->import_buffer("particle_counters");
+    fg->bind_buffer(_fg.alive_indices, lc.alive_indices.buffer);
+    fg->bind_buffer(_fg.dead_indices, lc.dead_indices.buffer);
+    fg->bind_buffer(_fg.particle_counters, lc.counters.buffer);
+
+    // the ping-pong buffers and the scratch of the sort job stay inside the sort pass.
+    auto &ps = _particle_sort;
+    _fg.sorted_keys = fg->import_buffer("sorted_keys");
+    _fg.sorted_values = fg->import_buffer("sorted_values");
+    _fg.sort_header = fg->import_buffer("sort_header");
+    fg->bind_buffer(_fg.sorted_keys, ps.keys[0].buffer);
+    fg->bind_buffer(_fg.sorted_values, ps.values[0].buffer);
+    fg->bind_buffer(_fg.sort_header, ps.header.buffer);
+
+    // stays in GENERAL: written as storage, read as sampled.
+    _fg.pyramid = fg->import_image("depth_pyramid", VK_IMAGE_ASPECT_COLOR_BIT);
+    fg->bind_image(_fg.pyramid, _depth_pyramid.texture.image, _depth_pyramid.level_count, VK_IMAGE_LAYOUT_GENERAL);
+
+    auto &mc = _meshlet_culling;
+    _fg.meshlet_draws = fg->import_buffer("meshlet_draw_commands");
+    _fg.culled_indices = fg->import_buffer("culled_indices");
+    fg->bind_buffer(_fg.meshlet_draws, mc.draw_commands.buffer);
+    fg->bind_buffer(_fg.culled_indices, mc.culled_indices.buffer);
+
+    _fg.simulate = fg->add_pass("simulate", FrameGraph::QUEUE_COMPUTE, [this](VkCommandBuffer cmd) { record_simulation(cmd); });
+    fg->write(_fg.simulate, _fg.instances, FrameGraph::ACCESS_COMPUTE_WRITE);
+
+    _fg.simulate_upload = fg->add_pass("upload simulation", FrameGraph::QUEUE_COMPUTE, [this](VkCommandBuffer cmd) { record_simulation_upload(cmd); });
+    fg->write(_fg.simulate_upload, _fg.instances, FrameGraph::ACCESS_TRANSFER_WRITE);
+
+    _fg.particles_emit = fg->add_pass("emit particles", FrameGraph::QUEUE_COMPUTE, [this](VkCommandBuffer cmd) { record_particle_emit(cmd); });
+    fg->write(_fg.particles_emit, _fg.instances, FrameGraph::ACCESS_COMPUTE_WRITE);
+    fg->write(_fg.particles_emit, _fg.alive_indices, FrameGraph::ACCESS_COMPUTE_WRITE);
+    fg->read(_fg.particles_emit, _fg.dead_indices, FrameGraph::ACCESS_COMPUTE_READ);
+    fg->write(_fg.particles_emit, _fg.particle_counters, FrameGraph::ACCESS_COMPUTE_READ_WRITE);
+
+    _fg.particles_update = fg->add_pass("update particles", FrameGraph::QUEUE_COMPUTE, [this](VkCommandBuffer cmd) { record_particle_update(cmd); });
+    fg->write(_fg.particles_update, _fg.instances, FrameGraph::ACCESS_COMPUTE_READ_WRITE);
+    fg->write(_fg.particles_update, _fg.alive_indices, FrameGraph::ACCESS_COMPUTE_READ_WRITE);
+    fg->write(_fg.particles_update, _fg.dead_indices, FrameGraph::ACCESS_COMPUTE_WRITE);
+    fg->read(_fg.particles_update, _fg.particle_counters, FrameGraph::ACCESS_INDIRECT_READ);
+    fg->write(_fg.particles_update, _fg.particle_counters, FrameGraph::ACCESS_COMPUTE_READ_WRITE);
+
+    _fg.particles_compact = fg->add_pass("compact particles", FrameGraph::QUEUE_COMPUTE, [this](VkCommandBuffer cmd) { record_particle_compact(cmd); });
+    fg->write(_fg.particles_compact, _fg.particle_counters, FrameGraph::ACCESS_COMPUTE_READ_WRITE);
+
+    _fg.sort_keys = fg->add_pass("sort keys", FrameGraph::QUEUE_COMPUTE, [this](VkCommandBuffer cmd) { record_sort_keys(cmd); });
+    fg->read(_fg.sort_keys, _fg.instances, FrameGraph::ACCESS_COMPUTE_READ);
+    fg->read(_fg.sort_keys, _fg.alive_indices, FrameGraph::ACCESS_COMPUTE_READ);
+    fg->read(_fg.sort_keys, _fg.particle_counters, FrameGraph::ACCESS_INDIRECT_READ);
+    fg->read(_fg.sort_keys, _fg.particle_counters, FrameGraph::ACCESS_COMPUTE_READ);
+    fg->write(_fg.sort_keys, _fg.sorted_keys, FrameGraph::ACCESS_COMPUTE_WRITE);
+    fg->write(_fg.sort_keys, _fg.sorted_values, FrameGraph::ACCESS_COMPUTE_WRITE);
+    fg->write(_fg.sort_keys, _fg.sort_header, FrameGraph::ACCESS_COMPUTE_WRITE);
+
+    _fg.radix_sort = fg->add_pass("radix sort", FrameGraph::QUEUE_COMPUTE, [this](VkCommandBuffer cmd) { record_radix_sort(cmd); });
+    fg->read(_fg.radix_sort, _fg.sort_header, FrameGraph::ACCESS_COMPUTE_READ);
+    fg->write(_fg.radix_sort, _fg.sorted_keys, FrameGraph::ACCESS_COMPUTE_READ_WRITE);
+    fg->write(_fg.radix_sort, _fg.sorted_values, FrameGraph::ACCESS_COMPUTE_READ_WRITE);
+
+    _fg.reset = fg->add_pass("reset draw commands", FrameGraph::QUEUE_COMPUTE, [this](VkCommandBuffer cmd) { record_draw_commands_reset(cmd); });
+    fg->write(_fg.reset, _fg.draw_commands, FrameGraph::ACCESS_TRANSFER_WRITE);
+
+    // the pyramid is the one of the previous frame.
+    _fg.classify = fg->add_pass("classify", FrameGraph::QUEUE_COMPUTE, [this](VkCommandBuffer cmd) { record_classify(cmd); });
+    fg->read(_fg.classify, _fg.instances, FrameGraph::ACCESS_COMPUTE_READ);
+    fg->read(_fg.classify, _fg.pyramid, FrameGraph::ACCESS_COMPUTE_READ);
+    fg->write(_fg.classify, _fg.near_indices, FrameGraph::ACCESS_COMPUTE_WRITE);
+    fg->write(_fg.classify, _fg.far_indices, FrameGraph::ACCESS_COMPUTE_WRITE);
+    fg->write(_fg.classify, _fg.draw_commands, FrameGraph::ACCESS_COMPUTE_READ_WRITE);
+    fg->read(_fg.classify, _fg.alive_indices, FrameGraph::ACCESS_COMPUTE_READ);
+    fg->read(_fg.classify, _fg.particle_counters, FrameGraph::ACCESS_INDIRECT_READ);
+    fg->read(_fg.classify, _fg.particle_counters, FrameGraph::ACCESS_COMPUTE_READ);
+
+    // graphics queue, with the global IBO and the object matrices.
+    _fg.meshlet_reset = fg->add_pass("reset meshlet draws", FrameGraph::QUEUE_GRAPHICS, [this](VkCommandBuffer cmd) { record_meshlet_draws_reset(cmd); });
+    fg->write(_fg.meshlet_reset, _fg.meshlet_draws, FrameGraph::ACCESS_TRANSFER_WRITE);
+
+    _fg.meshlet_cull = fg->add_pass("cull meshlets", FrameGraph::QUEUE_GRAPHICS, [this](VkCommandBuffer cmd) { record_meshlet_cull(cmd); });
+    fg->write(_fg.meshlet_cull, _fg.meshlet_draws, FrameGraph::ACCESS_COMPUTE_READ_WRITE);
+    fg->write(_fg.meshlet_cull, _fg.culled_indices, FrameGraph::ACCESS_COMPUTE_WRITE);
+}
 
-    // RENDER PASS BEGIN ---
+void Scene::declare_graphics_passes(FrameGraph *fg, FrameGraph::pass_id_t draw_pass, FrameGraph::resource_id_t depth)
+{
+    fg->read(draw_pass, _fg.instances, FrameGraph::ACCESS_VERTEX_BUFFER_READ);
+    fg->read(draw_pass, _fg.instances, FrameGraph::ACCESS_VERTEX_SHADER_READ); // impostors
+    fg->read(draw_pass, _fg.near_indices, FrameGraph::ACCESS_VERTEX_SHADER_READ);
+    fg->read(draw_pass, _fg.far_indices, FrameGraph::ACCESS_VERTEX_SHADER_READ);
+    fg->read(draw_pass, _fg.draw_commands, FrameGraph::ACCESS_INDIRECT_READ);
+    fg->read(draw_pass, _fg.sorted_values, FrameGraph::ACCESS_VERTEX_SHADER_READ);
+    fg->read(draw_pass, _fg.sort_header, FrameGraph::ACCESS_INDIRECT_READ);
+    fg->read(draw_pass, _fg.meshlet_draws, FrameGraph::ACCESS_INDIRECT_READ);
+    fg->read(draw_pass, _fg.culled_indices, FrameGraph::ACCESS_INDEX_BUFFER_READ);
+
+    // Hi-Z from this frame's depth, used to cull the next frame's instances.
+    _fg.pyramid_build = fg->add_pass("depth pyramid", FrameGraph::QUEUE_GRAPHICS,
+        [this](VkCommandBuffer cmd) { record_depth_pyramid(cmd, _depth_pyramid.render_extent); });
+    fg->read(_fg.pyramid_build, depth, FrameGraph::ACCESS_COMPUTE_SAMPLED_DEPTH);
+    fg->write(_fg.pyramid_build, _fg.pyramid, FrameGraph::ACCESS_COMPUTE_READ_WRITE);
+}
 
-    auto default_pipeline = _pipelines["default"];
-    auto default_view = _views["perspective"];
+void Scene::update_frame_graph(FrameGraph *fg, VkExtent2D render_extent)
+{
+    _texture_streaming.view_height = std::max(render_extent.height, 1u);
+
+    // CPU simulation: the particles are copied in, not computed.
+    const bool simulate_cpu = _simulate_cpu && !_use_emitters && !_cpu_particles.buffers.empty();
+    fg->set_enabled(_fg.simulate, !simulate_cpu && !_use_emitters);
+    fg->set_enabled(_fg.simulate_upload, simulate_cpu);
+
+    fg->set_enabled(_fg.particles_emit, _use_emitters);
+    fg->set_enabled(_fg.particles_update, _use_emitters);
+    fg->set_enabled(_fg.particles_compact, _use_emitters);
+
+    fg->set_enabled(_fg.sort_keys, _sort_particles);
+    fg->set_enabled(_fg.radix_sort, _sort_particles);
+
+    // with emitters, only classify knows the live particles: it feeds every draw.
+    // The sorted draw has its own list.
+    const bool classify = ((_instance_render_mode != INSTANCE_RENDER_MESH) || _use_emitters) && !_sort_particles;
+    fg->set_enabled(_fg.reset, classify);
+    fg->set_enabled(_fg.classify, classify);
+
+    // only the classify pass reads it.
+    const bool build_pyramid = classify && _occlusion_culling;
+    fg->set_enabled(_fg.pyramid_build, build_pyramid);
+    if (!build_pyramid)
+        _depth_pyramid.built = false;
+    _depth_pyramid.render_extent = render_extent;
+
+    // barriers only cover the live instances, anywhere in the pool with emitters.
+    const VkDeviceSize instance_count = _use_emitters ? _particle_lifecycle.capacity : (uint32_t)_nb_instances;
+    fg->set_buffer_range(_fg.instances, 0, instance_count * sizeof(instance_data_t));
+    fg->set_buffer_range(_fg.near_indices, 0, instance_count * sizeof(uint32_t));
+    fg->set_buffer_range(_fg.far_indices, 0, instance_count * sizeof(uint32_t));
+    fg->set_buffer_range(_fg.sorted_keys, 0, instance_count * sizeof(uint32_t));
+    fg->set_buffer_range(_fg.sorted_values, 0, instance_count * sizeof(uint32_t));
+
+    // the global objects are the only readers.
+    const bool cull_meshlets = !_meshlet_culling.meshlets.empty();
+    fg->set_enabled(_fg.meshlet_reset, cull_meshlets);
+    fg->set_enabled(_fg.meshlet_cull, cull_meshlets);
+    if (cull_meshlets)
+    {
+        fg->set_buffer_range(_fg.meshlet_draws, 0, _meshlet_culling.commands.size() * sizeof(VkDrawIndexedIndirectCommand));
+        fg->set_buffer_range(_fg.culled_indices, 0, (VkDeviceSize)_meshlet_culling.culled_index_count * sizeof(index_t));
+    }
+}
 
-    vkCmdSetViewport(cmd, 0, 1, &viewport);
-    vkCmdSetScissor(cmd, 0, 1, &scissor_rect);
+void Scene::record_simulation(VkCommandBuffer cmd)
+{
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, compute_particles.pipe.pipeline);
 
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, default_pipeline.pipeline);
+    // bind storage buffer and uniform buffer
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, compute_particles.pipe.pipeline_layout,
+        0, // bind to set #0
+        1, &compute_particles.descriptor_set, 0, nullptr);
 
-#if DRAW_GLOBAL_INSTANCES == 1
+    vkCmdDispatch(cmd, 1 + _nb_instances / 256, 1, 1);
+}
 
-    //
-    // SET 0
-    // scene/view bindings, one time
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, default_pipeline.pipeline_layout,
-        0, // bind to set #0
-        1, &default_view.descriptor_set, 0, nullptr);
+//
+// Runs particles.comp and the CPU simulation on the live particles at a few
+// times, reads the GPU particles back and compares position and rotation.
+// Sin and cos are only 2^-11 accurate on the GPU: the position tolerance
+// follows the amplitude of the curve, the rotation one is relative.
+//
+bool Scene::check_simulation()
+{
+    auto &check = _simulation_check;
+    check.requested = false;
+    check.results.clear();
 
-    for (const auto &m : _material_instances)
-    {
-        //
-        // SET 1
-        //
-        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, default_pipeline.pipeline_layout,
-            1, 1, &m.second.descriptor_set, 0, nullptr);
+    auto &is = _instance_sets[_particles];
+    uint32_t count = std::min(std::min(is.instance_count, (uint32_t)_nb_instances), _cpu_particles.simulator.size());
+    if (count == 0)
+        return true;
 
-        // TODO: loop in objects per material instances
-        for (auto i : _global_instance_set)
-        {
-            const _object_t &obj = _objects[i];
-            if (obj.material_ref != m.first)
-                continue;
+    Log("#  Check CPU/GPU simulation, " + std::to_string(count) + " particles\n");
 
-            // Bind Attribs Vertex/Index
-            VkDeviceSize offsets = obj.vertex_offset;
-            vkCmdBindVertexBuffers(cmd, 0, 1, &obj.vertex_buffer, &offsets);
-            vkCmdBindIndexBuffer(cmd, obj.index_buffer, obj.index_offset, VK_INDEX_TYPE_UINT16);
-
-            // ith object offset into dynamic ubo
-            std::array<uint32_t, 2> dynamic_offsets = {
-                static_cast<uint32_t>(i * _global_object_matrices_ubo.alignment),
-                static_cast<uint32_t>(i * _global_object_material_ubo.alignment),
-            };
-
-            //
-            // SET 2
-            // Bind Per-Object Uniforms
-            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, default_pipeline.pipeline_layout,
-                2, 1, &_global_objects_descriptor_set, //obj.descriptor_set,
-                (uint32_t)dynamic_offsets.size(), dynamic_offsets.data()); // dynamic offsets
+    // the frames in flight use the instance buffer and the compute command buffers.
+    VkResult result = vkDeviceWaitIdle(_ctx->device);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
 
-                                                                           // TODO: draw instanced for... instances.
-            vkCmdDrawIndexed(cmd, obj.indexCount, 1, 0, 0, 0);
-        }
+    VkDeviceSize size = count * sizeof(instance_data_t);
+    staging_buffer_t readback;
+    if (!create_buffer(&readback.buffer, &readback.memory, size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        return false;
+
+    VkQueryPool query_pool = VK_NULL_HANDLE;
+    if (_ctx->compute.timestamp_valid_bits != 0)
+    {
+        VkQueryPoolCreateInfo query_pool_info = {};
+        query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        query_pool_info.queryCount = 2;
+        result = vkCreateQueryPool(_ctx->device, &query_pool_info, nullptr, &query_pool);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            query_pool = VK_NULL_HANDLE;
     }
-#endif
 
-#if DRAW_INSTANCED_INSTANCES == 1
-    //
-    // Instanced Sets
-    //
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _instance_pipe.pipeline);
+    void *mapped = nullptr;
+    result = vkMapMemory(_ctx->device, readback.memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+    ErrorCheck(result);
 
-    //
-    // SET 0
-    // scene/view bindings, one time
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _instance_pipe.pipeline_layout,
-        0, // bind to set #0
-        1, &default_view.descriptor_set, 0, nullptr);
+    std::vector<ParticleSimulator::particle_t> gpu_particles(count);
+    std::vector<ParticleSimulator::particle_t> cpu_particles(count);
 
-    for (const auto &_is : _instance_sets)
+    // amplitude of the position curves, per axis.
+    const glm::vec3 amplitude = glm::abs(glm::vec3(_ax, _ay, _az)) + glm::abs(glm::vec3(_cx, _cy, _cz))
+        + glm::vec3(std::abs(_e0) + std::abs(_e1));
+    const glm::vec3 position_tolerance = 2.0f / 2048.0f * (glm::vec3(1.0f) + amplitude);
+    const float rotation_tolerance = 1e-5f;
+
+    // the last one is a week of uptime.
+    const double times[] = { 0.0, 1.0, 10.0, 1000.0, 604800.0 };
+    for (double t : times)
     {
-        const auto &is = _is.second;
-        //const auto &is = _instance_sets["plastic_cubes"];
-        //
-        // SET 1
-        //
-        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _instance_pipe.pipeline_layout,
-            1, 1, &_material_instances[is.material_ref].descriptor_set , 0, nullptr);
+        set_simulation_params(t);
 
-        const auto &obj = _objects[is.model_index];
+        {
+            void *ubo_mapped = nullptr;
+            result = vkMapMemory(_ctx->device, compute_particles.ubo.memory, 0, VK_WHOLE_SIZE, 0, &ubo_mapped);
+            ErrorCheck(result);
+            if (result != VK_SUCCESS)
+                break;
+            memcpy(ubo_mapped, &compute_particles.data, sizeof(compute_particles.data));
+            vkUnmapMemory(_ctx->device, compute_particles.ubo.memory);
+        }
 
-        // Bind Attribs Vertex/Index
-        VkDeviceSize vertex_offsets = obj.vertex_offset;
-        vkCmdBindVertexBuffers(cmd, 0, 1, &obj.vertex_buffer, &vertex_offsets); // bind point 0, per-vertex data
-        VkDeviceSize instance_offsets = 0;
-        vkCmdBindVertexBuffers(cmd, 1, 1, &is.instance_buffer.buffer, &instance_offsets); // bind point 1, per-instance data
-        vkCmdBindIndexBuffer(cmd, obj.index_buffer, obj.index_offset, VK_INDEX_TYPE_UINT16);
+        auto cmd = begin_single_time_commands(_ctx->compute);
+        {
+            if (query_pool != VK_NULL_HANDLE)
+            {
+                vkCmdResetQueryPool(cmd, query_pool, 0, 2);
+                vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
+            }
 
-        uint32_t instance_count = std::min(is.instance_count, (uint32_t)_nb_instances);
-        vkCmdDrawIndexed(cmd, obj.indexCount, instance_count, 0, 0, 0);
-    }
-#endif
-    // RENDER PASS END ---
-}
+            record_simulation(cmd);
 
-// =====================================================
+            if (query_pool != VK_NULL_HANDLE)
+                vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, query_pool, 1);
 
-uint32_t Scene::find_memory_type(uint32_t memory_type_bits, VkMemoryPropertyFlags desired_memory_flags)
-{
-    auto mem_props = _ctx->physical_device_memory_properties;
-    for (uint32_t i = 0; i < mem_props.memoryTypeCount; ++i)
-    {
-        if (memory_type_bits & 1)
+            VkMemoryBarrier barrier = {};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                1, &barrier, 0, nullptr, 0, nullptr);
+
+            VkBufferCopy region = {};
+            region.size = size;
+            vkCmdCopyBuffer(cmd, is.instance_buffer.buffer, readback.buffer, 1, &region);
+        }
+        end_single_time_commands(cmd, _ctx->compute);
+
+        _simulation_check_t::result_t r;
+        r.t = (float)t;
+        r.particle_count = count;
+        r.gpu_ms = -1.0f;
+        if (query_pool != VK_NULL_HANDLE)
         {
-            if ((mem_props.memoryTypes[i].propertyFlags & desired_memory_flags) == desired_memory_flags)
+            std::array<uint64_t, 2> timestamps = {};
+            result = vkGetQueryPoolResults(_ctx->device, query_pool, 0, 2,
+                sizeof(timestamps), timestamps.data(), sizeof(uint64_t),
+                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+            if (result == VK_SUCCESS)
+                r.gpu_ms = (float)((timestamps[1] - timestamps[0]) * _ctx->physical_device_properties.limits.timestampPeriod / 1000000.0);
+        }
+
+        // once, sequential: the readback memory is not cached.
+        memcpy(gpu_particles.data(), mapped, size);
+
+        _cpu_particles.simulator.simulate(_cpu_particles.params, count, cpu_particles.data());
+        r.cpu_ms = _cpu_particles.simulator.stats().wall_ms;
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            const auto &g = gpu_particles[i];
+            const auto &c = cpu_particles[i];
+            glm::vec3 position_error = glm::abs(glm::vec3(g.position) - glm::vec3(c.position));
+            glm::vec3 rotation_error = glm::abs(glm::vec3(g.rotation) - glm::vec3(c.rotation));
+            glm::vec3 rotation_limit = rotation_tolerance * (glm::vec3(1.0f) + glm::abs(glm::vec3(c.rotation)));
+
+            r.max_position_error = std::max(r.max_position_error, glm::max(position_error.x, glm::max(position_error.y, position_error.z)));
+            r.max_rotation_error = std::max(r.max_rotation_error, glm::max(rotation_error.x, glm::max(rotation_error.y, rotation_error.z)));
+
+            bool mismatch = glm::any(glm::greaterThan(position_error, position_tolerance))
+                || glm::any(glm::greaterThan(rotation_error, rotation_limit));
+            if (mismatch)
             {
-                return i;
+                if (r.mismatch_count == 0)
+                    r.first_mismatch = i;
+                ++r.mismatch_count;
             }
         }
-        memory_type_bits = memory_type_bits >> 1;
+
+        Log("#   t = " + std::to_string(t)
+            + ": max error position " + std::to_string(r.max_position_error)
+            + " rotation " + std::to_string(r.max_rotation_error)
+            + ", " + std::to_string(r.mismatch_count) + " mismatches"
+            + (r.mismatch_count ? " (first " + std::to_string(r.first_mismatch) + ")" : std::string())
+            + ", GPU " + std::to_string(r.gpu_ms) + " ms, CPU " + std::to_string(r.cpu_ms) + " ms\n");
+
+        check.results.push_back(r);
     }
 
-    return 0; // assert?
+    if (mapped)
+        vkUnmapMemory(_ctx->device, readback.memory);
+    vkFreeMemory(_ctx->device, readback.memory, nullptr);
+    vkDestroyBuffer(_ctx->device, readback.buffer, nullptr);
+    if (query_pool != VK_NULL_HANDLE)
+        vkDestroyQueryPool(_ctx->device, query_pool, nullptr);
+
+    // back to the animation time, the UBO is written by this frame.
+    set_simulation_params(_interpolate_simulation ? _simulation_clock.interpolated_time() : _simulation_clock.time());
+
+    return true;
 }
 
-bool Scene::create_buffer(
-    VkBuffer *pBuffer,                          // [out]
-    VkDeviceMemory *pBufferMemory,              // [out]
-    VkDeviceSize size,                          // [in]
-    VkBufferUsageFlags usage_flags,             // [in]
-    VkMemoryPropertyFlags memory_property_flags // [in]
+bool Scene::run_simulation_check()
+{
+    if (!check_simulation() || _simulation_check.results.empty())
+        return false;
+
+    for (const auto &r : _simulation_check.results)
+    {
+        if (r.mismatch_count > 0)
+            return false;
+    }
+    return true;
+}
+
+bool Scene::run_primitives_check()
+{
+    auto &check = _primitives_check;
+    if (!_primitives.run_tests(1u << check.log2_count, &check.results) || check.results.empty())
+        return false;
+
+    for (const auto &r : check.results)
+    {
+        if (r.mismatch_count > 0)
+            return false;
+    }
+    return true;
+}
+
+void Scene::record_simulation_upload(VkCommandBuffer cmd)
+{
+    const auto &cpu = _cpu_particles;
+    if (cpu.count == 0)
+        return;
+
+    // host writes are made visible by the submit.
+    VkBufferCopy region = {};
+    region.size = cpu.count * sizeof(instance_data_t);
+    vkCmdCopyBuffer(cmd, cpu.buffers[cpu.frame].buffer, _instance_sets[_particles].instance_buffer.buffer, 1, &region);
+}
+
+void Scene::record_draw_commands_reset(VkCommandBuffer cmd)
+{
+    auto &is = _instance_sets[_particles];
+    const auto &obj = _objects[is.model_index];
+
+    _instance_draw_commands_t reset_commands = {};
+    reset_commands.mesh.indexCount = obj.indexCount;
+    reset_commands.impostor.vertexCount = 6;
+    vkCmdUpdateBuffer(cmd, is.draw_commands.buffer, 0, sizeof(reset_commands), &reset_commands);
+}
+
+//
+// Particle lifecycle. The emit dispatch follows the spawn count of the
+// emitters, the update one comes from the counters, written by the last
+// compact: the CPU never knows how many particles are alive.
+//
+void Scene::record_particle_emit(VkCommandBuffer cmd)
+{
+    const auto &lc = _particle_lifecycle;
+    if (lc.data.emit_count == 0)
+        return;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, lc.emit_pipe.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, lc.emit_pipe.pipeline_layout,
+        0, 1, &lc.descriptor_set, 0, nullptr);
+
+    vkCmdDispatch(cmd, (lc.data.emit_count + 255) / 256, 1, 1);
+}
+
+void Scene::record_particle_update(VkCommandBuffer cmd)
+{
+    const auto &lc = _particle_lifecycle;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, lc.update_pipe.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, lc.update_pipe.pipeline_layout,
+        0, 1, &lc.descriptor_set, 0, nullptr);
+
+    vkCmdDispatchIndirect(cmd, lc.counters.buffer, offsetof(_particle_lifecycle_t::_counters_t, dispatch));
+}
+
+void Scene::record_particle_compact(VkCommandBuffer cmd)
+{
+    const auto &lc = _particle_lifecycle;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, lc.compact_pipe.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, lc.compact_pipe.pipeline_layout,
+        0, 1, &lc.descriptor_set, 0, nullptr);
+
+    vkCmdDispatch(cmd, 1, 1, 1);
+}
+
+//
+// Back to front particles. The keys pass writes the count, the dispatch of
+// the radix passes and the draw command: the CPU never knows the count with
+// emitters. The timestamps frame the whole sort.
+//
+void Scene::record_sort_keys(VkCommandBuffer cmd)
+{
+    auto &ps = _particle_sort;
+
+    if (ps.query_pool != VK_NULL_HANDLE)
+    {
+        vkCmdResetQueryPool(cmd, ps.query_pool, 2 * ps.frame, 2);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, ps.query_pool, 2 * ps.frame);
+    }
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ps.keys_pipe.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ps.keys_pipe.pipeline_layout,
+        0, 1, &ps.descriptor_set, 0, nullptr);
+
+    // with emitters, one thread per alive particle, at least one group.
+    if (_use_emitters)
+        vkCmdDispatchIndirect(cmd, _particle_lifecycle.counters.buffer, offsetof(_particle_lifecycle_t::_counters_t, dispatch));
+    else
+        vkCmdDispatch(cmd, std::max((ps.data.instance_count + 255) / 256, 1u), 1, 1);
+}
+
+//
+// Radix sort of keys[0] and values[0], the count is the one written by the
+// keys pass in the header.
+//
+void Scene::record_radix_sort(VkCommandBuffer cmd)
+{
+    auto &ps = _particle_sort;
+
+    _primitives.record_sort(cmd, ps.sort_job,
+        GpuPrimitives::count_at(offsetof(_particle_sort_t::_header_t, count) / sizeof(uint32_t)), ps.data.key_bits);
+
+    if (ps.query_pool != VK_NULL_HANDLE)
+    {
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, ps.query_pool, 2 * ps.frame + 1);
+        ps.written_frames |= 1u << ps.frame;
+    }
+}
+
+//
+// Classify near/far instances into the index lists and
+// fill the instance counts of the indirect draws.
+//
+void Scene::record_classify(VkCommandBuffer cmd)
+{
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, classify_particles.pipe.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, classify_particles.pipe.pipeline_layout,
+        0, 1, &classify_particles.descriptor_set, 0, nullptr);
+
+    // with emitters, one thread per alive particle.
+    if (_use_emitters)
+        vkCmdDispatchIndirect(cmd, _particle_lifecycle.counters.buffer, offsetof(_particle_lifecycle_t::_counters_t, dispatch));
+    else
+        vkCmdDispatch(cmd, 1 + _nb_instances / 256, 1, 1);
+}
+
+//
+// Index counts back to 0, the rest of the commands does not change.
+//
+void Scene::record_meshlet_draws_reset(VkCommandBuffer cmd)
+{
+    const auto &mc = _meshlet_culling;
+
+    VkBufferCopy region = {};
+    region.size = mc.commands.size() * sizeof(VkDrawIndexedIndirectCommand);
+    vkCmdCopyBuffer(cmd, mc.reset_commands.buffer, mc.draw_commands.buffer, 1, &region);
+}
+
+//
+// One group per meshlet, in rows of 65535 groups.
+//
+void Scene::record_meshlet_cull(VkCommandBuffer cmd)
+{
+    const auto &mc = _meshlet_culling;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mc.pipe.pipeline);
+    uint32_t matrices_offset = (uint32_t)(_global_object_matrices_ubo.frame * _global_object_matrices_ubo.size);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, mc.pipe.pipeline_layout,
+        0, 1, &mc.descriptor_set, 1, &matrices_offset);
+
+    const uint32_t count = (uint32_t)mc.meshlets.size();
+    const uint32_t row = 65535;
+    vkCmdDispatch(cmd, std::min(count, row), (count + row - 1) / row, 1);
+}
+
+void Scene::record_depth_pyramid(VkCommandBuffer cmd, VkExtent2D depth_extent)
+{
+    auto &dp = _depth_pyramid;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, dp.pipe.pipeline);
+
+    // the frame graph made the depth and the previous frame's reads safe.
+    // Only the rendered part of it is reduced, the pyramid always spans the whole view.
+    glm::ivec2 src_size = glm::ivec2(depth_extent.width, depth_extent.height);
+    for (uint32_t i = 0; i < dp.level_count; ++i)
+    {
+        glm::ivec2 dst_size = glm::max(glm::ivec2(dp.texture.extent.width >> i, dp.texture.extent.height >> i), glm::ivec2(1));
+
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, dp.pipe.pipeline_layout,
+            0, 1, &dp.descriptor_sets[i], 0, nullptr);
+
+        std::array<glm::ivec2, 2> sizes = { src_size, dst_size };
+        vkCmdPushConstants(cmd, dp.pipe.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sizes), sizes.data());
+
+        vkCmdDispatch(cmd, (dst_size.x + 7) / 8, (dst_size.y + 7) / 8, 1);
+
+        // level i is the source of level i+1. The graph covers the next frame's classify.
+        VkImageMemoryBarrier level_barrier = {};
+        level_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        level_barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        level_barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        level_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        level_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        level_barrier.image = dp.texture.image;
+        level_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        level_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        level_barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1 };
+
+        vkCmdPipelineBarrier(cmd,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            0, nullptr,
+            0, nullptr,
+            1, &level_barrier);
+
+        src_size = dst_size;
+    }
+
+    dp.built = true;
+}
+
+void Scene::draw(VkCommandBuffer cmd, VkViewport viewport, VkRect2D scissor_rect)
+{
+    // RENDER PASS BEGIN ---
+
+    const auto &default_pipeline = _pipelines[_default_pipeline];
+    const auto &default_view = _views[_main_view];
+
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &scissor_rect);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, default_pipeline.pipeline);
+
+#if DRAW_GLOBAL_INSTANCES == 1
+
+    //
+    // SET 0
+    // scene/view bindings, one time
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, default_pipeline.pipeline_layout,
+        0, // bind to set #0
+        1, &default_view.descriptor_set, 0, nullptr);
+
+    //
+    // SET 2
+    // all the objects matrices and material overrides, indexed by firstInstance.
+    // The copies written by this frame's upload().
+    std::array<uint32_t, 2> object_offsets = {
+        (uint32_t)(_global_object_matrices_ubo.frame * _global_object_matrices_ubo.size),
+        (uint32_t)(_global_object_material_ubo.frame * _global_object_material_ubo.size)
+    };
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, default_pipeline.pipeline_layout,
+        2, 1, &_global_objects_descriptor_set, (uint32_t)object_offsets.size(), object_offsets.data());
+
+    // Attribs Vertex/Index, shared by all the objects
+    VkDeviceSize global_vbo_offset = 0;
+    vkCmdBindVertexBuffers(cmd, 0, 1, &_global_object_vbo.buffer, &global_vbo_offset);
+    vkCmdBindIndexBuffer(cmd, _global_object_ibo.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+    for (const auto &bucket : _global_draw_buckets)
+    {
+        //
+        // SET 1
+        //
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, default_pipeline.pipeline_layout,
+            1, 1, &bucket.descriptor_set, 0, nullptr);
+
+        if (_ctx->features.multiDrawIndirect)
+        {
+            vkCmdDrawIndexedIndirect(cmd, _global_draw_commands.buffer,
+                bucket.first_command * sizeof(VkDrawIndexedIndirectCommand),
+                bucket.command_count, sizeof(VkDrawIndexedIndirectCommand));
+            continue;
+        }
+
+        for (uint32_t c = 0; c < bucket.command_count; ++c)
+        {
+            vkCmdDrawIndexedIndirect(cmd, _global_draw_commands.buffer,
+                (bucket.first_command + c) * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+        }
+    }
+
+    // Objects with meshlets: their visible indices, compacted by the cull pass.
+    const auto &mc = _meshlet_culling;
+    if (!mc.commands.empty())
+    {
+        vkCmdBindIndexBuffer(cmd, mc.culled_indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+        for (uint32_t i = 0; i < mc.commands.size(); ++i)
+        {
+            const _material_instance_t *m = _material_instances.get(_objects[mc.objects[i]].material);
+            if (!m || m->descriptor_set == VK_NULL_HANDLE)
+                continue;
+
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, default_pipeline.pipeline_layout,
+                1, 1, &m->descriptor_set, 0, nullptr);
+
+            vkCmdDrawIndexedIndirect(cmd, mc.draw_commands.buffer,
+                i * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+        }
+    }
+#endif
+
+#if DRAW_INSTANCED_INSTANCES == 1
+    //
+    // SET 0 and SET 1
+    // scene/view and bindless materials, one time for all the instance
+    // pipelines, their layouts are compatible up to set 1.
+    // Without bindless, set 1 is the material of each instance set.
+    //
+    std::array<VkDescriptorSet, 2> instance_sets = { default_view.descriptor_set, _bindless.descriptor_set };
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _instance_indirect_pipe.pipeline_layout,
+        0, _ctx->bindless ? 2 : 1, instance_sets.data(), 0, nullptr);
+    auto bind_instance_material = [&](const _instance_set_t &is) {
+        if (!_ctx->bindless)
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _instance_indirect_pipe.pipeline_layout,
+                1, 1, &_material_instances[is.material].descriptor_set, 0, nullptr);
+    };
+
+    if (_sort_particles)
+    {
+        //
+        // All the particles back to front, blended. The count comes from the keys pass.
+        //
+        const auto &ps = _particle_sort;
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _instance_sorted_pipe.pipeline);
+
+        bind_instance_material(_instance_sets[_particles]);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _instance_sorted_pipe.pipeline_layout,
+            2, 1, &ps.draw_descriptor_set, 0, nullptr);
+
+        vkCmdPushConstants(cmd, _instance_sorted_pipe.pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT,
+            0, sizeof(float), &ps.opacity);
+
+        const auto &obj = _objects[_instance_sets[_particles].model_index];
+        VkDeviceSize vertex_offsets = obj.vertex_offset;
+        vkCmdBindVertexBuffers(cmd, 0, 1, &obj.vertex_buffer, &vertex_offsets);
+        vkCmdBindIndexBuffer(cmd, obj.index_buffer, obj.index_offset, VK_INDEX_TYPE_UINT32);
+
+        vkCmdDrawIndexedIndirect(cmd, ps.header.buffer,
+            offsetof(_particle_sort_t::_header_t, draw), 1, sizeof(VkDrawIndexedIndirectCommand));
+    }
+    // with emitters, only the classify pass knows the live particles.
+    else if (_instance_render_mode == INSTANCE_RENDER_MESH && !_use_emitters)
+    {
+        //
+        // Instanced Sets
+        //
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _instance_pipe.pipeline);
+
+        for (const auto &is : _instance_sets)
+        {
+            const auto &obj = _objects[is.model_index];
+            bind_instance_material(is);
+
+            // Bind Attribs Vertex/Index
+            VkDeviceSize vertex_offsets = obj.vertex_offset;
+            vkCmdBindVertexBuffers(cmd, 0, 1, &obj.vertex_buffer, &vertex_offsets); // bind point 0, per-vertex data
+            VkDeviceSize instance_offsets = 0;
+            vkCmdBindVertexBuffers(cmd, 1, 1, &is.instance_buffer.buffer, &instance_offsets); // bind point 1, per-instance data
+            vkCmdBindIndexBuffer(cmd, obj.index_buffer, obj.index_offset, VK_INDEX_TYPE_UINT32);
+
+            uint32_t instance_count = std::min(is.instance_count, (uint32_t)_nb_instances);
+            vkCmdDrawIndexed(cmd, obj.indexCount, instance_count, 0, 0, 0);
+        }
+    }
+    else
+    {
+        //
+        // Near particles: full mesh, instance counts come from the classify pass.
+        //
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _instance_indirect_pipe.pipeline);
+
+        {
+            const auto &is = _instance_sets[_particles];
+            const auto &obj = _objects[is.model_index];
+            bind_instance_material(is);
+
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _instance_indirect_pipe.pipeline_layout,
+                2, 1, &is.near_descriptor_set, 0, nullptr);
+
+            VkDeviceSize vertex_offsets = obj.vertex_offset;
+            vkCmdBindVertexBuffers(cmd, 0, 1, &obj.vertex_buffer, &vertex_offsets);
+            vkCmdBindIndexBuffer(cmd, obj.index_buffer, obj.index_offset, VK_INDEX_TYPE_UINT32);
+
+            vkCmdDrawIndexedIndirect(cmd, is.draw_commands.buffer,
+                offsetof(_instance_draw_commands_t, mesh), 1, sizeof(_instance_draw_commands_t));
+        }
+
+        //
+        // Far particles: one view-aligned quad each, no vertex buffer.
+        //
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _impostor_pipe.pipeline);
+
+        {
+            const auto &is = _instance_sets[_particles];
+            const auto &obj = _objects[is.model_index];
+            bind_instance_material(is);
+
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _impostor_pipe.pipeline_layout,
+                2, 1, &is.far_descriptor_set, 0, nullptr);
+
+            vkCmdPushConstants(cmd, _impostor_pipe.pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT,
+                0, sizeof(float), &obj.bounding_radius);
+
+            vkCmdDrawIndirect(cmd, is.draw_commands.buffer,
+                offsetof(_instance_draw_commands_t, impostor), 1, sizeof(_instance_draw_commands_t));
+        }
+    }
+#endif
+    // RENDER PASS END ---
+}
+
+// =====================================================
+
+uint32_t Scene::find_memory_type(uint32_t memory_type_bits, VkMemoryPropertyFlags desired_memory_flags)
+{
+    auto mem_props = _ctx->physical_device_memory_properties;
+    for (uint32_t i = 0; i < mem_props.memoryTypeCount; ++i)
+    {
+        if (memory_type_bits & 1)
+        {
+            if ((mem_props.memoryTypes[i].propertyFlags & desired_memory_flags) == desired_memory_flags)
+            {
+                return i;
+            }
+        }
+        memory_type_bits = memory_type_bits >> 1;
+    }
+
+    return 0; // assert?
+}
+
+bool Scene::create_buffer(
+    VkBuffer *pBuffer,                          // [out]
+    VkDeviceMemory *pBufferMemory,              // [out]
+    VkDeviceSize size,                          // [in]
+    VkBufferUsageFlags usage_flags,             // [in]
+    VkMemoryPropertyFlags memory_property_flags // [in]
 )
 {
     VkResult result;
@@ -678,25 +1642,88 @@ bool Scene::copy_buffer_to_buffer(VkBuffer src, VkBuffer dst, VkDeviceSize size,
     return true;
 }
 
+bool Scene::upload_through_staging(const staging_writer_t &write, uint32_t count, uint32_t element_size, VkBuffer dst, VkDeviceSize dst_offset)
+{
+    // in pieces of the staging buffer, for meshes bigger than it.
+    auto &staging = get_global_staging_vbo();
+    uint32_t elements_per_piece = staging.size / element_size;
+    for (uint32_t first = 0; first < count; first += elements_per_piece)
+    {
+        uint32_t piece_count = std::min(count - first, elements_per_piece);
+        VkDeviceSize piece_size = (VkDeviceSize)piece_count * element_size;
+
+        void *mapped = nullptr;
+        VkResult result = vkMapMemory(_ctx->device, staging.memory, 0, piece_size, 0, &mapped);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+
+        write(mapped, first, piece_count);
+        vkUnmapMemory(_ctx->device, staging.memory);
+
+        if (!copy_buffer_to_buffer(staging.buffer, dst, piece_size, 0, dst_offset + (VkDeviceSize)first * element_size))
+            return false;
+    }
+
+    return true;
+}
+
+bool Scene::upload_through_staging(const void *data, VkDeviceSize size, VkBuffer dst, VkDeviceSize dst_offset)
+{
+    const uint8_t *src = (const uint8_t*)data;
+    return upload_through_staging([src](void *mapped, uint32_t first, uint32_t count) {
+        memcpy(mapped, src + first, count); }, (uint32_t)size, 1, dst, dst_offset);
+}
+
 bool Scene::create_texture_2d(_texture_t *texture)
 {
     VkResult result;
     auto device = _ctx->device;
 
+    VkFormatProperties format_properties = {};
+    vkGetPhysicalDeviceFormatProperties(_ctx->physical_device, texture->format, &format_properties);
+    const VkFormatFeatureFlags features = format_properties.optimalTilingFeatures;
+    const VkFormatFeatureFlags blit_features = VK_FORMAT_FEATURE_BLIT_SRC_BIT
+        | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+    if (!(features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+        Log("#     Format " + std::to_string(texture->format) + " cannot be sampled with optimal tiling\n");
+
+    // the blits are linear, else mipmap.comp, which only knows rgba32f.
+    bool blit = (features & blit_features) == blit_features;
+    texture->compute_mips = !texture->cooked && !blit && texture->format == VK_FORMAT_R32G32B32A32_SFLOAT
+        && (features & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT);
+
+    if (!texture->cooked) // else the levels of the data
+    {
+        texture->mip_levels = 1;
+        if (blit || texture->compute_mips)
+        {
+            while ((std::max(texture->extent.width, texture->extent.height) >> texture->mip_levels) > 0)
+                ++texture->mip_levels;
+        }
+        else
+        {
+            Log("#     Format " + std::to_string(texture->format) + " has no mip generation, 1 level\n");
+        }
+    }
+
     VkImageCreateInfo texture_create_info = {};
     texture_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     texture_create_info.imageType = VK_IMAGE_TYPE_2D;
     texture_create_info.format = texture->format;
     texture_create_info.extent = texture->extent;
-    texture_create_info.mipLevels = 1;
+    texture_create_info.mipLevels = texture->mip_levels;
     texture_create_info.arrayLayers = 1;
     texture_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
-    texture_create_info.tiling = VK_IMAGE_TILING_LINEAR;
-    texture_create_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    texture_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    texture_create_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    if (texture->compute_mips || texture->procedural)
+        texture_create_info.usage |= VK_IMAGE_USAGE_STORAGE_BIT;
     texture_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     texture_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // we will transfer the data from another buffer
 
-    Log("#     Create Image\n");
+    Log("#     Create Image, " + std::to_string(texture->mip_levels) + " levels\n");
     result = vkCreateImage(device, &texture_create_info, nullptr, &texture->image);
     ErrorCheck(result);
     if (result != VK_SUCCESS)
@@ -726,7 +1753,227 @@ bool Scene::create_texture_2d(_texture_t *texture)
     return true;
 }
 
-bool Scene::copy_data_to_staging_buffer(staging_buffer_t buffer, void *data, VkDeviceSize size, bool flush)
+bool Scene::record_texture_upload(VkCommandBuffer cmd, VkBuffer staging, VkDeviceSize offset,
+    const _texture_t &texture, _mip_scratch_t *scratch, const texture_cache_header_t *cooked)
+{
+    const uint32_t levels = texture.mip_levels;
+    const VkImageLayout write_layout = texture.compute_mips ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = write_layout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = texture.image;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1 }; // all the levels at once
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    // level 0, or every level of a cooked texture, from its first_level in the chain.
+    std::vector<VkBufferImageCopy> image_copy_regions(cooked ? levels : 1, vk::init::transfer::buffer_image_copy());
+    for (uint32_t i = 0; i < image_copy_regions.size(); ++i)
+    {
+        image_copy_regions[i].bufferOffset = offset
+            + (cooked ? cooked->level_offsets[texture.first_level + i] - cooked->level_offsets[texture.first_level] : 0);
+        image_copy_regions[i].imageSubresource.mipLevel = i;
+        image_copy_regions[i].imageExtent = { std::max(texture.extent.width >> i, 1u), std::max(texture.extent.height >> i, 1u), 1 };
+    }
+    vkCmdCopyBufferToImage(cmd, staging, texture.image, write_layout,
+        (uint32_t)image_copy_regions.size(), image_copy_regions.data());
+
+    if (!cooked && !texture.compute_mips)
+    {
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        record_mip_blits(cmd, texture);
+        return true;
+    }
+
+    VkPipelineStageFlags src_stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = write_layout;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    if (texture.compute_mips)
+    {
+        if (!record_compute_mips(cmd, texture, scratch))
+            return false;
+
+        barrier.srcAccessMask |= VK_ACCESS_SHADER_WRITE_BIT;
+        src_stage_mask |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    }
+
+    vkCmdPipelineBarrier(cmd, src_stage_mask, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    return true;
+}
+
+void Scene::record_mip_blits(VkCommandBuffer cmd, const _texture_t &texture)
+{
+    const uint32_t levels = texture.mip_levels;
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = texture.image;
+
+    for (uint32_t i = 1; i < levels; ++i)
+    {
+        VkImageBlit blit = {};
+        blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, i - 1, 0, 1 };
+        blit.srcOffsets[1] = { (int32_t)std::max(texture.extent.width >> (i - 1), 1u), (int32_t)std::max(texture.extent.height >> (i - 1), 1u), 1 };
+        blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, i, 0, 1 };
+        blit.dstOffsets[1] = { (int32_t)std::max(texture.extent.width >> i, 1u), (int32_t)std::max(texture.extent.height >> i, 1u), 1 };
+        vkCmdBlitImage(cmd, texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+        // level i is the source of the next blit.
+        if (i + 1 < levels)
+        {
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1 };
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0, 0, nullptr, 0, nullptr, 1, &barrier);
+        }
+    }
+
+    // the last level is still a transfer destination, the others sources.
+    std::array<VkImageMemoryBarrier, 2> final_barriers = { barrier, barrier };
+    uint32_t final_barrier_count = 0;
+    if (levels > 1)
+    {
+        final_barriers[final_barrier_count].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        final_barriers[final_barrier_count].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        final_barriers[final_barrier_count].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, levels - 1, 1, 0, 1 };
+        ++final_barrier_count;
+    }
+    final_barriers[final_barrier_count].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    final_barriers[final_barrier_count].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    final_barriers[final_barrier_count].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, std::max(levels - 1, 1u), 0, 1 };
+    ++final_barrier_count;
+
+    for (auto &b : final_barriers)
+    {
+        b.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        b.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        0, 0, nullptr, 0, nullptr, final_barrier_count, final_barriers.data());
+}
+
+bool Scene::record_compute_mips(VkCommandBuffer cmd, const _texture_t &texture, _mip_scratch_t *scratch)
+{
+    VkResult result;
+    const uint32_t levels = texture.mip_levels;
+
+    for (uint32_t i = 0; i < levels; ++i)
+    {
+        VkImageViewCreateInfo image_view_create_info = vk::init::image::image_view_create_info();
+        image_view_create_info.image = texture.image;
+        image_view_create_info.format = texture.format;
+        image_view_create_info.subresourceRange.baseMipLevel = i;
+        image_view_create_info.subresourceRange.levelCount = 1;
+
+        VkImageView view = VK_NULL_HANDLE;
+        result = vkCreateImageView(_ctx->device, &image_view_create_info, nullptr, &view);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+        scratch->level_views.push_back(view);
+    }
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = texture.image;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _mipmaps.pipe.pipeline);
+
+    for (uint32_t i = 1; i < levels; ++i)
+    {
+        VkDescriptorSetAllocateInfo descriptor_allocate_info = {};
+        descriptor_allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        descriptor_allocate_info.descriptorPool = _ctx->descriptor_pool;
+        descriptor_allocate_info.descriptorSetCount = 1;
+        descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[MIPMAP_DESCRIPTOR_SET_LAYOUT];
+
+        VkDescriptorSet set = VK_NULL_HANDLE;
+        result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &set);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+        scratch->descriptor_sets.push_back(set);
+
+        std::array<VkDescriptorImageInfo, 2> descriptor_image_infos = {};
+        descriptor_image_infos[0].imageView = scratch->level_views[i - 1];
+        descriptor_image_infos[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        descriptor_image_infos[1].imageView = scratch->level_views[i];
+        descriptor_image_infos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        std::array<VkWriteDescriptorSet, 2> write_descriptor_sets = {};
+        for (uint32_t b = 0; b < write_descriptor_sets.size(); ++b)
+        {
+            write_descriptor_sets[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write_descriptor_sets[b].dstSet = set;
+            write_descriptor_sets[b].dstBinding = b;
+            write_descriptor_sets[b].dstArrayElement = 0;
+            write_descriptor_sets[b].descriptorCount = 1;
+            write_descriptor_sets[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            write_descriptor_sets[b].pImageInfo = &descriptor_image_infos[b];
+        }
+        vkUpdateDescriptorSets(_ctx->device, (uint32_t)write_descriptor_sets.size(), write_descriptor_sets.data(), 0, nullptr);
+
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _mipmaps.pipe.pipeline_layout, 0, 1, &set, 0, nullptr);
+
+        uint32_t width = std::max(texture.extent.width >> i, 1u);
+        uint32_t height = std::max(texture.extent.height >> i, 1u);
+        vkCmdDispatch(cmd, (width + 7) / 8, (height + 7) / 8, 1);
+
+        // level i is the source of the next dispatch.
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1 };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+
+    return true;
+}
+
+void Scene::destroy_mip_scratch(_mip_scratch_t *scratch)
+{
+    for (auto view : scratch->level_views)
+        vkDestroyImageView(_ctx->device, view, nullptr);
+    scratch->level_views.clear();
+
+    if (!scratch->descriptor_sets.empty())
+        vkFreeDescriptorSets(_ctx->device, _ctx->descriptor_pool, (uint32_t)scratch->descriptor_sets.size(), scratch->descriptor_sets.data());
+    scratch->descriptor_sets.clear();
+}
+
+bool Scene::copy_data_to_staging_buffer(staging_buffer_t buffer, void *data, VkDeviceSize size, bool flush)
 {
     VkResult result;
     auto device = _ctx->device;
@@ -760,7 +2007,7 @@ bool Scene::transition_texture(VkImage *pImage, VkImageLayout old_layout, VkImag
     VkAccessFlags src_access_mask = VK_ACCESS_HOST_WRITE_BIT;
     VkAccessFlags dst_access_mask = VK_ACCESS_SHADER_READ_BIT;
     VkPipelineStageFlags src_stage_mask = VK_PIPELINE_STAGE_HOST_BIT;
-    VkPipelineStageFlags dst_stage_mask = VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT;
+    VkPipelineStageFlags dst_stage_mask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
 
     if (old_layout == VK_IMAGE_LAYOUT_UNDEFINED
         && new_layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
@@ -874,7 +2121,7 @@ bool Scene::transition_textures()
         layout_transition_barriers[i].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
         layout_transition_barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
         layout_transition_barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        layout_transition_barriers[i].image = t.second.image;
+        layout_transition_barriers[i].image = t.image;
         layout_transition_barriers[i].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
         ++i;
     }
@@ -882,7 +2129,7 @@ bool Scene::transition_textures()
     Log("#     Transition all textures\n");
     vkCmdPipelineBarrier(cmd,
         VK_PIPELINE_STAGE_HOST_BIT,
-        VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, // only sampled by the fragment shaders
         0,
         0, nullptr,
         0, nullptr,
@@ -916,47 +2163,50 @@ bool Scene::transition_textures()
 
 bool Scene::create_global_object_buffers()
 {
-    Log("#     Create Global Matrices Object\'s UBO\n");
+    // each copy starts on a dynamic offset and on a flush atom, both powers of 2.
+    const auto &limits = _ctx->physical_device_properties.limits;
+    const VkDeviceSize copy_alignment = std::max<VkDeviceSize>(std::max(limits.minStorageBufferOffsetAlignment, limits.nonCoherentAtomSize), 1);
+    auto copy_size = [copy_alignment](size_t size) { return (size_t)((size + copy_alignment - 1) / copy_alignment * copy_alignment); };
+
+    Log("#     Create Global Matrices Object\'s SSBO\n");
     {
-        // Find the memory alignment for the object matrices;
+        // Indexed by the object index (firstInstance) in the shader, tightly packed (std430).
         dynamic_uniform_buffer_t &mtx_ubo = _global_object_matrices_ubo;
-        size_t min_ubo_alignment = _ctx->physical_device_properties.limits.minUniformBufferOffsetAlignment;
-        mtx_ubo.alignment = sizeof(glm::mat4);
-        if (min_ubo_alignment > 0)
-        {
-            mtx_ubo.alignment = (mtx_ubo.alignment + min_ubo_alignment - 1) & ~(min_ubo_alignment - 1);
-        }
-        mtx_ubo.size = MAX_NB_OBJECTS * mtx_ubo.alignment;
-        mtx_ubo.host_data = utils::aligned_alloc(mtx_ubo.size, mtx_ubo.alignment);
+        // model matrix + normal matrix (mat3 as 3 x vec4), 112 bytes.
+        mtx_ubo.alignment = sizeof(TransformSystem::matrices_t);
+        mtx_ubo.size = copy_size(MAX_NB_OBJECTS * mtx_ubo.alignment);
+        mtx_ubo.host_data = utils::aligned_alloc(mtx_ubo.size, 16); // stride is not a power of 2
         for (size_t i = 0; i < MAX_NB_OBJECTS; ++i)
         {
-            glm::mat4 *model_mat_for_obj_i = (glm::mat4*)((uint64_t)mtx_ubo.host_data + (i * mtx_ubo.alignment));
-            *model_mat_for_obj_i = glm::mat4(1);
+            auto *matrices_for_obj_i = (TransformSystem::matrices_t*)((uint64_t)mtx_ubo.host_data + (i * mtx_ubo.alignment));
+            *matrices_for_obj_i = TransformSystem::matrices_t();
         }
 
 
         if (!create_buffer(
             &mtx_ubo.buffer,
             &mtx_ubo.memory,
-            mtx_ubo.size,
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+            MAX_PARALLEL_FRAMES * mtx_ubo.size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) // coherent or not, the dirty ranges are flushed
+            return false;
+
+        VkResult result = vkMapMemory(_ctx->device, mtx_ubo.memory, 0, VK_WHOLE_SIZE, 0, &mtx_ubo.mapped);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
             return false;
+        mtx_ubo.dirty.assign(MAX_NB_OBJECTS, 0);
+        mtx_ubo.any_dirty = false;
 
         _global_object_matrices_ubo_created = true;
     }
 
-    Log("#     Create Global Materials Object\'s UBO\n");
+    Log("#     Create Global Materials Object\'s SSBO\n");
     {
-        // Find the memory alignment for the object material overrides
+        // Same indexing as the matrices, 2 x vec4 per object.
         dynamic_uniform_buffer_t &mtl_ubo = _global_object_material_ubo;
-        size_t min_ubo_alignment = _ctx->physical_device_properties.limits.minUniformBufferOffsetAlignment;
         mtl_ubo.alignment = sizeof(_material_override_t);
-        if (min_ubo_alignment > 0)
-        {
-            mtl_ubo.alignment = (mtl_ubo.alignment + min_ubo_alignment - 1) & ~(min_ubo_alignment - 1);
-        }
-        mtl_ubo.size = MAX_NB_OBJECTS * mtl_ubo.alignment;
+        mtl_ubo.size = copy_size(MAX_NB_OBJECTS * mtl_ubo.alignment);
         mtl_ubo.host_data = utils::aligned_alloc(mtl_ubo.size, mtl_ubo.alignment);
         for (size_t i = 0; i < MAX_NB_OBJECTS; ++i)
         {
@@ -969,10 +2219,17 @@ bool Scene::create_global_object_buffers()
         if (!create_buffer(
             &mtl_ubo.buffer,
             &mtl_ubo.memory,
-            mtl_ubo.size,
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+            MAX_PARALLEL_FRAMES * mtl_ubo.size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) // coherent or not, the dirty ranges are flushed
+            return false;
+
+        VkResult result = vkMapMemory(_ctx->device, mtl_ubo.memory, 0, VK_WHOLE_SIZE, 0, &mtl_ubo.mapped);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
             return false;
+        mtl_ubo.dirty.assign(MAX_NB_OBJECTS, 0);
+        mtl_ubo.any_dirty = false;
 
         _global_object_material_ubo_created = true;
     }
@@ -982,11 +2239,12 @@ bool Scene::create_global_object_buffers()
     if (!create_buffer(
         &_global_object_vbo.buffer,
         &_global_object_vbo.memory,
-        4 * 1024 * 1024,
+        GLOBAL_VBO_SIZE,
         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
         return false;
 
+    _global_object_vbo.size = GLOBAL_VBO_SIZE;
     _global_object_vbo_created = true;
 
     // IBO
@@ -994,30 +2252,104 @@ bool Scene::create_global_object_buffers()
     if (!create_buffer(
         &_global_object_ibo.buffer,
         &_global_object_ibo.memory,
-        4 * 1024 * 1024,
-        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        GLOBAL_IBO_SIZE,
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, // read by the meshlet pass
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
         return false;
 
+    _global_object_ibo.size = GLOBAL_IBO_SIZE;
     _global_object_ibo_created = true;
 
     Log("#     Create Staging Buffer for VBO/IBO\n");
     if (!create_buffer(
         &_global_staging_vbo.buffer,
         &_global_staging_vbo.memory,
-        8 * 1024 * 1024,
+        GLOBAL_STAGING_SIZE,
         VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
         return false;
 
+    _global_staging_vbo.size = GLOBAL_STAGING_SIZE;
     _global_staging_vbo_created = true;
 
+    if (!create_meshlet_culling_buffers())
+        return false;
+
+    return true;
+}
+
+//
+// Meshlets, culled IBO and draw commands, for all the objects with meshlets.
+//
+bool Scene::create_meshlet_culling_buffers()
+{
+    auto &mc = _meshlet_culling;
+
+    Log("#     Create Meshlets, Culled IBO and Meshlet Draw Commands\n");
+    if (!create_buffer(
+        &mc.gpu_meshlets.buffer,
+        &mc.gpu_meshlets.memory,
+        MAX_NB_MESHLETS * sizeof(_meshlet_culling_t::_gpu_meshlet_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+        return false;
+
+    if (!create_buffer(
+        &mc.culled_indices.buffer,
+        &mc.culled_indices.memory,
+        CULLED_IBO_SIZE,
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+        return false;
+
+    if (!create_buffer(
+        &mc.draw_commands.buffer,
+        &mc.draw_commands.memory,
+        MAX_NB_OBJECTS * sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+        return false;
+
+    if (!create_buffer(
+        &mc.reset_commands.buffer,
+        &mc.reset_commands.memory,
+        MAX_NB_OBJECTS * sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        return false;
+
     return true;
 }
 
+void Scene::destroy_meshlet_culling_buffers()
+{
+    auto &mc = _meshlet_culling;
+
+    for (auto *b : { &mc.gpu_meshlets, &mc.culled_indices, &mc.draw_commands })
+    {
+        vkFreeMemory(_ctx->device, b->memory, nullptr);
+        vkDestroyBuffer(_ctx->device, b->buffer, nullptr);
+        *b = {};
+    }
+    vkFreeMemory(_ctx->device, mc.reset_commands.memory, nullptr);
+    vkDestroyBuffer(_ctx->device, mc.reset_commands.buffer, nullptr);
+    mc.reset_commands = {};
+
+    mc.meshlets.clear();
+    mc.commands.clear();
+    mc.objects.clear();
+    mc.culled_index_count = 0;
+}
+
 void Scene::destroy_global_object_buffers()
 {
     Log("#    Free Global Object Buffers Memory\n");
+    if (_global_object_matrices_ubo.mapped)
+        vkUnmapMemory(_ctx->device, _global_object_matrices_ubo.memory);
+    if (_global_object_material_ubo.mapped)
+        vkUnmapMemory(_ctx->device, _global_object_material_ubo.memory);
+    _global_object_matrices_ubo.mapped = nullptr;
+    _global_object_material_ubo.mapped = nullptr;
     vkFreeMemory(_ctx->device, _global_object_matrices_ubo.memory, nullptr);
     vkFreeMemory(_ctx->device, _global_object_material_ubo.memory, nullptr);
     vkFreeMemory(_ctx->device, _global_object_vbo.memory, nullptr);
@@ -1031,6 +2363,27 @@ void Scene::destroy_global_object_buffers()
     vkDestroyBuffer(_ctx->device, _global_object_ibo.buffer, nullptr);
     vkDestroyBuffer(_ctx->device, _global_staging_vbo.buffer, nullptr);
 
+    vkFreeMemory(_ctx->device, _global_draw_commands.memory, nullptr);
+    vkDestroyBuffer(_ctx->device, _global_draw_commands.buffer, nullptr);
+    _global_draw_commands = {};
+    _global_draw_buckets.clear();
+    destroy_meshlet_culling_buffers();
+
+    Log("#    Destroy Instance Set Buffers\n");
+    for (auto &is : _instance_sets)
+    {
+        for (auto *b : { &is.instance_buffer, &is.near_indices, &is.far_indices, &is.draw_commands })
+        {
+            vkFreeMemory(_ctx->device, b->memory, nullptr);
+            vkDestroyBuffer(_ctx->device, b->buffer, nullptr);
+        }
+        vkFreeMemory(_ctx->device, is.staging_buffer.memory, nullptr);
+        vkDestroyBuffer(_ctx->device, is.staging_buffer.buffer, nullptr);
+    }
+    destroy_cpu_simulation_buffers();
+    destroy_particle_lifecycle_buffers();
+    destroy_particle_sort_buffers();
+
     _global_object_matrices_ubo_created = false;
     _global_object_material_ubo_created = false;
     _global_object_vbo_created = false;
@@ -1038,7 +2391,224 @@ void Scene::destroy_global_object_buffers()
     _global_staging_vbo_created = false;
 }
 
+//
+// CPU simulation buffers, one per parallel frame, created the first time
+// the CPU simulation is on. Only position, rotation and scale are
+// simulated: the rest of the particles is copied from the instance buffer.
+//
+bool Scene::create_cpu_simulation_buffers()
+{
+    auto &cpu = _cpu_particles;
+    if (!cpu.buffers.empty())
+        return true;
+
+    Log("#     Create CPU Simulation Buffers\n");
+    auto &is = _instance_sets[_particles];
+    VkDeviceSize size = is.capacity * sizeof(instance_data_t);
+
+    cpu.buffers.resize(MAX_PARALLEL_FRAMES);
+    cpu.mapped.resize(MAX_PARALLEL_FRAMES, nullptr);
+    for (uint32_t f = 0; f < MAX_PARALLEL_FRAMES; ++f)
+    {
+        bool ok = create_buffer(
+            &cpu.buffers[f].buffer,
+            &cpu.buffers[f].memory,
+            size,
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+        if (ok)
+        {
+            copy_buffer_to_buffer(is.instance_buffer.buffer, cpu.buffers[f].buffer, size, 0, 0);
+
+            VkResult result = vkMapMemory(_ctx->device, cpu.buffers[f].memory, 0, VK_WHOLE_SIZE, 0, (void**)&cpu.mapped[f]);
+            ErrorCheck(result);
+            ok = (result == VK_SUCCESS);
+        }
+
+        if (!ok)
+        {
+            // back to the GPU simulation.
+            destroy_cpu_simulation_buffers();
+            _simulate_cpu = false;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Scene::destroy_cpu_simulation_buffers()
+{
+    auto &cpu = _cpu_particles;
+    for (size_t f = 0; f < cpu.buffers.size(); ++f)
+    {
+        if (cpu.mapped[f])
+            vkUnmapMemory(_ctx->device, cpu.buffers[f].memory);
+        vkFreeMemory(_ctx->device, cpu.buffers[f].memory, nullptr);
+        vkDestroyBuffer(_ctx->device, cpu.buffers[f].buffer, nullptr);
+    }
+    cpu.buffers.clear();
+    cpu.mapped.clear();
+    cpu.count = 0;
+}
+
+//
+// Particle lifecycle lists, indices into the instance buffer, and their counters.
+//
+bool Scene::create_particle_lifecycle_buffers()
+{
+    auto &lc = _particle_lifecycle;
+
+    Log("#     Create Particle Lifecycle Alive/Dead Lists and Counters\n");
+    if (!create_buffer(
+        &lc.alive_indices.buffer,
+        &lc.alive_indices.memory,
+        2 * lc.capacity * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+        return false;
+
+    if (!create_buffer(
+        &lc.dead_indices.buffer,
+        &lc.dead_indices.memory,
+        lc.capacity * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+        return false;
+
+    if (!create_buffer(
+        &lc.counters.buffer,
+        &lc.counters.memory,
+        sizeof(_particle_lifecycle_t::_counters_t),
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+        return false;
+
+    lc.reset_requested = true;
+    return true;
+}
+
+void Scene::destroy_particle_lifecycle_buffers()
+{
+    auto &lc = _particle_lifecycle;
+    for (auto *b : { &lc.alive_indices, &lc.dead_indices, &lc.counters })
+    {
+        vkFreeMemory(_ctx->device, b->memory, nullptr);
+        vkDestroyBuffer(_ctx->device, b->buffer, nullptr);
+        *b = {};
+    }
+}
+
+//
+// Every particle dead: all of them in the dead list, both alive lists empty.
+// Waits for the device, the frames in flight may be using the lists.
+//
+bool Scene::reset_particle_lifecycle()
+{
+    auto &lc = _particle_lifecycle;
+    lc.reset_requested = false;
+
+    VkResult result = vkDeviceWaitIdle(_ctx->device);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    const VkDeviceSize counters_size = sizeof(_particle_lifecycle_t::_counters_t);
+    static_assert(sizeof(_particle_lifecycle_t::_counters_t) % sizeof(uint32_t) == 0, "counters are uploaded as uints");
+
+    _particle_lifecycle_t::_counters_t counters = {};
+    counters.dispatch = { 1, 1, 1 }; // the threads check alive_count
+    counters.dead_count = (int32_t)lc.capacity;
+
+    // counters, then the dead list. Popped from the end: particle 0 first.
+    std::vector<uint32_t> data(counters_size / sizeof(uint32_t) + lc.capacity);
+    memcpy(data.data(), &counters, counters_size);
+    uint32_t *dead = data.data() + counters_size / sizeof(uint32_t);
+    for (uint32_t i = 0; i < lc.capacity; ++i)
+        dead[i] = lc.capacity - 1 - i;
+
+    // the instance staging buffer is only used by compile().
+    auto &is = _instance_sets[_particles];
+    if (!copy_data_to_staging_buffer(is.staging_buffer, data.data(), data.size() * sizeof(uint32_t), false))
+        return false;
+    if (!copy_buffer_to_buffer(is.staging_buffer.buffer, lc.counters.buffer, counters_size, 0, 0))
+        return false;
+    return copy_buffer_to_buffer(is.staging_buffer.buffer, lc.dead_indices.buffer, lc.capacity * sizeof(uint32_t), counters_size, 0);
+}
+
 // lazy creation - can do it at the beginning.
+//
+// Particle sort keys and values, twice, and the sort arguments. Sized for
+// every particle of the pool.
+//
+bool Scene::create_particle_sort_buffers()
+{
+    auto &ps = _particle_sort;
+    const uint32_t max_count = _instance_sets[_particles].capacity;
+
+    Log("#     Create Particle Sort Keys/Values and Header\n");
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        for (auto *b : { &ps.keys[i], &ps.values[i] })
+        {
+            if (!create_buffer(
+                &b->buffer,
+                &b->memory,
+                max_count * sizeof(uint32_t),
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+                return false;
+        }
+    }
+
+    if (!create_buffer(
+        &ps.header.buffer,
+        &ps.header.memory,
+        sizeof(_particle_sort_t::_header_t),
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+        return false;
+
+    Log("#     Create Particle Sort Job\n");
+    if (!_primitives.create_sort_job(&ps.sort_job, max_count,
+        { ps.keys[0].buffer, ps.keys[1].buffer }, { ps.values[0].buffer, ps.values[1].buffer }, ps.header.buffer))
+        return false;
+
+    // the sort time, when the compute queue has timestamps.
+    if (_ctx->compute.timestamp_valid_bits != 0)
+    {
+        VkQueryPoolCreateInfo query_pool_info = {};
+        query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        query_pool_info.queryCount = 2 * MAX_PARALLEL_FRAMES;
+        VkResult result = vkCreateQueryPool(_ctx->device, &query_pool_info, nullptr, &ps.query_pool);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            ps.query_pool = VK_NULL_HANDLE;
+    }
+
+    return true;
+}
+
+void Scene::destroy_particle_sort_buffers()
+{
+    auto &ps = _particle_sort;
+    _primitives.destroy_job(&ps.sort_job);
+
+    for (auto *b : { &ps.keys[0], &ps.keys[1], &ps.values[0], &ps.values[1], &ps.header })
+    {
+        vkFreeMemory(_ctx->device, b->memory, nullptr);
+        vkDestroyBuffer(_ctx->device, b->buffer, nullptr);
+        *b = {};
+    }
+
+    if (ps.query_pool != VK_NULL_HANDLE)
+        vkDestroyQueryPool(_ctx->device, ps.query_pool, nullptr);
+    ps.query_pool = VK_NULL_HANDLE;
+    ps.written_frames = 0;
+}
+
 Scene::vertex_buffer_object_t &Scene::get_global_object_vbo()
 {
     if (!_global_object_vbo_created)
@@ -1141,6 +2711,42 @@ bool Scene::create_scene_ubo()
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
         return false;
 
+    Log("#     Create Classify Uniform Buffer\n");
+    if (!create_buffer(
+        &classify_particles.ubo.buffer,
+        &classify_particles.ubo.memory,
+        sizeof(_classify_particles_data_t::_classify_data_t),
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        return false;
+
+    Log("#     Create Particle Lifecycle Uniform Buffer\n");
+    if (!create_buffer(
+        &_particle_lifecycle.ubo.buffer,
+        &_particle_lifecycle.ubo.memory,
+        sizeof(_particle_lifecycle_t::_lifecycle_data_t),
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        return false;
+
+    Log("#     Create Particle Sort Uniform Buffer\n");
+    if (!create_buffer(
+        &_particle_sort.ubo.buffer,
+        &_particle_sort.ubo.memory,
+        sizeof(_particle_sort_t::_sort_data_t),
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        return false;
+
+    Log("#     Create Meshlet Culling Uniform Buffer\n");
+    if (!create_buffer(
+        &_meshlet_culling.ubo.buffer,
+        &_meshlet_culling.ubo.memory,
+        sizeof(_meshlet_culling_t::_cull_data_t),
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        return false;
+
     return true;
 }
 
@@ -1151,6 +2757,18 @@ void Scene::destroy_scene_ubo()
 
     Log("#    Destroy Buffer\n");
     vkDestroyBuffer(_ctx->device, _scene_ubo.buffer, nullptr);
+
+    vkFreeMemory(_ctx->device, classify_particles.ubo.memory, nullptr);
+    vkDestroyBuffer(_ctx->device, classify_particles.ubo.buffer, nullptr);
+
+    vkFreeMemory(_ctx->device, _particle_lifecycle.ubo.memory, nullptr);
+    vkDestroyBuffer(_ctx->device, _particle_lifecycle.ubo.buffer, nullptr);
+
+    vkFreeMemory(_ctx->device, _particle_sort.ubo.memory, nullptr);
+    vkDestroyBuffer(_ctx->device, _particle_sort.ubo.buffer, nullptr);
+
+    vkFreeMemory(_ctx->device, _meshlet_culling.ubo.memory, nullptr);
+    vkDestroyBuffer(_ctx->device, _meshlet_culling.ubo.buffer, nullptr);
 }
 
 
@@ -1159,8 +2777,24 @@ void *Scene::get_aligned(dynamic_uniform_buffer_t *buffer, uint32_t idx)
     return (void*)((uint64_t)buffer->host_data + (idx * buffer->alignment));
 }
 
+void Scene::mark_dirty(dynamic_uniform_buffer_t *buffer, uint32_t idx)
+{
+    buffer->dirty[idx] = MAX_PARALLEL_FRAMES;
+    buffer->any_dirty = true;
+}
+
 void Scene::animate_object(float dt)
 {
+    // local rotations, the hierarchy carries the children around.
+    for (uint32_t i = 0; i < (uint32_t)_objects.size() && i < _transforms.size(); ++i)
+    {
+        const glm::vec3 &spin = _objects[i].spin;
+        if (spin == glm::vec3(0))
+            continue;
+
+        _transforms.set_rotation(i, glm::normalize(_transforms.rotation(i) * glm::quat(spin * dt)));
+    }
+
 #if 0
     static float obj_x = 0.0f;
     static float obj_y = 0.0f;
@@ -1179,41 +2813,201 @@ void Scene::animate_object(float dt)
     auto &obj_0 = _objects[0];
     auto &obj_1 = _objects[1];
 
-    // Aligned offset
-    glm::mat4* model_mat_obj_0 = (glm::mat4*)get_aligned(&_global_object_matrices_ubo, 0);
-    glm::mat4* model_mat_obj_1 = (glm::mat4*)get_aligned(&_global_object_matrices_ubo, 1);
-
-    *model_mat_obj_0 = glm::translate(glm::mat4(1), obj_0.position + glm::vec3(obj_x, obj_y, obj_z));
-    *model_mat_obj_1 = glm::translate(glm::mat4(1), obj_1.position + glm::vec3(-obj_x, obj_y, -obj_z));
+    // children follow, the matrices are rebuilt in upload().
+    _transforms.set_translation(0, obj_0.position + glm::vec3(obj_x, obj_y, obj_z));
+    _transforms.set_translation(1, obj_1.position + glm::vec3(-obj_x, obj_y, -obj_z));
 #endif
 
     if (!_animate_instance_data)
+    {
+        update_emitters(0.0);
         return;
+    }
 
-    static float t = 0.0f; // in seconds
-    t += dt;
+    // The kernel is a function of the time, not of the previous state:
+    // the steps due this frame are all covered by one dispatch at the last one.
+    uint32_t steps = _simulation_clock.advance(dt);
+    set_simulation_params(_interpolate_simulation ? _simulation_clock.interpolated_time() : _simulation_clock.time());
 
-    // fill uniform data for the simulation compute shader.
-    {
-        uint32_t instance_count = std::min(_instance_sets["particles"].instance_count, (uint32_t)_nb_instances);
-        compute_particles.data.data0 = glm::vec4(t, _speed, _rotation_speed, _pdt);
-        compute_particles.data.data1 = glm::vec4(_e0, _e1, _e2, _e3);
-        compute_particles.data.data2 = glm::vec4(_ax, _bx, _cx, _dx);
-        compute_particles.data.data3 = glm::vec4(_ay, _by, _cy, _dy);
-        compute_particles.data.data4 = glm::vec4(_az, _bz, _cz, _dz);
-        compute_particles.data.data5 = glm::vec4(_psx, _psy, _psz, 0);
-        compute_particles.data.data6 = glm::vec4(_rsx, _rsy, _rsz, 0);
-        compute_particles.data.data7 = glm::vec4(0,0,0,0);
-        compute_particles.data.instance_count = instance_count;
-    }
+    // the lifecycle integrates, whole steps only.
+    update_emitters(steps * _simulation_clock.step());
 }
 
-void Scene::animate_camera(float dt)
+//
+// Spawn counts of the frame, from the rates and bursts of the emitters.
+// The enabled emitters are packed in the UBO, each one gets a range of
+// the emit dispatch.
+//
+void Scene::update_emitters(double dt)
 {
-    static float accum_dt = 0.0f;
+    auto &lc = _particle_lifecycle;
+    auto &data = lc.data;
+
+    data.gravity = glm::vec4(lc.gravity, (float)dt);
+    data.scale = glm::vec4(_psx, _psy, _psz, 0);
+    data.rotation_speed = glm::vec4(_rsx, _rsy, _rsz, 0);
+    data.capacity = lc.capacity;
+    data.emitter_count = 0;
+    data.emit_count = 0;
+    ++data.seed;
+
+    if (!_use_emitters)
+        return;
 
-    ImGuiIO& io = ImGui::GetIO();
-    constexpr float PIXELS_TO_RADIANS = 0.01f;
+    for (auto &e : lc.emitters)
+    {
+        if (!e.enabled)
+            continue;
+
+        e.rate_accumulator += e.rate * dt;
+        double spawn = std::floor(e.rate_accumulator);
+        e.rate_accumulator -= spawn;
+
+        if (e.burst_count > 0 && e.burst_interval > 0.0f)
+        {
+            e.burst_timer += dt;
+            while (e.burst_timer >= e.burst_interval)
+            {
+                spawn += e.burst_count;
+                e.burst_timer -= e.burst_interval;
+            }
+        }
+
+        // more than the pool would be dropped by the shader anyway.
+        uint32_t count = (uint32_t)std::min(spawn, (double)(lc.capacity - data.emit_count));
+
+        auto &ed = data.emitters[data.emitter_count++];
+        ed.position = glm::vec4(e.position, e.radius);
+        ed.velocity = glm::vec4(e.velocity, e.spread);
+        ed.lifetime = glm::vec4(e.lifetime_min, std::max(e.lifetime_min, e.lifetime_max), 0, 0);
+        ed.first = data.emit_count;
+        ed.count = count;
+        data.emit_count += count;
+    }
+}
+
+void Scene::set_simulation_params(double t)
+{
+    // self rotation turns per axis, before the jitter of each particle.
+    glm::uvec4 rotation_turns = glm::uvec4(0);
+    glm::vec4 rotation_fractions = glm::vec4(0.0f);
+    const glm::vec3 rotation_speeds = glm::vec3(_rsx, _rsy, _rsz);
+    for (int a = 0; a < 3; ++a)
+        SimulationClock::split_turns((double)_e2 * rotation_speeds[a] * _rotation_speed * t, &rotation_turns[a], &rotation_fractions[a]);
+
+    const double position_time = _speed * t;
+    const glm::vec4 phases_0 = glm::vec4(
+        SimulationClock::wrap_phase(_bx * position_time), SimulationClock::wrap_phase(_dx * position_time),
+        SimulationClock::wrap_phase(_by * position_time), SimulationClock::wrap_phase(_dy * position_time));
+    const glm::vec4 phases_1 = glm::vec4(
+        SimulationClock::wrap_phase(_bz * position_time), SimulationClock::wrap_phase(_dz * position_time), 0, 0);
+
+    // fill uniform data for the simulation compute shader.
+    {
+        uint32_t instance_count = std::min(_instance_sets[_particles].instance_count, (uint32_t)_nb_instances);
+        compute_particles.data.data0 = glm::vec4(0, _speed, _rotation_speed, _pdt);
+        compute_particles.data.data1 = glm::vec4(_e0, _e1, _e2, _e3);
+        compute_particles.data.data2 = glm::vec4(_ax, _bx, _cx, _dx);
+        compute_particles.data.data3 = glm::vec4(_ay, _by, _cy, _dy);
+        compute_particles.data.data4 = glm::vec4(_az, _bz, _cz, _dz);
+        compute_particles.data.data5 = glm::vec4(_psx, _psy, _psz, 0);
+        compute_particles.data.data6 = glm::vec4(_rsx, _rsy, _rsz, 0);
+        compute_particles.data.data7 = phases_0;
+        compute_particles.data.data8 = phases_1;
+        compute_particles.data.data9 = rotation_fractions;
+        compute_particles.data.rotation_turns = rotation_turns;
+        compute_particles.data.instance_count = instance_count;
+    }
+
+    // same parameters, for the CPU simulation.
+    {
+        auto &p = _cpu_particles.params;
+        p.pdt = _pdt;
+        p.turns_rx = rotation_turns.x; p.turns_ry = rotation_turns.y; p.turns_rz = rotation_turns.z;
+        p.fraction_rx = rotation_fractions.x; p.fraction_ry = rotation_fractions.y; p.fraction_rz = rotation_fractions.z;
+        p.phase_bx = phases_0.x; p.phase_dx = phases_0.y; p.phase_by = phases_0.z; p.phase_dy = phases_0.w;
+        p.phase_bz = phases_1.x; p.phase_dz = phases_1.y;
+        p.e0 = _e0; p.e1 = _e1; p.e2 = _e2;
+        p.ax = _ax; p.bx = _bx; p.cx = _cx; p.dx = _dx;
+        p.ay = _ay; p.by = _by; p.cy = _cy; p.dy = _dy;
+        p.az = _az; p.bz = _bz; p.cz = _cz; p.dz = _dz;
+        p.psx = _psx; p.psy = _psy; p.psz = _psz;
+        p.rsx = _rsx; p.rsy = _rsy; p.rsz = _rsz;
+    }
+}
+
+void Scene::update_classify_data()
+{
+    auto &is = _instance_sets[_particles];
+    const auto &camera = _cameras[_main_camera];
+
+    float switch_distance = _instance_render_mode == INSTANCE_RENDER_IMPOSTOR ? 0.0f : _impostor_distance;
+    if (_instance_render_mode == INSTANCE_RENDER_MESH)
+        switch_distance = 1e18f; // with emitters, classified all near
+
+    classify_particles.data.camera_position = glm::inverse(camera.v)[3];
+    classify_particles.data.params = glm::vec4(switch_distance, _objects[is.model_index].bounding_radius, _use_emitters ? 1.0f : 0.0f, 0);
+
+    // The pyramid was built from the depth of the last frame, test against its camera.
+    const auto &dp = _depth_pyramid;
+    classify_particles.data.prev_view_proj = _last_view_proj;
+    classify_particles.data.pyramid = glm::vec4(
+        (float)dp.texture.extent.width, (float)dp.texture.extent.height, (float)dp.level_count,
+        (_occlusion_culling && dp.built) ? 1.0f : 0.0f);
+    _last_view_proj = camera.p * camera.v;
+
+    classify_particles.data.instance_count = std::min(is.instance_count, (uint32_t)_nb_instances);
+    classify_particles.data.index_count = _objects[is.model_index].indexCount;
+}
+
+void Scene::update_sort_data()
+{
+    auto &ps = _particle_sort;
+    const auto &is = _instance_sets[_particles];
+
+    ps.data.view = _cameras[_main_camera].v;
+    ps.data.depth_range = glm::vec4(ps.depth_range.x, std::max(ps.depth_range.y, ps.depth_range.x + 0.001f), 0, 0);
+    ps.data.instance_count = std::min(is.instance_count, (uint32_t)_nb_instances);
+    ps.data.index_count = _objects[is.model_index].indexCount;
+    ps.data.key_bits = (uint32_t)glm::clamp(ps.key_bits / 8 * 8, 8, 32); // even pass count
+    ps.data.use_alive_list = _use_emitters ? 1 : 0;
+}
+
+//
+// Frustum planes of the main camera (Gribb/Hartmann), for the meshlet pass.
+//
+void Scene::update_meshlet_culling_data()
+{
+    auto &mc = _meshlet_culling;
+    const auto &camera = _cameras[_main_camera];
+
+    glm::mat4 view_proj = camera.p * camera.v;
+    glm::vec4 rows[4];
+    for (int r = 0; r < 4; ++r)
+        rows[r] = glm::vec4(view_proj[0][r], view_proj[1][r], view_proj[2][r], view_proj[3][r]);
+
+    // z in [0, w]: the near plane is row 2 alone.
+    mc.data.frustum[0] = rows[3] + rows[0];
+    mc.data.frustum[1] = rows[3] - rows[0];
+    mc.data.frustum[2] = rows[3] + rows[1];
+    mc.data.frustum[3] = rows[3] - rows[1];
+    mc.data.frustum[4] = rows[2];
+    mc.data.frustum[5] = rows[3] - rows[2];
+    for (auto &plane : mc.data.frustum)
+        plane /= glm::length(glm::vec3(plane));
+
+    mc.data.camera_position = glm::inverse(camera.v)[3];
+    mc.data.meshlet_count = (uint32_t)mc.meshlets.size();
+    mc.data.frustum_culling = mc.frustum_culling ? 1 : 0;
+    mc.data.cone_culling = mc.cone_culling ? 1 : 0;
+}
+
+void Scene::animate_camera(float dt)
+{
+    static float accum_dt = 0.0f;
+
+    ImGuiIO& io = ImGui::GetIO();
+    constexpr float PIXELS_TO_RADIANS = 0.01f;
     if (!io.WantCaptureMouse)
     {
         if (io.MouseDown[0])
@@ -1225,7 +3019,7 @@ void Scene::animate_camera(float dt)
     }
     
 
-    auto &camera = _cameras["perspective"];
+    auto &camera = _cameras[_main_camera];
 
 #if 0
     const float cam_as = 0.3f; // angular_speed, radians/sec
@@ -1305,7 +3099,7 @@ void Scene::animate_light(float dt)
 bool Scene::update_scene_ubo()
 {
     auto &scene_ubo = get_scene_ubo();
-    auto camera = _cameras["perspective"];
+    const auto &camera = _cameras[_main_camera];
     //auto light = _lights[_current_light];
 
     VkResult result;
@@ -1351,61 +3145,174 @@ bool Scene::update_scene_ubo()
         vkUnmapMemory(_ctx->device, compute_particles.ubo.memory);
     }
 
-    return true;
-}
+    //
+    // CLASSIFY UBO
+    //
+    {
+        update_classify_data();
 
-bool Scene::update_all_objects_ubos()
-{
-    VkResult result;
-    std::array<VkMappedMemoryRange, 2> memory_ranges = {};
+        void *mapped = nullptr;
+        result = vkMapMemory(_ctx->device, classify_particles.ubo.memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
 
-    // TODO: update only modified(animated) matrices.
+        memcpy(mapped, &classify_particles.data, sizeof(classify_particles.data));
 
-    {
-        auto &ubo = get_global_object_matrices_ubo();
+        vkUnmapMemory(_ctx->device, classify_particles.ubo.memory);
+    }
 
+    //
+    // PARTICLE LIFECYCLE UBO
+    //
+    {
         void *mapped = nullptr;
-        result = vkMapMemory(_ctx->device, ubo.memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        result = vkMapMemory(_ctx->device, _particle_lifecycle.ubo.memory, 0, VK_WHOLE_SIZE, 0, &mapped);
         ErrorCheck(result);
         if (result != VK_SUCCESS)
             return false;
 
-        memcpy(mapped, ubo.host_data, _objects.size() * ubo.alignment);
+        memcpy(mapped, &_particle_lifecycle.data, sizeof(_particle_lifecycle.data));
+
+        vkUnmapMemory(_ctx->device, _particle_lifecycle.ubo.memory);
+    }
+
+    //
+    // PARTICLE SORT UBO
+    //
+    {
+        update_sort_data();
+
+        void *mapped = nullptr;
+        result = vkMapMemory(_ctx->device, _particle_sort.ubo.memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
 
-        // TODO: find out when this is really needed.
-        memory_ranges[0].sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-        memory_ranges[0].memory = ubo.memory;
-        memory_ranges[0].offset = 0;
-        memory_ranges[0].size = VK_WHOLE_SIZE;//_objects.size() * ubo.alignment;
+        memcpy(mapped, &_particle_sort.data, sizeof(_particle_sort.data));
 
-        vkUnmapMemory(_ctx->device, ubo.memory);
+        vkUnmapMemory(_ctx->device, _particle_sort.ubo.memory);
     }
 
+    //
+    // MESHLET CULLING UBO
+    //
     {
-        auto &ubo_material = get_global_object_material_ubo();
+        update_meshlet_culling_data();
 
         void *mapped = nullptr;
-        result = vkMapMemory(_ctx->device, ubo_material.memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        result = vkMapMemory(_ctx->device, _meshlet_culling.ubo.memory, 0, VK_WHOLE_SIZE, 0, &mapped);
         ErrorCheck(result);
         if (result != VK_SUCCESS)
             return false;
 
-        memcpy(mapped, ubo_material.host_data, _objects.size() * ubo_material.alignment);
+        memcpy(mapped, &_meshlet_culling.data, sizeof(_meshlet_culling.data));
+
+        vkUnmapMemory(_ctx->device, _meshlet_culling.ubo.memory);
+    }
+
+    return true;
+}
+
+void Scene::update_transforms()
+{
+    auto start = std::chrono::steady_clock::now();
 
-        // TODO: find out when this is really needed.
-        memory_ranges[1].sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-        memory_ranges[1].memory = ubo_material.memory;
-        memory_ranges[1].offset = 0;
-        memory_ranges[1].size = VK_WHOLE_SIZE;//_objects.size() * ubo_material.alignment;
+    std::vector<uint32_t> updated;
+    _transforms.update(&updated);
 
-        vkUnmapMemory(_ctx->device, ubo_material.memory);
+    auto &global_matrices_ubo = get_global_object_matrices_ubo();
+    for (uint32_t i : updated)
+    {
+        auto *matrices = (TransformSystem::matrices_t*)get_aligned(&global_matrices_ubo, i);
+        *matrices = _transforms.matrices(i);
+        mark_dirty(&global_matrices_ubo, i);
     }
 
-    vkFlushMappedMemoryRanges(_ctx->device, (uint32_t)memory_ranges.size(), memory_ranges.data());
+    auto end = std::chrono::steady_clock::now();
+    _transform_update_ms = std::chrono::duration<float, std::milli>(end - start).count();
+    _transform_update_count = (uint32_t)updated.size();
+}
+
+bool Scene::update_all_objects_ubos(uint32_t frame)
+{
+    std::vector<VkMappedMemoryRange> memory_ranges;
+
+    uint32_t object_count = (uint32_t)_objects.size();
+    upload_dirty_ranges(&get_global_object_matrices_ubo(), object_count, frame, &memory_ranges);
+    upload_dirty_ranges(&get_global_object_material_ubo(), object_count, frame, &memory_ranges);
+
+    _object_upload_bytes = 0;
+    _object_upload_ranges = (uint32_t)memory_ranges.size();
+    for (const auto &range : memory_ranges)
+        _object_upload_bytes += range.size;
+
+    // static scene: nothing to copy, nothing to flush.
+    if (memory_ranges.empty())
+        return true;
+
+    VkResult result = vkFlushMappedMemoryRanges(_ctx->device, (uint32_t)memory_ranges.size(), memory_ranges.data());
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
 
     return true;
 }
 
+void Scene::upload_dirty_ranges(dynamic_uniform_buffer_t *buffer, uint32_t count, uint32_t frame, std::vector<VkMappedMemoryRange> *ranges)
+{
+    // the fences of the frame are waited on, the other frame may still read its copy.
+    buffer->frame = frame % MAX_PARALLEL_FRAMES;
+    if (!buffer->any_dirty)
+        return;
+
+    // flushed ranges must be multiples of the atom, two runs closer
+    // than that share an atom and are merged. The copies start on an atom.
+    VkDeviceSize atom = std::max<VkDeviceSize>(_ctx->physical_device_properties.limits.nonCoherentAtomSize, 1);
+    VkDeviceSize copy_offset = buffer->frame * buffer->size;
+    size_t first_range = ranges->size();
+    bool still_dirty = false;
+
+    uint32_t i = 0;
+    while (i < count)
+    {
+        if (!buffer->dirty[i])
+        {
+            ++i;
+            continue;
+        }
+
+        uint32_t run_begin = i;
+        while (i < count && buffer->dirty[i])
+            still_dirty |= --buffer->dirty[i++] > 0;
+
+        VkDeviceSize begin = copy_offset + (run_begin * buffer->alignment) / atom * atom;
+        VkDeviceSize end = copy_offset + (i * buffer->alignment + atom - 1) / atom * atom;
+        end = std::min<VkDeviceSize>(end, copy_offset + buffer->size);
+
+        if (ranges->size() > first_range && begin <= ranges->back().offset + ranges->back().size)
+        {
+            ranges->back().size = end - ranges->back().offset;
+            continue;
+        }
+
+        VkMappedMemoryRange range = {};
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory = buffer->memory;
+        range.offset = begin;
+        range.size = end - begin;
+        ranges->push_back(range);
+    }
+    buffer->any_dirty = still_dirty;
+
+    // host_data mirrors each copy, copy the atom aligned ranges as they are.
+    for (size_t r = first_range; r < ranges->size(); ++r)
+    {
+        const auto &range = (*ranges)[r];
+        memcpy((uint8_t*)buffer->mapped + range.offset, (uint8_t*)buffer->host_data + (range.offset - copy_offset), (size_t)range.size);
+    }
+}
+
 bool Scene::update_all_instances_vbos()
 {
     return true;
@@ -1413,39 +3320,38 @@ bool Scene::update_all_instances_vbos()
 
 bool Scene::create_procedural_textures()
 {
-    Log("#     Create Texture Staging Buffer.\n");
-    VkDeviceSize max_texture_size = 4096 * 4096 * 4 * sizeof(float); // 4K RGBA Float
-    if (!create_buffer(&_texture_staging_buffer.buffer, &_texture_staging_buffer.memory, max_texture_size,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
-        return false;
-
-    Log("#     Compute Procedural Texture\n");
+    Log("#     Compute Procedural Textures\n");
 
-    using create_func = void(*)(utils::loaded_image*);
-    auto create_texture = [&](const std::string &name, VkFormat format, create_func f)
-    {
-        utils::loaded_image image;
-        f(&image);
-
-        auto &texture = _textures[name];
-        texture.format = format;
-        texture.extent = { image.width, image.height, 1 };
+    // metal [170..255], dielectrics [50..240]
+    _procedural_params_t checker_base;
+    checker_base.pattern = PROCEDURAL_CHECKER_BASE;
+    checker_base.a = glm::vec4(170.0f, 255.0f, 50.0f, 240.0f) / 255.0f;
+    if (!create_procedural_texture("checker_base", 512, checker_base))
+        return false;
 
-        create_texture_2d(&texture);
-        copy_data_to_staging_buffer(_texture_staging_buffer, image.data, image.size);
-        transition_texture(&texture.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-        copy_buffer_to_image(_texture_staging_buffer.buffer, texture.image, texture.extent);
-        transition_texture(&texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-        delete[] image.data;
-    };
+    // roughness, metallic, reflectance
+    _procedural_params_t checker_spec;
+    checker_spec.pattern = PROCEDURAL_CHECKER_SPEC;
+    checker_spec.a = glm::vec4(0.9f, 0.0f, 0.5f, 1.0f);
+    checker_spec.b = glm::vec4(0.05f, 0.6f, 0.1f, 0.0f);
+    checker_spec.seed = (uint32_t)std::chrono::high_resolution_clock::now().time_since_epoch().count();
+    if (!create_procedural_texture("checker_spec", 512, checker_spec))
+        return false;
 
+    _procedural_params_t neutral_base;
+    neutral_base.a = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+    if (!create_procedural_texture("neutral_base", 16, neutral_base))
+        return false;
 
-    create_texture("checker_base", VK_FORMAT_R32G32B32_SFLOAT, utils::create_checker_base_image);
-    create_texture("checker_spec", VK_FORMAT_R32G32B32_SFLOAT, utils::create_checker_spec_image);
+    _procedural_params_t neutral_metal_spec;
+    neutral_metal_spec.a = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+    if (!create_procedural_texture("neutral_metal_spec", 16, neutral_metal_spec))
+        return false;
 
-    create_texture("neutral_base", VK_FORMAT_R8G8B8A8_UNORM, utils::create_neutral_base_image);
-    create_texture("neutral_metal_spec", VK_FORMAT_R32G32B32A32_SFLOAT, utils::create_neutral_metal_spec_image);
-    create_texture("neutral_dielectric_spec", VK_FORMAT_R32G32B32A32_SFLOAT, utils::create_neutral_dielectric_spec_image);
+    _procedural_params_t neutral_dielectric_spec;
+    neutral_dielectric_spec.a = glm::vec4(1.0f, 0.0f, 1.0f, 0.0f);
+    if (!create_procedural_texture("neutral_dielectric_spec", 16, neutral_dielectric_spec))
+        return false;
 
     //
     // TEXTURE VIEWS
@@ -1456,19 +3362,163 @@ bool Scene::create_procedural_textures()
     for (auto &t : _textures)
     {
         VkImageViewCreateInfo texture_image_view_create_info = vk::init::image::image_view_create_info();
-        texture_image_view_create_info.image = t.second.image;
-        texture_image_view_create_info.format = t.second.format;
+        texture_image_view_create_info.image = t.image;
+        texture_image_view_create_info.format = t.format;
+        texture_image_view_create_info.subresourceRange.levelCount = t.mip_levels;
 
         Log("#     Create Image View\n");
-        result = vkCreateImageView(_ctx->device, &texture_image_view_create_info, nullptr, &t.second.view);
+        result = vkCreateImageView(_ctx->device, &texture_image_view_create_info, nullptr, &t.view);
         ErrorCheck(result);
         if (result != VK_SUCCESS)
             return false;
     }
 
+    // all of them in one submit.
+    auto cmd = begin_single_time_commands(_ctx->graphics);
+    for (const auto &procedural : _procedural.textures)
+        record_procedural_texture(cmd, procedural);
+    end_single_time_commands(cmd, _ctx->graphics);
+
+    return true;
+}
+
+bool Scene::create_procedural_texture(const std::string &name, uint32_t size, const _procedural_params_t &params)
+{
+    VkResult result;
+
+    _procedural_texture_t procedural;
+    procedural.name = name;
+    procedural.params = params;
+    procedural.texture = _textures.insert(name, _texture_t());
+
+    auto &texture = _textures[procedural.texture];
+    texture.format = VK_FORMAT_R8G8B8A8_UNORM; // storage and linear blits, both mandatory
+    texture.extent = { size, size, 1 };
+    texture.procedural = true;
+    texture.bindless_index = _bindless.texture_count++;
+    assert(texture.bindless_index < MAX_BINDLESS_TEXTURES);
+
+    if (!create_texture_2d(&texture))
+        return false;
+
+    VkImageViewCreateInfo image_view_create_info = vk::init::image::image_view_create_info();
+    image_view_create_info.image = texture.image;
+    image_view_create_info.format = texture.format;
+    image_view_create_info.subresourceRange.levelCount = 1;
+
+    result = vkCreateImageView(_ctx->device, &image_view_create_info, nullptr, &procedural.level_view);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    VkDescriptorSetAllocateInfo descriptor_allocate_info = {};
+    descriptor_allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptor_allocate_info.descriptorPool = _ctx->descriptor_pool;
+    descriptor_allocate_info.descriptorSetCount = 1;
+    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[PROCEDURAL_DESCRIPTOR_SET_LAYOUT];
+
+    result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &procedural.descriptor_set);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    VkDescriptorImageInfo descriptor_image_info = {};
+    descriptor_image_info.imageView = procedural.level_view;
+    descriptor_image_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkWriteDescriptorSet write_descriptor_set = {};
+    write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set.dstSet = procedural.descriptor_set;
+    write_descriptor_set.dstBinding = 0;
+    write_descriptor_set.dstArrayElement = 0;
+    write_descriptor_set.descriptorCount = 1;
+    write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    write_descriptor_set.pImageInfo = &descriptor_image_info;
+    vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
+
+    Log("#     " + name + ": " + std::to_string(size) + "x" + std::to_string(size) + ", "
+        + std::to_string(texture.mip_levels) + " levels\n");
+
+    _procedural.textures.push_back(procedural);
+
     return true;
 }
 
+// The whole image is rewritten: its previous content is dropped, once the
+// fragment shaders of the earlier submits are done with it.
+void Scene::record_procedural_texture(VkCommandBuffer cmd, const _procedural_texture_t &procedural)
+{
+    const auto &texture = _textures[procedural.texture];
+    const uint32_t levels = texture.mip_levels;
+
+    std::array<VkImageMemoryBarrier, 2> barriers = {};
+    for (auto &b : barriers)
+    {
+        b.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        b.srcAccessMask = 0;
+        b.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        b.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        b.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        b.image = texture.image;
+    }
+    barriers[0].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[0].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 1, levels - 1, 0, 1 };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, levels > 1 ? 2 : 1, barriers.data());
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _procedural.pipe.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _procedural.pipe.pipeline_layout,
+        0, 1, &procedural.descriptor_set, 0, nullptr);
+    vkCmdPushConstants(cmd, _procedural.pipe.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+        0, sizeof(procedural.params), &procedural.params);
+    vkCmdDispatch(cmd, (texture.extent.width + 7) / 8, (texture.extent.height + 7) / 8, 1);
+
+    // level 0 is the source of the first blit.
+    barriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &barriers[0]);
+
+    record_mip_blits(cmd, texture);
+}
+
+void Scene::regenerate_procedural_textures()
+{
+    auto &pt = _procedural;
+    pt.regenerate_requested = false;
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto cmd = begin_single_time_commands(_ctx->graphics);
+    for (const auto &procedural : pt.textures)
+        record_procedural_texture(cmd, procedural);
+    end_single_time_commands(cmd, _ctx->graphics);
+
+    pt.regenerate_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+VkFormat Scene::cooked_texture_format(const texture_cache_header_t &header) const
+{
+    bool srgb = header.srgb != 0;
+    switch (header.format)
+    {
+    case COOKED_R8:  return VK_FORMAT_R8_UNORM;
+    case COOKED_RG8: return VK_FORMAT_R8G8_UNORM;
+    case COOKED_BC1: return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+    case COOKED_BC4: return VK_FORMAT_BC4_UNORM_BLOCK;
+    case COOKED_BC5: return VK_FORMAT_BC5_UNORM_BLOCK;
+    case COOKED_BC7: return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+    default:         return srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+    }
+}
+
 bool Scene::create_texture_samplers()
 {
     VkResult result;
@@ -1485,7 +3535,7 @@ bool Scene::create_texture_samplers()
     sampler_create_info.anisotropyEnable = VK_TRUE;
     sampler_create_info.maxAnisotropy = 16;
     sampler_create_info.minLod = 0;
-    sampler_create_info.maxLod = 5;
+    sampler_create_info.maxLod = VK_LOD_CLAMP_NONE; // every level of the views
     sampler_create_info.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
     sampler_create_info.unnormalizedCoordinates = VK_FALSE;
 
@@ -1500,17 +3550,20 @@ bool Scene::create_texture_samplers()
 
 void Scene::destroy_textures()
 {
-    for (auto t : _textures)
+    for (const auto &tex : _textures)
     {
-        auto tex = t.second;
-        vkDestroyImageView(_ctx->device, tex.view, nullptr);
-        vkDestroyImage(_ctx->device, tex.image, nullptr);
-        vkFreeMemory(_ctx->device, tex.image_memory, nullptr);
+        if (tex.placeholder)
+            continue; // not its own
+
+        destroy_texture(tex);
     }
 
-    // staging buffer
-    vkDestroyBuffer(_ctx->device, _texture_staging_buffer.buffer, nullptr);
-    vkFreeMemory(_ctx->device, _texture_staging_buffer.memory, nullptr);
+    for (const auto &procedural : _procedural.textures)
+    {
+        vkDestroyImageView(_ctx->device, procedural.level_view, nullptr);
+        vkFreeDescriptorSets(_ctx->device, _ctx->descriptor_pool, 1, &procedural.descriptor_set);
+    }
+    _procedural.textures.clear();
 
     for (auto s : _samplers)
     {
@@ -1518,720 +3571,2868 @@ void Scene::destroy_textures()
     }
 }
 
-bool Scene::create_shader_module(const std::string &file_path, VkShaderModule *shader_module)
+bool Scene::create_bindless_set()
 {
-    auto content = utils::read_file_content(file_path);
+    VkResult result;
 
-    VkShaderModuleCreateInfo shader_creation_info = {};
-    shader_creation_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    shader_creation_info.codeSize = content.size();
-    shader_creation_info.pCode = (uint32_t *)content.data();
+    std::array<VkDescriptorPoolSize, 2> pool_sizes = {};
+    pool_sizes[0] = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 };
+    pool_sizes[1] = { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, MAX_BINDLESS_TEXTURES };
 
-    VkResult result;
+    VkDescriptorPoolCreateInfo pool_create_info = {};
+    pool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_create_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+    pool_create_info.maxSets = 1;
+    pool_create_info.poolSizeCount = (uint32_t)pool_sizes.size();
+    pool_create_info.pPoolSizes = pool_sizes.data();
 
-    Log("#      Create Shader Module\n");
-    result = vkCreateShaderModule(_ctx->device, &shader_creation_info, nullptr, shader_module);
+    Log("#      Create Bindless Descriptor Pool\n");
+    result = vkCreateDescriptorPool(_ctx->device, &pool_create_info, nullptr, &_bindless.descriptor_pool);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    VkDescriptorSetAllocateInfo descriptor_allocate_info = {};
+    descriptor_allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptor_allocate_info.descriptorPool = _bindless.descriptor_pool;
+    descriptor_allocate_info.descriptorSetCount = 1;
+    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[BINDLESS_DESCRIPTOR_SET_LAYOUT];
+
+    Log("#      Allocate Bindless Descriptor Set\n");
+    result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &_bindless.descriptor_set);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    Log("#      Create Material Table SSBO\n");
+    VkDeviceSize table_size = MAX_BINDLESS_MATERIALS * sizeof(_bindless_material_t);
+    if (!create_buffer(&_bindless.materials.buffer, &_bindless.materials.memory, table_size,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        return false;
+
+    result = vkMapMemory(_ctx->device, _bindless.materials.memory, 0, VK_WHOLE_SIZE, 0, (void**)&_bindless.mapped_materials);
     ErrorCheck(result);
     if (result != VK_SUCCESS)
         return false;
+    memset(_bindless.mapped_materials, 0, (size_t)table_size);
+
+    VkDescriptorBufferInfo table_info = {};
+    table_info.buffer = _bindless.materials.buffer;
+    table_info.offset = 0;
+    table_info.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet write_descriptor_set = {};
+    write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set.dstSet = _bindless.descriptor_set;
+    write_descriptor_set.dstBinding = 0;
+    write_descriptor_set.dstArrayElement = 0;
+    write_descriptor_set.descriptorCount = 1;
+    write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_descriptor_set.pBufferInfo = &table_info;
+
+    Log("#      Update Descriptor Set (Bindless Material Table)\n");
+    vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
+
+    Log("#      Update Descriptor Set (Bindless Textures)\n");
+    for (const auto &t : _textures)
+        write_bindless_texture(t);
+
+    for (const auto &m : _material_instances)
+        write_bindless_material(m);
 
     return true;
 }
 
-bool Scene::create_all_descriptor_set_layouts(VkDevice device, VkDescriptorSetLayout *layouts)
+void Scene::destroy_bindless_set()
 {
-    VkResult result;
-
-    // 3 SETS
-    //    set = 0 (SCENE)
-    //        binding = 0 : camera matrices, light pos (UBO)(VS+FS)
-    //        binding = 2 : texture sampler            (SMP)(FS)
-    //    set = 1 (MATERIAL instance)
-    //        binding = 0 : base texture               (TEX)(FS)
-    //        binding = 1 : spec texture               (TEX)(FS)
-    //    set = 2 (OBJECT instance)
-    //        binding = 0 : model matrix               (Dyn UBO)(VS)
-    //        binding = 1 : material overrides         (Dyn UBO)(FS) // same ubo?
-    //    set = x (COMPUTE particles)
-    //        binding = 0 : instance data              (SSBO)
-    //        binding = 1 : simulation params          (UBO)
+    if (_bindless.mapped_materials)
+        vkUnmapMemory(_ctx->device, _bindless.materials.memory);
+    _bindless.mapped_materials = nullptr;
+
+    vkDestroyBuffer(_ctx->device, _bindless.materials.buffer, nullptr);
+    vkFreeMemory(_ctx->device, _bindless.materials.memory, nullptr);
+    _bindless.materials = {};
+
+    // frees the set too.
+    vkDestroyDescriptorPool(_ctx->device, _bindless.descriptor_pool, nullptr);
+    _bindless.descriptor_pool = VK_NULL_HANDLE;
+    _bindless.descriptor_set = VK_NULL_HANDLE;
+}
 
-    //
-    // PER-SCENE
-    //
+// The free slots come from textures retired MAX_PARALLEL_FRAMES ago.
+uint32_t Scene::allocate_bindless_slot()
+{
+    if (!_bindless.free_slots.empty())
     {
-        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+        uint32_t slot = _bindless.free_slots.back();
+        _bindless.free_slots.pop_back();
+        return slot;
+    }
+    if (_bindless.texture_count >= MAX_BINDLESS_TEXTURES)
+        return UINT32_MAX;
+    return _bindless.texture_count++;
+}
 
-        bindings[0].binding = 0;
-        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        bindings[0].descriptorCount = 1; // use >1 for arrays bound to a single binding.
-        bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-        bindings[0].pImmutableSamplers = nullptr;
+// The slot is not read by any in-flight frame, the update after bind
+// flag lets us write it while the set is bound.
+void Scene::write_bindless_texture(const _texture_t &texture)
+{
+    if (texture.bindless_index >= MAX_BINDLESS_TEXTURES)
+        return;
 
-        bindings[1].binding = 1;
-        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
-        bindings[1].descriptorCount = 1;
-        bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-        bindings[1].pImmutableSamplers = nullptr; // TODO: set my sampler here, no need to bind afterwards
+    VkDescriptorImageInfo descriptor_image_info = {};
+    descriptor_image_info.imageView = texture.view;
+    descriptor_image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
-        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
-        desc_set_layout_create_info.pBindings = bindings.data();
+    VkWriteDescriptorSet write_descriptor_set = {};
+    write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set.dstSet = _bindless.descriptor_set;
+    write_descriptor_set.dstBinding = 1;
+    write_descriptor_set.dstArrayElement = texture.bindless_index;
+    write_descriptor_set.descriptorCount = 1;
+    write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    write_descriptor_set.pImageInfo = &descriptor_image_info;
 
-        Log("#      Create Default Descriptor Set Layout for Scene Uniforms\n");
-        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + SCENE_DESCRIPTOR_SET_LAYOUT);
-        ErrorCheck(result);
-        if (result != VK_SUCCESS)
-            return false;
-    }
+    vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
+}
 
-    //
-    // PER-MATERIAL INSTANCE
-    //
-    {
-        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+// Same for the table entry, coherent memory: visible at the next submit.
+void Scene::write_bindless_material(const _material_instance_t &material)
+{
+    const _texture_t *base = _textures.get(material.base_tex);
+    const _texture_t *spec = _textures.get(material.spec_tex);
 
-        bindings[0].binding = 0;
-        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-        bindings[0].descriptorCount = 1;
-        bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-        bindings[0].pImmutableSamplers = nullptr;
+    _bindless_material_t &entry = _bindless.mapped_materials[material.index];
+    entry.base_tex = base ? base->bindless_index : 0;
+    entry.spec_tex = spec ? spec->bindless_index : 0;
+}
 
-        bindings[1].binding = 1;
-        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-        bindings[1].descriptorCount = 1;
-        bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-        bindings[1].pImmutableSamplers = nullptr;
+// set = 1 of the global objects: base and spec textures.
+void Scene::write_material_descriptor_set(const _material_instance_t &material, VkDescriptorSet set)
+{
+    const _texture_t *base_tex = _textures.get(material.base_tex);
+    const _texture_t *spec_tex = _textures.get(material.spec_tex);
 
-        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
-        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
-        desc_set_layout_create_info.pBindings = bindings.data();
+    std::array<VkDescriptorImageInfo, 2> descriptor_image_infos = {};
+    descriptor_image_infos[0].imageView = base_tex ? base_tex->view : VK_NULL_HANDLE;
+    descriptor_image_infos[1].imageView = spec_tex ? spec_tex->view : VK_NULL_HANDLE;
 
-        Log("#      Create Default Descriptor Set Layout for Material instance Uniforms\n");
-        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + MATERIAL_DESCRIPTOR_SET_LAYOUT);
-        ErrorCheck(result);
-        if (result != VK_SUCCESS)
-            return false;
+    std::array<VkWriteDescriptorSet, 2> write_descriptor_sets = {};
+    for (uint32_t i = 0; i < write_descriptor_sets.size(); ++i)
+    {
+        descriptor_image_infos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        write_descriptor_sets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write_descriptor_sets[i].dstSet = set;
+        write_descriptor_sets[i].dstBinding = i; // 0 = base, 1 = spec
+        write_descriptor_sets[i].dstArrayElement = 0;
+        write_descriptor_sets[i].descriptorCount = 1;
+        write_descriptor_sets[i].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        write_descriptor_sets[i].pImageInfo = &descriptor_image_infos[i];
     }
 
-    //
-    // PER-OBJECT
-    //
-    {
-        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+    vkUpdateDescriptorSets(_ctx->device, (uint32_t)write_descriptor_sets.size(), write_descriptor_sets.data(), 0, nullptr);
+}
 
-        bindings[0].binding = 0;
-        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-        bindings[0].descriptorCount = 1;
-        bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-        bindings[0].pImmutableSamplers = nullptr;
+bool Scene::create_texture_loader()
+{
+    auto &tl = _texture_loads;
 
-        bindings[1].binding = 1;
-        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-        bindings[1].descriptorCount = 1;
-        bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-        bindings[1].pImmutableSamplers = nullptr;
+    Log("#     Create Texture Loader Staging Buffer\n");
+    if (!create_buffer(&tl.staging.buffer, &tl.staging.memory, TEXTURE_LOADER_STAGING_SIZE,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        return false;
 
-        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
-        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
-        desc_set_layout_create_info.pBindings = bindings.data();
+    // the workers write the pixels there directly.
+    VkResult result = vkMapMemory(_ctx->device, tl.staging.memory, 0, VK_WHOLE_SIZE, 0, &tl.mapped);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
 
-        Log("#      Create Default Descriptor Set Layout for Objects Uniforms\n");
-        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + OBJECT_DESCRIPTOR_SET_LAYOUT);
-        ErrorCheck(result);
-        if (result != VK_SUCCESS)
-            return false;
-    }
+    tl.loader.reset(new TextureLoader(tl.mapped, TEXTURE_LOADER_STAGING_SIZE, TEXTURE_CACHE_DIR,
+        _ctx->features.textureCompressionBC == VK_TRUE, TEXTURE_STREAMING_TAIL_EXTENT));
 
-    //
-    // COMPUTE
-    //
+    return true;
+}
+
+void Scene::destroy_texture_loader()
+{
+    auto &tl = _texture_loads;
+
+    // joins the workers, nothing writes the staging memory after this.
+    tl.loader.reset();
+
+    for (auto &upload : tl.uploads)
     {
-        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+        vkWaitForFences(_ctx->device, 1, &upload.fence, VK_TRUE, UINT64_MAX);
+        vkDestroyFence(_ctx->device, upload.fence, nullptr);
+        vkFreeCommandBuffers(_ctx->device, _ctx->graphics.command_pool, 1, &upload.cmd);
+        destroy_mip_scratch(&upload.mip_scratch);
+        destroy_texture(upload.loaded);
+    }
+    tl.uploads.clear();
+
+    for (const auto &r : tl.retired_sets)
+        vkFreeDescriptorSets(_ctx->device, _ctx->descriptor_pool, 1, &r.set);
+    tl.retired_sets.clear();
+
+    for (const auto &r : tl.retired_textures)
+        destroy_texture(r.texture);
+    tl.retired_textures.clear();
+    _texture_streaming.textures.clear();
+    _texture_streaming.resident_bytes = 0;
+
+    if (tl.mapped)
+        vkUnmapMemory(_ctx->device, tl.staging.memory);
+    tl.mapped = nullptr;
+    vkDestroyBuffer(_ctx->device, tl.staging.buffer, nullptr);
+    vkFreeMemory(_ctx->device, tl.staging.memory, nullptr);
+    tl.staging = {};
+}
 
-        bindings[0].binding = 0;
-        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        bindings[0].descriptorCount = 1; // use >1 for arrays bound to a single binding.
-        bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-        bindings[0].pImmutableSamplers = nullptr;
+bool Scene::load_texture(const texture_id_t &name, const std::string &file_path, const texture_id_t &placeholder,
+    bool srgb, texture_usage_t usage)
+{
+    if (_textures.find(name).valid())
+        return true; // loaded, or loading
 
-        bindings[1].binding = 1;
-        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        bindings[1].descriptorCount = 1;
-        bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-        bindings[1].pImmutableSamplers = nullptr;
+    if (!add_texture_placeholder(name, placeholder))
+        return false;
 
-        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
-        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
-        desc_set_layout_create_info.pBindings = bindings.data();
+    _texture_loads.loader->request(name, file_path, srgb, usage);
+    return true;
+}
 
-        Log("#      Create Descriptor Set Layout for Compute Particles (SSBO+UBO)\n");
-        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + COMPUTE_DESCRIPTOR_SET_LAYOUT);
-        ErrorCheck(result);
-        if (result != VK_SUCCESS)
-            return false;
+bool Scene::load_texture(const texture_id_t &name, std::vector<uint8_t> &&file_data, const texture_id_t &placeholder,
+    bool srgb, texture_usage_t usage)
+{
+    if (_textures.find(name).valid())
+        return true; // loaded, or loading
+
+    if (!add_texture_placeholder(name, placeholder))
+        return false;
+
+    _texture_loads.loader->request(name, std::move(file_data), srgb, usage);
+    return true;
+}
+
+// Same image, view and bindless slot, owned by the placeholder.
+bool Scene::add_texture_placeholder(const texture_id_t &name, const texture_id_t &placeholder)
+{
+    const _texture_t *source = _textures.get(_textures.find(placeholder));
+    if (!source || !_texture_loads.loader)
+    {
+        Log("#     Texture " + name + ": no placeholder " + placeholder + "\n");
+        return false;
     }
 
+    _texture_t texture = *source;
+    texture.placeholder = true;
+    _textures.insert(name, texture);
     return true;
 }
 
-bool Scene::create_all_descriptor_sets()
+//
+// The fences of the frame are waited on. Done uploads are swapped in,
+// then a few decoded images are uploaded, their copies run with the frame.
+//
+void Scene::update_texture_loads()
 {
-    _view_t &view = _views["perspective"]; // scene descriptor set is here
+    auto &tl = _texture_loads;
+    if (!tl.loader)
+        return;
 
-    VkResult result;
+    ++tl.frame;
 
-    VkDescriptorSetAllocateInfo descriptor_allocate_info = {};
-    descriptor_allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    descriptor_allocate_info.descriptorPool = _ctx->descriptor_pool;// _descriptor_pool;
-    descriptor_allocate_info.descriptorSetCount = 1;
-    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[SCENE_DESCRIPTOR_SET_LAYOUT];
+    // no frame in flight uses them anymore.
+    auto retired_end = std::remove_if(tl.retired_sets.begin(), tl.retired_sets.end(), [&](const _texture_loads_t::_retired_set_t &r) {
+        if (tl.frame - r.frame < MAX_PARALLEL_FRAMES)
+            return false;
+        vkFreeDescriptorSets(_ctx->device, _ctx->descriptor_pool, 1, &r.set);
+        return true;
+    });
+    tl.retired_sets.erase(retired_end, tl.retired_sets.end());
 
-    Log("#      Allocate Scene/View Descriptor Set\n");
-    result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &view.descriptor_set);
-    ErrorCheck(result);
-    if (result != VK_SUCCESS)
-        return false;
+    auto retired_texture_end = std::remove_if(tl.retired_textures.begin(), tl.retired_textures.end(), [&](const _texture_loads_t::_retired_texture_t &r) {
+        if (tl.frame - r.frame < MAX_PARALLEL_FRAMES)
+            return false;
+        destroy_texture(r.texture);
+        if (r.texture.bindless_index < MAX_BINDLESS_TEXTURES)
+            _bindless.free_slots.push_back(r.texture.bindless_index);
+        return true;
+    });
+    tl.retired_textures.erase(retired_texture_end, tl.retired_textures.end());
+
+    for (size_t i = 0; i < tl.uploads.size();)
+    {
+        auto &upload = tl.uploads[i];
+        if (vkGetFenceStatus(_ctx->device, upload.fence) != VK_SUCCESS)
+        {
+            ++i;
+            continue;
+        }
 
-    // TODO: create all material instances descriptor sets at once.
-    descriptor_allocate_info.descriptorSetCount = 1;
-    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[MATERIAL_DESCRIPTOR_SET_LAYOUT];
-    for (auto &m : _material_instances)
+        if (!end_texture_upload(&upload))
+            ++tl.failed_count;
+        tl.uploads.erase(tl.uploads.begin() + i);
+    }
+
+    TextureLoader::decoded_image_t image;
+    for (uint32_t n = 0; n < MAX_TEXTURE_UPLOADS_PER_FRAME && tl.loader->pop(&image); ++n)
     {
-        Log("#      Allocate Material Instance[n] Descriptor Set\n");
-        result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &m.second.descriptor_set);
-        ErrorCheck(result);
-        if (result != VK_SUCCESS)
-            return false;
+        bool begun = false;
+        if (image.levels_only)
+        {
+            // stays on the levels it has.
+            texture_handle_t handle = _textures.find(image.name);
+            const _texture_t *texture = _textures.get(handle);
+            begun = image.ok && texture && begin_texture_residency_change(handle, image.first_level, &image);
+            if (!begun && texture && texture->streaming_index < _texture_streaming.textures.size())
+            {
+                auto &streamed = _texture_streaming.textures[texture->streaming_index];
+                set_streaming_target(&streamed, texture->first_level);
+                streamed.pending = false;
+            }
+        }
+        else
+        {
+            begun = image.ok && begin_texture_upload(image);
+        }
+
+        if (!begun)
+        {
+            tl.loader->release(image);
+            ++tl.failed_count;
+        }
     }
+}
 
-    Log("#      Allocate Object Instance Descriptor Sets\n");
-    descriptor_allocate_info.descriptorSetCount = 1;
-    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[OBJECT_DESCRIPTOR_SET_LAYOUT];
-    result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &_global_objects_descriptor_set);
-    ErrorCheck(result);
-    if (result != VK_SUCCESS)
+bool Scene::begin_texture_upload(const TextureLoader::decoded_image_t &image)
+{
+    auto &tl = _texture_loads;
+
+    texture_handle_t handle = _textures.find(image.name);
+    if (!_textures.get(handle))
         return false;
 
-    Log("#      Allocate Compute Descriptor Set\n");
-    descriptor_allocate_info.descriptorSetCount = 1;
-    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[COMPUTE_DESCRIPTOR_SET_LAYOUT];
-    result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &compute_particles.descriptor_set);
+    _texture_loads_t::_upload_t upload = {};
+    upload.texture = handle;
+    upload.image = image;
+
+    // cooked: the levels from first_level, the finer ones are streamed.
+    const bool cooked = image.format == TextureLoader::PIXELS_COOKED;
+    _texture_t &texture = upload.loaded;
+    texture.format = cooked ? cooked_texture_format(image.cooked)
+        : image.format == TextureLoader::PIXELS_RGBA16F ? VK_FORMAT_R16G16B16A16_SFLOAT
+        : image.srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+    texture.first_level = cooked ? image.first_level : 0;
+    texture.extent = { std::max(image.width >> texture.first_level, 1u), std::max(image.height >> texture.first_level, 1u), 1 };
+    texture.mip_levels = cooked ? image.end_level - image.first_level : 1;
+    texture.cooked = cooked;
+    if (!create_texture_2d(&texture))
+    {
+        destroy_texture(texture);
+        return false;
+    }
+
+    VkImageViewCreateInfo texture_image_view_create_info = vk::init::image::image_view_create_info();
+    texture_image_view_create_info.image = texture.image;
+    texture_image_view_create_info.format = texture.format;
+    texture_image_view_create_info.subresourceRange.levelCount = texture.mip_levels;
+
+    VkResult result = vkCreateImageView(_ctx->device, &texture_image_view_create_info, nullptr, &texture.view);
     ErrorCheck(result);
     if (result != VK_SUCCESS)
+    {
+        destroy_texture(texture);
         return false;
+    }
 
-    //
-    // CONFIGURE DESCRIPTOR SETS
-    //
-    // When a set is allocated all values are undefined and all 
-    // descriptors are uninitialised. must init all statically used bindings:
+    return submit_texture_upload(&upload, [&](VkCommandBuffer cmd) {
+        return record_texture_upload(cmd, tl.staging.buffer, image.offset, upload.loaded, &upload.mip_scratch,
+            cooked ? &image.cooked : nullptr); });
+}
 
-    std::vector<VkWriteDescriptorSet> write_descriptor_sets = {};
+bool Scene::begin_texture_residency_change(texture_handle_t handle, uint32_t first_level, const TextureLoader::decoded_image_t *levels)
+{
+    auto &tl = _texture_loads;
 
-    // 4 SETS
-    //    set = 0 (SCENE)
-    //        binding = 0 : camera matrices, light     (UBO)(VS+FS)
-    //        binding = 1 : texture sampler            (SMP)(FS)
-    //    set = 1 (MATERIAL instance)
-    //        binding = 0 : base texture               (TEX)(FS)
-    //        binding = 1 : spec texture               (TEX)(FS)
-    //    set = 2 (OBJECT instance)
-    //        binding = 0 : model matrix               (Dyn UBO)(VS)
-    //        binding = 1 : material overrides         (Dyn UBO)(FS) // same ubo?
-    //    set = x (compute)
-    //        binding = 0 : per-instance data          (SSBO)
-    //        binding = 1 : simulation data            (UBO)
+    const _texture_t *current = _textures.get(handle);
+    if (!current || current->placeholder || current->streaming_index >= _texture_streaming.textures.size())
+        return false;
 
-    // SCENE UBO CAMERA = 0
-    {
-        Log("#      Update Descriptor Set (Scene CAMERA + LIGHT UBO)\n");
+    // the levels in the staging memory end where the current image starts.
+    const uint32_t end_level = current->first_level + current->mip_levels;
+    const bool finer = first_level < current->first_level;
+    if (first_level >= end_level
+        || (finer && (!levels || levels->first_level != first_level || levels->end_level != current->first_level)))
+        return false;
 
-        VkDescriptorBufferInfo descriptor_buffer_info = {};
-        descriptor_buffer_info.buffer = _scene_ubo.buffer;
-        descriptor_buffer_info.offset = 0;
-        descriptor_buffer_info.range = VK_WHOLE_SIZE;
+    const auto &header = _texture_streaming.textures[current->streaming_index].header;
+    const _texture_t previous = *current;
+
+    _texture_loads_t::_upload_t upload = {};
+    upload.texture = handle;
+    if (levels)
+        upload.image = *levels;
+    upload.residency_change = true;
+
+    _texture_t &texture = upload.loaded;
+    texture.format = previous.format;
+    texture.cooked = true;
+    texture.streaming_index = previous.streaming_index;
+    texture.first_level = first_level;
+    texture.extent = { std::max(header.width >> first_level, 1u), std::max(header.height >> first_level, 1u), 1 };
+    texture.mip_levels = end_level - first_level;
+    if (!create_texture_2d(&texture))
+    {
+        destroy_texture(texture);
+        return false;
+    }
 
-        VkWriteDescriptorSet write_descriptor_set = {};
-        write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        write_descriptor_set.dstSet = view.descriptor_set;
-        write_descriptor_set.dstBinding = 0;
-        write_descriptor_set.dstArrayElement = 0;
-        write_descriptor_set.descriptorCount = 1;
-        write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        write_descriptor_set.pImageInfo = nullptr;
-        write_descriptor_set.pBufferInfo = &descriptor_buffer_info;
-        write_descriptor_set.pTexelBufferView = nullptr;
+    VkImageViewCreateInfo texture_image_view_create_info = vk::init::image::image_view_create_info();
+    texture_image_view_create_info.image = texture.image;
+    texture_image_view_create_info.format = texture.format;
+    texture_image_view_create_info.subresourceRange.levelCount = texture.mip_levels;
 
-        //write_descriptor_sets.push_back(write_descriptor_set);
-        vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
+    VkResult result = vkCreateImageView(_ctx->device, &texture_image_view_create_info, nullptr, &texture.view);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+    {
+        destroy_texture(texture);
+        return false;
     }
 
-    // SAMPLER = 1
+    return submit_texture_upload(&upload, [&](VkCommandBuffer cmd) {
+        record_texture_residency_change(cmd, previous, upload.loaded, tl.staging.buffer, levels ? levels->offset : 0, header);
+        return true; });
+}
+
+//
+// Levels of the chain finer than from's come from the staging memory, the
+// others from the from image. It goes back to shader read only: the frames
+// recorded until the swap still sample it.
+//
+void Scene::record_texture_residency_change(VkCommandBuffer cmd, const _texture_t &from, const _texture_t &to,
+    VkBuffer staging, VkDeviceSize offset, const texture_cache_header_t &header)
+{
+    std::array<VkImageMemoryBarrier, 2> barriers = {};
+    for (auto &b : barriers)
     {
-        Log("#      Update Descriptor Set (Scene Global Sampler)\n");
+        b.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        b.srcAccessMask = 0;
+        b.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        b.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    }
+    barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[0].image = to.image;
+    barriers[0].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, to.mip_levels, 0, 1 };
+    barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[1].image = from.image;
+    barriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, from.mip_levels, 0, 1 };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, (uint32_t)barriers.size(), barriers.data());
+
+    std::vector<VkBufferImageCopy> buffer_copies;
+    for (uint32_t l = to.first_level; l < from.first_level; ++l)
+    {
+        VkBufferImageCopy region = vk::init::transfer::buffer_image_copy();
+        region.bufferOffset = offset + header.level_offsets[l] - header.level_offsets[to.first_level];
+        region.imageSubresource.mipLevel = l - to.first_level;
+        region.imageExtent = { std::max(header.width >> l, 1u), std::max(header.height >> l, 1u), 1 };
+        buffer_copies.push_back(region);
+    }
+    if (!buffer_copies.empty())
+    {
+        vkCmdCopyBufferToImage(cmd, staging, to.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            (uint32_t)buffer_copies.size(), buffer_copies.data());
+    }
 
-        VkDescriptorImageInfo descriptor_image_info = {};
-        descriptor_image_info.sampler = _samplers[0];
+    std::vector<VkImageCopy> image_copies;
+    for (uint32_t l = std::max(to.first_level, from.first_level); l < from.first_level + from.mip_levels; ++l)
+    {
+        VkImageCopy region = {};
+        region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, l - from.first_level, 0, 1 };
+        region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, l - to.first_level, 0, 1 };
+        region.extent = { std::max(header.width >> l, 1u), std::max(header.height >> l, 1u), 1 };
+        image_copies.push_back(region);
+    }
+    vkCmdCopyImage(cmd, from.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, to.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        (uint32_t)image_copies.size(), image_copies.data());
+
+    barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].srcAccessMask = 0; // read only
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    for (auto &b : barriers)
+    {
+        b.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        b.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        0, 0, nullptr, 0, nullptr, (uint32_t)barriers.size(), barriers.data());
+}
 
-        VkWriteDescriptorSet write_descriptor_set = {};
-        write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        write_descriptor_set.dstSet = view.descriptor_set;
-        write_descriptor_set.dstBinding = 1;
-        write_descriptor_set.dstArrayElement = 0;
-        write_descriptor_set.descriptorCount = 1;
-        write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
-        write_descriptor_set.pImageInfo = &descriptor_image_info;
-        write_descriptor_set.pBufferInfo = nullptr;
-        write_descriptor_set.pTexelBufferView = nullptr;
+bool Scene::submit_texture_upload(_texture_loads_t::_upload_t *upload, const std::function<bool(VkCommandBuffer)> &record)
+{
+    auto &tl = _texture_loads;
+
+    VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+    command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_allocate_info.commandPool = _ctx->graphics.command_pool;
+    command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    command_buffer_allocate_info.commandBufferCount = 1;
+    VkResult result = vkAllocateCommandBuffers(_ctx->device, &command_buffer_allocate_info, &upload->cmd);
+    ErrorCheck(result);
 
-        //write_descriptor_sets.push_back(write_descriptor_set);
-        vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
+    if (result == VK_SUCCESS)
+    {
+        VkFenceCreateInfo fence_create_info = {};
+        fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        result = vkCreateFence(_ctx->device, &fence_create_info, nullptr, &upload->fence);
+        ErrorCheck(result);
     }
 
-    //
-    // MATERIAL INSTANCES, SET = 1
-    //
+    if (result == VK_SUCCESS)
+    {
+        VkCommandBufferBeginInfo begin_info = {};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(upload->cmd, &begin_info);
+        bool recorded = record(upload->cmd);
+        vkEndCommandBuffer(upload->cmd);
+        result = recorded ? VK_SUCCESS : VK_ERROR_INITIALIZATION_FAILED;
+    }
 
-    for (auto &m : _material_instances)
+    if (result == VK_SUCCESS)
     {
-        // BASE TEX = 0
-        {
-            VkDescriptorImageInfo descriptor_image_info = {};
-            descriptor_image_info.imageView = _textures[m.second.base_tex].view;
-            descriptor_image_info.imageLayout = VK_IMAGE_LAYOUT_PREINITIALIZED; // why ? we did change the layout manually!! VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+        VkSubmitInfo submit_info = {};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &upload->cmd;
+        result = vkQueueSubmit(_ctx->graphics.queue, 1, &submit_info, upload->fence);
+        ErrorCheck(result);
+    }
 
-            VkWriteDescriptorSet write_descriptor_set = {};
-            write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            write_descriptor_set.dstSet = m.second.descriptor_set;
-            write_descriptor_set.dstBinding = 0;
-            write_descriptor_set.dstArrayElement = 0;
-            write_descriptor_set.descriptorCount = 1;
-            write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-            write_descriptor_set.pImageInfo = &descriptor_image_info;
-            write_descriptor_set.pBufferInfo = nullptr;
-            write_descriptor_set.pTexelBufferView = nullptr;
+    if (result != VK_SUCCESS)
+    {
+        vkDestroyFence(_ctx->device, upload->fence, nullptr);
+        if (upload->cmd != VK_NULL_HANDLE)
+            vkFreeCommandBuffers(_ctx->device, _ctx->graphics.command_pool, 1, &upload->cmd);
+        destroy_mip_scratch(&upload->mip_scratch);
+        destroy_texture(upload->loaded);
+        return false;
+    }
 
-            Log("#      Update Descriptor Set for Material Instance [n] BASE TEX\n");
-            //write_descriptor_sets.push_back(write_descriptor_set);
-            vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
-        }
+    tl.uploads.push_back(*upload);
 
-        // SPEC TEX = 1
-        {
-            VkDescriptorImageInfo descriptor_image_info = {};
-            descriptor_image_info.imageView = _textures[m.second.spec_tex].view;
-            //descriptor_image_info.imageLayout = VK_IMAGE_LAYOUT_PREINITIALIZED; // why ? we did change the layout manually!! VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-            descriptor_image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL; // why ? we did change the layout manually!! VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    return true;
+}
 
-            VkWriteDescriptorSet write_descriptor_set = {};
-            write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            write_descriptor_set.dstSet = m.second.descriptor_set;
-            write_descriptor_set.dstBinding = 1;
-            write_descriptor_set.dstArrayElement = 0;
-            write_descriptor_set.descriptorCount = 1;
-            write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-            write_descriptor_set.pImageInfo = &descriptor_image_info;
-            write_descriptor_set.pBufferInfo = nullptr;
-            write_descriptor_set.pTexelBufferView = nullptr;
+void Scene::destroy_texture(const _texture_t &texture)
+{
+    vkDestroyImageView(_ctx->device, texture.view, nullptr);
+    vkDestroyImage(_ctx->device, texture.image, nullptr);
+    vkFreeMemory(_ctx->device, texture.image_memory, nullptr);
+}
+
+bool Scene::end_texture_upload(_texture_loads_t::_upload_t *upload)
+{
+    auto &tl = _texture_loads;
+    auto &ts = _texture_streaming;
+
+    vkDestroyFence(_ctx->device, upload->fence, nullptr);
+    vkFreeCommandBuffers(_ctx->device, _ctx->graphics.command_pool, 1, &upload->cmd);
+    destroy_mip_scratch(&upload->mip_scratch);
+    tl.loader->release(upload->image);
+
+    // a slot no frame in flight reads.
+    _texture_t *texture = _textures.get(upload->texture);
+    uint32_t slot = texture ? allocate_bindless_slot() : UINT32_MAX;
+    if (slot == UINT32_MAX)
+    {
+        Log("#     Texture " + upload->image.name + ": no bindless slot left\n");
+        destroy_texture(upload->loaded);
+        if (upload->residency_change && texture)
+        {
+            auto &streamed = ts.textures[texture->streaming_index];
+            set_streaming_target(&streamed, texture->first_level);
+            streamed.pending = false;
+        }
+        return false;
+    }
+
+    upload->loaded.bindless_index = slot;
+    const _texture_t previous = *texture;
+    *texture = upload->loaded;
+    if (_bindless.descriptor_set != VK_NULL_HANDLE)
+        write_bindless_texture(*texture);
+
+    // the frames in flight still read the previous image, a placeholder's is not ours.
+    if (!previous.placeholder)
+        tl.retired_textures.push_back({ previous, tl.frame });
+
+    for (size_t i = 0; i < _material_instances.size(); ++i)
+    {
+        material_instance_handle_t handle = _material_instances.handle_at(i);
+        _material_instance_t &m = _material_instances[handle];
+        if (m.base_tex != upload->texture && m.spec_tex != upload->texture)
+            continue;
+
+        // visible at the next submit.
+        if (_bindless.descriptor_set != VK_NULL_HANDLE)
+            write_bindless_material(m);
+
+        // before compile(), the set is written with the texture there.
+        if (m.descriptor_set == VK_NULL_HANDLE)
+            continue;
+
+        VkDescriptorSetAllocateInfo descriptor_allocate_info = {};
+        descriptor_allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        descriptor_allocate_info.descriptorPool = _ctx->descriptor_pool;
+        descriptor_allocate_info.descriptorSetCount = 1;
+        descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[MATERIAL_DESCRIPTOR_SET_LAYOUT];
+
+        VkDescriptorSet set = VK_NULL_HANDLE;
+        VkResult result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &set);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            continue; // keeps the placeholder
+
+        write_material_descriptor_set(m, set);
+        tl.retired_sets.push_back({ m.descriptor_set, tl.frame });
+        m.descriptor_set = set;
+
+        for (auto &bucket : _global_draw_buckets)
+        {
+            if (bucket.material == handle)
+                bucket.descriptor_set = set;
+        }
+    }
+
+    if (upload->residency_change)
+    {
+        auto &streamed = ts.textures[texture->streaming_index];
+        streamed.pending = false;
+        if (texture->first_level < previous.first_level)
+            ++ts.streamed_in_count;
+        else
+            ++ts.evicted_count;
+        Log("#     Texture " + streamed.name + ": levels from " + std::to_string(texture->first_level) + " resident, was "
+            + std::to_string(previous.first_level) + "\n");
+        return true;
+    }
+
+    // the levels left in the cache file come later, when needed.
+    const auto &image = upload->image;
+    if (texture->cooked && image.streamable && image.first_level > 0)
+    {
+        _texture_streaming_t::_streamed_t streamed;
+        streamed.texture = upload->texture;
+        streamed.name = image.name;
+        streamed.header = image.cooked;
+        streamed.target_level = image.first_level;
+        streamed.tail_level = image.first_level;
+        streamed.wanted_level = image.first_level;
+        streamed.last_wanted_frame = tl.frame;
+        texture->streaming_index = (uint32_t)ts.textures.size();
+        ts.textures.push_back(streamed);
+    }
+    if (texture->cooked)
+        ts.resident_bytes += cooked_levels_size(image.cooked, image.first_level, image.end_level);
+
+    ++tl.loaded_count;
+    Log("#     Texture " + upload->image.name + " loaded: " + std::to_string(upload->image.width) + "x"
+        + std::to_string(upload->image.height) + ", decoded in " + std::to_string(upload->image.decode_ms) + " ms\n");
+
+    return true;
+}
+
+void Scene::set_streaming_target(_texture_streaming_t::_streamed_t *streamed, uint32_t level)
+{
+    auto &ts = _texture_streaming;
+    const uint32_t end_level = streamed->header.level_count;
+    ts.resident_bytes -= cooked_levels_size(streamed->header, streamed->target_level, end_level);
+    ts.resident_bytes += cooked_levels_size(streamed->header, level, end_level);
+    streamed->target_level = level;
+}
+
+//
+// The wanted level is the one whose texels are about the size of the pixels
+// the object covers: its bounding sphere projected at its nearest distance.
+// The textures with the biggest gap get their levels first.
+//
+void Scene::update_texture_streaming()
+{
+    auto &ts = _texture_streaming;
+    auto &tl = _texture_loads;
+    if (!tl.loader || ts.textures.empty())
+        return;
+
+    for (auto &streamed : ts.textures)
+        streamed.wanted_level = streamed.header.level_count - 1;
+
+    const auto &camera = _cameras[_main_camera];
+    const float focal = std::abs(camera.p[1][1]) * 0.5f * (float)ts.view_height; // pixels for 1 at distance 1
+
+    auto want = [&](texture_handle_t handle, float pixels) {
+        const _texture_t *texture = _textures.get(handle);
+        if (!texture || texture->streaming_index >= ts.textures.size())
+            return;
+
+        auto &streamed = ts.textures[texture->streaming_index];
+        float texels = (float)std::max(streamed.header.width, streamed.header.height);
+        float level = std::floor(std::log2(std::max(texels / pixels, 1.0f)) + ts.lod_bias);
+        uint32_t wanted = (uint32_t)glm::clamp(level, 0.0f, (float)(streamed.header.level_count - 1));
+        streamed.wanted_level = std::min(streamed.wanted_level, wanted);
+        streamed.last_wanted_frame = tl.frame;
+    };
+
+    for (uint32_t i = 0; i < (uint32_t)_objects.size() && i < _transforms.size(); ++i)
+    {
+        const _object_t &object = _objects[i];
+        const _material_instance_t *material = _material_instances.get(object.material);
+        if (!material)
+            continue;
+
+        const glm::mat4 &world = _transforms.matrices(i).world;
+        const glm::vec3 center = glm::vec3(world[3]);
+        const float scale = std::max({ glm::length(glm::vec3(world[0])), glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2])) });
+        const float radius = object.bounding_radius * scale;
+
+        bool visible = true;
+        for (const auto &plane : _meshlet_culling.data.frustum)
+            visible = visible && glm::dot(glm::vec3(plane), center) + plane.w >= -radius;
+        if (!visible)
+            continue;
+
+        const float distance = glm::length(center - glm::vec3(camera.pos)) - radius;
+        const float pixels = std::max(2.0f * radius * focal / std::max(distance, 0.01f), 1.0f);
+        want(material->base_tex, pixels);
+        want(material->spec_tex, pixels);
+    }
+
+    // back under budget_mb, when it was lowered.
+    evict_texture_levels(0, UINT32_MAX);
+
+    std::vector<uint32_t> candidates;
+    for (uint32_t i = 0; i < (uint32_t)ts.textures.size(); ++i)
+    {
+        const auto &streamed = ts.textures[i];
+        if (!streamed.pending && streamed.wanted_level < streamed.target_level)
+            candidates.push_back(i);
+    }
+    std::sort(candidates.begin(), candidates.end(), [&](uint32_t a, uint32_t b) {
+        return ts.textures[a].target_level - ts.textures[a].wanted_level > ts.textures[b].target_level - ts.textures[b].wanted_level;
+    });
+
+    const VkDeviceSize upload_budget = (VkDeviceSize)ts.upload_budget_kb * 1024;
+    VkDeviceSize upload_bytes = 0;
+    for (uint32_t i : candidates)
+    {
+        auto &streamed = ts.textures[i];
+
+        // one level at a time when the budget is short, the first one goes anyway.
+        uint32_t level = streamed.target_level;
+        while (level > streamed.wanted_level)
+        {
+            VkDeviceSize size = cooked_levels_size(streamed.header, level - 1, streamed.target_level);
+            if (upload_bytes + size > upload_budget && (upload_bytes > 0 || level < streamed.target_level))
+                break;
+            --level;
+        }
+        if (level == streamed.target_level)
+            break;
+
+        VkDeviceSize size = cooked_levels_size(streamed.header, level, streamed.target_level);
+        if (ts.resident_bytes + size > (VkDeviceSize)ts.budget_mb * 1024 * 1024 && !evict_texture_levels(size, i))
+            continue;
+
+        tl.loader->request_levels(streamed.name, streamed.header, level, streamed.target_level);
+        streamed.pending = true;
+        set_streaming_target(&streamed, level);
+        upload_bytes += size;
+    }
+}
+
+bool Scene::evict_texture_levels(VkDeviceSize needed, uint32_t keep)
+{
+    auto &ts = _texture_streaming;
+    const VkDeviceSize budget = (VkDeviceSize)ts.budget_mb * 1024 * 1024;
+
+    while (ts.resident_bytes + needed > budget)
+    {
+        // least recently needed, with levels above what it needs.
+        uint32_t victim = UINT32_MAX;
+        for (uint32_t i = 0; i < (uint32_t)ts.textures.size(); ++i)
+        {
+            const auto &streamed = ts.textures[i];
+            if (i == keep || streamed.pending || std::min(streamed.wanted_level, streamed.tail_level) <= streamed.target_level)
+                continue;
+            if (victim == UINT32_MAX || streamed.last_wanted_frame < ts.textures[victim].last_wanted_frame)
+                victim = i;
+        }
+        if (victim == UINT32_MAX)
+            return false;
+
+        auto &streamed = ts.textures[victim];
+        const uint32_t level = std::min(streamed.wanted_level, streamed.tail_level);
+        const uint32_t previous_level = streamed.target_level;
+        streamed.pending = true;
+        set_streaming_target(&streamed, level);
+        if (!begin_texture_residency_change(streamed.texture, level, nullptr))
+        {
+            set_streaming_target(&streamed, previous_level);
+            streamed.pending = false;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Scene::create_depth_pyramid()
+{
+    VkResult result;
+    auto &dp = _depth_pyramid;
+
+    // Power of 2 below the depth size, each level is then exactly half of the previous one.
+    auto previous_pow2 = [](uint32_t v) { uint32_t r = 1; while (r * 2 <= v) r *= 2; return r; };
+    uint32_t width = previous_pow2(dp.depth_extent.width);
+    uint32_t height = previous_pow2(dp.depth_extent.height);
+
+    dp.level_count = 1;
+    while ((std::max(width, height) >> dp.level_count) > 0 && dp.level_count < MAX_DEPTH_PYRAMID_LEVELS)
+        ++dp.level_count;
+
+    dp.texture.format = VK_FORMAT_R32_SFLOAT;
+    dp.texture.extent = { width, height, 1 };
+
+    VkImageCreateInfo image_create_info = {};
+    image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_create_info.imageType = VK_IMAGE_TYPE_2D;
+    image_create_info.format = dp.texture.format;
+    image_create_info.extent = dp.texture.extent;
+    image_create_info.mipLevels = dp.level_count;
+    image_create_info.arrayLayers = 1;
+    image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_create_info.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    Log("#     Create Depth Pyramid Image\n");
+    result = vkCreateImage(_ctx->device, &image_create_info, nullptr, &dp.texture.image);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    VkMemoryRequirements memory_requirements = {};
+    vkGetImageMemoryRequirements(_ctx->device, dp.texture.image, &memory_requirements);
+
+    VkMemoryAllocateInfo memory_allocate_info = {};
+    memory_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memory_allocate_info.allocationSize = memory_requirements.size;
+    memory_allocate_info.memoryTypeIndex = find_memory_type(memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    Log("#     Allocate Depth Pyramid Memory\n");
+    result = vkAllocateMemory(_ctx->device, &memory_allocate_info, nullptr, &dp.texture.image_memory);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    result = vkBindImageMemory(_ctx->device, dp.texture.image, dp.texture.image_memory, 0);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    VkImageViewCreateInfo image_view_create_info = {};
+    image_view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    image_view_create_info.image = dp.texture.image;
+    image_view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    image_view_create_info.format = dp.texture.format;
+    image_view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    image_view_create_info.subresourceRange.baseArrayLayer = 0;
+    image_view_create_info.subresourceRange.layerCount = 1;
+
+    Log("#     Create Depth Pyramid Image Views\n");
+    image_view_create_info.subresourceRange.baseMipLevel = 0;
+    image_view_create_info.subresourceRange.levelCount = dp.level_count;
+    result = vkCreateImageView(_ctx->device, &image_view_create_info, nullptr, &dp.texture.view);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    for (uint32_t i = 0; i < dp.level_count; ++i)
+    {
+        image_view_create_info.subresourceRange.baseMipLevel = i;
+        image_view_create_info.subresourceRange.levelCount = 1;
+        result = vkCreateImageView(_ctx->device, &image_view_create_info, nullptr, &dp.level_views[i]);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    VkSamplerCreateInfo sampler_create_info = {};
+    sampler_create_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_create_info.magFilter = VK_FILTER_NEAREST;
+    sampler_create_info.minFilter = VK_FILTER_NEAREST;
+    sampler_create_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    sampler_create_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_create_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_create_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_create_info.anisotropyEnable = VK_FALSE;
+    sampler_create_info.minLod = 0;
+    sampler_create_info.maxLod = (float)dp.level_count;
+    sampler_create_info.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+    sampler_create_info.unnormalizedCoordinates = VK_FALSE;
+
+    Log("#     Create Depth Pyramid Sampler\n");
+    result = vkCreateSampler(_ctx->device, &sampler_create_info, nullptr, &dp.sampler);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    // The pyramid stays in GENERAL: written as storage, read as sampled.
+    auto cmd = begin_single_time_commands(_ctx->graphics);
+    {
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = dp.texture.image;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, dp.level_count, 0, 1 };
+
+        vkCmdPipelineBarrier(cmd,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            0, nullptr,
+            0, nullptr,
+            1, &barrier);
+    }
+    end_single_time_commands(cmd, _ctx->graphics);
+
+    return true;
+}
+
+void Scene::destroy_depth_pyramid()
+{
+    auto &dp = _depth_pyramid;
+
+    vkDestroySampler(_ctx->device, dp.sampler, nullptr);
+    for (uint32_t i = 0; i < dp.level_count; ++i)
+    {
+        vkDestroyImageView(_ctx->device, dp.level_views[i], nullptr);
+    }
+    vkDestroyImageView(_ctx->device, dp.texture.view, nullptr);
+    vkDestroyImage(_ctx->device, dp.texture.image, nullptr);
+    vkFreeMemory(_ctx->device, dp.texture.image_memory, nullptr);
+}
+
+bool Scene::create_shader_module(const std::string &file_path, VkShaderModule *shader_module)
+{
+    auto content = utils::read_file_content(file_path);
+
+    VkShaderModuleCreateInfo shader_creation_info = {};
+    shader_creation_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shader_creation_info.codeSize = content.size();
+    shader_creation_info.pCode = (uint32_t *)content.data();
+
+    VkResult result;
+
+    Log("#      Create Shader Module\n");
+    result = vkCreateShaderModule(_ctx->device, &shader_creation_info, nullptr, shader_module);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    return true;
+}
+
+bool Scene::create_all_descriptor_set_layouts(VkDevice device, VkDescriptorSetLayout *layouts)
+{
+    VkResult result;
+
+    // 3 SETS
+    //    set = 0 (SCENE)
+    //        binding = 0 : camera matrices, light pos (UBO)(VS+FS)
+    //        binding = 2 : texture sampler            (SMP)(FS)
+    //    set = 1 (MATERIAL instance)
+    //        binding = 0 : base texture               (TEX)(FS)
+    //        binding = 1 : spec texture               (TEX)(FS)
+    //    set = 2 (OBJECT instance)
+    //        binding = 0 : model matrix               (Dyn UBO)(VS)
+    //        binding = 1 : material overrides         (Dyn UBO)(FS) // same ubo?
+    //    set = x (COMPUTE particles)
+    //        binding = 0 : instance data              (SSBO)
+    //        binding = 1 : simulation params          (UBO)
+    //    set = x (COMPUTE classify)
+    //        binding = 0 : instance data              (SSBO)
+    //        binding = 1 : camera, switch distance    (UBO)
+    //        binding = 2 : near instance indices      (SSBO)
+    //        binding = 3 : far instance indices       (SSBO)
+    //        binding = 4 : indirect draw commands     (SSBO)
+    //        binding = 5 : depth pyramid              (Sampler)
+    //    set = x (COMPUTE depth pyramid, one per level)
+    //        binding = 0 : source level or depth      (Sampler)
+    //        binding = 1 : destination level          (Storage Image)
+    //    set = 2 (INSTANCE data, indirect pipelines)
+    //        binding = 0 : instance data              (SSBO)(VS)
+    //        binding = 1 : near or far indices        (SSBO)(VS)
+    //    set = 1 (BINDLESS materials, instance pipelines)
+    //        binding = 0 : material table             (SSBO)(FS)
+    //        binding = 1 : all textures               (TEX[MAX_BINDLESS_TEXTURES])(FS)
+
+    //
+    // PER-SCENE
+    //
+    {
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+
+        bindings[0].binding = 0;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        bindings[0].descriptorCount = 1; // use >1 for arrays bound to a single binding.
+        bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+        bindings[0].pImmutableSamplers = nullptr;
+
+        bindings[1].binding = 1;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+        bindings[1].descriptorCount = 1;
+        bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        bindings[1].pImmutableSamplers = nullptr; // TODO: set my sampler here, no need to bind afterwards
+
+        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
+        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+        desc_set_layout_create_info.pBindings = bindings.data();
+
+        Log("#      Create Default Descriptor Set Layout for Scene Uniforms\n");
+        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + SCENE_DESCRIPTOR_SET_LAYOUT);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // PER-MATERIAL INSTANCE
+    //
+    {
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+
+        bindings[0].binding = 0;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        bindings[0].descriptorCount = 1;
+        bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        bindings[0].pImmutableSamplers = nullptr;
+
+        bindings[1].binding = 1;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        bindings[1].descriptorCount = 1;
+        bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        bindings[1].pImmutableSamplers = nullptr;
+
+        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
+        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+        desc_set_layout_create_info.pBindings = bindings.data();
+
+        Log("#      Create Default Descriptor Set Layout for Material instance Uniforms\n");
+        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + MATERIAL_DESCRIPTOR_SET_LAYOUT);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // PER-OBJECT
+    //
+    {
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+
+        // all the objects, indexed with gl_InstanceIndex. Dynamic: the copy of the frame.
+        bindings[0].binding = 0;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+        bindings[0].descriptorCount = 1;
+        bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        bindings[0].pImmutableSamplers = nullptr;
+
+        bindings[1].binding = 1;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+        bindings[1].descriptorCount = 1;
+        bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        bindings[1].pImmutableSamplers = nullptr;
+
+        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
+        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+        desc_set_layout_create_info.pBindings = bindings.data();
+
+        Log("#      Create Default Descriptor Set Layout for Objects Uniforms\n");
+        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + OBJECT_DESCRIPTOR_SET_LAYOUT);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // COMPUTE
+    //
+    {
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+
+        bindings[0].binding = 0;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[0].descriptorCount = 1; // use >1 for arrays bound to a single binding.
+        bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[0].pImmutableSamplers = nullptr;
+
+        bindings[1].binding = 1;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        bindings[1].descriptorCount = 1;
+        bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[1].pImmutableSamplers = nullptr;
+
+        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
+        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+        desc_set_layout_create_info.pBindings = bindings.data();
+
+        Log("#      Create Descriptor Set Layout for Compute Particles (SSBO+UBO)\n");
+        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + COMPUTE_DESCRIPTOR_SET_LAYOUT);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // CLASSIFY
+    //
+    {
+        std::array<VkDescriptorSetLayoutBinding, 8> bindings = {};
+
+        for (uint32_t i = 0; i < bindings.size(); ++i)
+        {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            bindings[i].pImmutableSamplers = nullptr;
+        }
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        bindings[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER; // depth pyramid
+
+        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
+        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+        desc_set_layout_create_info.pBindings = bindings.data();
+
+        Log("#      Create Descriptor Set Layout for Classify Particles (SSBO+UBO+3 SSBO+Sampler+2 SSBO)\n");
+        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + CLASSIFY_DESCRIPTOR_SET_LAYOUT);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // PARTICLE LIFECYCLE (emit, update, compact)
+    //
+    {
+        std::array<VkDescriptorSetLayoutBinding, 5> bindings = {};
+
+        for (uint32_t i = 0; i < bindings.size(); ++i)
+        {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            bindings[i].pImmutableSamplers = nullptr;
+        }
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
+        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+        desc_set_layout_create_info.pBindings = bindings.data();
+
+        Log("#      Create Descriptor Set Layout for Particle Lifecycle (SSBO+UBO+3 SSBO)\n");
+        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + LIFECYCLE_DESCRIPTOR_SET_LAYOUT);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // PARTICLE SORT KEYS
+    //
+    {
+        std::array<VkDescriptorSetLayoutBinding, 7> bindings = {};
+
+        for (uint32_t i = 0; i < bindings.size(); ++i)
+        {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            bindings[i].pImmutableSamplers = nullptr;
+        }
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
+        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+        desc_set_layout_create_info.pBindings = bindings.data();
+
+        Log("#      Create Descriptor Set Layout for Particle Sort (SSBO+UBO+5 SSBO)\n");
+        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + SORT_DESCRIPTOR_SET_LAYOUT);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // INSTANCE DATA, READ BY INDEX IN THE VS
+    //
+    {
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+
+        bindings[0].binding = 0;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[0].descriptorCount = 1;
+        bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        bindings[0].pImmutableSamplers = nullptr;
+
+        bindings[1].binding = 1;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[1].descriptorCount = 1;
+        bindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        bindings[1].pImmutableSamplers = nullptr;
+
+        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
+        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+        desc_set_layout_create_info.pBindings = bindings.data();
+
+        Log("#      Create Descriptor Set Layout for Indexed Instance Data (2 SSBO)\n");
+        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + INSTANCE_DESCRIPTOR_SET_LAYOUT);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // DEPTH PYRAMID, ONE SET PER LEVEL
+    //
+    {
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+
+        bindings[0].binding = 0;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[0].descriptorCount = 1;
+        bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[0].pImmutableSamplers = nullptr;
+
+        bindings[1].binding = 1;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[1].descriptorCount = 1;
+        bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[1].pImmutableSamplers = nullptr;
+
+        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
+        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+        desc_set_layout_create_info.pBindings = bindings.data();
+
+        Log("#      Create Descriptor Set Layout for Depth Pyramid (Sampler+Storage Image)\n");
+        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + DEPTH_PYRAMID_DESCRIPTOR_SET_LAYOUT);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // BINDLESS MATERIALS, with descriptor indexing only
+    //
+    if (_ctx->bindless)
+    {
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+
+        bindings[0].binding = 0;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[0].descriptorCount = 1;
+        bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        bindings[0].pImmutableSamplers = nullptr;
+
+        bindings[1].binding = 1;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        bindings[1].descriptorCount = MAX_BINDLESS_TEXTURES;
+        bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        bindings[1].pImmutableSamplers = nullptr;
+
+        // the table buffer never changes, only its content.
+        std::array<VkDescriptorBindingFlagsEXT, 2> binding_flags = {
+            0,
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT
+        };
+
+        VkDescriptorSetLayoutBindingFlagsCreateInfoEXT binding_flags_create_info = {};
+        binding_flags_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+        binding_flags_create_info.bindingCount = (uint32_t)binding_flags.size();
+        binding_flags_create_info.pBindingFlags = binding_flags.data();
+
+        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
+        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        desc_set_layout_create_info.pNext = &binding_flags_create_info;
+        desc_set_layout_create_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+        desc_set_layout_create_info.pBindings = bindings.data();
+
+        Log("#      Create Descriptor Set Layout for Bindless Materials (SSBO+Texture Array)\n");
+        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + BINDLESS_DESCRIPTOR_SET_LAYOUT);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // MESHLET CULLING
+    //
+    {
+        std::array<VkDescriptorSetLayoutBinding, 6> bindings = {};
+
+        for (uint32_t i = 0; i < bindings.size(); ++i)
+        {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            bindings[i].pImmutableSamplers = nullptr;
+        }
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC; // object matrices of the frame
+
+        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
+        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+        desc_set_layout_create_info.pBindings = bindings.data();
+
+        Log("#      Create Descriptor Set Layout for Meshlet Culling (SSBO+UBO+4 SSBO)\n");
+        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + MESHLET_DESCRIPTOR_SET_LAYOUT);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // MIPMAP (compute fallback of the blits)
+    //
+    {
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+
+        for (uint32_t i = 0; i < bindings.size(); ++i)
+        {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            bindings[i].pImmutableSamplers = nullptr;
+        }
+
+        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
+        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        desc_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+        desc_set_layout_create_info.pBindings = bindings.data();
+
+        Log("#      Create Descriptor Set Layout for Mipmaps (2 Storage Images)\n");
+        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + MIPMAP_DESCRIPTOR_SET_LAYOUT);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // PROCEDURAL TEXTURES
+    //
+    {
+        VkDescriptorSetLayoutBinding binding = {};
+        binding.binding = 0;
+        binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        binding.descriptorCount = 1;
+        binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        binding.pImmutableSamplers = nullptr;
+
+        VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {};
+        desc_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        desc_set_layout_create_info.bindingCount = 1;
+        desc_set_layout_create_info.pBindings = &binding;
+
+        Log("#      Create Descriptor Set Layout for Procedural Textures (1 Storage Image)\n");
+        result = vkCreateDescriptorSetLayout(device, &desc_set_layout_create_info, nullptr, layouts + PROCEDURAL_DESCRIPTOR_SET_LAYOUT);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    return true;
+}
+
+bool Scene::create_all_descriptor_sets()
+{
+    _view_t &view = _views[_main_view]; // scene descriptor set is here
+
+    VkResult result;
+
+    VkDescriptorSetAllocateInfo descriptor_allocate_info = {};
+    descriptor_allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptor_allocate_info.descriptorPool = _ctx->descriptor_pool;// _descriptor_pool;
+    descriptor_allocate_info.descriptorSetCount = 1;
+    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[SCENE_DESCRIPTOR_SET_LAYOUT];
+
+    Log("#      Allocate Scene/View Descriptor Set\n");
+    result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &view.descriptor_set);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    // TODO: create all material instances descriptor sets at once.
+    descriptor_allocate_info.descriptorSetCount = 1;
+    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[MATERIAL_DESCRIPTOR_SET_LAYOUT];
+    for (auto &m : _material_instances)
+    {
+        Log("#      Allocate Material Instance[n] Descriptor Set\n");
+        result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &m.descriptor_set);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    Log("#      Allocate Object Instance Descriptor Sets\n");
+    descriptor_allocate_info.descriptorSetCount = 1;
+    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[OBJECT_DESCRIPTOR_SET_LAYOUT];
+    result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &_global_objects_descriptor_set);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    Log("#      Allocate Compute Descriptor Set\n");
+    descriptor_allocate_info.descriptorSetCount = 1;
+    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[COMPUTE_DESCRIPTOR_SET_LAYOUT];
+    result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &compute_particles.descriptor_set);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    Log("#      Allocate Classify Descriptor Set\n");
+    descriptor_allocate_info.descriptorSetCount = 1;
+    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[CLASSIFY_DESCRIPTOR_SET_LAYOUT];
+    result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &classify_particles.descriptor_set);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    Log("#      Allocate Particle Lifecycle Descriptor Set\n");
+    descriptor_allocate_info.descriptorSetCount = 1;
+    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[LIFECYCLE_DESCRIPTOR_SET_LAYOUT];
+    result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &_particle_lifecycle.descriptor_set);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    Log("#      Allocate Particle Sort Descriptor Sets\n");
+    descriptor_allocate_info.descriptorSetCount = 1;
+    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[SORT_DESCRIPTOR_SET_LAYOUT];
+    result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &_particle_sort.descriptor_set);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[INSTANCE_DESCRIPTOR_SET_LAYOUT];
+    result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &_particle_sort.draw_descriptor_set);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    Log("#      Allocate Meshlet Culling Descriptor Sets\n");
+    descriptor_allocate_info.descriptorSetCount = 1;
+    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[MESHLET_DESCRIPTOR_SET_LAYOUT];
+    result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &_meshlet_culling.descriptor_set);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+    Log("#      Allocate Depth Pyramid Descriptor Sets\n");
+    descriptor_allocate_info.descriptorSetCount = 1;
+    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[DEPTH_PYRAMID_DESCRIPTOR_SET_LAYOUT];
+    for (uint32_t i = 0; i < _depth_pyramid.level_count; ++i)
+    {
+        result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &_depth_pyramid.descriptor_sets[i]);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    Log("#      Allocate Near/Far Instance Descriptor Sets\n");
+    descriptor_allocate_info.descriptorSetCount = 1;
+    descriptor_allocate_info.pSetLayouts = &_descriptor_set_layouts[INSTANCE_DESCRIPTOR_SET_LAYOUT];
+    for (auto &is : _instance_sets)
+    {
+        result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &is.near_descriptor_set);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+
+        result = vkAllocateDescriptorSets(_ctx->device, &descriptor_allocate_info, &is.far_descriptor_set);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // CONFIGURE DESCRIPTOR SETS
+    //
+    // When a set is allocated all values are undefined and all 
+    // descriptors are uninitialised. must init all statically used bindings:
+
+    std::vector<VkWriteDescriptorSet> write_descriptor_sets = {};
+
+    // 4 SETS
+    //    set = 0 (SCENE)
+    //        binding = 0 : camera matrices, light     (UBO)(VS+FS)
+    //        binding = 1 : texture sampler            (SMP)(FS)
+    //    set = 1 (MATERIAL instance)
+    //        binding = 0 : base texture               (TEX)(FS)
+    //        binding = 1 : spec texture               (TEX)(FS)
+    //    set = 2 (OBJECT instance)
+    //        binding = 0 : model matrix               (Dyn UBO)(VS)
+    //        binding = 1 : material overrides         (Dyn UBO)(FS) // same ubo?
+    //    set = x (compute)
+    //        binding = 0 : per-instance data          (SSBO)
+    //        binding = 1 : simulation data            (UBO)
+
+    // SCENE UBO CAMERA = 0
+    {
+        Log("#      Update Descriptor Set (Scene CAMERA + LIGHT UBO)\n");
+
+        VkDescriptorBufferInfo descriptor_buffer_info = {};
+        descriptor_buffer_info.buffer = _scene_ubo.buffer;
+        descriptor_buffer_info.offset = 0;
+        descriptor_buffer_info.range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet write_descriptor_set = {};
+        write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write_descriptor_set.dstSet = view.descriptor_set;
+        write_descriptor_set.dstBinding = 0;
+        write_descriptor_set.dstArrayElement = 0;
+        write_descriptor_set.descriptorCount = 1;
+        write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        write_descriptor_set.pImageInfo = nullptr;
+        write_descriptor_set.pBufferInfo = &descriptor_buffer_info;
+        write_descriptor_set.pTexelBufferView = nullptr;
+
+        //write_descriptor_sets.push_back(write_descriptor_set);
+        vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
+    }
+
+    // SAMPLER = 1
+    {
+        Log("#      Update Descriptor Set (Scene Global Sampler)\n");
+
+        VkDescriptorImageInfo descriptor_image_info = {};
+        descriptor_image_info.sampler = _samplers[0];
+
+        VkWriteDescriptorSet write_descriptor_set = {};
+        write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write_descriptor_set.dstSet = view.descriptor_set;
+        write_descriptor_set.dstBinding = 1;
+        write_descriptor_set.dstArrayElement = 0;
+        write_descriptor_set.descriptorCount = 1;
+        write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+        write_descriptor_set.pImageInfo = &descriptor_image_info;
+        write_descriptor_set.pBufferInfo = nullptr;
+        write_descriptor_set.pTexelBufferView = nullptr;
+
+        //write_descriptor_sets.push_back(write_descriptor_set);
+        vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
+    }
+
+    //
+    // MATERIAL INSTANCES, SET = 1
+    //
+
+    for (auto &m : _material_instances)
+    {
+        Log("#      Update Descriptor Set for Material Instance [n] BASE/SPEC TEX\n");
+        write_material_descriptor_set(m, m.descriptor_set);
+    }
+
+    //
+    // GLOBAL OBJECT SSBOs, SET = 2
+    //
+
+    // MATRICES SSBO = 0
+    {
+        VkDescriptorBufferInfo descriptor_buffer_info = {};
+        descriptor_buffer_info.buffer = _global_object_matrices_ubo.buffer;
+        descriptor_buffer_info.offset = 0;
+        descriptor_buffer_info.range = _global_object_matrices_ubo.size; // one copy
+
+        VkWriteDescriptorSet write_descriptor_set = {};
+        write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write_descriptor_set.dstSet = _global_objects_descriptor_set;
+        write_descriptor_set.dstBinding = 0;
+        write_descriptor_set.dstArrayElement = 0;
+        write_descriptor_set.descriptorCount = 1;
+        write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+        write_descriptor_set.pImageInfo = nullptr;
+        write_descriptor_set.pBufferInfo = &descriptor_buffer_info;
+        write_descriptor_set.pTexelBufferView = nullptr;
+
+        Log("#      Update Descriptor Set (Object Matrices SSBO)\n");
+        //write_descriptor_sets.push_back(write_descriptor_set);
+        vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
+    }
+
+    // MATERIALS SSBO = 1
+    {
+        VkDescriptorBufferInfo descriptor_buffer_info = {};
+        descriptor_buffer_info.buffer = _global_object_material_ubo.buffer;
+        descriptor_buffer_info.offset = 0;
+        descriptor_buffer_info.range = _global_object_material_ubo.size; // one copy
+
+        VkWriteDescriptorSet write_descriptor_set = {};
+        write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write_descriptor_set.dstSet = _global_objects_descriptor_set;
+        write_descriptor_set.dstBinding = 1;
+        write_descriptor_set.dstArrayElement = 0;
+        write_descriptor_set.descriptorCount = 1;
+        write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+        write_descriptor_set.pImageInfo = nullptr;
+        write_descriptor_set.pBufferInfo = &descriptor_buffer_info;
+        write_descriptor_set.pTexelBufferView = nullptr;
+
+        Log("#      Update Descriptor Set (Object Materials SSBO)\n");
+        //write_descriptor_sets.push_back(write_descriptor_set);
+        vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
+    }
+
+    //
+    // COMPUTE - PER INSTANCE SSBO = 0
+    //
+    {
+        Log("#      Update Descriptor Set (Per-Instance SSBO)\n");
+
+        VkDescriptorBufferInfo descriptor_buffer_info = {};
+        descriptor_buffer_info.buffer = _instance_sets[_particles].instance_buffer.buffer;
+        descriptor_buffer_info.offset = 0;
+        descriptor_buffer_info.range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet write_descriptor_set = {};
+        write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write_descriptor_set.dstSet = compute_particles.descriptor_set;
+        write_descriptor_set.dstBinding = 0;
+        write_descriptor_set.dstArrayElement = 0;
+        write_descriptor_set.descriptorCount = 1;
+        write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write_descriptor_set.pImageInfo = nullptr;
+        write_descriptor_set.pBufferInfo = &descriptor_buffer_info;
+        write_descriptor_set.pTexelBufferView = nullptr;
+
+        //write_descriptor_sets.push_back(write_descriptor_set);
+        vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
+    }
+
+    //
+    // COMPUTE - SIMULATION DATA UBO = 1
+    //
+    {
+        Log("#      Update Descriptor Set (Per-Instance SSBO)\n");
+
+        VkDescriptorBufferInfo descriptor_buffer_info = {};
+        descriptor_buffer_info.buffer = compute_particles.ubo.buffer;
+        descriptor_buffer_info.offset = 0;
+        descriptor_buffer_info.range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet write_descriptor_set = {};
+        write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write_descriptor_set.dstSet = compute_particles.descriptor_set;
+        write_descriptor_set.dstBinding = 1;
+        write_descriptor_set.dstArrayElement = 0;
+        write_descriptor_set.descriptorCount = 1;
+        write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        write_descriptor_set.pImageInfo = nullptr;
+        write_descriptor_set.pBufferInfo = &descriptor_buffer_info;
+        write_descriptor_set.pTexelBufferView = nullptr;
+
+        vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
+    }
+
+    //
+    // CLASSIFY - INSTANCE DATA, UBO, NEAR/FAR INDICES, DRAW COMMANDS
+    //
+    {
+        Log("#      Update Descriptor Set (Classify)\n");
+
+        auto &is = _instance_sets[_particles];
+
+        std::array<VkDescriptorBufferInfo, 5> descriptor_buffer_infos = {};
+        descriptor_buffer_infos[0].buffer = is.instance_buffer.buffer;
+        descriptor_buffer_infos[1].buffer = classify_particles.ubo.buffer;
+        descriptor_buffer_infos[2].buffer = is.near_indices.buffer;
+        descriptor_buffer_infos[3].buffer = is.far_indices.buffer;
+        descriptor_buffer_infos[4].buffer = is.draw_commands.buffer;
+
+        std::array<VkWriteDescriptorSet, 5> write_descriptor_sets = {};
+        for (uint32_t i = 0; i < write_descriptor_sets.size(); ++i)
+        {
+            descriptor_buffer_infos[i].offset = 0;
+            descriptor_buffer_infos[i].range = VK_WHOLE_SIZE;
+
+            write_descriptor_sets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write_descriptor_sets[i].dstSet = classify_particles.descriptor_set;
+            write_descriptor_sets[i].dstBinding = i;
+            write_descriptor_sets[i].dstArrayElement = 0;
+            write_descriptor_sets[i].descriptorCount = 1;
+            write_descriptor_sets[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            write_descriptor_sets[i].pBufferInfo = &descriptor_buffer_infos[i];
+        }
+        write_descriptor_sets[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+        vkUpdateDescriptorSets(_ctx->device, (uint32_t)write_descriptor_sets.size(), write_descriptor_sets.data(), 0, nullptr);
+
+        VkDescriptorImageInfo pyramid_image_info = {};
+        pyramid_image_info.sampler = _depth_pyramid.sampler;
+        pyramid_image_info.imageView = _depth_pyramid.texture.view;
+        pyramid_image_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkWriteDescriptorSet pyramid_write = {};
+        pyramid_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        pyramid_write.dstSet = classify_particles.descriptor_set;
+        pyramid_write.dstBinding = 5;
+        pyramid_write.dstArrayElement = 0;
+        pyramid_write.descriptorCount = 1;
+        pyramid_write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        pyramid_write.pImageInfo = &pyramid_image_info;
+
+        vkUpdateDescriptorSets(_ctx->device, 1, &pyramid_write, 0, nullptr);
+
+        std::array<VkDescriptorBufferInfo, 2> lifecycle_buffer_infos = {};
+        lifecycle_buffer_infos[0].buffer = _particle_lifecycle.alive_indices.buffer;
+        lifecycle_buffer_infos[1].buffer = _particle_lifecycle.counters.buffer;
+
+        std::array<VkWriteDescriptorSet, 2> lifecycle_writes = {};
+        for (uint32_t i = 0; i < lifecycle_writes.size(); ++i)
+        {
+            lifecycle_buffer_infos[i].offset = 0;
+            lifecycle_buffer_infos[i].range = VK_WHOLE_SIZE;
+
+            lifecycle_writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            lifecycle_writes[i].dstSet = classify_particles.descriptor_set;
+            lifecycle_writes[i].dstBinding = 6 + i;
+            lifecycle_writes[i].dstArrayElement = 0;
+            lifecycle_writes[i].descriptorCount = 1;
+            lifecycle_writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            lifecycle_writes[i].pBufferInfo = &lifecycle_buffer_infos[i];
+        }
+
+        vkUpdateDescriptorSets(_ctx->device, (uint32_t)lifecycle_writes.size(), lifecycle_writes.data(), 0, nullptr);
+    }
+
+    //
+    // PARTICLE LIFECYCLE - INSTANCE DATA, UBO, ALIVE/DEAD INDICES, COUNTERS
+    //
+    {
+        Log("#      Update Descriptor Set (Particle Lifecycle)\n");
+
+        auto &lc = _particle_lifecycle;
+
+        std::array<VkDescriptorBufferInfo, 5> descriptor_buffer_infos = {};
+        descriptor_buffer_infos[0].buffer = _instance_sets[_particles].instance_buffer.buffer;
+        descriptor_buffer_infos[1].buffer = lc.ubo.buffer;
+        descriptor_buffer_infos[2].buffer = lc.alive_indices.buffer;
+        descriptor_buffer_infos[3].buffer = lc.dead_indices.buffer;
+        descriptor_buffer_infos[4].buffer = lc.counters.buffer;
+
+        std::array<VkWriteDescriptorSet, 5> write_descriptor_sets = {};
+        for (uint32_t i = 0; i < write_descriptor_sets.size(); ++i)
+        {
+            descriptor_buffer_infos[i].offset = 0;
+            descriptor_buffer_infos[i].range = VK_WHOLE_SIZE;
+
+            write_descriptor_sets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write_descriptor_sets[i].dstSet = lc.descriptor_set;
+            write_descriptor_sets[i].dstBinding = i;
+            write_descriptor_sets[i].dstArrayElement = 0;
+            write_descriptor_sets[i].descriptorCount = 1;
+            write_descriptor_sets[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            write_descriptor_sets[i].pBufferInfo = &descriptor_buffer_infos[i];
+        }
+        write_descriptor_sets[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+        vkUpdateDescriptorSets(_ctx->device, (uint32_t)write_descriptor_sets.size(), write_descriptor_sets.data(), 0, nullptr);
+    }
+
+    //
+    // PARTICLE SORT KEYS
+    //
+    {
+        Log("#      Update Descriptor Set (Particle Sort)\n");
+
+        auto &ps = _particle_sort;
+
+        std::array<VkDescriptorBufferInfo, 7> descriptor_buffer_infos = {};
+        descriptor_buffer_infos[0].buffer = _instance_sets[_particles].instance_buffer.buffer;
+        descriptor_buffer_infos[1].buffer = ps.ubo.buffer;
+        descriptor_buffer_infos[2].buffer = _particle_lifecycle.alive_indices.buffer;
+        descriptor_buffer_infos[3].buffer = _particle_lifecycle.counters.buffer;
+        descriptor_buffer_infos[4].buffer = ps.header.buffer;
+        descriptor_buffer_infos[5].buffer = ps.keys[0].buffer;
+        descriptor_buffer_infos[6].buffer = ps.values[0].buffer;
+
+        std::array<VkWriteDescriptorSet, 7> write_descriptor_sets = {};
+        for (uint32_t i = 0; i < write_descriptor_sets.size(); ++i)
+        {
+            descriptor_buffer_infos[i].offset = 0;
+            descriptor_buffer_infos[i].range = VK_WHOLE_SIZE;
+
+            write_descriptor_sets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write_descriptor_sets[i].dstSet = ps.descriptor_set;
+            write_descriptor_sets[i].dstBinding = i;
+            write_descriptor_sets[i].dstArrayElement = 0;
+            write_descriptor_sets[i].descriptorCount = 1;
+            write_descriptor_sets[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            write_descriptor_sets[i].pBufferInfo = &descriptor_buffer_infos[i];
+        }
+        write_descriptor_sets[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+        vkUpdateDescriptorSets(_ctx->device, (uint32_t)write_descriptor_sets.size(), write_descriptor_sets.data(), 0, nullptr);
+    }
+
+    //
+    // MESHLET CULLING
+    //
+    {
+        Log("#      Update Descriptor Set (Meshlet Culling)\n");
+
+        auto &mc = _meshlet_culling;
+
+        std::array<VkDescriptorBufferInfo, 6> descriptor_buffer_infos = {};
+        descriptor_buffer_infos[0].buffer = mc.gpu_meshlets.buffer;
+        descriptor_buffer_infos[1].buffer = mc.ubo.buffer;
+        descriptor_buffer_infos[2].buffer = _global_object_matrices_ubo.buffer;
+        descriptor_buffer_infos[3].buffer = _global_object_ibo.buffer;
+        descriptor_buffer_infos[4].buffer = mc.culled_indices.buffer;
+        descriptor_buffer_infos[5].buffer = mc.draw_commands.buffer;
+
+        std::array<VkWriteDescriptorSet, 6> write_descriptor_sets = {};
+        for (uint32_t i = 0; i < write_descriptor_sets.size(); ++i)
+        {
+            descriptor_buffer_infos[i].offset = 0;
+            descriptor_buffer_infos[i].range = VK_WHOLE_SIZE;
+
+            write_descriptor_sets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write_descriptor_sets[i].dstSet = mc.descriptor_set;
+            write_descriptor_sets[i].dstBinding = i;
+            write_descriptor_sets[i].dstArrayElement = 0;
+            write_descriptor_sets[i].descriptorCount = 1;
+            write_descriptor_sets[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            write_descriptor_sets[i].pBufferInfo = &descriptor_buffer_infos[i];
+        }
+        write_descriptor_sets[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        write_descriptor_sets[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+        descriptor_buffer_infos[2].range = _global_object_matrices_ubo.size; // one copy
+
+        vkUpdateDescriptorSets(_ctx->device, (uint32_t)write_descriptor_sets.size(), write_descriptor_sets.data(), 0, nullptr);
+    }
+
+    //
+    // DEPTH PYRAMID - LEVEL i READS LEVEL i-1 (OR THE DEPTH), WRITES LEVEL i
+    //
+    for (uint32_t i = 0; i < _depth_pyramid.level_count; ++i)
+    {
+        Log("#      Update Descriptor Set (Depth Pyramid Level)\n");
+
+        std::array<VkDescriptorImageInfo, 2> image_infos = {};
+        image_infos[0].sampler = _depth_pyramid.sampler;
+        image_infos[0].imageView = (i == 0) ? _depth_pyramid.depth_view : _depth_pyramid.level_views[i - 1];
+        image_infos[0].imageLayout = (i == 0) ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+        image_infos[1].sampler = VK_NULL_HANDLE;
+        image_infos[1].imageView = _depth_pyramid.level_views[i];
+        image_infos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        std::array<VkWriteDescriptorSet, 2> write_descriptor_sets = {};
+        for (uint32_t b = 0; b < write_descriptor_sets.size(); ++b)
+        {
+            write_descriptor_sets[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write_descriptor_sets[b].dstSet = _depth_pyramid.descriptor_sets[i];
+            write_descriptor_sets[b].dstBinding = b;
+            write_descriptor_sets[b].dstArrayElement = 0;
+            write_descriptor_sets[b].descriptorCount = 1;
+            write_descriptor_sets[b].pImageInfo = &image_infos[b];
+        }
+        write_descriptor_sets[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        write_descriptor_sets[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+        vkUpdateDescriptorSets(_ctx->device, (uint32_t)write_descriptor_sets.size(), write_descriptor_sets.data(), 0, nullptr);
+    }
+
+    //
+    // NEAR/FAR INSTANCE SETS, SET = 2
+    //
+    for (auto &is : _instance_sets)
+    {
+        Log("#      Update Descriptor Sets (Near/Far Instances)\n");
+
+        std::array<VkDescriptorBufferInfo, 3> descriptor_buffer_infos = {};
+        descriptor_buffer_infos[0].buffer = is.instance_buffer.buffer;
+        descriptor_buffer_infos[1].buffer = is.near_indices.buffer;
+        descriptor_buffer_infos[2].buffer = is.far_indices.buffer;
+        for (auto &info : descriptor_buffer_infos)
+        {
+            info.offset = 0;
+            info.range = VK_WHOLE_SIZE;
+        }
+
+        std::array<VkWriteDescriptorSet, 4> write_descriptor_sets = {};
+        for (auto &w : write_descriptor_sets)
+        {
+            w.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            w.dstArrayElement = 0;
+            w.descriptorCount = 1;
+            w.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        }
+        write_descriptor_sets[0].dstSet = is.near_descriptor_set;
+        write_descriptor_sets[0].dstBinding = 0;
+        write_descriptor_sets[0].pBufferInfo = &descriptor_buffer_infos[0];
+        write_descriptor_sets[1].dstSet = is.near_descriptor_set;
+        write_descriptor_sets[1].dstBinding = 1;
+        write_descriptor_sets[1].pBufferInfo = &descriptor_buffer_infos[1];
+        write_descriptor_sets[2].dstSet = is.far_descriptor_set;
+        write_descriptor_sets[2].dstBinding = 0;
+        write_descriptor_sets[2].pBufferInfo = &descriptor_buffer_infos[0];
+        write_descriptor_sets[3].dstSet = is.far_descriptor_set;
+        write_descriptor_sets[3].dstBinding = 1;
+        write_descriptor_sets[3].pBufferInfo = &descriptor_buffer_infos[2];
+
+        vkUpdateDescriptorSets(_ctx->device, (uint32_t)write_descriptor_sets.size(), write_descriptor_sets.data(), 0, nullptr);
+    }
+
+    //
+    // SORTED PARTICLES, SET = 2: INSTANCE DATA, SORTED VALUES
+    //
+    {
+        Log("#      Update Descriptor Set (Sorted Particles)\n");
+
+        std::array<VkDescriptorBufferInfo, 2> descriptor_buffer_infos = {};
+        descriptor_buffer_infos[0].buffer = _instance_sets[_particles].instance_buffer.buffer;
+        descriptor_buffer_infos[1].buffer = _particle_sort.values[0].buffer;
+
+        std::array<VkWriteDescriptorSet, 2> write_descriptor_sets = {};
+        for (uint32_t i = 0; i < write_descriptor_sets.size(); ++i)
+        {
+            descriptor_buffer_infos[i].offset = 0;
+            descriptor_buffer_infos[i].range = VK_WHOLE_SIZE;
+
+            write_descriptor_sets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write_descriptor_sets[i].dstSet = _particle_sort.draw_descriptor_set;
+            write_descriptor_sets[i].dstBinding = i;
+            write_descriptor_sets[i].dstArrayElement = 0;
+            write_descriptor_sets[i].descriptorCount = 1;
+            write_descriptor_sets[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            write_descriptor_sets[i].pBufferInfo = &descriptor_buffer_infos[i];
+        }
+
+        vkUpdateDescriptorSets(_ctx->device, (uint32_t)write_descriptor_sets.size(), write_descriptor_sets.data(), 0, nullptr);
+    }
+
+
+    // UPDATE ALL AT ONCE
+    //vkUpdateDescriptorSets(_ctx->device, (uint32_t)write_descriptor_sets.size(), write_descriptor_sets.data(), 0, nullptr);
+
+    return true;
+}
+
+bool Scene::compile()
+{
+    auto &is = _instance_sets[_particles];
+
+    Log("#     Create Instance Set SSBO/VBO\n");
+    if (!create_buffer(
+        &is.instance_buffer.buffer,
+        &is.instance_buffer.memory,
+        is.capacity * sizeof(instance_data_t),
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+        return false;
+
+    if (!create_buffer(
+        &is.staging_buffer.buffer,
+        &is.staging_buffer.memory,
+        is.capacity * sizeof(instance_data_t),
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        return false;
+
+    Log("#     Create Instance Set Near/Far Indices and Draw Commands\n");
+    if (!create_buffer(
+        &is.near_indices.buffer,
+        &is.near_indices.memory,
+        is.capacity * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+        return false;
+
+    if (!create_buffer(
+        &is.far_indices.buffer,
+        &is.far_indices.memory,
+        is.capacity * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+        return false;
+
+    if (!create_buffer(
+        &is.draw_commands.buffer,
+        &is.draw_commands.memory,
+        sizeof(_instance_draw_commands_t),
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+        return false;
+
+    _particle_lifecycle.capacity = is.capacity;
+    if (!create_particle_lifecycle_buffers())
+        return false;
+
+    if (!create_particle_sort_buffers())
+        return false;
+
+    // initial fill of buffer
+    uint32_t instance_count = is.capacity;
+    size_t instance_data_size = instance_count * sizeof(instance_data_t);
+    copy_data_to_staging_buffer(is.staging_buffer, is.instance_data.data(), instance_data_size, false);
+    copy_buffer_to_buffer(is.staging_buffer.buffer, is.instance_buffer.buffer, instance_data_size, 0, 0);
+
+    // the CPU simulation only needs the jitters.
+    static_assert(sizeof(instance_data_t) == sizeof(ParticleSimulator::particle_t), "CPU particles must match the instance data");
+    _cpu_particles.simulator.set_particles((const ParticleSimulator::particle_t*)is.instance_data.data(), instance_count);
+
+    // clear simulation instance data.
+    _instance_sets[_particles].instance_data.clear();
+
+
+    if (_ctx->bindless)
+    {
+        Log("#     Create Bindless Material Set\n");
+        if (!create_bindless_set())
+            return false;
+    }
+
+    // All descriptor sets, for all objects/instance_set
+    Log("#     Create Scene and global object Descriptor Ses\n");
+    if (!create_all_descriptor_sets())
+        return false;
+
+    Log("#     Create Global Object Draw Commands\n");
+    if (!create_buffer(
+        &_global_draw_commands.buffer,
+        &_global_draw_commands.memory,
+        MAX_NB_OBJECTS * sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        return false;
+
+    if (!build_global_draw_commands())
+        return false;
+
+
+    return true;
+}
+
+bool Scene::build_pipelines(VkRenderPass rp)
+{
+    VkResult result;
+
+    _default_pipeline = _pipelines.insert("default", _pipeline_t());
+    _pipeline_t &default_pipeline = _pipelines[_default_pipeline];
+
+    {
+        std::array<VkDescriptorSetLayout, 3> pipeline_descriptor_set_layouts = {
+            _descriptor_set_layouts[SCENE_DESCRIPTOR_SET_LAYOUT], // scene ubo
+            _descriptor_set_layouts[MATERIAL_DESCRIPTOR_SET_LAYOUT], // sampler
+            _descriptor_set_layouts[OBJECT_DESCRIPTOR_SET_LAYOUT]  // material override per object ubo
+        };
+
+        // use it later to define uniform buffer
+        VkPipelineLayoutCreateInfo layout_create_info = {};
+        layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layout_create_info.setLayoutCount = (uint32_t)pipeline_descriptor_set_layouts.size();
+        layout_create_info.pSetLayouts = pipeline_descriptor_set_layouts.data();
+        layout_create_info.pushConstantRangeCount = 0;
+        layout_create_info.pPushConstantRanges = nullptr; // constant into shader for opti???
+
+        Log("#     Create Default Pipeline Layout\n");
+        result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &default_pipeline.pipeline_layout);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    Log("#     Create Default Vertex Shader\n");
+    if (!create_shader_module("./data/simple.vert.spv", &default_pipeline.vs))
+        return false;
+
+    Log("#     Create Default Fragment Shader\n");
+    if (!create_shader_module("./data/simple.frag.spv", &default_pipeline.fs))
+        return false;
+
+    std::array<VkPipelineShaderStageCreateInfo, 2> shader_stage_create_infos = {
+        vk::init::pipeline::shader_stage_create_info(default_pipeline.vs, VK_SHADER_STAGE_VERTEX_BIT),
+        vk::init::pipeline::shader_stage_create_info(default_pipeline.fs, VK_SHADER_STAGE_FRAGMENT_BIT)
+    };
+
+    VkPipelineVertexInputStateCreateInfo vertex_input_state_create_info = {};
+    vertex_input_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertex_input_state_create_info.vertexBindingDescriptionCount = vertex_t::binding_description_count();
+    vertex_input_state_create_info.pVertexBindingDescriptions = vertex_t::binding_descriptions();
+    vertex_input_state_create_info.vertexAttributeDescriptionCount = vertex_t::attribute_description_count();
+    vertex_input_state_create_info.pVertexAttributeDescriptions = vertex_t::attribute_descriptions();
+
+    // vertex topology config = triangles
+    VkPipelineInputAssemblyStateCreateInfo input_assembly_state_create_info = {};
+    input_assembly_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    input_assembly_state_create_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    input_assembly_state_create_info.primitiveRestartEnable = VK_FALSE;
+
+    VkViewport viewport = vk::init::pipeline::viewport(); // dynamic, will set the correct size later.
+
+    VkRect2D scissors = {};
+    scissors.offset = { 0, 0 };
+    scissors.extent = { 512, 512 };
+
+    VkPipelineViewportStateCreateInfo viewport_state_create_info = {};
+    viewport_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport_state_create_info.viewportCount = 1;
+    viewport_state_create_info.pViewports = &viewport;
+    viewport_state_create_info.scissorCount = 1;
+    viewport_state_create_info.pScissors = &scissors;
+
+    VkPipelineRasterizationStateCreateInfo raster_state_create_info = vk::init::pipeline::raster_state_create_info();
+    raster_state_create_info.polygonMode = VK_POLYGON_MODE_FILL; //VK_POLYGON_MODE_LINE;
+    raster_state_create_info.cullMode = VK_CULL_MODE_NONE;// VK_CULL_MODE_BACK_BIT;
+    raster_state_create_info.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+    VkPipelineMultisampleStateCreateInfo multisample_state_create_info = vk::init::pipeline::multisample_state_create_info_NO_MSAA();
+
+    VkPipelineDepthStencilStateCreateInfo depth_stencil_state_create_info = vk::init::pipeline::depth_stencil_state_create_info();
+
+    VkPipelineColorBlendAttachmentState color_blend_attachment_state = vk::init::pipeline::color_blend_attachment_state_NO_BLEND();
+
+    VkPipelineColorBlendStateCreateInfo color_blend_state_create_info = vk::init::pipeline::color_blend_state_create_info();
+    color_blend_state_create_info.attachmentCount = 1;
+    color_blend_state_create_info.pAttachments = &color_blend_attachment_state;
+
+    std::array<VkDynamicState, 2> dynamic_state = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamic_state_create_info = {};
+    dynamic_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamic_state_create_info.dynamicStateCount = (uint32_t)dynamic_state.size();
+    dynamic_state_create_info.pDynamicStates = dynamic_state.data();
+
+    VkGraphicsPipelineCreateInfo pipeline_create_info = {};
+    pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_create_info.stageCount = (uint32_t)shader_stage_create_infos.size();
+    pipeline_create_info.pStages = shader_stage_create_infos.data();
+    pipeline_create_info.pVertexInputState = &vertex_input_state_create_info;
+    pipeline_create_info.pInputAssemblyState = &input_assembly_state_create_info;
+    pipeline_create_info.pTessellationState = nullptr;
+    pipeline_create_info.pViewportState = &viewport_state_create_info;
+    pipeline_create_info.pRasterizationState = &raster_state_create_info;
+    pipeline_create_info.pMultisampleState = &multisample_state_create_info;
+    pipeline_create_info.pDepthStencilState = &depth_stencil_state_create_info;
+    pipeline_create_info.pColorBlendState = &color_blend_state_create_info;
+    pipeline_create_info.pDynamicState = &dynamic_state_create_info;
+    pipeline_create_info.layout = default_pipeline.pipeline_layout;
+    pipeline_create_info.renderPass = rp; // TODO: create a render pass inside Scene
+    pipeline_create_info.subpass = 0;
+    pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE; // only if VK_PIPELINE_CREATE_DERIVATIVE flag is set.
+    pipeline_create_info.basePipelineIndex = 0;
+
+    Log("#     Create Default Pipeline\n");
+    result = vkCreateGraphicsPipelines(
+        _ctx->device,
+        VK_NULL_HANDLE, // cache
+        1,
+        &pipeline_create_info,
+        nullptr,
+        &default_pipeline.pipeline);
+    ErrorCheck(result);
+    if (result != VK_SUCCESS)
+        return false;
+
+
+    //
+    // Pipeline for instancing.
+    //
+
+    // The 4 instance pipeline layouts share sets 0 and 1 and the push constant
+    // range, so that the scene and bindless sets are bound once for all of them.
+    // Without descriptor indexing, set 1 is the material of each instance set.
+    VkDescriptorSetLayout instance_material_set_layout = _ctx->bindless
+        ? _descriptor_set_layouts[BINDLESS_DESCRIPTOR_SET_LAYOUT]  // material table + textures
+        : _descriptor_set_layouts[MATERIAL_DESCRIPTOR_SET_LAYOUT]; // base + spec textures
+    const char *instancing_fs_path = _ctx->bindless ? "./data/instancing.frag.spv" : "./data/instancing_sets.frag.spv";
+    const char *impostor_fs_path = _ctx->bindless ? "./data/impostor.frag.spv" : "./data/impostor_sets.frag.spv";
+    VkPushConstantRange instance_push_constant_range = {};
+    instance_push_constant_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    instance_push_constant_range.offset = 0;
+    instance_push_constant_range.size = sizeof(float); // bounding radius of the impostors, opacity of the sorted particles
+
+    {
+        std::array<VkDescriptorSetLayout, 2> pipeline_descriptor_set_layouts = {
+            _descriptor_set_layouts[SCENE_DESCRIPTOR_SET_LAYOUT], // scene ubo
+            instance_material_set_layout
+        };
+
+        // use it later to define uniform buffer
+        VkPipelineLayoutCreateInfo layout_create_info = {};
+        layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layout_create_info.setLayoutCount = (uint32_t)pipeline_descriptor_set_layouts.size();
+        layout_create_info.pSetLayouts = pipeline_descriptor_set_layouts.data();
+        layout_create_info.pushConstantRangeCount = 1;
+        layout_create_info.pPushConstantRanges = &instance_push_constant_range;
+
+        Log("#     Create Instancing Pipeline Layout\n");
+        result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &_instance_pipe.pipeline_layout);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    Log("#     Create Instancing Vertex Shader\n");
+    if (!create_shader_module("./data/instancing.vert.spv", &_instance_pipe.vs))
+        return false;
+
+    Log("#     Create Instancing Fragment Shader\n");
+    if (!create_shader_module(instancing_fs_path, &_instance_pipe.fs))
+        return false;
+
+    shader_stage_create_infos[0].module = _instance_pipe.vs;
+    shader_stage_create_infos[1].module = _instance_pipe.fs;
+
+    {
+        VkPipelineVertexInputStateCreateInfo vertex_input_state_create_info = {};
+        vertex_input_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertex_input_state_create_info.vertexBindingDescriptionCount = instance_data_t::binding_description_count();
+        vertex_input_state_create_info.pVertexBindingDescriptions = instance_data_t::binding_descriptions();
+        vertex_input_state_create_info.vertexAttributeDescriptionCount = instance_data_t::attribute_description_count();
+        vertex_input_state_create_info.pVertexAttributeDescriptions = instance_data_t::attribute_descriptions();
+
+        VkGraphicsPipelineCreateInfo pipeline_create_info = {};
+        pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipeline_create_info.stageCount = (uint32_t)shader_stage_create_infos.size();
+        pipeline_create_info.pStages = shader_stage_create_infos.data(); // <-- instancing shaders
+        pipeline_create_info.pVertexInputState = &vertex_input_state_create_info; // <--- instancing 2 vertex buffers (vertex and instance data)
+        pipeline_create_info.pInputAssemblyState = &input_assembly_state_create_info;
+        pipeline_create_info.pTessellationState = nullptr;
+        pipeline_create_info.pViewportState = &viewport_state_create_info;
+        pipeline_create_info.pRasterizationState = &raster_state_create_info;
+        pipeline_create_info.pMultisampleState = &multisample_state_create_info;
+        pipeline_create_info.pDepthStencilState = &depth_stencil_state_create_info;
+        pipeline_create_info.pColorBlendState = &color_blend_state_create_info;
+        pipeline_create_info.pDynamicState = &dynamic_state_create_info;
+        pipeline_create_info.layout = _instance_pipe.pipeline_layout; // <--- instancing pipe layout
+        pipeline_create_info.renderPass = rp;
+        pipeline_create_info.subpass = 0;
+        pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+        pipeline_create_info.basePipelineIndex = 0;
+
+        Log("#     Create Instancing Pipeline\n");
+        result = vkCreateGraphicsPipelines(
+            _ctx->device,
+            VK_NULL_HANDLE, // cache
+            1,
+            &pipeline_create_info,
+            nullptr,
+            &_instance_pipe.pipeline);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // COMPUTE PARRTICLES
+    //
+
+    {
+        VkDescriptorSetLayout compute_pipeline_descriptor_set_layout = 
+            _descriptor_set_layouts[COMPUTE_DESCRIPTOR_SET_LAYOUT];
+
+        VkPipelineLayoutCreateInfo layout_create_info = {};
+        layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layout_create_info.setLayoutCount = 1;
+        layout_create_info.pSetLayouts = &compute_pipeline_descriptor_set_layout;
+        layout_create_info.pushConstantRangeCount = 0;
+        layout_create_info.pPushConstantRanges = nullptr;
+
+        Log("#     Create Compute Pipeline Layout\n");
+        result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &compute_particles.pipe.pipeline_layout);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+
+        Log("#     Create Particles Compute Shader\n");
+        if (!create_shader_module("./data/particles.comp.spv", &compute_particles.pipe.cs))
+            return false;
+
+        VkPipelineShaderStageCreateInfo compute_shader_stage_create_info =
+            vk::init::pipeline::shader_stage_create_info(compute_particles.pipe.cs, VK_SHADER_STAGE_COMPUTE_BIT);
+
+        VkComputePipelineCreateInfo compute_pipeline_create_info = {};
+        compute_pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        compute_pipeline_create_info.stage = compute_shader_stage_create_info;
+        compute_pipeline_create_info.layout = compute_particles.pipe.pipeline_layout;
+        compute_pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+        compute_pipeline_create_info.basePipelineIndex = 0;
+
+        Log("#     Create Instancing Pipeline\n");
+        result = vkCreateComputePipelines(
+            _ctx->device,
+            VK_NULL_HANDLE, // cache
+            1,
+            &compute_pipeline_create_info,
+            nullptr,
+            &compute_particles.pipe.pipeline);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // Pipeline for indirect instancing: instance data is fetched from
+    // an SSBO through the near list, only the mesh vertex buffer is bound.
+    //
+
+    {
+        std::array<VkDescriptorSetLayout, 3> pipeline_descriptor_set_layouts = {
+            _descriptor_set_layouts[SCENE_DESCRIPTOR_SET_LAYOUT], // scene ubo
+            instance_material_set_layout,
+            _descriptor_set_layouts[INSTANCE_DESCRIPTOR_SET_LAYOUT]  // instance data + near indices
+        };
+
+        VkPipelineLayoutCreateInfo layout_create_info = {};
+        layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layout_create_info.setLayoutCount = (uint32_t)pipeline_descriptor_set_layouts.size();
+        layout_create_info.pSetLayouts = pipeline_descriptor_set_layouts.data();
+        layout_create_info.pushConstantRangeCount = 1;
+        layout_create_info.pPushConstantRanges = &instance_push_constant_range;
+
+        Log("#     Create Indirect Instancing Pipeline Layout\n");
+        result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &_instance_indirect_pipe.pipeline_layout);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    Log("#     Create Indirect Instancing Vertex Shader\n");
+    if (!create_shader_module("./data/instancing_indirect.vert.spv", &_instance_indirect_pipe.vs))
+        return false;
+
+    Log("#     Create Indirect Instancing Fragment Shader\n");
+    if (!create_shader_module(instancing_fs_path, &_instance_indirect_pipe.fs))
+        return false;
+
+    shader_stage_create_infos[0].module = _instance_indirect_pipe.vs;
+    shader_stage_create_infos[1].module = _instance_indirect_pipe.fs;
+
+    {
+        pipeline_create_info.pVertexInputState = &vertex_input_state_create_info; // vertex_t only
+        pipeline_create_info.layout = _instance_indirect_pipe.pipeline_layout;
 
-            Log("#      Update Descriptor Set for Material Instance [n] SPEC TEX\n");
-            //write_descriptor_sets.push_back(write_descriptor_set);
-            vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
-        }
+        Log("#     Create Indirect Instancing Pipeline\n");
+        result = vkCreateGraphicsPipelines(
+            _ctx->device,
+            VK_NULL_HANDLE, // cache
+            1,
+            &pipeline_create_info,
+            nullptr,
+            &_instance_indirect_pipe.pipeline);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
     }
 
     //
-    // DYNAMIC GLOBAL OBJECT UBOs, SET = 2
+    // Pipeline for the sorted particles: same as the indirect one, through
+    // the back to front list, blended, depth tested but not written.
     //
 
-    // MATRICES UBO = 0
     {
-        VkDescriptorBufferInfo descriptor_buffer_info = {};
-        descriptor_buffer_info.buffer = _global_object_matrices_ubo.buffer;
-        descriptor_buffer_info.offset = 0;
-        descriptor_buffer_info.range = VK_WHOLE_SIZE;
+        std::array<VkDescriptorSetLayout, 3> pipeline_descriptor_set_layouts = {
+            _descriptor_set_layouts[SCENE_DESCRIPTOR_SET_LAYOUT], // scene ubo
+            instance_material_set_layout,
+            _descriptor_set_layouts[INSTANCE_DESCRIPTOR_SET_LAYOUT]  // instance data + sorted indices
+        };
 
-        VkWriteDescriptorSet write_descriptor_set = {};
-        write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        write_descriptor_set.dstSet = _global_objects_descriptor_set;
-        write_descriptor_set.dstBinding = 0;
-        write_descriptor_set.dstArrayElement = 0;
-        write_descriptor_set.descriptorCount = 1;
-        write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-        write_descriptor_set.pImageInfo = nullptr;
-        write_descriptor_set.pBufferInfo = &descriptor_buffer_info;
-        write_descriptor_set.pTexelBufferView = nullptr;
+        VkPipelineLayoutCreateInfo layout_create_info = {};
+        layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layout_create_info.setLayoutCount = (uint32_t)pipeline_descriptor_set_layouts.size();
+        layout_create_info.pSetLayouts = pipeline_descriptor_set_layouts.data();
+        layout_create_info.pushConstantRangeCount = 1;
+        layout_create_info.pPushConstantRanges = &instance_push_constant_range;
 
-        Log("#      Update Descriptor Set (Object Matrices UBO)\n");
-        //write_descriptor_sets.push_back(write_descriptor_set);
-        vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
+        Log("#     Create Sorted Instancing Pipeline Layout\n");
+        result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &_instance_sorted_pipe.pipeline_layout);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
     }
 
-    // MATERIALS UBO = 1
-    {
-        VkDescriptorBufferInfo descriptor_buffer_info = {};
-        descriptor_buffer_info.buffer = _global_object_material_ubo.buffer;
-        descriptor_buffer_info.offset = 0;
-        descriptor_buffer_info.range = VK_WHOLE_SIZE;
+    Log("#     Create Sorted Instancing Vertex Shader\n");
+    if (!create_shader_module("./data/instancing_sorted.vert.spv", &_instance_sorted_pipe.vs))
+        return false;
 
-        VkWriteDescriptorSet write_descriptor_set = {};
-        write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        write_descriptor_set.dstSet = _global_objects_descriptor_set;
-        write_descriptor_set.dstBinding = 1;
-        write_descriptor_set.dstArrayElement = 0;
-        write_descriptor_set.descriptorCount = 1;
-        write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-        write_descriptor_set.pImageInfo = nullptr;
-        write_descriptor_set.pBufferInfo = &descriptor_buffer_info;
-        write_descriptor_set.pTexelBufferView = nullptr;
+    Log("#     Create Sorted Instancing Fragment Shader\n");
+    if (!create_shader_module(instancing_fs_path, &_instance_sorted_pipe.fs))
+        return false;
 
-        Log("#      Update Descriptor Set (Object Materials UBO)\n");
-        //write_descriptor_sets.push_back(write_descriptor_set);
-        vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
-    }
+    shader_stage_create_infos[0].module = _instance_sorted_pipe.vs;
+    shader_stage_create_infos[1].module = _instance_sorted_pipe.fs;
 
-    //
-    // COMPUTE - PER INSTANCE SSBO = 0
-    //
     {
-        Log("#      Update Descriptor Set (Per-Instance SSBO)\n");
+        VkPipelineDepthStencilStateCreateInfo blended_depth_stencil_state_create_info = vk::init::pipeline::depth_stencil_state_create_info();
+        blended_depth_stencil_state_create_info.depthWriteEnable = VK_FALSE;
 
-        VkDescriptorBufferInfo descriptor_buffer_info = {};
-        descriptor_buffer_info.buffer = _instance_sets["particles"].instance_buffer.buffer;
-        descriptor_buffer_info.offset = 0;
-        descriptor_buffer_info.range = VK_WHOLE_SIZE;
+        VkPipelineColorBlendAttachmentState blended_color_blend_attachment_state = vk::init::pipeline::color_blend_attachment_state_ALPHA_BLEND();
+        VkPipelineColorBlendStateCreateInfo blended_color_blend_state_create_info = vk::init::pipeline::color_blend_state_create_info();
+        blended_color_blend_state_create_info.attachmentCount = 1;
+        blended_color_blend_state_create_info.pAttachments = &blended_color_blend_attachment_state;
 
-        VkWriteDescriptorSet write_descriptor_set = {};
-        write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        write_descriptor_set.dstSet = compute_particles.descriptor_set;
-        write_descriptor_set.dstBinding = 0;
-        write_descriptor_set.dstArrayElement = 0;
-        write_descriptor_set.descriptorCount = 1;
-        write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        write_descriptor_set.pImageInfo = nullptr;
-        write_descriptor_set.pBufferInfo = &descriptor_buffer_info;
-        write_descriptor_set.pTexelBufferView = nullptr;
+        VkGraphicsPipelineCreateInfo blended_pipeline_create_info = pipeline_create_info;
+        blended_pipeline_create_info.pVertexInputState = &vertex_input_state_create_info; // vertex_t only
+        blended_pipeline_create_info.pDepthStencilState = &blended_depth_stencil_state_create_info;
+        blended_pipeline_create_info.pColorBlendState = &blended_color_blend_state_create_info;
+        blended_pipeline_create_info.layout = _instance_sorted_pipe.pipeline_layout;
 
-        //write_descriptor_sets.push_back(write_descriptor_set);
-        vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
+        Log("#     Create Sorted Instancing Pipeline\n");
+        result = vkCreateGraphicsPipelines(
+            _ctx->device,
+            VK_NULL_HANDLE, // cache
+            1,
+            &blended_pipeline_create_info,
+            nullptr,
+            &_instance_sorted_pipe.pipeline);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
     }
 
     //
-    // COMPUTE - SIMULATION DATA UBO = 1
+    // Pipeline for sphere impostors: one quad per far instance, no vertex buffer.
     //
-    {
-        Log("#      Update Descriptor Set (Per-Instance SSBO)\n");
 
-        VkDescriptorBufferInfo descriptor_buffer_info = {};
-        descriptor_buffer_info.buffer = compute_particles.ubo.buffer;
-        descriptor_buffer_info.offset = 0;
-        descriptor_buffer_info.range = VK_WHOLE_SIZE;
+    {
+        std::array<VkDescriptorSetLayout, 3> pipeline_descriptor_set_layouts = {
+            _descriptor_set_layouts[SCENE_DESCRIPTOR_SET_LAYOUT], // scene ubo
+            instance_material_set_layout,
+            _descriptor_set_layouts[INSTANCE_DESCRIPTOR_SET_LAYOUT]  // instance data + far indices
+        };
 
-        VkWriteDescriptorSet write_descriptor_set = {};
-        write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        write_descriptor_set.dstSet = compute_particles.descriptor_set;
-        write_descriptor_set.dstBinding = 1;
-        write_descriptor_set.dstArrayElement = 0;
-        write_descriptor_set.descriptorCount = 1;
-        write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        write_descriptor_set.pImageInfo = nullptr;
-        write_descriptor_set.pBufferInfo = &descriptor_buffer_info;
-        write_descriptor_set.pTexelBufferView = nullptr;
+        VkPipelineLayoutCreateInfo layout_create_info = {};
+        layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layout_create_info.setLayoutCount = (uint32_t)pipeline_descriptor_set_layouts.size();
+        layout_create_info.pSetLayouts = pipeline_descriptor_set_layouts.data();
+        layout_create_info.pushConstantRangeCount = 1;
+        layout_create_info.pPushConstantRanges = &instance_push_constant_range;
 
-        vkUpdateDescriptorSets(_ctx->device, 1, &write_descriptor_set, 0, nullptr);
+        Log("#     Create Impostor Pipeline Layout\n");
+        result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &_impostor_pipe.pipeline_layout);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
     }
 
-
-    // UPDATE ALL AT ONCE
-    //vkUpdateDescriptorSets(_ctx->device, (uint32_t)write_descriptor_sets.size(), write_descriptor_sets.data(), 0, nullptr);
-
-    return true;
-}
-
-bool Scene::compile()
-{
-    auto &is = _instance_sets["particles"];
-
-    Log("#     Create Instance Set SSBO/VBO\n");
-    if (!create_buffer(
-        &is.instance_buffer.buffer,
-        &is.instance_buffer.memory,
-        MAX_INSTANCE_COUNT * sizeof(instance_data_t),
-        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+    Log("#     Create Impostor Vertex Shader\n");
+    if (!create_shader_module("./data/impostor.vert.spv", &_impostor_pipe.vs))
         return false;
 
-    if (!create_buffer(
-        &is.staging_buffer.buffer,
-        &is.staging_buffer.memory,
-        MAX_INSTANCE_COUNT * sizeof(instance_data_t),
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+    Log("#     Create Impostor Fragment Shader\n");
+    if (!create_shader_module(impostor_fs_path, &_impostor_pipe.fs))
         return false;
 
-    // initial fill of buffer
-    uint32_t instance_count = MAX_INSTANCE_COUNT;
-    size_t instance_data_size = instance_count * sizeof(instance_data_t);
-    copy_data_to_staging_buffer(is.staging_buffer, is.instance_data.data(), instance_data_size, false);
-    copy_buffer_to_buffer(is.staging_buffer.buffer, is.instance_buffer.buffer, instance_data_size, 0, 0);
-
-    // clear simulation instance data.
-    _instance_sets["particles"].instance_data.clear();
-
-
-    // All descriptor sets, for all objects/instance_set
-    Log("#     Create Scene and global object Descriptor Ses\n");
-    if (!create_all_descriptor_sets())
-        return false;
+    shader_stage_create_infos[0].module = _impostor_pipe.vs;
+    shader_stage_create_infos[1].module = _impostor_pipe.fs;
 
+    {
+        VkPipelineVertexInputStateCreateInfo empty_vertex_input_state_create_info = {};
+        empty_vertex_input_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-    return true;
-}
+        pipeline_create_info.pVertexInputState = &empty_vertex_input_state_create_info;
+        pipeline_create_info.layout = _impostor_pipe.pipeline_layout;
 
-bool Scene::build_pipelines(VkRenderPass rp)
-{
-    VkResult result;
+        Log("#     Create Impostor Pipeline\n");
+        result = vkCreateGraphicsPipelines(
+            _ctx->device,
+            VK_NULL_HANDLE, // cache
+            1,
+            &pipeline_create_info,
+            nullptr,
+            &_impostor_pipe.pipeline);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
 
-    _pipeline_t &default_pipeline = _pipelines["default"];
+    //
+    // CLASSIFY PARTICLES (near mesh / far impostor)
+    //
 
     {
-        std::array<VkDescriptorSetLayout, 3> pipeline_descriptor_set_layouts = {
-            _descriptor_set_layouts[SCENE_DESCRIPTOR_SET_LAYOUT], // scene ubo
-            _descriptor_set_layouts[MATERIAL_DESCRIPTOR_SET_LAYOUT], // sampler
-            _descriptor_set_layouts[OBJECT_DESCRIPTOR_SET_LAYOUT]  // material override per object ubo
-        };
+        VkDescriptorSetLayout classify_pipeline_descriptor_set_layout =
+            _descriptor_set_layouts[CLASSIFY_DESCRIPTOR_SET_LAYOUT];
 
-        // use it later to define uniform buffer
         VkPipelineLayoutCreateInfo layout_create_info = {};
         layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        layout_create_info.setLayoutCount = (uint32_t)pipeline_descriptor_set_layouts.size();
-        layout_create_info.pSetLayouts = pipeline_descriptor_set_layouts.data();
+        layout_create_info.setLayoutCount = 1;
+        layout_create_info.pSetLayouts = &classify_pipeline_descriptor_set_layout;
         layout_create_info.pushConstantRangeCount = 0;
-        layout_create_info.pPushConstantRanges = nullptr; // constant into shader for opti???
+        layout_create_info.pPushConstantRanges = nullptr;
 
-        Log("#     Create Default Pipeline Layout\n");
-        result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &default_pipeline.pipeline_layout);
+        Log("#     Create Classify Pipeline Layout\n");
+        result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &classify_particles.pipe.pipeline_layout);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+
+        Log("#     Create Classify Compute Shader\n");
+        if (!create_shader_module("./data/particles_classify.comp.spv", &classify_particles.pipe.cs))
+            return false;
+
+        VkComputePipelineCreateInfo compute_pipeline_create_info = {};
+        compute_pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        compute_pipeline_create_info.stage =
+            vk::init::pipeline::shader_stage_create_info(classify_particles.pipe.cs, VK_SHADER_STAGE_COMPUTE_BIT);
+        compute_pipeline_create_info.layout = classify_particles.pipe.pipeline_layout;
+        compute_pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+        compute_pipeline_create_info.basePipelineIndex = 0;
+
+        Log("#     Create Classify Pipeline\n");
+        result = vkCreateComputePipelines(
+            _ctx->device,
+            VK_NULL_HANDLE, // cache
+            1,
+            &compute_pipeline_create_info,
+            nullptr,
+            &classify_particles.pipe.pipeline);
         ErrorCheck(result);
         if (result != VK_SUCCESS)
             return false;
     }
 
-    Log("#     Create Default Vertex Shader\n");
-    if (!create_shader_module("./data/simple.vert.spv", &default_pipeline.vs))
-        return false;
+    //
+    // PARTICLE LIFECYCLE (emit, update, compact), same descriptor set
+    //
 
-    Log("#     Create Default Fragment Shader\n");
-    if (!create_shader_module("./data/simple.frag.spv", &default_pipeline.fs))
-        return false;
+    {
+        VkDescriptorSetLayout lifecycle_pipeline_descriptor_set_layout =
+            _descriptor_set_layouts[LIFECYCLE_DESCRIPTOR_SET_LAYOUT];
 
-    std::array<VkPipelineShaderStageCreateInfo, 2> shader_stage_create_infos = {
-        vk::init::pipeline::shader_stage_create_info(default_pipeline.vs, VK_SHADER_STAGE_VERTEX_BIT),
-        vk::init::pipeline::shader_stage_create_info(default_pipeline.fs, VK_SHADER_STAGE_FRAGMENT_BIT)
-    };
+        auto &lc = _particle_lifecycle;
+        const std::array<std::pair<_compute_pipeline_t*, const char*>, 3> lifecycle_pipes = { {
+            { &lc.emit_pipe, "./data/particles_emit.comp.spv" },
+            { &lc.update_pipe, "./data/particles_update.comp.spv" },
+            { &lc.compact_pipe, "./data/particles_compact.comp.spv" },
+        } };
 
-    VkPipelineVertexInputStateCreateInfo vertex_input_state_create_info = {};
-    vertex_input_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertex_input_state_create_info.vertexBindingDescriptionCount = vertex_t::binding_description_count();
-    vertex_input_state_create_info.pVertexBindingDescriptions = vertex_t::binding_descriptions();
-    vertex_input_state_create_info.vertexAttributeDescriptionCount = vertex_t::attribute_description_count();
-    vertex_input_state_create_info.pVertexAttributeDescriptions = vertex_t::attribute_descriptions();
+        for (const auto &lp : lifecycle_pipes)
+        {
+            _compute_pipeline_t *pipe = lp.first;
+
+            VkPipelineLayoutCreateInfo layout_create_info = {};
+            layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            layout_create_info.setLayoutCount = 1;
+            layout_create_info.pSetLayouts = &lifecycle_pipeline_descriptor_set_layout;
+            layout_create_info.pushConstantRangeCount = 0;
+            layout_create_info.pPushConstantRanges = nullptr;
+
+            Log("#     Create Particle Lifecycle Pipeline Layout\n");
+            result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &pipe->pipeline_layout);
+            ErrorCheck(result);
+            if (result != VK_SUCCESS)
+                return false;
+
+            Log(std::string("#     Create Particle Lifecycle Compute Shader ") + lp.second + "\n");
+            if (!create_shader_module(lp.second, &pipe->cs))
+                return false;
+
+            VkComputePipelineCreateInfo compute_pipeline_create_info = {};
+            compute_pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+            compute_pipeline_create_info.stage =
+                vk::init::pipeline::shader_stage_create_info(pipe->cs, VK_SHADER_STAGE_COMPUTE_BIT);
+            compute_pipeline_create_info.layout = pipe->pipeline_layout;
+            compute_pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+            compute_pipeline_create_info.basePipelineIndex = 0;
+
+            Log("#     Create Particle Lifecycle Pipeline\n");
+            result = vkCreateComputePipelines(
+                _ctx->device,
+                VK_NULL_HANDLE, // cache
+                1,
+                &compute_pipeline_create_info,
+                nullptr,
+                &pipe->pipeline);
+            ErrorCheck(result);
+            if (result != VK_SUCCESS)
+                return false;
+        }
+    }
 
-    // vertex topology config = triangles
-    VkPipelineInputAssemblyStateCreateInfo input_assembly_state_create_info = {};
-    input_assembly_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    input_assembly_state_create_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    input_assembly_state_create_info.primitiveRestartEnable = VK_FALSE;
+    //
+    // PARTICLE SORT KEYS, the sort itself is in _primitives
+    //
 
-    VkViewport viewport = vk::init::pipeline::viewport(); // dynamic, will set the correct size later.
+    {
+        VkDescriptorSetLayout sort_pipeline_descriptor_set_layout =
+            _descriptor_set_layouts[SORT_DESCRIPTOR_SET_LAYOUT];
 
-    VkRect2D scissors = {};
-    scissors.offset = { 0, 0 };
-    scissors.extent = { 512, 512 };
+        auto &pipe = _particle_sort.keys_pipe;
 
-    VkPipelineViewportStateCreateInfo viewport_state_create_info = {};
-    viewport_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewport_state_create_info.viewportCount = 1;
-    viewport_state_create_info.pViewports = &viewport;
-    viewport_state_create_info.scissorCount = 1;
-    viewport_state_create_info.pScissors = &scissors;
+        VkPipelineLayoutCreateInfo layout_create_info = {};
+        layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layout_create_info.setLayoutCount = 1;
+        layout_create_info.pSetLayouts = &sort_pipeline_descriptor_set_layout;
+        layout_create_info.pushConstantRangeCount = 0;
+        layout_create_info.pPushConstantRanges = nullptr;
 
-    VkPipelineRasterizationStateCreateInfo raster_state_create_info = vk::init::pipeline::raster_state_create_info();
-    raster_state_create_info.polygonMode = VK_POLYGON_MODE_FILL; //VK_POLYGON_MODE_LINE;
-    raster_state_create_info.cullMode = VK_CULL_MODE_NONE;// VK_CULL_MODE_BACK_BIT;
-    raster_state_create_info.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        Log("#     Create Particle Sort Pipeline Layout\n");
+        result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &pipe.pipeline_layout);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+
+        Log("#     Create Particle Sort Keys Compute Shader\n");
+        if (!create_shader_module("./data/sort_keys.comp.spv", &pipe.cs))
+            return false;
+
+        VkComputePipelineCreateInfo compute_pipeline_create_info = {};
+        compute_pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        compute_pipeline_create_info.stage =
+            vk::init::pipeline::shader_stage_create_info(pipe.cs, VK_SHADER_STAGE_COMPUTE_BIT);
+        compute_pipeline_create_info.layout = pipe.pipeline_layout;
+        compute_pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+        compute_pipeline_create_info.basePipelineIndex = 0;
+
+        Log("#     Create Particle Sort Keys Pipeline\n");
+        result = vkCreateComputePipelines(
+            _ctx->device,
+            VK_NULL_HANDLE, // cache
+            1,
+            &compute_pipeline_create_info,
+            nullptr,
+            &pipe.pipeline);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
 
-    VkPipelineMultisampleStateCreateInfo multisample_state_create_info = vk::init::pipeline::multisample_state_create_info_NO_MSAA();
+    //
+    // MESHLET CULLING
+    //
 
-    VkPipelineDepthStencilStateCreateInfo depth_stencil_state_create_info = vk::init::pipeline::depth_stencil_state_create_info();
+    {
+        VkDescriptorSetLayout meshlet_pipeline_descriptor_set_layout =
+            _descriptor_set_layouts[MESHLET_DESCRIPTOR_SET_LAYOUT];
 
-    VkPipelineColorBlendAttachmentState color_blend_attachment_state = vk::init::pipeline::color_blend_attachment_state_NO_BLEND();
+        auto &pipe = _meshlet_culling.pipe;
 
-    VkPipelineColorBlendStateCreateInfo color_blend_state_create_info = vk::init::pipeline::color_blend_state_create_info();
-    color_blend_state_create_info.attachmentCount = 1;
-    color_blend_state_create_info.pAttachments = &color_blend_attachment_state;
+        VkPipelineLayoutCreateInfo layout_create_info = {};
+        layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layout_create_info.setLayoutCount = 1;
+        layout_create_info.pSetLayouts = &meshlet_pipeline_descriptor_set_layout;
+        layout_create_info.pushConstantRangeCount = 0;
+        layout_create_info.pPushConstantRanges = nullptr;
 
-    std::array<VkDynamicState, 2> dynamic_state = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
-    VkPipelineDynamicStateCreateInfo dynamic_state_create_info = {};
-    dynamic_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamic_state_create_info.dynamicStateCount = (uint32_t)dynamic_state.size();
-    dynamic_state_create_info.pDynamicStates = dynamic_state.data();
+        Log("#     Create Meshlet Culling Pipeline Layout\n");
+        result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &pipe.pipeline_layout);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
 
-    VkGraphicsPipelineCreateInfo pipeline_create_info = {};
-    pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipeline_create_info.stageCount = (uint32_t)shader_stage_create_infos.size();
-    pipeline_create_info.pStages = shader_stage_create_infos.data();
-    pipeline_create_info.pVertexInputState = &vertex_input_state_create_info;
-    pipeline_create_info.pInputAssemblyState = &input_assembly_state_create_info;
-    pipeline_create_info.pTessellationState = nullptr;
-    pipeline_create_info.pViewportState = &viewport_state_create_info;
-    pipeline_create_info.pRasterizationState = &raster_state_create_info;
-    pipeline_create_info.pMultisampleState = &multisample_state_create_info;
-    pipeline_create_info.pDepthStencilState = &depth_stencil_state_create_info;
-    pipeline_create_info.pColorBlendState = &color_blend_state_create_info;
-    pipeline_create_info.pDynamicState = &dynamic_state_create_info;
-    pipeline_create_info.layout = default_pipeline.pipeline_layout;
-    pipeline_create_info.renderPass = rp; // TODO: create a render pass inside Scene
-    pipeline_create_info.subpass = 0;
-    pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE; // only if VK_PIPELINE_CREATE_DERIVATIVE flag is set.
-    pipeline_create_info.basePipelineIndex = 0;
+        Log("#     Create Meshlet Culling Compute Shader\n");
+        if (!create_shader_module("./data/meshlet_cull.comp.spv", &pipe.cs))
+            return false;
 
-    Log("#     Create Default Pipeline\n");
-    result = vkCreateGraphicsPipelines(
-        _ctx->device,
-        VK_NULL_HANDLE, // cache
-        1,
-        &pipeline_create_info,
-        nullptr,
-        &default_pipeline.pipeline);
-    ErrorCheck(result);
-    if (result != VK_SUCCESS)
-        return false;
+        VkComputePipelineCreateInfo compute_pipeline_create_info = {};
+        compute_pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        compute_pipeline_create_info.stage =
+            vk::init::pipeline::shader_stage_create_info(pipe.cs, VK_SHADER_STAGE_COMPUTE_BIT);
+        compute_pipeline_create_info.layout = pipe.pipeline_layout;
+        compute_pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+        compute_pipeline_create_info.basePipelineIndex = 0;
 
+        Log("#     Create Meshlet Culling Pipeline\n");
+        result = vkCreateComputePipelines(
+            _ctx->device,
+            VK_NULL_HANDLE, // cache
+            1,
+            &compute_pipeline_create_info,
+            nullptr,
+            &pipe.pipeline);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
 
     //
-    // Pipeline for instancing.
+    // MIPMAP (compute fallback of the blits)
     //
 
     {
-        std::array<VkDescriptorSetLayout, 2> pipeline_descriptor_set_layouts = {
-            _descriptor_set_layouts[SCENE_DESCRIPTOR_SET_LAYOUT], // scene ubo
-            _descriptor_set_layouts[MATERIAL_DESCRIPTOR_SET_LAYOUT]  // sampler
-        };
+        VkDescriptorSetLayout mipmap_pipeline_descriptor_set_layout =
+            _descriptor_set_layouts[MIPMAP_DESCRIPTOR_SET_LAYOUT];
+
+        auto &pipe = _mipmaps.pipe;
 
-        // use it later to define uniform buffer
         VkPipelineLayoutCreateInfo layout_create_info = {};
         layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        layout_create_info.setLayoutCount = (uint32_t)pipeline_descriptor_set_layouts.size();
-        layout_create_info.pSetLayouts = pipeline_descriptor_set_layouts.data();
+        layout_create_info.setLayoutCount = 1;
+        layout_create_info.pSetLayouts = &mipmap_pipeline_descriptor_set_layout;
         layout_create_info.pushConstantRangeCount = 0;
-        layout_create_info.pPushConstantRanges = nullptr; // constant into shader for opti???
+        layout_create_info.pPushConstantRanges = nullptr;
 
-        Log("#     Create Instancing Pipeline Layout\n");
-        result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &_instance_pipe.pipeline_layout);
+        Log("#     Create Mipmap Pipeline Layout\n");
+        result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &pipe.pipeline_layout);
         ErrorCheck(result);
         if (result != VK_SUCCESS)
             return false;
-    }
 
-    Log("#     Create Instancing Vertex Shader\n");
-    if (!create_shader_module("./data/instancing.vert.spv", &_instance_pipe.vs))
-        return false;
+        Log("#     Create Mipmap Compute Shader\n");
+        if (!create_shader_module("./data/mipmap.comp.spv", &pipe.cs))
+            return false;
 
-    Log("#     Create Instancing Fragment Shader\n");
-    if (!create_shader_module("./data/instancing.frag.spv", &_instance_pipe.fs))
-        return false;
+        VkComputePipelineCreateInfo compute_pipeline_create_info = {};
+        compute_pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        compute_pipeline_create_info.stage =
+            vk::init::pipeline::shader_stage_create_info(pipe.cs, VK_SHADER_STAGE_COMPUTE_BIT);
+        compute_pipeline_create_info.layout = pipe.pipeline_layout;
+        compute_pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+        compute_pipeline_create_info.basePipelineIndex = 0;
 
-    shader_stage_create_infos[0].module = _instance_pipe.vs;
-    shader_stage_create_infos[1].module = _instance_pipe.fs;
+        Log("#     Create Mipmap Pipeline\n");
+        result = vkCreateComputePipelines(
+            _ctx->device,
+            VK_NULL_HANDLE, // cache
+            1,
+            &compute_pipeline_create_info,
+            nullptr,
+            &pipe.pipeline);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+    }
+
+    //
+    // PROCEDURAL TEXTURES (level 0, the parameters in push constants)
+    //
 
     {
-        VkPipelineVertexInputStateCreateInfo vertex_input_state_create_info = {};
-        vertex_input_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertex_input_state_create_info.vertexBindingDescriptionCount = instance_data_t::binding_description_count();
-        vertex_input_state_create_info.pVertexBindingDescriptions = instance_data_t::binding_descriptions();
-        vertex_input_state_create_info.vertexAttributeDescriptionCount = instance_data_t::attribute_description_count();
-        vertex_input_state_create_info.pVertexAttributeDescriptions = instance_data_t::attribute_descriptions();
+        VkDescriptorSetLayout procedural_pipeline_descriptor_set_layout =
+            _descriptor_set_layouts[PROCEDURAL_DESCRIPTOR_SET_LAYOUT];
 
-        VkGraphicsPipelineCreateInfo pipeline_create_info = {};
-        pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        pipeline_create_info.stageCount = (uint32_t)shader_stage_create_infos.size();
-        pipeline_create_info.pStages = shader_stage_create_infos.data(); // <-- instancing shaders
-        pipeline_create_info.pVertexInputState = &vertex_input_state_create_info; // <--- instancing 2 vertex buffers (vertex and instance data)
-        pipeline_create_info.pInputAssemblyState = &input_assembly_state_create_info;
-        pipeline_create_info.pTessellationState = nullptr;
-        pipeline_create_info.pViewportState = &viewport_state_create_info;
-        pipeline_create_info.pRasterizationState = &raster_state_create_info;
-        pipeline_create_info.pMultisampleState = &multisample_state_create_info;
-        pipeline_create_info.pDepthStencilState = &depth_stencil_state_create_info;
-        pipeline_create_info.pColorBlendState = &color_blend_state_create_info;
-        pipeline_create_info.pDynamicState = &dynamic_state_create_info;
-        pipeline_create_info.layout = _instance_pipe.pipeline_layout; // <--- instancing pipe layout
-        pipeline_create_info.renderPass = rp;
-        pipeline_create_info.subpass = 0;
-        pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
-        pipeline_create_info.basePipelineIndex = 0;
+        auto &pipe = _procedural.pipe;
 
-        Log("#     Create Instancing Pipeline\n");
-        result = vkCreateGraphicsPipelines(
+        VkPushConstantRange push_constant_range = {};
+        push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        push_constant_range.offset = 0;
+        push_constant_range.size = sizeof(_procedural_params_t);
+
+        VkPipelineLayoutCreateInfo layout_create_info = {};
+        layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layout_create_info.setLayoutCount = 1;
+        layout_create_info.pSetLayouts = &procedural_pipeline_descriptor_set_layout;
+        layout_create_info.pushConstantRangeCount = 1;
+        layout_create_info.pPushConstantRanges = &push_constant_range;
+
+        Log("#     Create Procedural Texture Pipeline Layout\n");
+        result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &pipe.pipeline_layout);
+        ErrorCheck(result);
+        if (result != VK_SUCCESS)
+            return false;
+
+        Log("#     Create Procedural Texture Compute Shader\n");
+        if (!create_shader_module("./data/procedural_texture.comp.spv", &pipe.cs))
+            return false;
+
+        VkComputePipelineCreateInfo compute_pipeline_create_info = {};
+        compute_pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        compute_pipeline_create_info.stage =
+            vk::init::pipeline::shader_stage_create_info(pipe.cs, VK_SHADER_STAGE_COMPUTE_BIT);
+        compute_pipeline_create_info.layout = pipe.pipeline_layout;
+        compute_pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+        compute_pipeline_create_info.basePipelineIndex = 0;
+
+        Log("#     Create Procedural Texture Pipeline\n");
+        result = vkCreateComputePipelines(
             _ctx->device,
             VK_NULL_HANDLE, // cache
             1,
-            &pipeline_create_info,
+            &compute_pipeline_create_info,
             nullptr,
-            &_instance_pipe.pipeline);
+            &pipe.pipeline);
         ErrorCheck(result);
         if (result != VK_SUCCESS)
             return false;
     }
 
     //
-    // COMPUTE PARRTICLES
+    // DEPTH PYRAMID (max reduction, one dispatch per level)
     //
 
     {
-        VkDescriptorSetLayout compute_pipeline_descriptor_set_layout = 
-            _descriptor_set_layouts[COMPUTE_DESCRIPTOR_SET_LAYOUT];
+        VkDescriptorSetLayout pyramid_pipeline_descriptor_set_layout =
+            _descriptor_set_layouts[DEPTH_PYRAMID_DESCRIPTOR_SET_LAYOUT];
+
+        VkPushConstantRange push_constant_range = {};
+        push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        push_constant_range.offset = 0;
+        push_constant_range.size = 2 * sizeof(glm::ivec2); // source size, destination size
 
         VkPipelineLayoutCreateInfo layout_create_info = {};
         layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
         layout_create_info.setLayoutCount = 1;
-        layout_create_info.pSetLayouts = &compute_pipeline_descriptor_set_layout;
-        layout_create_info.pushConstantRangeCount = 0;
-        layout_create_info.pPushConstantRanges = nullptr;
+        layout_create_info.pSetLayouts = &pyramid_pipeline_descriptor_set_layout;
+        layout_create_info.pushConstantRangeCount = 1;
+        layout_create_info.pPushConstantRanges = &push_constant_range;
 
-        Log("#     Create Compute Pipeline Layout\n");
-        result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &compute_particles.pipe.pipeline_layout);
+        Log("#     Create Depth Pyramid Pipeline Layout\n");
+        result = vkCreatePipelineLayout(_ctx->device, &layout_create_info, nullptr, &_depth_pyramid.pipe.pipeline_layout);
         ErrorCheck(result);
         if (result != VK_SUCCESS)
             return false;
 
-        Log("#     Create Particles Compute Shader\n");
-        if (!create_shader_module("./data/particles.comp.spv", &compute_particles.pipe.cs))
+        Log("#     Create Depth Pyramid Compute Shader\n");
+        if (!create_shader_module("./data/depth_pyramid.comp.spv", &_depth_pyramid.pipe.cs))
             return false;
 
-        VkPipelineShaderStageCreateInfo compute_shader_stage_create_info =
-            vk::init::pipeline::shader_stage_create_info(compute_particles.pipe.cs, VK_SHADER_STAGE_COMPUTE_BIT);
-
         VkComputePipelineCreateInfo compute_pipeline_create_info = {};
         compute_pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-        compute_pipeline_create_info.stage = compute_shader_stage_create_info;
-        compute_pipeline_create_info.layout = compute_particles.pipe.pipeline_layout;
+        compute_pipeline_create_info.stage =
+            vk::init::pipeline::shader_stage_create_info(_depth_pyramid.pipe.cs, VK_SHADER_STAGE_COMPUTE_BIT);
+        compute_pipeline_create_info.layout = _depth_pyramid.pipe.pipeline_layout;
         compute_pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
         compute_pipeline_create_info.basePipelineIndex = 0;
 
-        Log("#     Create Instancing Pipeline\n");
+        Log("#     Create Depth Pyramid Pipeline\n");
         result = vkCreateComputePipelines(
             _ctx->device,
             VK_NULL_HANDLE, // cache
             1,
             &compute_pipeline_create_info,
             nullptr,
-            &compute_particles.pipe.pipeline);
+            &_depth_pyramid.pipe.pipeline);
         ErrorCheck(result);
         if (result != VK_SUCCESS)
             return false;
@@ -2251,9 +6452,8 @@ void Scene::destroy_pipelines()
         vkDestroyDescriptorSetLayout(_ctx->device, _descriptor_set_layouts[i], nullptr);
     }
 
-    for (auto p : _pipelines)
+    for (const auto &pipe : _pipelines)
     {
-        auto pipe = p.second;
 
         Log("#    Destroy Shader Modules\n");
         vkDestroyShaderModule(_ctx->device, pipe.vs, nullptr);
@@ -2276,6 +6476,35 @@ void Scene::destroy_pipelines()
 
     Log("#    Destroy Pipeline Layout\n");
     vkDestroyPipelineLayout(_ctx->device, _instance_pipe.pipeline_layout, nullptr);
+
+    // indirect instancing, sorted and impostor pipelines
+    for (auto *pipe : { &_instance_indirect_pipe, &_instance_sorted_pipe, &_impostor_pipe })
+    {
+        Log("#    Destroy Shader Modules\n");
+        vkDestroyShaderModule(_ctx->device, pipe->vs, nullptr);
+        vkDestroyShaderModule(_ctx->device, pipe->fs, nullptr);
+
+        Log("#    Destroy Pipeline\n");
+        vkDestroyPipeline(_ctx->device, pipe->pipeline, nullptr);
+
+        Log("#    Destroy Pipeline Layout\n");
+        vkDestroyPipelineLayout(_ctx->device, pipe->pipeline_layout, nullptr);
+    }
+
+    // compute pipelines
+    for (auto *pipe : { &compute_particles.pipe, &classify_particles.pipe, &_depth_pyramid.pipe,
+        &_particle_lifecycle.emit_pipe, &_particle_lifecycle.update_pipe, &_particle_lifecycle.compact_pipe,
+        &_particle_sort.keys_pipe, &_meshlet_culling.pipe, &_mipmaps.pipe, &_procedural.pipe })
+    {
+        Log("#    Destroy Compute Shader Module\n");
+        vkDestroyShaderModule(_ctx->device, pipe->cs, nullptr);
+
+        Log("#    Destroy Compute Pipeline\n");
+        vkDestroyPipeline(_ctx->device, pipe->pipeline, nullptr);
+
+        Log("#    Destroy Compute Pipeline Layout\n");
+        vkDestroyPipelineLayout(_ctx->device, pipe->pipeline_layout, nullptr);
+    }
 }
 
 bool Scene::add_pipeline(pipeline_description_t p)
@@ -2285,22 +6514,35 @@ bool Scene::add_pipeline(pipeline_description_t p)
     // TODO:
     // load shaders, create descriptor layouts, create pipeline, ...
 
-    _pipelines[p.id] = pipe;
+    _pipelines.insert(p.id, pipe);
 
     return true;
 }
 
 bool Scene::add_material_instance(material_instance_description_t mi)
 {
+    const _material_instance_t *found = _material_instances.get(_material_instances.find(mi.instance_id));
+    uint32_t index = found ? found->index : (uint32_t)_material_instances.size();
+    if (index >= MAX_BINDLESS_MATERIALS)
+    {
+        Log("#     Too many material instances for the bindless table\n");
+        return false;
+    }
+
     _material_instance_t material_instance = {};
-    material_instance.base_tex = mi.base_tex;
-    material_instance.spec_tex = mi.specular_tex;
+    material_instance.base_tex = _textures.find(mi.base_tex);
+    material_instance.spec_tex = _textures.find(mi.specular_tex);
+    material_instance.index = index;
 
     // TODO:
     // get layout descriptions from material_id
     // create descriptor set
 
-    _material_instances[mi.instance_id] = material_instance;
+    _material_instances.insert(mi.instance_id, material_instance);
+
+    // after compile(), the table entry is all that is needed, no descriptor set.
+    if (_bindless.descriptor_set != VK_NULL_HANDLE)
+        write_bindless_material(material_instance);
 
     return true;
 }
@@ -2319,12 +6561,14 @@ void Scene::tmp_change_sphere_base_color(int idx, const glm::vec4 &base_color)
 {
     _material_override_t *material = get_object_material(idx);
     material->base_color = base_color;
+    mark_dirty(&_global_object_material_ubo, idx);
 }
 
 void Scene::tmp_change_sphere_spec_color(int idx, const glm::vec4 &spec_color)
 {
     _material_override_t *material = get_object_material(idx);
     material->specular = spec_color;
+    mark_dirty(&_global_object_material_ubo, idx);
 }
 
 glm::vec4 Scene::get_object_base_color(int idx)
@@ -2368,6 +6612,21 @@ void Scene::show_property_sheet()
 
             ImGui::Combo("Current Light", &_current_light, "Light_0\0Light_1\0Light_2\0\0");
 
+            if (_current_item_idx < (int)_transforms.size())
+            {
+                glm::vec3 position = _transforms.translation(_current_item_idx);
+                if (ImGui::DragFloat3("Position", glm::value_ptr(position), 0.05f))
+                    _transforms.set_translation(_current_item_idx, position);
+
+                glm::vec3 euler = glm::degrees(glm::eulerAngles(_transforms.rotation(_current_item_idx)));
+                if (ImGui::DragFloat3("Rotation", glm::value_ptr(euler), 1.0f))
+                    _transforms.set_rotation(_current_item_idx, glm::quat(glm::radians(euler)));
+
+                glm::vec3 scale = _transforms.scale(_current_item_idx);
+                if (ImGui::DragFloat3("Scale", glm::value_ptr(scale), 0.01f, 0.01f, 100.0f))
+                    _transforms.set_scale(_current_item_idx, glm::max(scale, glm::vec3(0.01f)));
+            }
+
             glm::vec4 base_color = get_object_base_color(_current_item_idx);
             if (ImGui::ColorEdit4("base_color", glm::value_ptr(base_color)))
             {
@@ -2444,7 +6703,206 @@ void Scene::show_property_sheet()
             ImGui::SliderFloat("Speed", &_speed, 0.001f, 1.0f);
             ImGui::SliderFloat("R. Speed", &_rotation_speed, 0.001f, 1.0f);
 
-            ImGui::SliderInt("Instances", &_nb_instances, 1, MAX_INSTANCE_COUNT);
+            ImGui::SliderInt("Instances", &_nb_instances, 1, (int)_instance_sets[_particles].capacity);
+
+            int step_hz = (int)(1.0 / _simulation_clock.step() + 0.5);
+            if (ImGui::SliderInt("Sim. step (Hz)", &step_hz, 10, 240))
+                _simulation_clock.set_step(1.0 / step_hz);
+            ImGui::Checkbox("Interpolate sim.", &_interpolate_simulation);
+            ImGui::Text("Sim. time %.3f s, step %llu, %u steps/frame, alpha %.2f",
+                _simulation_clock.time(), (unsigned long long)_simulation_clock.step_index(),
+                _simulation_clock.last_step_count(), _simulation_clock.alpha());
+            ImGui::Checkbox("Simulate on CPU", &_simulate_cpu);
+        }
+
+        if (ImGui::CollapsingHeader("Emitters"))
+        {
+            auto &lc = _particle_lifecycle;
+
+            // starts from an empty pool: the instances were on the loop.
+            if (ImGui::Checkbox("Spawn from emitters", &_use_emitters) && _use_emitters)
+                lc.reset_requested = true;
+            ImGui::SameLine();
+            if (ImGui::Button("Kill all"))
+                lc.reset_requested = true;
+
+            ImGui::DragFloat3("Gravity", glm::value_ptr(lc.gravity), 0.1f);
+
+            for (int i = 0; i < (int)lc.emitters.size(); ++i)
+            {
+                auto &e = lc.emitters[i];
+                ImGui::PushID(i);
+                ImGui::Checkbox((std::string("Emitter ") + std::to_string(i)).c_str(), &e.enabled);
+                if (e.enabled)
+                {
+                    ImGui::DragFloat3("Position", glm::value_ptr(e.position), 0.1f);
+                    ImGui::SliderFloat("Radius", &e.radius, 0.0f, 10.0f);
+                    ImGui::DragFloat3("Velocity", glm::value_ptr(e.velocity), 0.1f);
+                    ImGui::SliderFloat("Spread", &e.spread, 0.0f, 50.0f);
+                    ImGui::SliderFloat("Rate (/s)", &e.rate, 0.0f, 1000000.0f, "%.0f", 4.0f);
+                    ImGui::SliderInt("Burst", &e.burst_count, 0, (int)lc.capacity);
+                    ImGui::SliderFloat("Burst every (s)", &e.burst_interval, 0.05f, 10.0f);
+                    ImGui::DragFloatRange2("Lifetime (s)", &e.lifetime_min, &e.lifetime_max, 0.05f, 0.05f, 60.0f);
+                }
+                ImGui::PopID();
+            }
+
+            // the alive count stays on the GPU.
+            ImGui::Text("Spawned this frame: %u, pool of %u particles", lc.data.emit_count, lc.capacity);
+        }
+
+        if (ImGui::CollapsingHeader("Impostors"))
+        {
+            ImGui::Combo("Render mode", &_instance_render_mode, "Mesh\0Hybrid\0Impostor\0\0");
+            ImGui::SliderFloat("Switch distance", &_impostor_distance, 0.0f, 500.0f);
+            ImGui::Checkbox("Hi-Z occlusion culling", &_occlusion_culling);
+        }
+
+        if (ImGui::CollapsingHeader("Transparency"))
+        {
+            auto &ps = _particle_sort;
+
+            // every particle as a mesh, no impostors nor culling.
+            ImGui::Checkbox("Sorted alpha blending", &_sort_particles);
+            ImGui::SliderFloat("Opacity", &ps.opacity, 0.0f, 1.0f);
+
+            int key_bits_index = ps.key_bits / 8 - 1;
+            if (ImGui::Combo("Key bits", &key_bits_index, "8\0" "16\0" "24\0" "32 (float depth)\0\0"))
+                ps.key_bits = 8 * (key_bits_index + 1);
+            if (ps.key_bits < 32)
+                ImGui::DragFloatRange2("Key depth range", &ps.depth_range.x, &ps.depth_range.y, 0.5f, 0.01f, 10000.0f);
+
+            if (_sort_particles)
+            {
+                if (ps.query_pool != VK_NULL_HANDLE)
+                    ImGui::Text("Sort: %.3f ms, %u radix passes", ps.gpu_ms, ps.data.key_bits / 4);
+                else
+                    ImGui::Text("Sort: no timestamps on the compute queue");
+            }
+        }
+
+        if (ImGui::CollapsingHeader("Texture loading"))
+        {
+            const auto &tl = _texture_loads;
+            ImGui::Text("Decoding: %u, uploading: %u", tl.loader ? tl.loader->pending_count() : 0, (uint32_t)tl.uploads.size());
+            ImGui::Text("Loaded: %u, failed: %u", tl.loaded_count, tl.failed_count);
+
+            auto &ts = _texture_streaming;
+            ImGui::SliderInt("VRAM budget (MB)", &ts.budget_mb, 16, 2048);
+            ImGui::SliderInt("Upload budget (KB/frame)", &ts.upload_budget_kb, 256, 64 * 1024);
+            ImGui::SliderFloat("LOD bias", &ts.lod_bias, -2.0f, 4.0f);
+            ImGui::Text("Streamed: %u, resident: %.1f MB", (uint32_t)ts.textures.size(), ts.resident_bytes / (1024.0f * 1024.0f));
+            ImGui::Text("Levels streamed in: %u, evicted: %u", ts.streamed_in_count, ts.evicted_count);
+        }
+
+        if (ImGui::CollapsingHeader("Procedural textures"))
+        {
+            auto &pt = _procedural;
+            for (auto &procedural : pt.textures)
+            {
+                auto &p = procedural.params;
+                ImGui::PushID(procedural.name.c_str());
+                ImGui::Text("%s", procedural.name.c_str());
+                switch (p.pattern)
+                {
+                case PROCEDURAL_CHECKER_BASE:
+                    pt.regenerate_requested |= ImGui::SliderInt("Cell size", (int*)&p.cell_size, 1, 128);
+                    pt.regenerate_requested |= ImGui::DragFloatRange2("Metal", &p.a.x, &p.a.y, 0.005f, 0.0f, 1.0f);
+                    pt.regenerate_requested |= ImGui::DragFloatRange2("Dielectric", &p.a.z, &p.a.w, 0.005f, 0.0f, 1.0f);
+                    break;
+                case PROCEDURAL_CHECKER_SPEC:
+                    pt.regenerate_requested |= ImGui::SliderInt("Cell size", (int*)&p.cell_size, 1, 128);
+                    pt.regenerate_requested |= ImGui::ColorEdit3("Plain cells", &p.a.x);
+                    pt.regenerate_requested |= ImGui::SliderFloat("Roughness", &p.b.x, 0.0f, 1.0f);
+                    pt.regenerate_requested |= ImGui::SliderFloat("Roughness slope", &p.b.y, 0.0f, 1.0f);
+                    pt.regenerate_requested |= ImGui::SliderFloat("Noise", &p.b.z, 0.0f, 1.0f);
+                    pt.regenerate_requested |= ImGui::InputInt("Seed", (int*)&p.seed);
+                    break;
+                default:
+                    pt.regenerate_requested |= ImGui::ColorEdit4("Color", &p.a.x);
+                    break;
+                }
+                ImGui::PopID();
+            }
+            ImGui::Text("Last regeneration: %.3f ms", pt.regenerate_ms);
+        }
+
+        if (ImGui::CollapsingHeader("Meshlet culling"))
+        {
+            auto &mc = _meshlet_culling;
+
+            ImGui::Checkbox("Frustum culling", &mc.frustum_culling);
+            ImGui::Checkbox("Back face cone culling", &mc.cone_culling);
+            ImGui::Text("%u objects, %u meshlets, %u indices",
+                (uint32_t)mc.commands.size(), (uint32_t)mc.meshlets.size(), mc.culled_index_count);
+        }
+
+        if (ImGui::CollapsingHeader("Benchmark"))
+        {
+            ImGui::Text("GPU compute  : %.3f ms", _gpu_compute_ms);
+            ImGui::Text("GPU graphics : %.3f ms", _gpu_graphics_ms);
+            ImGui::Text("Object upload: %u bytes, %u ranges", (uint32_t)_object_upload_bytes, _object_upload_ranges);
+            ImGui::Text("Transforms   : %u updated, %.3f ms", _transform_update_count, _transform_update_ms);
+            if (_simulate_cpu)
+            {
+                const auto &stats = _cpu_particles.simulator.stats();
+                ImGui::Text("CPU simulation: %.3f ms, %u threads", stats.wall_ms, stats.thread_count);
+                ImGui::Text("                %.1f M particles/s/core", stats.particles_per_second_per_core() / 1000000.0);
+            }
+
+            if (_benchmark.state == _benchmark_t::IDLE)
+            {
+                if (ImGui::Button("Run mesh vs hybrid"))
+                {
+                    _benchmark.state = _benchmark_t::WARMUP;
+                    _benchmark.pass = 0;
+                    _benchmark.frame = 0;
+                    _benchmark.saved_render_mode = _instance_render_mode;
+                    _benchmark.saved_nb_instances = _nb_instances;
+                    _benchmark.has_results = false;
+                    _nb_instances = (int32_t)_instance_sets[_particles].capacity;
+                }
+            }
+            else
+            {
+                ImGui::Text("Running... pass %d, frame %d", _benchmark.pass, _benchmark.frame);
+            }
+
+            if (_benchmark.has_results)
+            {
+                ImGui::Text("Mesh   : compute %.3f ms, graphics %.3f ms", _benchmark.results[0].x, _benchmark.results[0].y);
+                ImGui::Text("Hybrid : compute %.3f ms, graphics %.3f ms", _benchmark.results[1].x, _benchmark.results[1].y);
+                if (_benchmark.results[0].z > 0.0f || _benchmark.results[1].z > 0.0f)
+                    ImGui::Text("Sort   : %.3f ms, %.3f ms (in compute)", _benchmark.results[0].z, _benchmark.results[1].z);
+            }
+
+            // it overwrites the particles of the emitters.
+            if (!_use_emitters && ImGui::Button("Check CPU vs GPU simulation"))
+                _simulation_check.requested = true;
+            for (const auto &r : _simulation_check.results)
+            {
+                ImGui::Text("t = %7.1f: %s, max error pos %.2e rot %.2e", r.t,
+                    r.mismatch_count ? "FAIL" : "ok", r.max_position_error, r.max_rotation_error);
+                if (r.mismatch_count)
+                    ImGui::Text("            %u mismatches, first at particle %u", r.mismatch_count, r.first_mismatch);
+                ImGui::Text("            GPU %.3f ms, CPU %.3f ms (%u particles)", r.gpu_ms, r.cpu_ms, r.particle_count);
+            }
+
+            // scan, compaction, reduction and sort, each variant.
+            if (_primitives.has_subgroups())
+            {
+                bool use_subgroups = _primitives.use_subgroups();
+                if (ImGui::Checkbox("Subgroup scans", &use_subgroups))
+                    _primitives.set_use_subgroups(use_subgroups);
+            }
+            ImGui::SliderInt("Elements (log2)", &_primitives_check.log2_count, 10, 24);
+            if (ImGui::Button("Check GPU primitives"))
+                _primitives_check.requested = true;
+            for (const auto &r : _primitives_check.results)
+            {
+                ImGui::Text("%-26s%s: %s, %.3f ms, %.1f M/s", r.name.c_str(), r.subgroups ? " (sg)" : "     ",
+                    r.mismatch_count ? "FAIL" : "ok", r.gpu_ms, r.elements_per_second() / 1000000.0);
+            }
         }
     }
     ImGui::End();
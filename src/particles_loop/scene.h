@@ -5,8 +5,17 @@
 
 #include <stdint.h> // uint32_t
 #include "glm_usage.h"
+#include "frame_graph.h"
+#include "slot_map.h"
+#include "transform.h"
+#include "particles_cpu.h"
+#include "simulation_clock.h"
+#include "gpu_primitives.h"
+#include "texture_loader.h"
 
 #include <array>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <unordered_map>
 
@@ -17,7 +26,7 @@
 #define ROWS_COUNT 256
 #define COLS_COUNT 256
 #define SLICE_COUNT 2
-#define MAX_INSTANCE_COUNT (ROWS_COUNT * COLS_COUNT * SLICE_COUNT)
+#define MAX_INSTANCE_COUNT (ROWS_COUNT * COLS_COUNT * SLICE_COUNT) // default particle count, see --instances
 // 96x96 = 9216
 // 128x128 = 16384 instances. x instance_data_size = 1572864 bytes
 
@@ -42,6 +51,20 @@ public:
     using material_instance_id_t = std::string;
     using texture_id_t = std::string;
 
+    // Dense handles, resolved once from the names at build time.
+    struct instance_set_tag;
+    struct pipeline_tag;
+    struct material_instance_tag;
+    struct texture_tag;
+    struct camera_tag;
+    struct view_tag;
+    using instance_set_handle_t = handle_t<instance_set_tag>;
+    using pipeline_handle_t = handle_t<pipeline_tag>;
+    using material_instance_handle_t = handle_t<material_instance_tag>;
+    using texture_handle_t = handle_t<texture_tag>;
+    using camera_handle_t = handle_t<camera_tag>;
+    using view_handle_t = handle_t<view_tag>;
+
     //
     // Vertex format for geometry VBOs
     //
@@ -69,7 +92,7 @@ public:
         glm::vec4 speed;
         glm::vec4 jitter; // random numbers
         glm::vec4 base;
-        glm::vec4 spec;
+        glm::vec4 spec; // x = roughness, y = metallic, z = reflectance, w = material index
 
         static uint32_t binding_description_count();
         static VkVertexInputBindingDescription * binding_descriptions();
@@ -77,21 +100,48 @@ public:
         static VkVertexInputAttributeDescription * attribute_descriptions();
     };
 
-    using index_t = uint16_t;
+    using index_t = uint32_t; // scanned meshes are well past 65536 vertices
+
+    //
+    // Cluster of triangles of an object, a run of its indices, culled on its
+    // own by the meshlet pass. Built by build_meshlets().
+    //
+    struct meshlet_t
+    {
+        glm::vec4 sphere;     // xyz = center, w = radius, object space
+        glm::vec4 cone;       // xyz = axis of the normals, w = cutoff, 1 = no cone
+        uint32_t first_index; // into the indices of the object
+        uint32_t index_count;
+    };
 
     struct object_description_t
     {
         object_id_t name = "";
 
         uint32_t indexCount = 0;
-        uint16_t *indices = nullptr;
+        const index_t *indices = nullptr;
         uint32_t vertexCount = 0;
-        vertex_t *vertices = nullptr;
+        const vertex_t *vertices = nullptr;
+
+        // Without vertices/indices: count of them from first are written
+        // straight into the staging memory, and the bounding radius is given.
+        std::function<void(vertex_t *dst, uint32_t first, uint32_t count)> write_vertices;
+        std::function<void(index_t *dst, uint32_t first, uint32_t count)> write_indices;
+        float bounding_radius = 0.0f; // 0 = from the vertices
+
+        object_id_t geometry = ""; // an object added before, whose vertices/indices are shared
+
+        // With meshlets, only the visible and front facing ones are drawn.
+        // They cover all the indices. Shared with the geometry.
+        uint32_t meshletCount = 0;
+        const meshlet_t *meshlets = nullptr;
 
         // for each instance
         glm::vec3 position = glm::vec3(0, 0, 0);
-        // TODO: add rotation and scale.
-
+        glm::quat rotation = glm::quat(1, 0, 0, 0);
+        glm::vec3 scale = glm::vec3(1, 1, 1);
+        object_id_t parent = ""; // an object added before this one, empty = root
+        glm::vec3 spin = glm::vec3(0, 0, 0); // radians per second around the local axes, children follow
 
         material_instance_id_t material = "white_rough";
 
@@ -114,6 +164,7 @@ public:
         glm::vec4 base_color = glm::vec4(0.5, 0.5, 0.5, 1.0);
         glm::vec4 specular = glm::vec4(0.5, 0.0, 0.0, 0.0); // roughness, metallic, reflectance, 0
         glm::vec4 jitters = glm::vec4(0, 0, 0, 0);
+        material_instance_id_t material = ""; // empty = the material of the instance set
     };
 
     struct light_description_t
@@ -164,25 +215,51 @@ public:
     bool add_object_to_global_instance_set(object_description_t od);
     bool add_instance_set(instance_set_description_t is, uint32_t estimated_instance_count = 0);
     uint32_t add_object_to_instance_set(instanced_object_description_t o, instance_set_id_t is);
+    uint32_t add_object_to_instance_set(const instanced_object_description_t &o, instance_set_handle_t is);
+    instance_set_handle_t find_instance_set(const instance_set_id_t &is) const { return _instance_sets.find(is); }
     bool add_light(light_description_t li);
     bool add_camera(camera_description_t ca);
     bool add_pipeline(pipeline_description_t p);
     bool add_material_instance(material_instance_description_t mi);
 
-    bool init(VkRenderPass rp);
+    // After init(), never waits: the file is decoded by the loader threads and
+    // uploaded a few frames later. Until then the texture is the placeholder,
+    // the materials can use its name right away.
+    // The usage chooses the compressed format, see texture_cooker.h.
+    bool load_texture(const texture_id_t &name, const std::string &file_path, const texture_id_t &placeholder,
+        bool srgb = false, texture_usage_t usage = TEXTURE_USAGE_ALBEDO);
+    bool load_texture(const texture_id_t &name, std::vector<uint8_t> &&file_data, const texture_id_t &placeholder,
+        bool srgb = false, texture_usage_t usage = TEXTURE_USAGE_ALBEDO);
+
+    // depth_view: depth aspect of the render pass depth attachment, source of the Hi-Z.
+    bool init(VkRenderPass rp, VkImageView depth_view, VkExtent2D depth_extent);
     void de_init();
     bool compile(); // create descriptor sets once all ythe scene is built.
     void update(float dt);
-    void upload();
+    void upload(uint32_t frame); // frame = parallel frame index, after its fences
     
     // fill graphics command buffer
     void draw(VkCommandBuffer cmd, VkViewport viewport, VkRect2D scissor_rect);
-    // fill compute command buffer
-    void record_compute_commands(VkCommandBuffer cmd);
+
+    // Frame graph, after compile(): the compute passes before the renderer's scene pass,
+    // and what the scene pass (draw_pass) reads, plus the depth pyramid pass after it.
+    void declare_compute_passes(FrameGraph *fg);
+    void declare_graphics_passes(FrameGraph *fg, FrameGraph::pass_id_t draw_pass, FrameGraph::resource_id_t depth);
+    // each frame, before execute(): enabled passes and touched ranges.
+    void update_frame_graph(FrameGraph *fg, VkExtent2D render_extent);
+
+    // GPU times of the last completed frame, in milliseconds.
+    void set_gpu_timings(float compute_ms, float graphics_ms);
 
     const glm::vec4 &sky_color() { return _lighting_block.sky_color; }
     const glm::vec4 &bg_color() { return _bg_color; }
 
+    // The checks of the UI, right away, between two frames. False on a
+    // mismatch or when nothing could be checked: --check-simulation,
+    // --check-primitives.
+    bool run_simulation_check();
+    bool run_primitives_check();
+
 private:
 
     struct staging_buffer_t
@@ -202,27 +279,36 @@ private:
     {
         void *          host_data = nullptr;
         size_t          alignment = 0;
-        size_t          size = 0;
-        VkBuffer        buffer = VK_NULL_HANDLE;
+        size_t          size = 0;              // of host_data, and of each copy in the buffer
+        VkBuffer        buffer = VK_NULL_HANDLE; // one copy per parallel frame, bound with a dynamic offset
         VkDeviceMemory  memory = VK_NULL_HANDLE;
+        void *          mapped = nullptr;      // persistent, the copies receive the dirty ranges of host_data
+        std::vector<uint8_t> dirty = {};       // per element, copies still to write
+        bool            any_dirty = false;
+        uint32_t        frame = 0;             // copy read by the frame being recorded
     };
 
     // VBO/IBO to handle multiple objects.
     struct vertex_buffer_object_t
     {
         uint32_t        offset = 0; // first free byte offset.
+        uint32_t        size = 0;   // reserved bytes.
         VkBuffer        buffer = VK_NULL_HANDLE;
         VkDeviceMemory  memory = VK_NULL_HANDLE;
-        // TODO: store reserved size
     };
 
     void show_property_sheet();
     void animate_camera(float dt);
     void animate_light(float dt);
     void animate_object(float dt);
+    void set_simulation_params(double t); // compute UBO data and CPU params, wrapped phases
+
+    void update_classify_data();
+    void update_benchmark();
 
     bool update_scene_ubo();
-    bool update_all_objects_ubos();
+    bool update_all_objects_ubos(uint32_t frame);
+    void update_transforms(); // dirty transforms -> matrices SSBO host data
     bool update_all_instances_vbos();
 
     uniform_buffer_t &get_scene_ubo();
@@ -242,6 +328,23 @@ private:
     bool create_texture_samplers();
     void destroy_textures();
 
+    // frame graph passes, barriers are put by the graph.
+    void record_simulation(VkCommandBuffer cmd);
+    void record_simulation_upload(VkCommandBuffer cmd); // CPU simulation
+    void record_draw_commands_reset(VkCommandBuffer cmd);
+    void record_particle_emit(VkCommandBuffer cmd);    // particle lifecycle
+    void record_particle_update(VkCommandBuffer cmd);  //
+    void record_particle_compact(VkCommandBuffer cmd); //
+    void record_sort_keys(VkCommandBuffer cmd);  // back to front particles
+    void record_radix_sort(VkCommandBuffer cmd); //
+    void record_classify(VkCommandBuffer cmd);
+    void record_meshlet_draws_reset(VkCommandBuffer cmd);
+    void record_meshlet_cull(VkCommandBuffer cmd);
+    void record_depth_pyramid(VkCommandBuffer cmd, VkExtent2D depth_extent); // rendered part of the depth
+
+    bool create_depth_pyramid();
+    void destroy_depth_pyramid();
+
     bool create_shader_module(const std::string &file_path, VkShaderModule *shader_module);
 
     bool build_pipelines(VkRenderPass rp);
@@ -261,6 +364,9 @@ private:
         VkMemoryPropertyFlags memory_property_flags // [in]
     );
     bool copy_buffer_to_buffer(VkBuffer src, VkBuffer dst, VkDeviceSize size, VkDeviceSize src_offset = 0, VkDeviceSize dst_offset = 0);
+    using staging_writer_t = std::function<void(void *dst, uint32_t first, uint32_t count)>;
+    bool upload_through_staging(const staging_writer_t &write, uint32_t count, uint32_t element_size, VkBuffer dst, VkDeviceSize dst_offset = 0);
+    bool upload_through_staging(const void *data, VkDeviceSize size, VkBuffer dst, VkDeviceSize dst_offset = 0);
     bool copy_buffer_to_image(VkBuffer src, VkImage dst, VkExtent3D extent);
     bool transition_texture(VkImage *pImage, VkImageLayout old_layout, VkImageLayout new_layout);
     bool copy_data_to_staging_buffer(staging_buffer_t buffer, void *data, VkDeviceSize size, bool flush = true);
@@ -307,28 +413,61 @@ private:
         uint32_t vertex_offset = 0;
         VkBuffer vertex_buffer = VK_NULL_HANDLE; // ref
 
+        float bounding_radius = 0.0f; // around the mesh origin, for impostors
+
+        uint32_t first_meshlet = 0; // in _meshlet_culling
+        uint32_t meshlet_count = 0; // 0 = drawn whole, in the global draw buckets
+        uint32_t meshlet_draw = 0;  // its draw command in _meshlet_culling
+
         // for animation
         glm::vec3 position = glm::vec3(0, 0, 0);
+        glm::vec3 spin = glm::vec3(0, 0, 0);
         glm::vec4 base_color = glm::vec4(0.5, 0.5, 0.5, 1.0);
         glm::vec4 specular = glm::vec4(1, 1, 0, 0); // roughness, metallic, 0, 0
 
-        material_instance_id_t material_ref;
+        material_instance_handle_t material;
     };
 
-    // set #2 binding #0 model_matrix       : VS
-    //        binding #1 material overrides : FS
+    // set #2 binding #0 model_matrix[]       : VS
+    //        binding #1 material overrides[] : FS
     VkDescriptorSet _global_objects_descriptor_set = VK_NULL_HANDLE;
 
+    // Global objects sorted by material, one indirect draw per material.
+    // firstInstance is the object index into the matrices/materials SSBOs.
+    struct _global_draw_bucket_t
+    {
+        material_instance_handle_t material;
+        VkDescriptorSet descriptor_set = VK_NULL_HANDLE; // set #1
+        uint32_t first_command = 0;
+        uint32_t command_count = 0;
+    };
+    std::vector<_global_draw_bucket_t> _global_draw_buckets;
+    staging_buffer_t _global_draw_commands; // VkDrawIndexedIndirectCommand[MAX_NB_OBJECTS], host visible
+    bool build_global_draw_commands();
+
     std::vector<_object_t> _objects;
-    uint32_t _add_object(const object_description_t &desc);
+    static constexpr uint32_t NO_OBJECT = UINT32_MAX;
+    uint32_t _add_object(const object_description_t &desc); // NO_OBJECT if it does not fit
+
+    // one transform per object, same index.
+    TransformSystem _transforms;
+    float _transform_update_ms = 0.0f; // last update
+    uint32_t _transform_update_count = 0;
 
     // global list of free roaming objects.
     std::vector<object_id_t> _object_names = {};
     std::vector<uint32_t> _global_instance_set = {};
 
     void *get_aligned(dynamic_uniform_buffer_t *buffer, uint32_t idx);
-    dynamic_uniform_buffer_t _global_object_matrices_ubo; // all objects model matrices in one buffer
-    dynamic_uniform_buffer_t _global_object_material_ubo; // all objects material overrides in one buffer
+    void mark_dirty(dynamic_uniform_buffer_t *buffer, uint32_t idx);
+    // Copies the dirty elements of [0..count[ to the copy of the frame, merged
+    // into ranges aligned on nonCoherentAtomSize, and adds the ranges to flush.
+    // An element stays dirty until every copy has it.
+    void upload_dirty_ranges(dynamic_uniform_buffer_t *buffer, uint32_t count, uint32_t frame, std::vector<VkMappedMemoryRange> *ranges);
+    VkDeviceSize _object_upload_bytes = 0; // last update, matrices + materials
+    uint32_t _object_upload_ranges = 0;
+    dynamic_uniform_buffer_t _global_object_matrices_ubo; // all objects model matrices in one SSBO
+    dynamic_uniform_buffer_t _global_object_material_ubo; // all objects material overrides in one SSBO
     vertex_buffer_object_t _global_object_vbo; // all objects vertices in one buffer
     vertex_buffer_object_t _global_object_ibo; // all objects indices in one buffer
     vertex_buffer_object_t _global_staging_vbo; // used for transfer.
@@ -376,7 +515,8 @@ private:
         glm::mat4 p = glm::mat4(1); // proj matrix
         glm::vec4 pos = glm::vec4(1);
     };
-    std::unordered_map<camera_id_t, _camera_t> _cameras;
+    slot_map<_camera_t, camera_tag> _cameras;
+    camera_handle_t _main_camera; // camera of the main view
 
     //
     // VIEW / SCENE
@@ -394,7 +534,8 @@ private:
         VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
     };
 
-    std::unordered_map<view_id_t, _view_t> _views;
+    slot_map<_view_t, view_tag> _views;
+    view_handle_t _main_view; // "perspective"
     uniform_buffer_t _scene_ubo;
     bool _scene_ubo_created = false;
 
@@ -413,13 +554,37 @@ private:
         // atm, we chose to put it in material instances,
         // because we group together base+spec textures in
         // a single set with predefined bindings.
+        uint32_t        bindless_index = UINT32_MAX; // slot in the bindless texture array
+        bool            placeholder = false; // image, view and slot of another texture, until loaded
+        uint32_t        mip_levels = 1;      // full chain when the GPU can build it
+        bool            compute_mips = false; // no linear blit for the format: mipmap.comp
+        bool            cooked = false;      // mip_levels come with the data, see texture_cooker.h
+        uint32_t        first_level = 0;     // cooked: level of the chain in image level 0, see _texture_streaming
+        uint32_t        streaming_index = UINT32_MAX; // in _texture_streaming.textures
+        bool            procedural = false;  // level 0 is a storage image, see _procedural
     };
 
+    // Views and sets of the compute mips, freed once the upload is done.
+    struct _mip_scratch_t
+    {
+        std::vector<VkImageView> level_views;
+        std::vector<VkDescriptorSet> descriptor_sets;
+    };
+
+    // optimal tiling, mip_levels and compute_mips from the format features.
     bool create_texture_2d(_texture_t *texture);
+    // copy of level 0 from the staging buffer, mips, then shader read only.
+    // Graphics queue, for the blits. cooked: copy of all the levels instead.
+    bool record_texture_upload(VkCommandBuffer cmd, VkBuffer staging, VkDeviceSize offset,
+        const _texture_t &texture, _mip_scratch_t *scratch, const texture_cache_header_t *cooked = nullptr);
+    // level 0 in TRANSFER_SRC, the others in TRANSFER_DST. Ends in shader read only.
+    void record_mip_blits(VkCommandBuffer cmd, const _texture_t &texture);
+    VkFormat cooked_texture_format(const texture_cache_header_t &header) const;
+    bool record_compute_mips(VkCommandBuffer cmd, const _texture_t &texture, _mip_scratch_t *scratch);
+    void destroy_mip_scratch(_mip_scratch_t *scratch);
     bool transition_textures();
 
-    std::unordered_map<texture_id_t, _texture_t> _textures;
-    staging_buffer_t _texture_staging_buffer;
+    slot_map<_texture_t, texture_tag> _textures;
 
     std::array<VkSampler, 1> _samplers;
 
@@ -430,6 +595,15 @@ private:
         MATERIAL_DESCRIPTOR_SET_LAYOUT,
         OBJECT_DESCRIPTOR_SET_LAYOUT,
         COMPUTE_DESCRIPTOR_SET_LAYOUT,
+        CLASSIFY_DESCRIPTOR_SET_LAYOUT,
+        LIFECYCLE_DESCRIPTOR_SET_LAYOUT,
+        SORT_DESCRIPTOR_SET_LAYOUT,
+        INSTANCE_DESCRIPTOR_SET_LAYOUT,
+        DEPTH_PYRAMID_DESCRIPTOR_SET_LAYOUT,
+        BINDLESS_DESCRIPTOR_SET_LAYOUT,
+        MESHLET_DESCRIPTOR_SET_LAYOUT,
+        MIPMAP_DESCRIPTOR_SET_LAYOUT,
+        PROCEDURAL_DESCRIPTOR_SET_LAYOUT,
 
         DESCRIPTOR_SET_LAYOUT_COUNT
     };
@@ -444,7 +618,8 @@ private:
         VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
     };
 
-    std::unordered_map<pipeline_id_t, _pipeline_t> _pipelines;
+    slot_map<_pipeline_t, pipeline_tag> _pipelines;
+    pipeline_handle_t _default_pipeline;
 
     struct _compute_pipeline_t
     {
@@ -455,13 +630,152 @@ private:
 
     struct _material_instance_t
     {
-        texture_id_t base_tex;
-        texture_id_t spec_tex;
+        texture_handle_t base_tex;
+        texture_handle_t spec_tex;
+        uint32_t index = 0; // slot in the bindless material table
         VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
         // set = 1 binding = 0 texture2d base;
         //         binding = 1 texture2d spec;
     };
-    std::unordered_map<material_instance_id_t, _material_instance_t> _material_instances;
+    slot_map<_material_instance_t, material_instance_tag> _material_instances;
+
+    //
+    // Bindless materials, for the instance sets: all the textures in one array,
+    // and a table of materials indexing it. Each instance carries its material index.
+    //
+    #define MAX_BINDLESS_TEXTURES 256 // same in the shaders
+    #define MAX_BINDLESS_MATERIALS 256
+    struct _bindless_material_t // std430, material_t in the shaders
+    {
+        uint32_t base_tex;
+        uint32_t spec_tex;
+    };
+    struct _bindless_t
+    {
+        // update after bind: textures and materials can be added while frames are in flight.
+        VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
+        // set = 1 binding = 0 material table (SSBO)
+        //         binding = 1 texture2D textures[MAX_BINDLESS_TEXTURES]
+        VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+        vertex_buffer_object_t materials; // host visible, persistently mapped
+        _bindless_material_t *mapped_materials = nullptr;
+        uint32_t texture_count = 0;
+        std::vector<uint32_t> free_slots; // below texture_count, of retired textures
+    } _bindless;
+
+    uint32_t allocate_bindless_slot(); // UINT32_MAX when full
+    bool create_bindless_set();
+    void destroy_bindless_set();
+    void write_bindless_texture(const _texture_t &texture);
+    void write_bindless_material(const _material_instance_t &material);
+    void write_material_descriptor_set(const _material_instance_t &material, VkDescriptorSet set);
+
+    //
+    // Textures from files. The decoded pixels are copied on the graphics
+    // queue with a command buffer and a fence each, checked in the next
+    // upload()s. Once the copy is done the texture takes a new bindless slot
+    // and its materials a new set 1: the frames in flight keep reading the
+    // placeholder (or the previous image), the old sets, images and slots
+    // are freed when they are done.
+    //
+    #define TEXTURE_LOADER_STAGING_SIZE (128 * 1024 * 1024) // a 4K HDR image
+    #define MAX_TEXTURE_UPLOADS_PER_FRAME 4
+    struct _texture_loads_t
+    {
+        std::unique_ptr<TextureLoader> loader;
+        staging_buffer_t staging; // host visible, mapped while the loader lives
+        void *mapped = nullptr;
+
+        struct _upload_t
+        {
+            texture_handle_t texture;
+            TextureLoader::decoded_image_t image;
+            _texture_t loaded; // swapped in when the fence is signaled
+            _mip_scratch_t mip_scratch;
+            VkCommandBuffer cmd = VK_NULL_HANDLE;
+            VkFence fence = VK_NULL_HANDLE;
+            bool residency_change = false; // the texture had its own image
+        };
+        std::vector<_upload_t> uploads;
+
+        struct _retired_set_t
+        {
+            VkDescriptorSet set;
+            uint64_t frame;
+        };
+        std::vector<_retired_set_t> retired_sets;
+
+        // image and bindless slot of a texture before its swap.
+        struct _retired_texture_t
+        {
+            _texture_t texture;
+            uint64_t frame;
+        };
+        std::vector<_retired_texture_t> retired_textures;
+        uint64_t frame = 0; // upload() calls
+
+        uint32_t loaded_count = 0;
+        uint32_t failed_count = 0;
+    } _texture_loads;
+
+    bool create_texture_loader();
+    void destroy_texture_loader();
+    void update_texture_loads(); // in upload(), never waits
+    bool add_texture_placeholder(const texture_id_t &name, const texture_id_t &placeholder);
+    bool begin_texture_upload(const TextureLoader::decoded_image_t &image);
+    bool end_texture_upload(_texture_loads_t::_upload_t *upload);
+    // new image with the chain levels [first_level, end[: the ones in
+    // levels, the others copied from the current image.
+    bool begin_texture_residency_change(texture_handle_t handle, uint32_t first_level, const TextureLoader::decoded_image_t *levels);
+    void record_texture_residency_change(VkCommandBuffer cmd, const _texture_t &from, const _texture_t &to,
+        VkBuffer staging, VkDeviceSize offset, const texture_cache_header_t &header);
+    // a command buffer and a fence of its own, upload.loaded is destroyed on failure.
+    bool submit_texture_upload(_texture_loads_t::_upload_t *upload, const std::function<bool(VkCommandBuffer)> &record);
+    void destroy_texture(const _texture_t &texture);
+
+    //
+    // Streaming of the cooked textures loaded from files. They start with
+    // the levels up to TEXTURE_STREAMING_TAIL_EXTENT texels. In each
+    // upload(), the finest level each texture needs is estimated from the
+    // projected size of the visible objects whose material uses it. Then:
+    // - the finer levels are read from the cache file by the loader, at most
+    //   upload_budget_kb per frame, and uploaded with the levels already
+    //   there into a new image, swapped in like a loaded texture;
+    // - above budget_mb, the finest levels of the least recently needed
+    //   textures are dropped the same way, into a smaller image.
+    // The sizes counted are the ones of the cooked levels, resident or on
+    // their way, close to the images' memory.
+    //
+    #define TEXTURE_STREAMING_TAIL_EXTENT 64
+    struct _texture_streaming_t
+    {
+        struct _streamed_t
+        {
+            texture_handle_t texture;
+            std::string name;
+            texture_cache_header_t header; // the whole chain
+            uint32_t target_level = 0;     // first level once the pending change is done
+            uint32_t tail_level = 0;       // never dropped
+            uint32_t wanted_level = 0;     // this frame
+            uint64_t last_wanted_frame = 0;
+            bool pending = false;          // levels requested, or a new image in flight
+        };
+        std::vector<_streamed_t> textures;
+
+        int budget_mb = 256;
+        int upload_budget_kb = 8 * 1024;
+        float lod_bias = 0.0f; // added to the wanted level
+        uint32_t view_height = 1;  // pixels, of the render extent
+
+        VkDeviceSize resident_bytes = 0;
+        uint32_t streamed_in_count = 0;
+        uint32_t evicted_count = 0;
+    } _texture_streaming;
+
+    void update_texture_streaming(); // in upload(), after the transforms
+    void set_streaming_target(_texture_streaming_t::_streamed_t *streamed, uint32_t level); // keeps resident_bytes
+    // drops levels until needed more bytes fit, keep is never touched.
+    bool evict_texture_levels(VkDeviceSize needed, uint32_t keep);
 
     //
     // COMPUTE
@@ -471,7 +785,7 @@ private:
     {
         struct _simulation_data_t
         {
-            glm::vec4 data0; // x = time, y = speed, z = rot_speed, w = delay
+            glm::vec4 data0; // x = _, y = speed, z = rot_speed, w = delay
             glm::vec4 data1; // x = e0, y = e1, z = e2, w = e3
             glm::vec4 data2; // x = ax, y = bx, z = cx, w = dx
             glm::vec4 data3; // x = ay, y = by, z = cy, w = dy
@@ -479,7 +793,11 @@ private:
             glm::vec4 data4; // x = az, y = bz, z = cz, w = dz
             glm::vec4 data5; // x = psx, y = psy, z = psz, w = _
             glm::vec4 data6; // x = rsx, y = rsy, z = rsz, w = _
-            glm::vec4 data7; // x = _, y = _, z = _, w = _
+            glm::vec4 data7; // x = bx phase, y = dx phase, z = by phase, w = dy phase
+
+            glm::vec4 data8; // x = bz phase, y = dz phase, z = _, w = _
+            glm::vec4 data9; // xyz = self rotation turns, fraction, per axis
+            glm::uvec4 rotation_turns; // xyz = whole self rotation turns mod 2^24, per axis
 
             int instance_count;
         } data;
@@ -490,19 +808,396 @@ private:
         VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
     } compute_particles;
 
+    //
+    // Near/far classification of the instances, feeds the indirect draws.
+    //
+    struct _classify_particles_data_t
+    {
+        struct _classify_data_t
+        {
+            glm::vec4 camera_position; // world space
+            glm::vec4 params; // x = impostor switch distance, y = mesh bounding radius, z = 1 if the alive list is used, w = _
+            glm::mat4 prev_view_proj; // camera of the frame the depth pyramid comes from
+            glm::vec4 pyramid; // x = width, y = height, z = level count, w = 1 if occlusion culling
+            uint32_t instance_count;
+            uint32_t index_count;
+        } data;
+        uniform_buffer_t ubo;
+        _compute_pipeline_t pipe;
+        // set = 0 binding = 0 instance data
+        //         binding = 1 ubo (camera, switch distance)
+        //         binding = 2 near instance indices
+        //         binding = 3 far instance indices
+        //         binding = 4 draw commands
+        //         binding = 5 depth pyramid
+        //         binding = 6 alive indices (lifecycle)
+        //         binding = 7 lifecycle counters
+        VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+    } classify_particles;
+
+    //
+    // Hierarchical max depth of the previous frame, for occlusion culling.
+    //
+    #define MAX_DEPTH_PYRAMID_LEVELS 16
+    struct _depth_pyramid_t
+    {
+        VkImageView depth_view = VK_NULL_HANDLE; // ref, owned by the renderer
+        VkExtent2D  depth_extent = { 0, 0 };
+
+        _texture_t texture; // R32_SFLOAT, level 0 is the depth size rounded down to a power of 2
+        uint32_t level_count = 0;
+        std::array<VkImageView, MAX_DEPTH_PYRAMID_LEVELS> level_views = {};
+        VkSampler sampler = VK_NULL_HANDLE; // nearest, clamp
+
+        _compute_pipeline_t pipe;
+        // set = 0 binding = 0 source: depth for level 0, level i-1 otherwise
+        //         binding = 1 destination level i
+        std::array<VkDescriptorSet, MAX_DEPTH_PYRAMID_LEVELS> descriptor_sets = {};
+
+        bool built = false; // false until a frame has filled it
+        VkExtent2D render_extent = { 0, 0 }; // rendered part of the depth, this frame
+    } _depth_pyramid;
+
+    //
+    // Mip chain of the RGBA32F textures without linear blit, a 2x2 box per level.
+    //
+    struct _mipmap_t
+    {
+        _compute_pipeline_t pipe;
+        // set = 0 binding = 0 level i-1, storage image
+        //         binding = 1 level i
+    } _mipmaps;
+
+    //
+    // Procedural textures, written by procedural_texture.comp in level 0 of
+    // an RGBA8 storage image, then blitted down the mips. Nothing goes
+    // through the host. When their parameters change, they are regenerated
+    // in upload(), between two frames.
+    //
+    enum procedural_pattern_t
+    {
+        PROCEDURAL_CHECKER_BASE = 0, // a.xy: metal cells range, a.zw: dielectric cells range
+        PROCEDURAL_CHECKER_SPEC,     // a: plain cells, b: roughness base, slope and noise of the metal cells
+        PROCEDURAL_CONSTANT,         // a
+    };
+
+    // push constants of procedural_texture.comp
+    struct _procedural_params_t
+    {
+        glm::vec4 a = glm::vec4(1.0f);
+        glm::vec4 b = glm::vec4(0.0f);
+        uint32_t pattern = PROCEDURAL_CONSTANT;
+        uint32_t cell_size = 20; // texels of a checker cell
+        uint32_t seed = 0;       // of the roughness noise
+    };
+
+    struct _procedural_texture_t
+    {
+        std::string name;
+        texture_handle_t texture;
+        VkImageView level_view = VK_NULL_HANDLE; // level 0, storage
+        VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+        _procedural_params_t params;
+    };
+
+    struct _procedural_t
+    {
+        _compute_pipeline_t pipe;
+        // set = 0 binding = 0 level 0, storage image
+        std::vector<_procedural_texture_t> textures;
+        bool regenerate_requested = false;
+        float regenerate_ms = 0.0f; // last regeneration, queue wait included
+    } _procedural;
+
+    bool create_procedural_texture(const std::string &name, uint32_t size, const _procedural_params_t &params);
+    void record_procedural_texture(VkCommandBuffer cmd, const _procedural_texture_t &procedural);
+    void regenerate_procedural_textures();
+
+    //
+    // Cluster culling of the global objects that have meshlets. Each frame a
+    // pass tests every meshlet against the frustum and its normal cone, and
+    // appends the indices of the visible ones to the culled IBO, in the
+    // range of their object. One indirect draw per object, whose index count
+    // is summed by the pass. Compute shaders only, no mesh shaders.
+    //
+    // On the graphics queue, right before the draw: the global IBO and the
+    // object matrices it reads stay with that queue.
+    //
+    struct _meshlet_culling_t
+    {
+        struct _cull_data_t
+        {
+            glm::vec4 frustum[6]; // world space, xyz = inward normal, w = distance
+            glm::vec4 camera_position;
+            uint32_t meshlet_count;
+            uint32_t frustum_culling;
+            uint32_t cone_culling;
+            uint32_t pad;
+        } data;
+        uniform_buffer_t ubo;
+
+        // std430, meshlet_t in meshlet_cull.comp.
+        struct _gpu_meshlet_t
+        {
+            glm::vec4 sphere;
+            glm::vec4 cone;
+            uint32_t first_index; // into the global IBO
+            uint32_t index_count;
+            uint32_t object;
+            uint32_t draw;
+        };
+        std::vector<_gpu_meshlet_t> meshlets; // all the objects, for the shared geometries
+        std::vector<VkDrawIndexedIndirectCommand> commands; // index counts at 0
+        std::vector<uint32_t> objects; // object of each command
+        uint32_t culled_index_count = 0; // reserved in culled_indices
+
+        vertex_buffer_object_t gpu_meshlets;   // _gpu_meshlet_t[MAX_NB_MESHLETS]
+        vertex_buffer_object_t culled_indices; // index buffer, written by the pass
+        vertex_buffer_object_t draw_commands;  // VkDrawIndexedIndirectCommand[MAX_NB_OBJECTS], written by the pass
+        staging_buffer_t reset_commands;       // commands, host visible, copied over draw_commands first
+
+        _compute_pipeline_t pipe;
+        // set = 0 binding = 0 meshlets
+        //         binding = 1 ubo (frustum, camera)
+        //         binding = 2 object matrices
+        //         binding = 3 global indices
+        //         binding = 4 culled indices
+        //         binding = 5 draw commands
+        VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+
+        bool frustum_culling = true;
+        bool cone_culling = true;
+    } _meshlet_culling;
+
+    bool create_meshlet_culling_buffers();
+    void destroy_meshlet_culling_buffers();
+    bool add_meshlets(const object_description_t &desc, const _object_t *shared, uint32_t object_index, _object_t *obj);
+    void update_meshlet_culling_data();
+
+    struct _frame_graph_ids_t
+    {
+        FrameGraph::resource_id_t instances = FrameGraph::INVALID_ID;
+        FrameGraph::resource_id_t near_indices = FrameGraph::INVALID_ID;
+        FrameGraph::resource_id_t far_indices = FrameGraph::INVALID_ID;
+        FrameGraph::resource_id_t draw_commands = FrameGraph::INVALID_ID;
+        FrameGraph::resource_id_t pyramid = FrameGraph::INVALID_ID;
+        FrameGraph::resource_id_t alive_indices = FrameGraph::INVALID_ID;
+        FrameGraph::resource_id_t dead_indices = FrameGraph::INVALID_ID;
+        FrameGraph::resource_id_t particle_counters = FrameGraph::INVALID_ID;
+        FrameGraph::resource_id_t sorted_keys = FrameGraph::INVALID_ID;
+        FrameGraph::resource_id_t sorted_values = FrameGraph::INVALID_ID;
+        FrameGraph::resource_id_t sort_header = FrameGraph::INVALID_ID;
+        FrameGraph::resource_id_t meshlet_draws = FrameGraph::INVALID_ID;
+        FrameGraph::resource_id_t culled_indices = FrameGraph::INVALID_ID;
+
+        FrameGraph::pass_id_t simulate = FrameGraph::INVALID_ID;
+        FrameGraph::pass_id_t simulate_upload = FrameGraph::INVALID_ID; // CPU simulation
+        FrameGraph::pass_id_t particles_emit = FrameGraph::INVALID_ID;  // particle lifecycle
+        FrameGraph::pass_id_t particles_update = FrameGraph::INVALID_ID;
+        FrameGraph::pass_id_t particles_compact = FrameGraph::INVALID_ID;
+        FrameGraph::pass_id_t sort_keys = FrameGraph::INVALID_ID;  // back to front particles
+        FrameGraph::pass_id_t radix_sort = FrameGraph::INVALID_ID; //
+        FrameGraph::pass_id_t reset = FrameGraph::INVALID_ID;
+        FrameGraph::pass_id_t classify = FrameGraph::INVALID_ID;
+        FrameGraph::pass_id_t pyramid_build = FrameGraph::INVALID_ID;
+        FrameGraph::pass_id_t meshlet_reset = FrameGraph::INVALID_ID;
+        FrameGraph::pass_id_t meshlet_cull = FrameGraph::INVALID_ID;
+    } _fg;
+
+    bool _occlusion_culling = true;
+    glm::mat4 _last_view_proj = glm::mat4(1);
+
+    //
+    // CPU simulation, instead of the "simulate" pass: the particles of a frame are
+    // written into the mapped buffer of that frame, the "upload simulation" pass
+    // copies them into the instance buffer.
+    //
     bool _simulate_cpu = false;
+    struct _cpu_particles_t
+    {
+        ParticleSimulator simulator; // keeps the jitters, SoA
+        ParticleSimulator::params_t params;
+        std::vector<staging_buffer_t> buffers; // one per parallel frame, host visible, created on first use
+        std::vector<ParticleSimulator::particle_t*> mapped;
+        uint32_t frame = 0; // buffer written by the last upload()
+        uint32_t count = 0; // particles simulated in it
+    } _cpu_particles;
+
+    bool create_cpu_simulation_buffers();
+    void destroy_cpu_simulation_buffers();
+
+    //
+    // Particles with a lifetime, spawned by emitters, instead of the loop.
+    // The free particles are in a dead list, the live ones in an alive list,
+    // both kept by the shaders with atomics. Per frame: emit pops dead ones,
+    // update ages the alive ones and appends the survivors to the other alive
+    // list, compact makes it the current one and writes the dispatch command
+    // of the next update and of classify. Nothing is read back.
+    //
+    #define MAX_PARTICLE_EMITTERS 4 // same in the shaders
+    bool _use_emitters = false;
+
+    struct _particle_emitter_t
+    {
+        bool enabled = false;
+        glm::vec3 position = glm::vec3(0);
+        float radius = 0.5f;                // spawn sphere
+        glm::vec3 velocity = glm::vec3(0);
+        float spread = 1.0f;                // random speed, in any direction
+        float rate = 0.0f;                  // particles/s
+        int burst_count = 0;                // particles every burst_interval
+        float burst_interval = 1.0f;        // seconds
+        float lifetime_min = 1.0f;          // seconds
+        float lifetime_max = 2.0f;
+        double rate_accumulator = 0.0;      // part of a particle not spawned yet
+        double burst_timer = 0.0;
+    };
+
+    struct _particle_lifecycle_t
+    {
+        struct _lifecycle_data_t
+        {
+            struct _emitter_data_t
+            {
+                glm::vec4 position; // xyz, w = spawn radius
+                glm::vec4 velocity; // xyz, w = spread
+                glm::vec4 lifetime; // x = min, y = max
+                uint32_t first;     // first thread of the emitter in the emit dispatch
+                uint32_t count;     // particles to spawn this frame
+                uint32_t pad[2];
+            } emitters[MAX_PARTICLE_EMITTERS];
+            glm::vec4 gravity;        // xyz, w = dt
+            glm::vec4 scale;          // xyz = particle scale
+            glm::vec4 rotation_speed; // xyz = turns/s
+            uint32_t emitter_count;
+            uint32_t emit_count;      // sum of the emitter counts
+            uint32_t capacity;
+            uint32_t seed;
+        } data;
+        uniform_buffer_t ubo;
+
+        // std430, same in the shaders.
+        struct _counters_t
+        {
+            VkDispatchIndirectCommand dispatch; // update and classify, 256 alive particles per group
+            uint32_t alive_count;      // in the current list
+            uint32_t alive_offset;     // first element of the current list, 0 or capacity
+            uint32_t next_alive_count; // appended to the other list this frame
+            int32_t  dead_count;
+        };
+
+        uint32_t capacity = 0; // the whole instance buffer, set by compile()
+        vertex_buffer_object_t alive_indices; // 2 x capacity
+        vertex_buffer_object_t dead_indices;  // capacity
+        vertex_buffer_object_t counters;      // _counters_t
+
+        _compute_pipeline_t emit_pipe;
+        _compute_pipeline_t update_pipe;
+        _compute_pipeline_t compact_pipe;
+        // set = 0 binding = 0 instance data
+        //         binding = 1 ubo (emitters, dt)
+        //         binding = 2 alive indices
+        //         binding = 3 dead indices
+        //         binding = 4 counters
+        VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+
+        std::array<_particle_emitter_t, MAX_PARTICLE_EMITTERS> emitters;
+        glm::vec3 gravity = glm::vec3(0.0f, -9.81f, 0.0f);
+        bool reset_requested = true; // all the particles dead, done between two frames
+    } _particle_lifecycle;
+
+    bool create_particle_lifecycle_buffers();
+    void destroy_particle_lifecycle_buffers();
+    bool reset_particle_lifecycle();
+    void update_emitters(double dt); // spawn counts of the frame
+
+    //
+    // Back to front particles, for alpha blending. One key per particle to
+    // draw, from its view depth, sorted with its index by the radix sort of
+    // _primitives. The sorted indices feed one blended indirect draw, the
+    // count is written by the keys pass and never read back.
+    //
+    bool _sort_particles = false;
+
+    struct _particle_sort_t
+    {
+        struct _sort_data_t
+        {
+            glm::mat4 view;
+            glm::vec4 depth_range;   // x = near, y = far, of the quantized keys
+            uint32_t instance_count; // without the alive list
+            uint32_t index_count;    // of the particle mesh
+            uint32_t key_bits;       // 8, 16, 24 or 32
+            uint32_t use_alive_list;
+        } data;
+        uniform_buffer_t ubo;
+
+        // std430, same in sort_keys.comp.
+        struct _header_t
+        {
+            uint32_t count;                     // of the sort job
+            uint32_t pad[3];
+            VkDrawIndexedIndirectCommand draw;  // all the sorted particles
+        };
+
+        std::array<vertex_buffer_object_t, 2> keys;   // ping-pong, sorted into [0]
+        std::array<vertex_buffer_object_t, 2> values; // instance indices, with the keys
+        vertex_buffer_object_t header;                // _header_t
+        GpuPrimitives::job_t sort_job;
+
+        _compute_pipeline_t keys_pipe;
+        // set = 0 binding = 0 instance data
+        //         binding = 1 ubo (view, key bits)
+        //         binding = 2 alive indices (lifecycle)
+        //         binding = 3 lifecycle counters
+        //         binding = 4 header
+        //         binding = 5/6 keys/values to sort
+        VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+        VkDescriptorSet draw_descriptor_set = VK_NULL_HANDLE; // set #2: instance data, values[0]
+
+        int key_bits = 16;
+        glm::vec2 depth_range = glm::vec2(0.1f, 200.0f);
+        float opacity = 0.5f;
+
+        // GPU time from the keys to the end of the sort, per parallel frame.
+        VkQueryPool query_pool = VK_NULL_HANDLE; // 2 timestamps per frame
+        uint32_t frame = 0;          // of the last upload()
+        uint32_t written_frames = 0; // bit per frame, its timestamps can be read
+        float gpu_ms = 0.0f;
+    } _particle_sort;
+
+    bool create_particle_sort_buffers();
+    void destroy_particle_sort_buffers();
+    void update_sort_data();
 
     //
     // instances
     //
+    // Filled by the classify pass, consumed by vkCmdDraw*Indirect.
+    struct _instance_draw_commands_t
+    {
+        VkDrawIndexedIndirectCommand mesh; // near instances, full mesh
+        VkDrawIndirectCommand impostor;    // far instances, one quad each
+    };
+
     struct _instance_set_t
     {
         uint32_t model_index; // reference mesh for the instances
 
         uint32_t instance_count = 0;
+        uint32_t capacity = 0; // instances its buffers hold, the estimated count
         vertex_buffer_object_t instance_buffer;
         staging_buffer_t staging_buffer;
 
+        vertex_buffer_object_t near_indices; // uint per visible near instance
+        vertex_buffer_object_t far_indices;  // uint per visible far instance
+        vertex_buffer_object_t draw_commands; // _instance_draw_commands_t
+
+        // set = 2 binding = 0 instance data
+        //         binding = 1 near or far instance indices
+        VkDescriptorSet near_descriptor_set = VK_NULL_HANDLE;
+        VkDescriptorSet far_descriptor_set = VK_NULL_HANDLE;
+
         //std::vector<glm::vec3> positions = {};
         //std::vector<glm::vec3> rotations = {};
         //std::vector<glm::vec3> scales = {};
@@ -512,12 +1207,74 @@ private:
         std::vector<instance_data_t> instance_data = {};
 
         // TODO: array of material indices.
-        material_instance_id_t material_ref; // same material for all objects in the instance set.
+        material_instance_handle_t material; // default material for all objects in the instance set.
     };
 
-    std::unordered_map<instance_set_id_t, _instance_set_t> _instance_sets;
+    slot_map<_instance_set_t, instance_set_tag> _instance_sets;
+    instance_set_handle_t _particles; // the simulated set, "particles"
     
     _pipeline_t _instance_pipe;
+    _pipeline_t _instance_indirect_pipe; // near instances, fetches instance data by index
+    _pipeline_t _impostor_pipe;          // far instances, sphere impostors
+    _pipeline_t _instance_sorted_pipe;   // all instances back to front, blended
+
+    enum
+    {
+        INSTANCE_RENDER_MESH = 0, // every instance is a full mesh
+        INSTANCE_RENDER_HYBRID,   // mesh when near, impostor when far
+        INSTANCE_RENDER_IMPOSTOR  // every instance is an impostor
+    };
+    int _instance_render_mode = INSTANCE_RENDER_HYBRID;
+    float _impostor_distance = 40.0f; // switch distance from the camera, in world units
+
+    // Mesh vs hybrid timings, over a fixed number of frames.
+    struct _benchmark_t
+    {
+        enum { IDLE, WARMUP, MEASURE } state = IDLE;
+        int pass = 0; // index in the list of modes to measure
+        int frame = 0;
+        double accum_compute_ms = 0.0;
+        double accum_graphics_ms = 0.0;
+        double accum_sort_ms = 0.0;
+        int saved_render_mode = 0;
+        int32_t saved_nb_instances = 0;
+        std::array<glm::vec3, 2> results = {}; // x = compute ms, y = graphics ms, z = particle sort ms, per mode
+        bool has_results = false;
+    } _benchmark;
+
+    float _gpu_compute_ms = 0.0f;
+    float _gpu_graphics_ms = 0.0f;
+
+    // particles.comp against the CPU simulation, at a few times.
+    // Runs between two frames, the device idle.
+    struct _simulation_check_t
+    {
+        struct result_t
+        {
+            float t = 0.0f;
+            uint32_t particle_count = 0;
+            float max_position_error = 0.0f;
+            float max_rotation_error = 0.0f;
+            uint32_t mismatch_count = 0; // over the tolerance
+            uint32_t first_mismatch = UINT32_MAX;
+            float gpu_ms = 0.0f; // dispatch only, -1 without timestamps
+            float cpu_ms = 0.0f;
+        };
+        bool requested = false;
+        std::vector<result_t> results;
+    } _simulation_check;
+    bool check_simulation();
+
+    // Scan, compaction, reduction and sort, the particle sort uses them.
+    GpuPrimitives _primitives;
+
+    // _primitives against the CPU, and their throughput. Between two frames.
+    struct _primitives_check_t
+    {
+        bool requested = false;
+        int log2_count = 20;
+        std::vector<GpuPrimitives::test_result_t> results;
+    } _primitives_check;
 
     // IMGUI controlled vars
     glm::vec4 _bg_color = glm::vec4(0.1f, 0.1f, 0.1f, 1.0f);
@@ -561,6 +1318,8 @@ private:
     float _rsz = 0.156f;// 1.0f;
 
     float _pdt = 0.1f; // delta time in sec
+    SimulationClock _simulation_clock; // 60 Hz
+    bool _interpolate_simulation = true; // false = render the last step, reproducible
     float _speed = 0.001f;
     float _rotation_speed = 0.1f;// 1.0f;
 
@@ -0,0 +1,75 @@
+#include "simulation_clock.h"
+
+#include <math.h>
+
+#define TWO_PI_D 6.283185307179586
+
+SimulationClock::SimulationClock(double step, uint32_t max_steps)
+    : _step(step > 0.0 ? step : 1.0 / 60.0)
+    , _max_steps(max_steps > 0 ? max_steps : 1)
+{
+}
+
+uint32_t SimulationClock::advance(double dt)
+{
+    if (dt < 0.0)
+        dt = 0.0;
+
+    _accumulator += dt;
+
+    uint32_t steps = (uint32_t)fmin(floor(_accumulator / _step), (double)_max_steps);
+    _step_index += steps;
+    _accumulator -= steps * _step;
+
+    // too far behind: drop the steps we will never catch up with.
+    if (_accumulator >= _step)
+        _accumulator = fmod(_accumulator, _step);
+
+    _last_step_count = steps;
+    return steps;
+}
+
+void SimulationClock::reset()
+{
+    _base_time = 0.0;
+    _step_index = 0;
+    _accumulator = 0.0;
+    _last_step_count = 0;
+}
+
+void SimulationClock::set_step(double step)
+{
+    if (step <= 0.0 || step == _step)
+        return;
+
+    // rebase: the new steps start at the current time.
+    _base_time = time();
+    _step_index = 0;
+    _step = step;
+    _accumulator = fmin(_accumulator, _step * 0.999);
+}
+
+double SimulationClock::time() const
+{
+    return _base_time + (double)_step_index * _step;
+}
+
+float SimulationClock::wrap(double x, double period)
+{
+    double r = fmod(x, period);
+    if (r < 0.0)
+        r += period;
+    return (float)r;
+}
+
+float SimulationClock::wrap_phase(double radians)
+{
+    return wrap(radians, TWO_PI_D);
+}
+
+void SimulationClock::split_turns(double turns, uint32_t *whole, float *fraction)
+{
+    double w = floor(turns);
+    *whole = (uint32_t)wrap(w, 16777216.0); // an integer below 2^24, exact in a float
+    *fraction = (float)(turns - w);
+}
@@ -0,0 +1,55 @@
+#ifndef _VULKAN_SIMULATION_CLOCK_H_
+#define _VULKAN_SIMULATION_CLOCK_H_
+
+#include <stdint.h> // uint32_t
+
+//
+// Fixed step simulation clock, independent of the frame rate.
+//
+// advance() accumulates the frame time and returns how many steps of
+// step() seconds are due, at most max_steps: after a hitch the rest
+// is dropped instead of spiraling. The time base is an integer step
+// count, times are step_index * step in double, exact for years.
+//
+// Values sent to float shaders must stay small: wrap_phase() reduces
+// frequency * time in double before the conversion.
+//
+class SimulationClock
+{
+public:
+    explicit SimulationClock(double step = 1.0 / 60.0, uint32_t max_steps = 8);
+
+    uint32_t advance(double dt);
+    void reset();
+
+    void set_step(double step); // keeps the current time
+    double step() const { return _step; }
+    uint32_t max_steps() const { return _max_steps; }
+
+    uint64_t step_index() const { return _step_index; }
+    uint32_t last_step_count() const { return _last_step_count; } // of the last advance()
+
+    double time() const; // of the last step
+    double alpha() const { return _accumulator / _step; } // [0..1[, towards the next step
+    double interpolated_time() const { return time() + _accumulator; }
+
+    // x mod period, in [0, period[, computed in double.
+    static float wrap(double x, double period);
+    static float wrap_phase(double radians); // [0, 2pi[
+
+    // turns = whole + fraction, fraction in [0, 1[. whole mod 2^24: a
+    // float times it mod 1 is exact in integers, see particles.comp.
+    static void split_turns(double turns, uint32_t *whole, float *fraction);
+
+private:
+
+    double _step;
+    uint32_t _max_steps;
+
+    double _base_time = 0.0;  // time of step 0, moves on set_step()
+    uint64_t _step_index = 0;
+    double _accumulator = 0.0; // < _step
+    uint32_t _last_step_count = 0;
+};
+
+#endif // _VULKAN_SIMULATION_CLOCK_H_
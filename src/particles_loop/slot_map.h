@@ -0,0 +1,173 @@
+#ifndef _VULKAN_SLOT_MAP_H_
+#define _VULKAN_SLOT_MAP_H_
+
+#include <stdint.h> // uint32_t
+#include <assert.h>
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+//
+// Typed handle: slot index + generation of the slot when the handle was made.
+// The tag only keeps handles of different containers from mixing.
+//
+template<typename Tag>
+struct handle_t
+{
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool valid() const { return index != UINT32_MAX; }
+    bool operator==(const handle_t &o) const { return index == o.index && generation == o.generation; }
+    bool operator!=(const handle_t &o) const { return !(*this == o); }
+    bool operator<(const handle_t &o) const { return index < o.index; } // for sorting by handle
+};
+
+//
+// Values are kept packed in a vector: iterating is a linear walk, a lookup
+// by handle is two array reads. Erasing moves the last value into the hole
+// and bumps the generation of the slot, stale handles resolve to nullptr.
+//
+// Names are for build time only: find(name) hashes the string once,
+// keep the handle for the per frame work.
+//
+template<typename T, typename Tag>
+class slot_map
+{
+public:
+    using handle = handle_t<Tag>;
+
+    // Replaces the value if the name is already there, same handle.
+    handle insert(const std::string &name, const T &value)
+    {
+        handle h = find(name);
+        if (h.valid())
+        {
+            _values[_slots[h.index].dense] = value;
+            return h;
+        }
+
+        uint32_t slot_index;
+        if (!_free_slots.empty())
+        {
+            slot_index = _free_slots.back();
+            _free_slots.pop_back();
+        }
+        else
+        {
+            slot_index = (uint32_t)_slots.size();
+            _slots.push_back({});
+        }
+
+        _slot_t &slot = _slots[slot_index];
+        slot.dense = (uint32_t)_values.size();
+
+        _values.push_back(value);
+        _dense_to_slot.push_back(slot_index);
+        _names.push_back(name);
+
+        h.index = slot_index;
+        h.generation = slot.generation;
+        _name_to_handle[name] = h;
+        return h;
+    }
+
+    bool erase(handle h)
+    {
+        if (!contains(h))
+            return false;
+
+        _slot_t &slot = _slots[h.index];
+        uint32_t dense = slot.dense;
+        uint32_t last = (uint32_t)_values.size() - 1;
+
+        _name_to_handle.erase(_names[dense]);
+
+        if (dense != last)
+        {
+            _values[dense] = std::move(_values[last]);
+            _names[dense] = std::move(_names[last]);
+            _dense_to_slot[dense] = _dense_to_slot[last];
+            _slots[_dense_to_slot[dense]].dense = dense;
+        }
+        _values.pop_back();
+        _names.pop_back();
+        _dense_to_slot.pop_back();
+
+        slot.dense = UINT32_MAX;
+        ++slot.generation;
+        _free_slots.push_back(h.index);
+        return true;
+    }
+
+    bool contains(handle h) const
+    {
+        return h.index < _slots.size()
+            && _slots[h.index].generation == h.generation
+            && _slots[h.index].dense != UINT32_MAX;
+    }
+
+    T *get(handle h) { return contains(h) ? &_values[_slots[h.index].dense] : nullptr; }
+    const T *get(handle h) const { return contains(h) ? &_values[_slots[h.index].dense] : nullptr; }
+
+    T &operator[](handle h) { assert(contains(h)); return _values[_slots[h.index].dense]; }
+    const T &operator[](handle h) const { assert(contains(h)); return _values[_slots[h.index].dense]; }
+
+    // invalid handle if not found.
+    handle find(const std::string &name) const
+    {
+        auto found = _name_to_handle.find(name);
+        return (found != _name_to_handle.end()) ? found->second : handle{};
+    }
+
+    // i in [0..size()[, in iteration order.
+    handle handle_at(size_t i) const
+    {
+        handle h;
+        h.index = _dense_to_slot[i];
+        h.generation = _slots[h.index].generation;
+        return h;
+    }
+    const std::string &name_at(size_t i) const { return _names[i]; }
+
+    size_t size() const { return _values.size(); }
+    bool empty() const { return _values.empty(); }
+
+    void clear()
+    {
+        for (size_t i = 0; i < _values.size(); ++i)
+        {
+            _slot_t &slot = _slots[_dense_to_slot[i]];
+            slot.dense = UINT32_MAX;
+            ++slot.generation;
+            _free_slots.push_back(_dense_to_slot[i]);
+        }
+        _values.clear();
+        _names.clear();
+        _dense_to_slot.clear();
+        _name_to_handle.clear();
+    }
+
+    typename std::vector<T>::iterator begin() { return _values.begin(); }
+    typename std::vector<T>::iterator end() { return _values.end(); }
+    typename std::vector<T>::const_iterator begin() const { return _values.begin(); }
+    typename std::vector<T>::const_iterator end() const { return _values.end(); }
+
+private:
+
+    struct _slot_t
+    {
+        uint32_t dense = UINT32_MAX; // index in _values, UINT32_MAX when free
+        uint32_t generation = 0;
+    };
+
+    std::vector<T>           _values;
+    std::vector<uint32_t>    _dense_to_slot;
+    std::vector<std::string> _names; // parallel to _values
+    std::vector<_slot_t>     _slots;
+    std::vector<uint32_t>    _free_slots;
+    std::unordered_map<std::string, handle> _name_to_handle;
+};
+
+#endif // _VULKAN_SLOT_MAP_H_
@@ -0,0 +1,779 @@
+#include "build_options.h"
+#include "platform.h"
+#include "texture_cooker.h"
+#include "Shared.h"      // Log
+#include "mesh_cache.h"  // hash_bytes, create_parent_directory
+#include "thread_pool.h"
+#include "utils.h"       // map_file
+
+#include <ctype.h>  // isalnum
+#include <float.h>  // FLT_MAX
+#include <math.h>   // powf
+#include <stdio.h>  // rename, remove
+#include <string.h> // memcpy
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#   define COOKER_SSE2 1
+#   include <emmintrin.h>
+#endif
+
+#define TEXTURE_CACHE_MAGIC 0x43584554 // "TEXC"
+#define LEVEL_ALIGNMENT 16 // BC block size, for the buffer to image copies
+
+static uint64_t align_level(uint64_t offset)
+{
+    return (offset + LEVEL_ALIGNMENT - 1) & ~(uint64_t)(LEVEL_ALIGNMENT - 1);
+}
+
+static bool is_block_compressed(cooked_format_t format)
+{
+    return format >= COOKED_BC1;
+}
+
+size_t cooked_level_size(cooked_format_t format, uint32_t width, uint32_t height)
+{
+    size_t block_count = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+    switch (format)
+    {
+    case COOKED_BC1:
+    case COOKED_BC4: return block_count * 8;
+    case COOKED_BC5:
+    case COOKED_BC7: return block_count * 16;
+    case COOKED_R8:  return (size_t)width * height;
+    case COOKED_RG8: return (size_t)width * height * 2;
+    default:         return (size_t)width * height * 4;
+    }
+}
+
+size_t cooked_levels_size(const texture_cache_header_t &header, uint32_t first_level, uint32_t end_level)
+{
+    if (first_level >= end_level || end_level > header.level_count)
+        return 0;
+    return (size_t)(header.level_offsets[end_level - 1] + header.level_sizes[end_level - 1] - header.level_offsets[first_level]);
+}
+
+uint32_t cooked_tail_level(const texture_cache_header_t &header, uint32_t max_extent)
+{
+    uint32_t level = 0;
+    while (level + 1 < header.level_count && (std::max(header.width, header.height) >> level) > max_extent)
+        ++level;
+    return level;
+}
+
+const char *cooked_format_name(cooked_format_t format)
+{
+    switch (format)
+    {
+    case COOKED_R8:  return "R8";
+    case COOKED_RG8: return "RG8";
+    case COOKED_BC1: return "BC1";
+    case COOKED_BC4: return "BC4";
+    case COOKED_BC5: return "BC5";
+    case COOKED_BC7: return "BC7";
+    default:         return "RGBA8";
+    }
+}
+
+static cooked_format_t choose_format(texture_usage_t usage, bool has_alpha, bool block_compression)
+{
+    switch (usage)
+    {
+    case TEXTURE_USAGE_SPEC:   return block_compression ? COOKED_BC7 : COOKED_RGBA8;
+    case TEXTURE_USAGE_MASK:   return block_compression ? COOKED_BC4 : COOKED_R8;
+    case TEXTURE_USAGE_NORMAL: return block_compression ? COOKED_BC5 : COOKED_RG8;
+    default:                   return !block_compression ? COOKED_RGBA8 : has_alpha ? COOKED_BC7 : COOKED_BC1;
+    }
+}
+
+uint64_t texture_source_hash(const void *data, size_t size, const texture_cook_options_t &options)
+{
+    uint64_t seed = (uint64_t)options.usage | (options.srgb ? 0x100 : 0) | (options.block_compression ? 0x200 : 0);
+    return hash_bytes(data, size, seed);
+}
+
+std::string texture_cache_path(const std::string &cache_directory, const std::string &texture_name)
+{
+    std::string file_name = texture_name;
+    for (char &c : file_name)
+    {
+        if (!isalnum((unsigned char)c) && c != '-' && c != '.')
+            c = '_';
+    }
+    return cache_directory + file_name + ".tex";
+}
+
+//
+// MIPS
+//
+
+static float srgb_to_linear(uint8_t c)
+{
+    static const std::vector<float> table = [] {
+        std::vector<float> t(256);
+        for (int i = 0; i < 256; ++i)
+        {
+            float s = i / 255.0f;
+            t[i] = s <= 0.04045f ? s / 12.92f : powf((s + 0.055f) / 1.055f, 2.4f);
+        }
+        return t;
+    }();
+    return table[c];
+}
+
+static uint8_t linear_to_srgb(float l)
+{
+    float s = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+    return (uint8_t)std::min(std::max(s * 255.0f + 0.5f, 0.0f), 255.0f);
+}
+
+// 2x2 box, the last row or column of an odd size is skipped.
+static void downsample(const uint8_t *src, uint32_t src_width, uint32_t src_height, bool srgb, std::vector<uint8_t> *dst)
+{
+    uint32_t width = std::max(src_width / 2, 1u);
+    uint32_t height = std::max(src_height / 2, 1u);
+    dst->resize((size_t)width * height * 4);
+
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        const uint8_t *row0 = src + (size_t)std::min(2 * y, src_height - 1) * src_width * 4;
+        const uint8_t *row1 = src + (size_t)std::min(2 * y + 1, src_height - 1) * src_width * 4;
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            uint32_t x0 = std::min(2 * x, src_width - 1) * 4;
+            uint32_t x1 = std::min(2 * x + 1, src_width - 1) * 4;
+            uint8_t *out = dst->data() + ((size_t)y * width + x) * 4;
+            for (uint32_t c = 0; c < 4; ++c)
+            {
+                if (srgb && c < 3)
+                {
+                    float sum = srgb_to_linear(row0[x0 + c]) + srgb_to_linear(row0[x1 + c])
+                        + srgb_to_linear(row1[x0 + c]) + srgb_to_linear(row1[x1 + c]);
+                    out[c] = linear_to_srgb(sum * 0.25f);
+                }
+                else
+                {
+                    out[c] = (uint8_t)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+                }
+            }
+        }
+    }
+}
+
+//
+// BLOCK ENCODERS
+//
+
+static void fetch_block(const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t block_x, uint32_t block_y, uint8_t *block)
+{
+    for (uint32_t y = 0; y < 4; ++y)
+    {
+        uint32_t sy = std::min(block_y * 4 + y, height - 1);
+        for (uint32_t x = 0; x < 4; ++x)
+        {
+            uint32_t sx = std::min(block_x * 4 + x, width - 1);
+            memcpy(block + (y * 4 + x) * 4, rgba + ((size_t)sy * width + sx) * 4, 4);
+        }
+    }
+}
+
+// Nearest palette entry of each texel, squared distance over the first
+// `channels` channels. Returns the summed distance.
+static float nearest_indices(const uint8_t *block, const float (*palette)[4], uint32_t palette_size, uint32_t channels, uint8_t *indices)
+{
+    float error = 0.0f;
+
+#if COOKER_SSE2
+    // 4 texels at a time, one channel per register.
+    for (uint32_t t = 0; t < 16; t += 4)
+    {
+        const uint8_t *p = block + t * 4;
+        __m128 r = _mm_setr_ps(p[0], p[4], p[8], p[12]);
+        __m128 g = _mm_setr_ps(p[1], p[5], p[9], p[13]);
+        __m128 b = _mm_setr_ps(p[2], p[6], p[10], p[14]);
+        __m128 a = _mm_setr_ps(p[3], p[7], p[11], p[15]);
+
+        __m128 best = _mm_set1_ps(FLT_MAX);
+        __m128i best_index = _mm_setzero_si128();
+        for (uint32_t k = 0; k < palette_size; ++k)
+        {
+            __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[k][0]));
+            __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[k][1]));
+            __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[k][2]));
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+            if (channels == 4)
+            {
+                __m128 da = _mm_sub_ps(a, _mm_set1_ps(palette[k][3]));
+                d = _mm_add_ps(d, _mm_mul_ps(da, da));
+            }
+
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, best));
+            best = _mm_min_ps(d, best);
+            best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32((int)k)), _mm_andnot_si128(closer, best_index));
+        }
+
+        alignas(16) int32_t index[4];
+        alignas(16) float distance[4];
+        _mm_store_si128((__m128i*)index, best_index);
+        _mm_store_ps(distance, best);
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            indices[t + i] = (uint8_t)index[i];
+            error += distance[i];
+        }
+    }
+#else
+    for (uint32_t t = 0; t < 16; ++t)
+    {
+        const uint8_t *p = block + t * 4;
+        float best = FLT_MAX;
+        for (uint32_t k = 0; k < palette_size; ++k)
+        {
+            float d = 0.0f;
+            for (uint32_t c = 0; c < channels; ++c)
+                d += (p[c] - palette[k][c]) * (p[c] - palette[k][c]);
+            if (d < best)
+            {
+                best = d;
+                indices[t] = (uint8_t)k;
+            }
+        }
+        error += best;
+    }
+#endif
+
+    return error;
+}
+
+// Extremes of the texels along their principal axis.
+static void principal_endpoints(const uint8_t *block, uint32_t channels, float *e0, float *e1)
+{
+    float mean[4] = {};
+    float low[4] = { 255.0f, 255.0f, 255.0f, 255.0f };
+    float high[4] = {};
+    for (uint32_t t = 0; t < 16; ++t)
+    {
+        for (uint32_t c = 0; c < channels; ++c)
+        {
+            mean[c] += block[t * 4 + c] / 16.0f;
+            low[c] = std::min(low[c], (float)block[t * 4 + c]);
+            high[c] = std::max(high[c], (float)block[t * 4 + c]);
+        }
+    }
+
+    float covariance[4][4] = {};
+    for (uint32_t t = 0; t < 16; ++t)
+    {
+        for (uint32_t i = 0; i < channels; ++i)
+        {
+            for (uint32_t j = 0; j < channels; ++j)
+                covariance[i][j] += (block[t * 4 + i] - mean[i]) * (block[t * 4 + j] - mean[j]);
+        }
+    }
+
+    // power iteration, from the diagonal of the bounding box.
+    float axis[4] = {};
+    for (uint32_t c = 0; c < channels; ++c)
+        axis[c] = high[c] - low[c];
+    for (int iteration = 0; iteration < 8; ++iteration)
+    {
+        float next[4] = {};
+        float largest = 0.0f;
+        for (uint32_t i = 0; i < channels; ++i)
+        {
+            for (uint32_t j = 0; j < channels; ++j)
+                next[i] += covariance[i][j] * axis[j];
+            largest = std::max(largest, fabsf(next[i]));
+        }
+        if (largest == 0.0f)
+            break;
+        for (uint32_t c = 0; c < channels; ++c)
+            axis[c] = next[c] / largest;
+    }
+
+    float length2 = 0.0f;
+    for (uint32_t c = 0; c < channels; ++c)
+        length2 += axis[c] * axis[c];
+
+    float t_min = 0.0f;
+    float t_max = 0.0f;
+    if (length2 > 0.0f)
+    {
+        t_min = FLT_MAX;
+        t_max = -FLT_MAX;
+        for (uint32_t t = 0; t < 16; ++t)
+        {
+            float d = 0.0f;
+            for (uint32_t c = 0; c < channels; ++c)
+                d += (block[t * 4 + c] - mean[c]) * axis[c];
+            t_min = std::min(t_min, d / length2);
+            t_max = std::max(t_max, d / length2);
+        }
+    }
+
+    for (uint32_t c = 0; c < 4; ++c)
+    {
+        e0[c] = c < channels ? std::min(std::max(mean[c] + axis[c] * t_min, 0.0f), 255.0f) : 255.0f;
+        e1[c] = c < channels ? std::min(std::max(mean[c] + axis[c] * t_max, 0.0f), 255.0f) : 255.0f;
+    }
+}
+
+// Least squares endpoints for the indices, weights[index] between 0 (e0) and 1 (e1).
+static void refine_endpoints(const uint8_t *block, const uint8_t *indices, const float *weights, uint32_t channels, float *e0, float *e1)
+{
+    float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+    float ax[4] = {}, bx[4] = {};
+    for (uint32_t t = 0; t < 16; ++t)
+    {
+        float b = weights[indices[t]];
+        float a = 1.0f - b;
+        aa += a * a;
+        bb += b * b;
+        ab += a * b;
+        for (uint32_t c = 0; c < channels; ++c)
+        {
+            ax[c] += a * block[t * 4 + c];
+            bx[c] += b * block[t * 4 + c];
+        }
+    }
+
+    float determinant = aa * bb - ab * ab;
+    if (fabsf(determinant) < 1e-6f)
+        return; // a single index, the endpoints are fine
+
+    for (uint32_t c = 0; c < channels; ++c)
+    {
+        e0[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / determinant, 0.0f), 255.0f);
+        e1[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / determinant, 0.0f), 255.0f);
+    }
+}
+
+static uint16_t to_565(const float *c)
+{
+    uint32_t r = (uint32_t)(c[0] * 31.0f / 255.0f + 0.5f);
+    uint32_t g = (uint32_t)(c[1] * 63.0f / 255.0f + 0.5f);
+    uint32_t b = (uint32_t)(c[2] * 31.0f / 255.0f + 0.5f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void from_565(uint16_t v, float *c)
+{
+    uint32_t r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+    c[0] = (float)((r << 3) | (r >> 2));
+    c[1] = (float)((g << 2) | (g >> 4));
+    c[2] = (float)((b << 3) | (b >> 2));
+    c[3] = 255.0f;
+}
+
+// 4 colors mode: color0 > color1.
+static float bc1_block(const uint8_t *block, const float *e0, const float *e1, uint8_t *out, float *ordered0, float *ordered1, uint8_t *indices)
+{
+    uint16_t c0 = to_565(e0);
+    uint16_t c1 = to_565(e1);
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    float palette[4][4];
+    from_565(c0, palette[0]);
+    from_565(c1, palette[1]);
+    for (uint32_t c = 0; c < 4; ++c)
+    {
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+
+    // equal colors are the 3 colors mode, where index 3 is black.
+    float error = nearest_indices(block, palette, c0 == c1 ? 1 : 4, 3, indices);
+
+    uint32_t bits = 0;
+    for (uint32_t t = 0; t < 16; ++t)
+        bits |= (uint32_t)indices[t] << (2 * t);
+
+    out[0] = (uint8_t)(c0 & 0xff);
+    out[1] = (uint8_t)(c0 >> 8);
+    out[2] = (uint8_t)(c1 & 0xff);
+    out[3] = (uint8_t)(c1 >> 8);
+    memcpy(out + 4, &bits, 4); // little endian
+    memcpy(ordered0, palette[0], sizeof(palette[0]));
+    memcpy(ordered1, palette[1], sizeof(palette[1]));
+    return error;
+}
+
+void encode_bc1_block(const uint8_t *block, uint8_t *out)
+{
+    static const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+    float e0[4], e1[4];
+    principal_endpoints(block, 3, e0, e1);
+
+    uint8_t indices[16];
+    float error = bc1_block(block, e0, e1, out, e0, e1, indices);
+
+    // once more, with the best endpoints for these indices.
+    refine_endpoints(block, indices, weights, 3, e0, e1);
+    uint8_t candidate[8];
+    if (bc1_block(block, e0, e1, candidate, e0, e1, indices) < error)
+        memcpy(out, candidate, sizeof(candidate));
+}
+
+// 8 values mode: red0 > red1, red0 = red1 is the 6 values mode, same index 0.
+void encode_bc4_block(const uint8_t *block, uint32_t channel, uint8_t *out)
+{
+    uint8_t low = 255, high = 0;
+    for (uint32_t t = 0; t < 16; ++t)
+    {
+        low = std::min(low, block[t * 4 + channel]);
+        high = std::max(high, block[t * 4 + channel]);
+    }
+
+    float palette[8] = { (float)high, (float)low };
+    for (uint32_t k = 2; k < 8; ++k)
+        palette[k] = ((8 - k) * high + (k - 1) * low) / 7.0f;
+
+    uint64_t bits = 0;
+    for (uint32_t t = 0; t < 16 && high != low; ++t)
+    {
+        float value = block[t * 4 + channel];
+        uint32_t index = 0;
+        for (uint32_t k = 1; k < 8; ++k)
+        {
+            if (fabsf(value - palette[k]) < fabsf(value - palette[index]))
+                index = k;
+        }
+        bits |= (uint64_t)index << (3 * t);
+    }
+
+    out[0] = high;
+    out[1] = low;
+    for (uint32_t i = 0; i < 6; ++i)
+        out[2 + i] = (uint8_t)(bits >> (8 * i));
+}
+
+void encode_bc5_block(const uint8_t *block, uint8_t *out)
+{
+    encode_bc4_block(block, 0, out);
+    encode_bc4_block(block, 1, out + 8);
+}
+
+static const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// 7 bits and the p-bit that fits best, shared by the 4 channels.
+static void quantize_bc7_endpoint(const float *e, uint8_t *q, uint8_t *p_bit, int *value)
+{
+    float best = FLT_MAX;
+    for (uint8_t p = 0; p < 2; ++p)
+    {
+        uint8_t tq[4];
+        float error = 0.0f;
+        for (uint32_t c = 0; c < 4; ++c)
+        {
+            tq[c] = (uint8_t)std::min(std::max((int)((e[c] - p) / 2.0f + 0.5f), 0), 127);
+            float v = (float)((tq[c] << 1) | p);
+            error += (v - e[c]) * (v - e[c]);
+        }
+        if (error < best)
+        {
+            best = error;
+            memcpy(q, tq, 4);
+            *p_bit = p;
+        }
+    }
+    for (uint32_t c = 0; c < 4; ++c)
+        value[c] = (q[c] << 1) | *p_bit;
+}
+
+// Mode 6. The indices are those of e0 -> e1, before the anchor swap.
+static float bc7_block(const uint8_t *block, const float *e0, const float *e1, uint8_t *out, uint8_t *indices)
+{
+    uint8_t q0[4], q1[4], p0, p1;
+    int v0[4], v1[4];
+    quantize_bc7_endpoint(e0, q0, &p0, v0);
+    quantize_bc7_endpoint(e1, q1, &p1, v1);
+
+    float palette[16][4];
+    for (uint32_t k = 0; k < 16; ++k)
+    {
+        for (uint32_t c = 0; c < 4; ++c)
+            palette[k][c] = (float)(((64 - BC7_WEIGHTS[k]) * v0[c] + BC7_WEIGHTS[k] * v1[c] + 32) >> 6);
+    }
+    float error = nearest_indices(block, palette, 16, 4, indices);
+
+    // the high bit of the first index is implicit 0: swapped endpoints
+    // reverse the indices, the weights are symmetric.
+    uint8_t stored[16];
+    memcpy(stored, indices, sizeof(stored));
+    if (stored[0] & 8)
+    {
+        std::swap(q0, q1);
+        std::swap(p0, p1);
+        for (uint32_t t = 0; t < 16; ++t)
+            stored[t] = 15 - stored[t];
+    }
+
+    uint8_t bytes[16] = {};
+    uint32_t position = 0;
+    auto put = [&](uint32_t value, uint32_t count) {
+        for (uint32_t b = 0; b < count; ++b, ++position)
+            bytes[position / 8] |= (uint8_t)(((value >> b) & 1) << (position % 8));
+    };
+
+    put(1 << 6, 7); // mode 6
+    for (uint32_t c = 0; c < 4; ++c)
+    {
+        put(q0[c], 7);
+        put(q1[c], 7);
+    }
+    put(p0, 1);
+    put(p1, 1);
+    put(stored[0], 3);
+    for (uint32_t t = 1; t < 16; ++t)
+        put(stored[t], 4);
+
+    memcpy(out, bytes, sizeof(bytes));
+    return error;
+}
+
+void encode_bc7_block(const uint8_t *block, uint8_t *out)
+{
+    static const float weights[16] = {
+        0 / 64.0f,  4 / 64.0f,  9 / 64.0f, 13 / 64.0f, 17 / 64.0f, 21 / 64.0f, 26 / 64.0f, 30 / 64.0f,
+        34 / 64.0f, 38 / 64.0f, 43 / 64.0f, 47 / 64.0f, 51 / 64.0f, 55 / 64.0f, 60 / 64.0f, 64 / 64.0f };
+
+    float e0[4], e1[4];
+    principal_endpoints(block, 4, e0, e1);
+
+    uint8_t indices[16];
+    float error = bc7_block(block, e0, e1, out, indices);
+
+    refine_endpoints(block, indices, weights, 4, e0, e1);
+    uint8_t candidate[16];
+    if (bc7_block(block, e0, e1, candidate, indices) < error)
+        memcpy(out, candidate, sizeof(candidate));
+}
+
+//
+// COOKING
+//
+
+static void encode_level(const uint8_t *rgba, uint32_t width, uint32_t height, cooked_format_t format, ThreadPool *pool, uint8_t *dst)
+{
+    if (!is_block_compressed(format))
+    {
+        uint32_t channels = format == COOKED_R8 ? 1 : format == COOKED_RG8 ? 2 : 4;
+        for (size_t i = 0; i < (size_t)width * height; ++i)
+            memcpy(dst + i * channels, rgba + i * 4, channels);
+        return;
+    }
+
+    const uint32_t blocks_x = (width + 3) / 4;
+    const uint32_t blocks_y = (height + 3) / 4;
+    const size_t block_size = cooked_level_size(format, 4, 4);
+
+    auto encode_rows = [&](uint32_t begin, uint32_t end, uint32_t) {
+        uint8_t block[64];
+        for (uint32_t by = begin; by < end; ++by)
+        {
+            for (uint32_t bx = 0; bx < blocks_x; ++bx)
+            {
+                fetch_block(rgba, width, height, bx, by, block);
+                uint8_t *out = dst + ((size_t)by * blocks_x + bx) * block_size;
+                switch (format)
+                {
+                case COOKED_BC1: encode_bc1_block(block, out); break;
+                case COOKED_BC4: encode_bc4_block(block, 0, out); break;
+                case COOKED_BC5: encode_bc5_block(block, out); break;
+                default:         encode_bc7_block(block, out); break;
+                }
+            }
+        }
+    };
+
+    if (pool)
+        pool->parallel_for(blocks_y, 1, encode_rows);
+    else
+        encode_rows(0, blocks_y, 0);
+}
+
+void cook_texture(const uint8_t *rgba, uint32_t width, uint32_t height, const texture_cook_options_t &options,
+    uint64_t source_hash, texture_cache_header_t *header, std::vector<uint8_t> *data)
+{
+    bool has_alpha = false;
+    for (size_t i = 0; i < (size_t)width * height && !has_alpha; ++i)
+        has_alpha = rgba[i * 4 + 3] != 255;
+
+    cooked_format_t format = choose_format(options.usage, has_alpha, options.block_compression);
+
+    *header = {};
+    header->magic = TEXTURE_CACHE_MAGIC;
+    header->version = TEXTURE_CACHE_VERSION;
+    header->source_hash = source_hash;
+    header->format = format;
+    header->srgb = options.srgb ? 1 : 0;
+    header->width = width;
+    header->height = height;
+    header->data_offset = align_level(sizeof(texture_cache_header_t));
+
+    header->level_count = 1;
+    while ((std::max(width, height) >> header->level_count) > 0 && header->level_count < MAX_COOKED_LEVELS)
+        ++header->level_count;
+
+    for (uint32_t l = 0; l < header->level_count; ++l)
+    {
+        header->level_offsets[l] = header->data_size;
+        header->level_sizes[l] = cooked_level_size(format, std::max(width >> l, 1u), std::max(height >> l, 1u));
+        header->data_size = align_level(header->data_size + header->level_sizes[l]);
+    }
+    data->assign((size_t)header->data_size, 0);
+
+    std::vector<uint8_t> level(rgba, rgba + (size_t)width * height * 4);
+    std::vector<uint8_t> next;
+    for (uint32_t l = 0; l < header->level_count; ++l)
+    {
+        uint32_t level_width = std::max(width >> l, 1u);
+        uint32_t level_height = std::max(height >> l, 1u);
+        encode_level(level.data(), level_width, level_height, format, options.pool, data->data() + header->level_offsets[l]);
+
+        if (l + 1 < header->level_count)
+        {
+            downsample(level.data(), level_width, level_height, options.srgb, &next);
+            level.swap(next);
+        }
+    }
+}
+
+static bool write_cooked_texture(const std::string &cache_path, const texture_cache_header_t &header, const std::vector<uint8_t> &data)
+{
+    create_parent_directory(cache_path);
+
+    // a crash while writing leaves a .tmp, never a truncated cache.
+    std::string temp_path = cache_path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            Log("#     Cannot write " + temp_path + "\n");
+            return false;
+        }
+
+        static const char padding[LEVEL_ALIGNMENT] = {};
+        file.write((const char*)&header, sizeof(header));
+        file.write(padding, header.data_offset - sizeof(header));
+        file.write((const char*)data.data(), (std::streamsize)data.size());
+        if (!file.good())
+        {
+            Log("#     Cannot write " + temp_path + "\n");
+            file.close();
+            remove(temp_path.c_str());
+            return false;
+        }
+    }
+
+    remove(cache_path.c_str());
+    if (rename(temp_path.c_str(), cache_path.c_str()) != 0)
+    {
+        remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool open_cooked_texture(const std::string &cache_path, uint64_t source_hash, utils::mapped_file *file)
+{
+    if (GetFileAttributesA(cache_path.c_str()) == INVALID_FILE_ATTRIBUTES)
+        return false; // not cooked yet, quietly.
+
+    if (!utils::map_file(cache_path, file))
+        return false;
+
+    const texture_cache_header_t *header = (const texture_cache_header_t*)file->data;
+    bool valid = file->size >= sizeof(texture_cache_header_t)
+        && header->magic == TEXTURE_CACHE_MAGIC
+        && header->version == TEXTURE_CACHE_VERSION
+        && header->source_hash == source_hash
+        && header->format <= COOKED_BC7
+        && header->level_count > 0 && header->level_count <= MAX_COOKED_LEVELS
+        && header->data_offset + header->data_size <= file->size;
+    for (uint32_t l = 0; valid && l < header->level_count; ++l)
+    {
+        valid = header->level_offsets[l] % LEVEL_ALIGNMENT == 0
+            && header->level_offsets[l] + header->level_sizes[l] <= header->data_size;
+    }
+    if (!valid)
+    {
+        Log("#     Stale or invalid " + cache_path + "\n");
+        utils::unmap_file(file);
+        return false;
+    }
+    return true;
+}
+
+bool load_cooked_texture(const std::string &cache_path, uint64_t source_hash, const texture_cook_options_t &options,
+    const std::function<bool(std::vector<uint8_t> *rgba, uint32_t *width, uint32_t *height)> &produce,
+    const std::function<uint8_t *(const texture_cache_header_t &, bool in_cache, uint32_t *first_level)> &destination,
+    texture_cache_header_t *header)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    utils::mapped_file file;
+    if (open_cooked_texture(cache_path, source_hash, &file))
+    {
+        *header = *(const texture_cache_header_t*)file.data;
+        uint32_t first_level = 0;
+        uint8_t *dst = destination(*header, true, &first_level);
+        if (dst)
+        {
+            memcpy(dst, file.data + header->data_offset + header->level_offsets[first_level],
+                cooked_levels_size(*header, first_level, header->level_count));
+        }
+        utils::unmap_file(&file);
+
+        float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        Log("#     " + cache_path + ": " + cooked_format_name((cooked_format_t)header->format) + ", "
+            + std::to_string(header->level_count) + " levels, read from level " + std::to_string(first_level) + " in "
+            + std::to_string(ms) + " ms\n");
+        return dst != nullptr;
+    }
+
+    std::vector<uint8_t> rgba;
+    uint32_t width = 0, height = 0;
+    if (!produce(&rgba, &width, &height) || width == 0 || height == 0)
+        return false;
+
+    start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> data;
+    cook_texture(rgba.data(), width, height, options, source_hash, header, &data);
+    float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    Log("#     Cooked " + cache_path + ": " + cooked_format_name((cooked_format_t)header->format) + ", "
+        + std::to_string(header->level_count) + " levels, " + std::to_string(header->data_size / 1024) + " KB in "
+        + std::to_string(ms) + " ms\n");
+
+    // served from memory when it cannot be written.
+    bool in_cache = write_cooked_texture(cache_path, *header, data);
+
+    uint32_t first_level = 0;
+    uint8_t *dst = destination(*header, in_cache, &first_level);
+    if (dst)
+    {
+        memcpy(dst, data.data() + header->level_offsets[first_level],
+            cooked_levels_size(*header, first_level, header->level_count));
+    }
+    return dst != nullptr;
+}
+
+bool read_cooked_levels(const std::string &cache_path, uint64_t source_hash, uint32_t first_level, uint32_t end_level, uint8_t *dst)
+{
+    utils::mapped_file file;
+    if (!open_cooked_texture(cache_path, source_hash, &file))
+        return false;
+
+    const texture_cache_header_t *header = (const texture_cache_header_t*)file.data;
+    size_t size = cooked_levels_size(*header, first_level, end_level);
+    if (size > 0)
+        memcpy(dst, file.data + header->data_offset + header->level_offsets[first_level], size);
+    utils::unmap_file(&file);
+    return size > 0;
+}
@@ -0,0 +1,119 @@
+#ifndef _VULKAN_TEXTURE_COOKER_H_
+#define _VULKAN_TEXTURE_COOKER_H_
+
+#include <stdint.h> // uint32_t
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+//
+// Cooked textures: the whole mip chain of an RGBA8 image, box filtered on
+// the CPU (in linear space for sRGB) and block compressed, after a header.
+// The levels are copied as they are to the staging buffer.
+//
+// The format follows the usage of the texture:
+//   albedo: BC1, or BC7 when some texel is not opaque
+//   spec:   BC7, the shaders read roughness, metallic and reflectance in rgb
+//   mask:   BC4, red
+//   normal: BC5, red and green
+// and RGBA8, R8 or RG8 when the device has no BC formats.
+//
+// BC7 only uses mode 6: one subset, rgba endpoints, 16 levels. The blocks
+// are independent, a level is encoded on the threads of the pool.
+//
+// A cooked file is valid for one source hash (of the pixels or of the
+// encoded file, seeded with the options) and one TEXTURE_CACHE_VERSION.
+//
+// A range of levels is copied as it is in the data: level l at
+// level_offsets[l] - level_offsets[first]. The coarse ones are read first,
+// the finer ones later, from the same file (texture streaming).
+//
+
+// Bump with any change of the layout, of the mips or of an encoder.
+#define TEXTURE_CACHE_VERSION 1
+#define MAX_COOKED_LEVELS 16
+
+enum texture_usage_t
+{
+    TEXTURE_USAGE_ALBEDO = 0,
+    TEXTURE_USAGE_SPEC,
+    TEXTURE_USAGE_MASK,
+    TEXTURE_USAGE_NORMAL,
+};
+
+enum cooked_format_t
+{
+    COOKED_RGBA8 = 0,
+    COOKED_R8,
+    COOKED_RG8,
+    COOKED_BC1,
+    COOKED_BC4,
+    COOKED_BC5,
+    COOKED_BC7,
+};
+
+struct texture_cook_options_t
+{
+    texture_usage_t usage = TEXTURE_USAGE_ALBEDO;
+    bool srgb = false;
+    bool block_compression = true; // the device samples BC formats
+    ThreadPool *pool = nullptr;     // nullptr: the calling thread only
+};
+
+struct texture_cache_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_hash;
+
+    uint32_t format;      // cooked_format_t
+    uint32_t srgb;
+    uint32_t width;       // of level 0
+    uint32_t height;
+    uint32_t level_count;
+    uint32_t pad;
+    uint64_t data_offset; // from the start of the file
+    uint64_t data_size;   // all the levels
+
+    uint64_t level_offsets[MAX_COOKED_LEVELS]; // from the start of the data, 16 bytes aligned
+    uint64_t level_sizes[MAX_COOKED_LEVELS];
+};
+
+size_t cooked_level_size(cooked_format_t format, uint32_t width, uint32_t height);
+const char *cooked_format_name(cooked_format_t format);
+
+// levels [first_level, end_level[
+size_t cooked_levels_size(const texture_cache_header_t &header, uint32_t first_level, uint32_t end_level);
+// first level whose larger side is at most max_extent, the last one if none.
+uint32_t cooked_tail_level(const texture_cache_header_t &header, uint32_t max_extent);
+
+uint64_t texture_source_hash(const void *data, size_t size, const texture_cook_options_t &options);
+std::string texture_cache_path(const std::string &cache_directory, const std::string &texture_name);
+
+// rgba: width * height * 4 bytes.
+void cook_texture(const uint8_t *rgba, uint32_t width, uint32_t height, const texture_cook_options_t &options,
+    uint64_t source_hash, texture_cache_header_t *header, std::vector<uint8_t> *data);
+
+// Copies the levels of the cooked texture to destination(), after running
+// produce() and cooking its pixels when there is none valid.
+// destination(header, in_cache, first_level) picks the first level copied
+// (0 when left alone) and returns where the levels from there go, or nullptr.
+// in_cache: the file is written, read_cooked_levels() can read it later.
+bool load_cooked_texture(const std::string &cache_path, uint64_t source_hash, const texture_cook_options_t &options,
+    const std::function<bool(std::vector<uint8_t> *rgba, uint32_t *width, uint32_t *height)> &produce,
+    const std::function<uint8_t *(const texture_cache_header_t &, bool in_cache, uint32_t *first_level)> &destination,
+    texture_cache_header_t *header);
+
+// Levels [first_level, end_level[ of a valid cache file, see cooked_levels_size().
+bool read_cooked_levels(const std::string &cache_path, uint64_t source_hash, uint32_t first_level, uint32_t end_level, uint8_t *dst);
+
+// One 4x4 block of rgba8, row by row, texels clamped to the image.
+void encode_bc1_block(const uint8_t *block, uint8_t *out);                   // 8 bytes, rgb
+void encode_bc4_block(const uint8_t *block, uint32_t channel, uint8_t *out); // 8 bytes
+void encode_bc5_block(const uint8_t *block, uint8_t *out);                   // 16 bytes, r and g
+void encode_bc7_block(const uint8_t *block, uint8_t *out);                   // 16 bytes, rgba
+
+#endif // _VULKAN_TEXTURE_COOKER_H_
@@ -0,0 +1,366 @@
+#include "build_options.h"
+#include "platform.h"
+#include "texture_loader.h"
+#include "Shared.h" // Log
+#include "utils.h"  // map_file
+
+#include <string.h> // memcpy
+
+#include <algorithm>
+#include <chrono>
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#define STBI_ONLY_JPEG
+#define STBI_ONLY_HDR
+#include "stb_image.h"
+
+static const size_t STAGING_ALIGNMENT = 16; // >= the texel size, for vkCmdCopyBufferToImage
+
+// round to nearest, overflow to infinity, small values to denormals or 0.
+static uint16_t float_to_half(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (((bits >> 23) & 0xff) == 0xff) // inf, nan
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    if (exponent >= 31)
+        return sign | 0x7c00;
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - exponent);
+        return sign | (uint16_t)((mantissa + (1u << (shift - 1))) >> shift);
+    }
+
+    uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+    half += (mantissa >> 12) & 1; // may carry into the exponent, still right
+    return sign | (uint16_t)half;
+}
+
+TextureLoader::TextureLoader(void *staging, size_t staging_size, const std::string &cache_directory,
+    bool block_compression, uint32_t tail_extent, uint32_t worker_count)
+    : _cache_directory(cache_directory)
+    , _block_compression(block_compression)
+    , _tail_extent(tail_extent)
+    , _staging((uint8_t*)staging)
+    , _staging_size(staging_size)
+{
+    _free_ranges[0] = staging_size;
+
+    if (worker_count == 0)
+        worker_count = std::max(std::thread::hardware_concurrency() / 2, 1u);
+
+    for (uint32_t i = 0; i < worker_count; ++i)
+        _workers.emplace_back(&TextureLoader::worker_main, this);
+}
+
+TextureLoader::~TextureLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _wake.notify_all();
+    _freed.notify_all();
+
+    for (auto &w : _workers)
+        w.join();
+}
+
+void TextureLoader::request(const std::string &name, const std::string &file_path, bool srgb, texture_usage_t usage)
+{
+    _request_t r;
+    r.name = name;
+    r.file_path = file_path;
+    r.srgb = srgb;
+    r.usage = usage;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _requests.push_back(std::move(r));
+        ++_pending;
+    }
+    _wake.notify_one();
+}
+
+void TextureLoader::request(const std::string &name, std::vector<uint8_t> &&file_data, bool srgb, texture_usage_t usage)
+{
+    _request_t r;
+    r.name = name;
+    r.file_data = std::move(file_data);
+    r.srgb = srgb;
+    r.usage = usage;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _requests.push_back(std::move(r));
+        ++_pending;
+    }
+    _wake.notify_one();
+}
+
+void TextureLoader::request_levels(const std::string &name, const texture_cache_header_t &header, uint32_t first_level, uint32_t end_level)
+{
+    _request_t r;
+    r.name = name;
+    r.srgb = header.srgb != 0;
+    r.levels_only = true;
+    r.header = header;
+    r.first_level = first_level;
+    r.end_level = end_level;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _requests.push_back(std::move(r));
+        ++_pending;
+    }
+    _wake.notify_one();
+}
+
+bool TextureLoader::pop(decoded_image_t *image)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_decoded.empty())
+        return false;
+
+    *image = std::move(_decoded.front());
+    _decoded.pop_front();
+    --_pending;
+    return true;
+}
+
+void TextureLoader::release(const decoded_image_t &image)
+{
+    if (image.ok)
+        free_range(image.offset, image.size);
+}
+
+void TextureLoader::free_range(size_t offset, size_t size)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        size = (size + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+
+        // merged with the free neighbours.
+        auto next = _free_ranges.lower_bound(offset);
+        if (next != _free_ranges.end() && offset + size == next->first)
+        {
+            size += next->second;
+            next = _free_ranges.erase(next);
+        }
+        if (next != _free_ranges.begin())
+        {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second == offset)
+            {
+                previous->second += size;
+                offset = previous->first;
+                size = previous->second;
+            }
+        }
+        _free_ranges[offset] = size;
+    }
+    _freed.notify_all();
+}
+
+uint32_t TextureLoader::pending_count()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _pending;
+}
+
+bool TextureLoader::allocate(size_t size, size_t *offset)
+{
+    size = (size + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+
+    // first fit.
+    for (auto it = _free_ranges.begin(); it != _free_ranges.end(); ++it)
+    {
+        if (it->second < size)
+            continue;
+
+        *offset = it->first;
+        size_t left = it->second - size;
+        _free_ranges.erase(it);
+        if (left > 0)
+            _free_ranges[*offset + size] = left;
+        return true;
+    }
+    return false;
+}
+
+bool TextureLoader::wait_for_staging(const std::string &name, size_t size, size_t *offset)
+{
+    if (size > _staging_size)
+    {
+        Log("#     Texture " + name + ": bigger than the staging memory\n");
+        return false;
+    }
+
+    bool allocated = false;
+    std::unique_lock<std::mutex> lock(_mutex);
+    _freed.wait(lock, [&] { return _quit || (allocated = allocate(size, offset)); });
+    return allocated;
+}
+
+void TextureLoader::worker_main()
+{
+    for (;;)
+    {
+        _request_t request;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this] { return _quit || !_requests.empty(); });
+            if (_quit)
+                return;
+            request = std::move(_requests.front());
+            _requests.pop_front();
+        }
+
+        decoded_image_t image;
+        image.name = request.name;
+        image.srgb = request.srgb;
+        if (request.levels_only)
+            read_levels(request, &image);
+        else
+            decode(request, &image);
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _decoded.push_back(std::move(image));
+        }
+    }
+}
+
+void TextureLoader::decode(_request_t &request, decoded_image_t *image)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    utils::mapped_file file;
+    const uint8_t *data = request.file_data.data();
+    size_t data_size = request.file_data.size();
+    if (!request.file_path.empty())
+    {
+        if (!utils::map_file(request.file_path, &file))
+        {
+            Log("#     Texture " + request.name + ": cannot open " + request.file_path + "\n");
+            return;
+        }
+        data = (const uint8_t*)file.data;
+        data_size = file.size;
+    }
+
+    if (!stbi_is_hdr_from_memory(data, (int)data_size))
+    {
+        texture_cook_options_t options;
+        options.usage = request.usage;
+        options.srgb = request.srgb;
+        options.block_compression = _block_compression;
+
+        auto produce = [&](std::vector<uint8_t> *rgba, uint32_t *width, uint32_t *height) {
+            int w = 0, h = 0, channels = 0;
+            stbi_uc *pixels = stbi_load_from_memory(data, (int)data_size, &w, &h, &channels, 4);
+            if (!pixels)
+            {
+                Log("#     Texture " + request.name + ": " + stbi_failure_reason() + "\n");
+                return false;
+            }
+            rgba->assign(pixels, pixels + (size_t)w * h * 4);
+            stbi_image_free(pixels);
+            *width = (uint32_t)w;
+            *height = (uint32_t)h;
+            return true;
+        };
+        // the tail only, when the rest can be read again.
+        auto destination = [&](const texture_cache_header_t &header, bool in_cache, uint32_t *first_level) -> uint8_t* {
+            if (in_cache && _tail_extent > 0)
+                *first_level = cooked_tail_level(header, _tail_extent);
+            image->first_level = *first_level;
+            image->end_level = header.level_count;
+            image->streamable = in_cache;
+            image->size = cooked_levels_size(header, image->first_level, image->end_level);
+            if (!wait_for_staging(request.name, image->size, &image->offset))
+                return nullptr;
+            return _staging + image->offset;
+        };
+
+        uint64_t source_hash = texture_source_hash(data, data_size, options);
+        image->ok = load_cooked_texture(texture_cache_path(_cache_directory, request.name), source_hash,
+            options, produce, destination, &image->cooked);
+        utils::unmap_file(&file);
+        request.file_data.clear();
+
+        image->format = PIXELS_COOKED;
+        image->width = image->cooked.width;
+        image->height = image->cooked.height;
+        image->decode_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return;
+    }
+
+    int width = 0, height = 0, channels = 0;
+    float *pixels = stbi_loadf_from_memory(data, (int)data_size, &width, &height, &channels, 4);
+    utils::unmap_file(&file);
+    request.file_data.clear();
+
+    if (!pixels)
+    {
+        Log("#     Texture " + request.name + ": " + stbi_failure_reason() + "\n");
+        return;
+    }
+
+    image->format = PIXELS_RGBA16F;
+    image->width = (uint32_t)width;
+    image->height = (uint32_t)height;
+    image->size = (size_t)width * height * 4 * sizeof(uint16_t);
+
+    if (!wait_for_staging(request.name, image->size, &image->offset))
+    {
+        stbi_image_free(pixels);
+        return;
+    }
+
+    uint16_t *dst = (uint16_t*)(_staging + image->offset);
+    for (size_t i = 0; i < (size_t)width * height * 4; ++i)
+        dst[i] = float_to_half(pixels[i]);
+    stbi_image_free(pixels);
+
+    image->ok = true;
+    image->decode_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void TextureLoader::read_levels(const _request_t &request, decoded_image_t *image)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    image->format = PIXELS_COOKED;
+    image->width = request.header.width;
+    image->height = request.header.height;
+    image->cooked = request.header;
+    image->first_level = request.first_level;
+    image->end_level = request.end_level;
+    image->streamable = true;
+    image->levels_only = true;
+    image->size = cooked_levels_size(request.header, request.first_level, request.end_level);
+    if (image->size == 0 || !wait_for_staging(request.name, image->size, &image->offset))
+        return;
+
+    if (!read_cooked_levels(texture_cache_path(_cache_directory, request.name), request.header.source_hash,
+        request.first_level, request.end_level, _staging + image->offset))
+    {
+        Log("#     Texture " + request.name + ": cannot read its levels from the cache\n");
+        free_range(image->offset, image->size); // not ok: never released
+        return;
+    }
+
+    image->ok = true;
+    image->decode_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
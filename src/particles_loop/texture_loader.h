@@ -0,0 +1,123 @@
+#ifndef _VULKAN_TEXTURE_LOADER_H_
+#define _VULKAN_TEXTURE_LOADER_H_
+
+#include <stdint.h> // uint32_t
+
+#include "texture_cooker.h"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// Background decoding of PNG, JPG and HDR images with stb_image.
+//
+// request() only queues the file, a worker thread decodes it and writes
+// the pixels in the staging memory given at construction, a host visible
+// buffer mapped once: the scene copies them to the image from there. Then
+// pop() hands it to the main thread, which release()s the staging range
+// once the copy is done. Nothing here waits on the main thread, but a
+// worker waits for staging room when the memory is full.
+//
+// LDR images are cooked, see texture_cooker.h: a valid cache file is copied
+// as it is, without decoding the image. Only the levels up to tail_extent
+// texels are copied at first, request_levels() reads the finer ones from
+// the cache file later. HDR ones are RGBA16F, one level. A file that does
+// not decode leaves its texture on the placeholder.
+//
+class TextureLoader
+{
+public:
+    enum pixel_format_t
+    {
+        PIXELS_RGBA8 = 0,
+        PIXELS_RGBA16F,
+        PIXELS_COOKED, // see cooked
+    };
+
+    struct decoded_image_t
+    {
+        std::string name;
+        bool ok = false; // false: not found or not decoded, nothing to release
+        bool srgb = false;
+        pixel_format_t format = PIXELS_RGBA8;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        size_t offset = 0; // in the staging memory
+        size_t size = 0;
+        texture_cache_header_t cooked = {}; // the whole chain
+        uint32_t first_level = 0; // cooked levels [first_level, end_level[ are at offset
+        uint32_t end_level = 0;
+        bool streamable = false;  // in the cache, request_levels() can read it
+        bool levels_only = false; // from request_levels()
+        float decode_ms = 0.0f;
+    };
+
+    // tail_extent: 0 = every level at once.
+    // 0 workers = half the hardware threads, the frame loop keeps the other ones.
+    TextureLoader(void *staging, size_t staging_size, const std::string &cache_directory,
+        bool block_compression, uint32_t tail_extent, uint32_t worker_count = 0);
+    ~TextureLoader();
+
+    TextureLoader(const TextureLoader &) = delete;
+    TextureLoader &operator=(const TextureLoader &) = delete;
+
+    void request(const std::string &name, const std::string &file_path, bool srgb, texture_usage_t usage);
+    // the encoded file, from memory (a glTF buffer view).
+    void request(const std::string &name, std::vector<uint8_t> &&file_data, bool srgb, texture_usage_t usage);
+    // cooked levels [first_level, end_level[ of a texture popped before.
+    void request_levels(const std::string &name, const texture_cache_header_t &header, uint32_t first_level, uint32_t end_level);
+
+    // Never blocks. False when no image is decoded yet.
+    bool pop(decoded_image_t *image);
+    void release(const decoded_image_t &image);
+
+    uint32_t pending_count(); // requested, not popped yet
+
+private:
+
+    struct _request_t
+    {
+        std::string name;
+        std::string file_path;       // or
+        std::vector<uint8_t> file_data;
+        bool srgb = false;
+        texture_usage_t usage = TEXTURE_USAGE_ALBEDO;
+
+        bool levels_only = false; // or
+        texture_cache_header_t header = {};
+        uint32_t first_level = 0;
+        uint32_t end_level = 0;
+    };
+
+    void worker_main();
+    void decode(_request_t &request, decoded_image_t *image);
+    void read_levels(const _request_t &request, decoded_image_t *image);
+    bool allocate(size_t size, size_t *offset); // under _mutex
+    void free_range(size_t offset, size_t size);
+    bool wait_for_staging(const std::string &name, size_t size, size_t *offset);
+
+    std::string _cache_directory;
+    bool _block_compression = false;
+    uint32_t _tail_extent = 0;
+
+    uint8_t *_staging = nullptr;
+    size_t _staging_size = 0;
+    std::map<size_t, size_t> _free_ranges; // offset -> size, coalesced
+
+    std::vector<std::thread> _workers;
+
+    std::mutex _mutex;
+    std::condition_variable _wake;  // workers: a request, or quit
+    std::condition_variable _freed; // workers: staging room
+    std::deque<_request_t> _requests;
+    std::deque<decoded_image_t> _decoded;
+    uint32_t _pending = 0;
+    bool _quit = false;
+};
+
+#endif // _VULKAN_TEXTURE_LOADER_H_
@@ -0,0 +1,96 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t worker_count)
+{
+    if (worker_count == 0)
+    {
+        uint32_t hw = std::thread::hardware_concurrency();
+        worker_count = hw > 1 ? hw - 1 : 0;
+    }
+
+    for (uint32_t i = 0; i < worker_count; ++i)
+        _workers.emplace_back(&ThreadPool::worker_main, this, i + 1);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _wake.notify_all();
+
+    for (auto &w : _workers)
+        w.join();
+}
+
+void ThreadPool::parallel_for(uint32_t count, uint32_t grain, const task_t &task)
+{
+    if (count == 0)
+        return;
+
+    grain = std::max(grain, 1u);
+
+    // not worth waking anybody.
+    if (_workers.empty() || count <= grain)
+    {
+        task(0, count, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _task = &task;
+        _count = count;
+        _grain = grain;
+        _next.store(0);
+        _busy_workers = (uint32_t)_workers.size();
+        ++_generation;
+    }
+    _wake.notify_all();
+
+    run_chunks(0);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _busy_workers == 0; });
+    _task = nullptr;
+}
+
+void ThreadPool::run_chunks(uint32_t thread)
+{
+    for (;;)
+    {
+        uint32_t begin = _next.fetch_add(_grain);
+        if (begin >= _count)
+            break;
+        uint32_t end = std::min(begin + _grain, _count);
+        (*_task)(begin, end, thread);
+    }
+}
+
+void ThreadPool::worker_main(uint32_t thread)
+{
+    uint64_t seen_generation = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [&] { return _quit || _generation != seen_generation; });
+            if (_quit)
+                return;
+            seen_generation = _generation;
+        }
+
+        run_chunks(thread);
+
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            last = (--_busy_workers == 0);
+        }
+        if (last)
+            _done.notify_one();
+    }
+}
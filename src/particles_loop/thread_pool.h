@@ -0,0 +1,58 @@
+#ifndef _VULKAN_THREAD_POOL_H_
+#define _VULKAN_THREAD_POOL_H_
+
+#include <stdint.h> // uint32_t
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Fixed set of worker threads for data parallel loops.
+//
+// parallel_for() splits [0..count[ into chunks of `grain` items, the workers
+// and the calling thread take chunks until none is left, then it returns.
+// The calling thread is thread 0, the workers are 1..thread_count()-1.
+//
+class ThreadPool
+{
+public:
+    using task_t = std::function<void(uint32_t begin, uint32_t end, uint32_t thread)>;
+
+    // 0 = one worker per hardware thread, minus the calling thread.
+    explicit ThreadPool(uint32_t worker_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    uint32_t thread_count() const { return (uint32_t)_workers.size() + 1; }
+
+    // Blocks until all the chunks are done. Not reentrant.
+    void parallel_for(uint32_t count, uint32_t grain, const task_t &task);
+
+private:
+
+    void worker_main(uint32_t thread);
+    void run_chunks(uint32_t thread);
+
+    std::vector<std::thread> _workers;
+
+    std::mutex _mutex;
+    std::condition_variable _wake;  // workers: a new loop, or quit
+    std::condition_variable _done;  // caller: the last worker is out
+    uint64_t _generation = 0;       // one per parallel_for
+    uint32_t _busy_workers = 0;
+    bool _quit = false;
+
+    // current loop
+    const task_t *_task = nullptr;
+    uint32_t _count = 0;
+    uint32_t _grain = 1;
+    std::atomic<uint32_t> _next{ 0 };
+};
+
+#endif // _VULKAN_THREAD_POOL_H_
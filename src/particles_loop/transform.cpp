@@ -0,0 +1,233 @@
+#include "transform.h"
+
+#include <stddef.h> // offsetof
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#   define TRANSFORM_SIMD 1
+#   include <xmmintrin.h>
+#else
+#   define TRANSFORM_SIMD 0
+#endif
+
+uint32_t TransformSystem::add(uint32_t parent, const glm::vec3 &translation, const glm::quat &rotation, const glm::vec3 &scale)
+{
+    uint32_t index = size();
+    // parents first, index order is the hierarchy order.
+    if (parent != NO_PARENT && parent >= index)
+        parent = NO_PARENT;
+
+    glm::quat q = glm::normalize(rotation);
+
+    _tx.push_back(translation.x); _ty.push_back(translation.y); _tz.push_back(translation.z);
+    _qx.push_back(q.x); _qy.push_back(q.y); _qz.push_back(q.z); _qw.push_back(q.w);
+    _sx.push_back(scale.x); _sy.push_back(scale.y); _sz.push_back(scale.z);
+    _parent.push_back(parent);
+    _dirty.push_back(1);
+
+    _matrices.push_back({});
+
+    return index;
+}
+
+void TransformSystem::clear()
+{
+    for (auto *v : { &_tx, &_ty, &_tz, &_qx, &_qy, &_qz, &_qw, &_sx, &_sy, &_sz })
+        v->clear();
+    _parent.clear();
+    _dirty.clear();
+    _matrices.clear();
+}
+
+void TransformSystem::set_translation(uint32_t i, const glm::vec3 &t)
+{
+    _tx[i] = t.x; _ty[i] = t.y; _tz[i] = t.z;
+    _dirty[i] = 1;
+}
+
+void TransformSystem::set_rotation(uint32_t i, const glm::quat &rotation)
+{
+    glm::quat q = glm::normalize(rotation);
+    _qx[i] = q.x; _qy[i] = q.y; _qz[i] = q.z; _qw[i] = q.w;
+    _dirty[i] = 1;
+}
+
+void TransformSystem::set_scale(uint32_t i, const glm::vec3 &s)
+{
+    _sx[i] = s.x; _sy[i] = s.y; _sz[i] = s.z;
+    _dirty[i] = 1;
+}
+
+#if TRANSFORM_SIMD == 1
+// out = a * b, a is a full mat4, b has `columns` columns.
+static inline void mul_mat4(const float *a, const float *b, float *out, int columns)
+{
+    __m128 a0 = _mm_loadu_ps(a + 0);
+    __m128 a1 = _mm_loadu_ps(a + 4);
+    __m128 a2 = _mm_loadu_ps(a + 8);
+    __m128 a3 = _mm_loadu_ps(a + 12);
+    for (int j = 0; j < columns; ++j)
+    {
+        const float *bj = b + 4 * j;
+        __m128 r = _mm_mul_ps(a0, _mm_set1_ps(bj[0]));
+        r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(bj[1])));
+        r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(bj[2])));
+        r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(bj[3])));
+        _mm_storeu_ps(out + 4 * j, r);
+    }
+}
+
+// out = a * b, 3x3 stored as 3 vec4 columns (w = 0).
+static inline void mul_mat3(const float *a, const float *b, float *out)
+{
+    __m128 a0 = _mm_loadu_ps(a + 0);
+    __m128 a1 = _mm_loadu_ps(a + 4);
+    __m128 a2 = _mm_loadu_ps(a + 8);
+    for (int j = 0; j < 3; ++j)
+    {
+        const float *bj = b + 4 * j;
+        __m128 r = _mm_mul_ps(a0, _mm_set1_ps(bj[0]));
+        r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(bj[1])));
+        r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(bj[2])));
+        _mm_storeu_ps(out + 4 * j, r);
+    }
+}
+#endif
+
+void TransformSystem::update(std::vector<uint32_t> *updated)
+{
+    uint32_t count = size();
+    if (count == 0)
+        return;
+
+    // A dirty parent dirties its subtree, parents come first.
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (_parent[i] != NO_PARENT && _dirty[_parent[i]])
+            _dirty[i] = 1;
+    }
+
+    compute_local_matrices(0, count);
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (!_dirty[i])
+            continue;
+
+        // holds the local matrices, roots are done.
+        matrices_t &m = _matrices[i];
+        if (_parent[i] != NO_PARENT)
+        {
+            const matrices_t &p = _matrices[_parent[i]];
+#if TRANSFORM_SIMD == 1
+            // in place: column j of the result only reads column j of m.
+            mul_mat4(glm::value_ptr(p.world), glm::value_ptr(m.world), glm::value_ptr(m.world), 4);
+            mul_mat3(glm::value_ptr(p.normal[0]), glm::value_ptr(m.normal[0]), glm::value_ptr(m.normal[0]));
+#else
+            m.world = p.world * m.world;
+            glm::mat3 n = glm::mat3(glm::vec3(p.normal[0]), glm::vec3(p.normal[1]), glm::vec3(p.normal[2]))
+                * glm::mat3(glm::vec3(m.normal[0]), glm::vec3(m.normal[1]), glm::vec3(m.normal[2]));
+            for (int c = 0; c < 3; ++c)
+                m.normal[c] = glm::vec4(n[c], 0);
+#endif
+        }
+
+        _dirty[i] = 0;
+        if (updated)
+            updated->push_back(i);
+    }
+}
+
+//
+// Local matrices: M = T * R * S, N = R * S^-1 (inverse transpose of R * S).
+//
+
+void TransformSystem::compute_local_matrices_scalar(uint32_t first, uint32_t count)
+{
+    for (uint32_t i = first; i < first + count; ++i)
+    {
+        if (!_dirty[i])
+            continue;
+
+        glm::mat3 r = glm::mat3_cast(glm::quat(_qw[i], _qx[i], _qy[i], _qz[i]));
+        glm::vec3 s(_sx[i], _sy[i], _sz[i]);
+
+        matrices_t &local = _matrices[i];
+        for (int c = 0; c < 3; ++c)
+        {
+            local.world[c] = glm::vec4(r[c] * s[c], 0);
+            local.normal[c] = glm::vec4(r[c] / s[c], 0);
+        }
+        local.world[3] = glm::vec4(_tx[i], _ty[i], _tz[i], 1);
+    }
+}
+
+void TransformSystem::compute_local_matrices(uint32_t first, uint32_t count)
+{
+#if TRANSFORM_SIMD == 1
+    uint32_t end = first + (count & ~3u);
+    for (uint32_t i = first; i < end; i += 4)
+    {
+        // static blocks are skipped whole.
+        if (!(_dirty[i] | _dirty[i + 1] | _dirty[i + 2] | _dirty[i + 3]))
+            continue;
+
+        __m128 qx = _mm_loadu_ps(&_qx[i]);
+        __m128 qy = _mm_loadu_ps(&_qy[i]);
+        __m128 qz = _mm_loadu_ps(&_qz[i]);
+        __m128 qw = _mm_loadu_ps(&_qw[i]);
+
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 two = _mm_set1_ps(2.0f);
+        __m128 xx = _mm_mul_ps(qx, qx), yy = _mm_mul_ps(qy, qy), zz = _mm_mul_ps(qz, qz);
+        __m128 xy = _mm_mul_ps(qx, qy), xz = _mm_mul_ps(qx, qz), yz = _mm_mul_ps(qy, qz);
+        __m128 wx = _mm_mul_ps(qw, qx), wy = _mm_mul_ps(qw, qy), wz = _mm_mul_ps(qw, qz);
+
+        // rotation columns
+        __m128 r00 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)));
+        __m128 r10 = _mm_mul_ps(two, _mm_add_ps(xy, wz));
+        __m128 r20 = _mm_mul_ps(two, _mm_sub_ps(xz, wy));
+        __m128 r01 = _mm_mul_ps(two, _mm_sub_ps(xy, wz));
+        __m128 r11 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)));
+        __m128 r21 = _mm_mul_ps(two, _mm_add_ps(yz, wx));
+        __m128 r02 = _mm_mul_ps(two, _mm_add_ps(xz, wy));
+        __m128 r12 = _mm_mul_ps(two, _mm_sub_ps(yz, wx));
+        __m128 r22 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+
+        __m128 sx = _mm_loadu_ps(&_sx[i]);
+        __m128 sy = _mm_loadu_ps(&_sy[i]);
+        __m128 sz = _mm_loadu_ps(&_sz[i]);
+        __m128 isx = _mm_div_ps(one, sx);
+        __m128 isy = _mm_div_ps(one, sy);
+        __m128 isz = _mm_div_ps(one, sz);
+
+        __m128 zero = _mm_setzero_ps();
+
+        // one column for the 4 transforms per register set, transposed into 4 columns.
+        auto store_column = [&](__m128 x, __m128 y, __m128 z, __m128 w, size_t offset)
+        {
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+            _mm_storeu_ps((float*)((uint8_t*)&_matrices[i + 0] + offset), x);
+            _mm_storeu_ps((float*)((uint8_t*)&_matrices[i + 1] + offset), y);
+            _mm_storeu_ps((float*)((uint8_t*)&_matrices[i + 2] + offset), z);
+            _mm_storeu_ps((float*)((uint8_t*)&_matrices[i + 3] + offset), w);
+        };
+
+        const size_t world_offset = offsetof(matrices_t, world);
+        const size_t normal_offset = offsetof(matrices_t, normal);
+        const size_t column = 4 * sizeof(float);
+
+        store_column(_mm_mul_ps(r00, sx), _mm_mul_ps(r10, sx), _mm_mul_ps(r20, sx), zero, world_offset + 0 * column);
+        store_column(_mm_mul_ps(r01, sy), _mm_mul_ps(r11, sy), _mm_mul_ps(r21, sy), zero, world_offset + 1 * column);
+        store_column(_mm_mul_ps(r02, sz), _mm_mul_ps(r12, sz), _mm_mul_ps(r22, sz), zero, world_offset + 2 * column);
+        store_column(_mm_loadu_ps(&_tx[i]), _mm_loadu_ps(&_ty[i]), _mm_loadu_ps(&_tz[i]), one, world_offset + 3 * column);
+
+        store_column(_mm_mul_ps(r00, isx), _mm_mul_ps(r10, isx), _mm_mul_ps(r20, isx), zero, normal_offset + 0 * column);
+        store_column(_mm_mul_ps(r01, isy), _mm_mul_ps(r11, isy), _mm_mul_ps(r21, isy), zero, normal_offset + 1 * column);
+        store_column(_mm_mul_ps(r02, isz), _mm_mul_ps(r12, isz), _mm_mul_ps(r22, isz), zero, normal_offset + 2 * column);
+    }
+
+    compute_local_matrices_scalar(end, first + count - end);
+#else
+    compute_local_matrices_scalar(first, count);
+#endif
+}
@@ -0,0 +1,71 @@
+#ifndef _VULKAN_TRANSFORM_H_
+#define _VULKAN_TRANSFORM_H_
+
+#include <stdint.h> // uint32_t
+
+#include "glm_usage.h"
+
+#include <vector>
+
+//
+// Local transforms (translation, rotation, scale, parent) of the scene objects,
+// stored as structure of arrays, and their world and normal matrices.
+//
+// A parent is always added before its children, so index order is a valid
+// hierarchy order: update() walks the arrays once, front to back.
+//
+// - set_*() marks the transform dirty, update() marks its whole subtree dirty,
+//   then rebuilds the local matrices of the dirty transforms 4 at a time (SSE),
+//   in place, and multiplies them by the world matrix of their parent.
+// - The normal matrix is the inverse transpose of the world 3x3, accumulated
+//   as parent_normal * R * S^-1, so no inverse is needed.
+//
+class TransformSystem
+{
+public:
+    static constexpr uint32_t NO_PARENT = UINT32_MAX;
+
+    // Column major, std430 compatible: mat4 + mat3 with vec4 columns.
+    struct matrices_t
+    {
+        glm::mat4 world = glm::mat4(1);
+        glm::vec4 normal[3] = { glm::vec4(1,0,0,0), glm::vec4(0,1,0,0), glm::vec4(0,0,1,0) };
+    };
+
+    uint32_t add(uint32_t parent, const glm::vec3 &translation, const glm::quat &rotation, const glm::vec3 &scale);
+    void clear();
+
+    void set_translation(uint32_t i, const glm::vec3 &t);
+    void set_rotation(uint32_t i, const glm::quat &q);
+    void set_scale(uint32_t i, const glm::vec3 &s);
+
+    glm::vec3 translation(uint32_t i) const { return glm::vec3(_tx[i], _ty[i], _tz[i]); }
+    glm::quat rotation(uint32_t i) const { return glm::quat(_qw[i], _qx[i], _qy[i], _qz[i]); }
+    glm::vec3 scale(uint32_t i) const { return glm::vec3(_sx[i], _sy[i], _sz[i]); }
+    uint32_t parent(uint32_t i) const { return _parent[i]; }
+
+    // Recomputes the dirty subtrees. The indices of the updated transforms
+    // are appended to updated (hierarchy order), if given.
+    void update(std::vector<uint32_t> *updated = nullptr);
+
+    const matrices_t &matrices(uint32_t i) const { return _matrices[i]; }
+    uint32_t size() const { return (uint32_t)_parent.size(); }
+
+private:
+
+    // into _matrices, for the dirty transforms.
+    void compute_local_matrices(uint32_t first, uint32_t count); // 4 at a time, SSE
+    void compute_local_matrices_scalar(uint32_t first, uint32_t count);
+
+    // local transforms, SoA
+    std::vector<float> _tx, _ty, _tz;
+    std::vector<float> _qx, _qy, _qz, _qw;
+    std::vector<float> _sx, _sy, _sz;
+    std::vector<uint32_t> _parent;
+    std::vector<uint8_t> _dirty;
+
+    // results, AoS: one copy per object into the matrices SSBO.
+    std::vector<matrices_t> _matrices;
+};
+
+#endif // _VULKAN_TRANSFORM_H_
@@ -4,8 +4,6 @@
 #include <map>
 #include <array>
 #include <fstream>
-#include <chrono>
-#include <random>
 #include <functional>
 
 //
@@ -275,6 +273,61 @@ namespace utils
         }
     }
 
+    bool map_file(const std::string &file_path, mapped_file *file)
+    {
+        *file = mapped_file();
+
+        HANDLE handle = CreateFileA(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (handle == INVALID_HANDLE_VALUE)
+        {
+            Log("#     Failed to open " + file_path + "\n");
+            return false;
+        }
+        file->file_handle = handle;
+
+        LARGE_INTEGER size = {};
+        if (!GetFileSizeEx(handle, &size) || (uint64_t)size.QuadPart > SIZE_MAX)
+        {
+            unmap_file(file);
+            return false;
+        }
+
+        // no mapping of an empty file.
+        file->size = (size_t)size.QuadPart;
+        if (file->size == 0)
+            return true;
+
+        file->mapping_handle = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!file->mapping_handle)
+        {
+            Log("#     Failed to map " + file_path + "\n");
+            unmap_file(file);
+            return false;
+        }
+
+        file->data = (const char*)MapViewOfFile(file->mapping_handle, FILE_MAP_READ, 0, 0, 0);
+        if (!file->data)
+        {
+            Log("#     Failed to map " + file_path + "\n");
+            unmap_file(file);
+            return false;
+        }
+
+        return true;
+    }
+
+    void unmap_file(mapped_file *file)
+    {
+        if (file->data)
+            UnmapViewOfFile(file->data);
+        if (file->mapping_handle)
+            CloseHandle(file->mapping_handle);
+        if (file->file_handle)
+            CloseHandle(file->file_handle);
+        *file = mapped_file();
+    }
+
     void* aligned_alloc(size_t size, size_t alignment)
     {
         void *data = nullptr;
@@ -297,158 +350,6 @@ namespace utils
 #endif
     }
 
-    void create_checker_base_image(loaded_image *checker_image)
-    {
-        checker_image->width = 512;
-        checker_image->height = 512;
-        checker_image->size = sizeof(float) * checker_image->width * checker_image->height * 3;
-        checker_image->data = (void *) new float[checker_image->width * checker_image->height * 3];
-
-        // metal [170..255]
-        constexpr float metal_min = 170.0f / 255.0f;
-        constexpr float metal_scale = (255.0f - 170.0f) / 255.0f;
-
-        // dielectrics [50..240]
-        constexpr float dielectric_min = 50.0f / 255.0f;
-        constexpr float dielectric_max = 240.0f / 255.0f;
-        constexpr float dielectric_scale = dielectric_max - dielectric_min;
-
-        for (uint32_t y = 0; y < checker_image->height; ++y)
-        {
-            float dy = (float)y / (float)checker_image->height;
-
-            for (uint32_t x = 0; x < checker_image->width; ++x)
-            {
-                float dx = (float)x / (float)checker_image->width; 
-
-                float *pixel = ((float *)checker_image->data) + 3 * (y * checker_image->width + x);
-        
-                float r = (1.0f - dx);
-                float g = (dx) * (1.0f - dy);
-                float b = dx * dy;
-
-                if ((x % 40 < 20 && y % 40 < 20)
-                || (x % 40 >= 20 && y % 40 >= 20)) 
-                { 
-                    pixel[0] = metal_min + metal_scale * r;
-                    pixel[1] = metal_min + metal_scale * g;
-                    pixel[2] = metal_min + metal_scale * b;
-                }
-                else
-                {
-                    // dielectric [10..240]
-                    pixel[0] = dielectric_min + dielectric_scale * r;
-                    pixel[1] = dielectric_min + dielectric_scale * g;
-                    pixel[2] = dielectric_min + dielectric_scale * b;
-                }
-            }
-        }
-    }
-
-    void create_checker_spec_image(loaded_image *checker_image)
-    {
-        auto seed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-        auto real_rand = std::bind(std::uniform_real_distribution<float>(0, 1), std::mt19937((unsigned int)seed));
-
-        checker_image->width = 512;
-        checker_image->height = 512;
-        checker_image->size = sizeof(float) * checker_image->width * checker_image->height * 3;
-        checker_image->data = (void *) new float[checker_image->width * checker_image->height * 3];
-
-        for (uint32_t y = 0; y < checker_image->height; ++y)
-        {
-            float dy = (float)y / (float)checker_image->height;
-
-            for (uint32_t x = 0; x < checker_image->width; ++x)
-            {
-                float dx = (float)x / (float)checker_image->width;
-
-                float *pixel = ((float *)checker_image->data) + 3 * (y * checker_image->width + x);
-
-                float r = 0.9f;
-                float m = 0.0f;
-                float s = 0.5f;
-                if (x % 40 < 20 && y % 40 < 20)
-                { 
-                    float dx = (x % 20) / 20.0f;
-                    float dy = (y % 20) / 20.0f;
-                    r = 0.05f+0.6f*dx*dy + 0.1f*real_rand()*dx*dy; m = 1.0f; s = 1.0f;
-                }
-                if (x % 40 >= 20 && y % 40 >= 20) 
-                { 
-                    float dx = (x % 20) / 20.0f; dx -= 0.5f;
-                    float dy = (y % 20) / 20.0f; dy -= 0.5f;
-                    float r2 = dx * dx + dy * dy;
-                    r = 0.05f + 0.6f * r2 + 0.1f*real_rand()*r2; m = 1.0f; s = 1.0f;
-                }
-
-                pixel[0] = r; // roughness
-                pixel[1] = m; // metallic
-                pixel[2] = s; // reflectance
-            }
-        }
-    }
-
-    void create_neutral_base_image(loaded_image *default_image)
-    {
-        default_image->width = 16;
-        default_image->height = 16;
-        default_image->size = sizeof(uint8_t) * default_image->width * default_image->height * 4;
-        default_image->data = (void *) new uint8_t[default_image->width * default_image->height * 4];
-
-        for (uint32_t x = 0; x < default_image->width; ++x)
-        {
-            for (uint32_t y = 0; y < default_image->height; ++y)
-            {
-                uint8_t *pixel = ((uint8_t *)default_image->data) + 4 * (x * default_image->height + y);
-                pixel[0] = 255;
-                pixel[1] = 255;
-                pixel[2] = 255;
-                pixel[3] = 255;
-            }
-        }
-    }
-
-    void create_neutral_dielectric_spec_image(loaded_image *image)
-    {
-        image->width = 16;
-        image->height = 16;
-        image->size = sizeof(float) * image->width * image->height * 4;
-        image->data = (void *) new float[image->width * image->height * 4];
-
-        for (uint32_t x = 0; x < image->width; ++x)
-        {
-            for (uint32_t y = 0; y < image->height; ++y)
-            {
-                float *pixel = ((float*)image->data) + 4 * (x * image->height + y);
-                pixel[0] = 1.0f; // roughness
-                pixel[1] = 0.0f; // metallic
-                pixel[2] = 1.0f; // reflectance
-                pixel[3] = 0;
-            }
-        }
-    }
-
-    void create_neutral_metal_spec_image(loaded_image *image)
-    {
-        image->width = 16;
-        image->height = 16;
-        image->size = sizeof(float) * image->width * image->height * 4;
-        image->data = (void *) new float[image->width * image->height * 4];
-
-        for (uint32_t x = 0; x < image->width; ++x)
-        {
-            for (uint32_t y = 0; y < image->height; ++y)
-            {
-                float *pixel = ((float*)image->data) + 4 * (x * image->height + y);
-                pixel[0] = 1.0f; // roughness
-                pixel[1] = 1.0f; // metallic
-                pixel[2] = 1.0f; // reflectance
-                pixel[3] = 0;
-            }
-        }
-    }
-
     /* METAL REFLECTANCE COMMON VALUES
     Silver    0.97, 0.96, 0.91
     Aluminum  0.91, 0.92, 0.92
@@ -37,25 +37,27 @@ namespace utils
     std::vector<char> read_file_content(const std::string &file_path);
 
     //
-    // OTHER
+    // FILE UTILS
     //
 
-    void* aligned_alloc(size_t size, size_t alignment);
-    void aligned_free(void* data);
-
-    struct loaded_image
+    // Read only view of a whole file, the pages are read on first touch.
+    struct mapped_file
     {
-        uint32_t width;
-        uint32_t height;
-        uint32_t size;
-        void *data;
+        const char *data = nullptr;
+        size_t size = 0;
+        void *file_handle = nullptr;
+        void *mapping_handle = nullptr;
     };
 
-    void create_checker_base_image(loaded_image *);
-    void create_checker_spec_image(loaded_image *);
-    void create_neutral_base_image(loaded_image *);
-    void create_neutral_metal_spec_image(loaded_image *);
-    void create_neutral_dielectric_spec_image(loaded_image *);
+    bool map_file(const std::string &file_path, mapped_file *);
+    void unmap_file(mapped_file *);
+
+    //
+    // OTHER
+    //
+
+    void* aligned_alloc(size_t size, size_t alignment);
+    void aligned_free(void* data);
 
 } // namespace utils
 